@@ -0,0 +1,38 @@
+#include "AffinityScheduler.h"
+
+namespace chromafiler {
+
+AffinityScheduler::AffinityScheduler(int workers)
+        : pending(workers < 1 ? 1 : workers), keyCounts(workers < 1 ? 1 : workers) {}
+
+int AffinityScheduler::workerFor(const Key &key) {
+    auto it = assignments.find(key);
+    if (it != assignments.end())
+        return it->second;
+    int best = 0;
+    for (int i = 1; i < (int)pending.size(); i++) {
+        if (pending[i] < pending[best]
+                || (pending[i] == pending[best] && keyCounts[i] < keyCounts[best]))
+            best = i;
+    }
+    assignments.emplace(key, best);
+    keyCounts[best]++;
+    return best;
+}
+
+int AffinityScheduler::begin(const Key &key) {
+    int worker = workerFor(key);
+    pending[worker]++;
+    return worker;
+}
+
+void AffinityScheduler::end(int worker) {
+    if (worker >= 0 && worker < (int)pending.size() && pending[worker] > 0)
+        pending[worker]--;
+}
+
+int AffinityScheduler::outstanding(int worker) const {
+    return (worker >= 0 && worker < (int)pending.size()) ? pending[worker] : 0;
+}
+
+} // namespace
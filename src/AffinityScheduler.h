@@ -0,0 +1,32 @@
+#pragma once
+#include <common.h>
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace chromafiler {
+
+// Pins each key (eg. the bytes of a preview handler CLSID) to one of a fixed number of workers
+// for the rest of the session, so all work for a key runs in order on the same thread. A new key
+// goes to the worker with the fewest outstanding requests, then the fewest keys, so independent
+// keys are spread across workers.
+// Not thread-safe.
+class AffinityScheduler {
+public:
+    typedef std::array<uint8_t, 16> Key;
+
+    explicit AffinityScheduler(int workers);
+    int workerFor(const Key &key); // assigns the key to a worker if it's new
+    int begin(const Key &key); // like workerFor(), and counts a request outstanding on the worker
+    void end(int worker); // call when a request from begin() is done
+    int outstanding(int worker) const;
+
+private:
+    std::map<Key, int> assignments;
+    std::vector<int> pending; // per worker
+    std::vector<int> keyCounts; // per worker
+};
+
+} // namespace
@@ -0,0 +1,322 @@
+#include "Animation.h"
+#include <algorithm>
+#include <cstring>
+
+namespace chromafiler {
+
+const uint32_t MAX_FRAME_DATA = 64 * 1024 * 1024; // compressed bytes
+const size_t MAX_EXTRA_CHUNKS = 64 * 1024;
+
+static uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint16_t be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void putBE32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// round(x / 255) for x in [0, 255 * 255]
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+FrameCompositor::FrameCompositor(int width, int height)
+        : canvasWidth(width), canvasHeight(height),
+          pixels((size_t)width * height * 4), saved((size_t)width * height * 4) {}
+
+void FrameCompositor::reset() {
+    std::fill(pixels.begin(), pixels.end(), (uint8_t)0);
+    pendingDisposal = DISPOSE_NONE;
+}
+
+const uint8_t * FrameCompositor::canvas() const {
+    return pixels.data();
+}
+
+int FrameCompositor::width() const {
+    return canvasWidth;
+}
+
+int FrameCompositor::height() const {
+    return canvasHeight;
+}
+
+void FrameCompositor::copyRect(const std::vector<uint8_t> &src, std::vector<uint8_t> &dest,
+        const Rect &rect) {
+    size_t rowBytes = (size_t)(rect.right - rect.left) * 4;
+    for (int y = rect.top; y < rect.bottom; y++) {
+        size_t offset = ((size_t)y * canvasWidth + rect.left) * 4;
+        memcpy(&dest[offset], &src[offset], rowBytes);
+    }
+}
+
+void FrameCompositor::clearRect(const Rect &rect) {
+    size_t rowBytes = (size_t)(rect.right - rect.left) * 4;
+    for (int y = rect.top; y < rect.bottom; y++)
+        memset(&pixels[((size_t)y * canvasWidth + rect.left) * 4], 0, rowBytes);
+}
+
+void FrameCompositor::compose(const FrameInfo &frame, const uint8_t *src, ptrdiff_t stride) {
+    if (pendingDisposal == DISPOSE_BACKGROUND) {
+        clearRect(pendingRect);
+    } else if (pendingDisposal == DISPOSE_PREVIOUS) {
+        copyRect(saved, pixels, pendingRect);
+    }
+
+    Rect rect = {std::max(frame.left, 0), std::max(frame.top, 0),
+        (int)std::min((int64_t)frame.left + frame.width, (int64_t)canvasWidth),
+        (int)std::min((int64_t)frame.top + frame.height, (int64_t)canvasHeight)};
+    if (rect.right <= rect.left || rect.bottom <= rect.top) {
+        pendingDisposal = DISPOSE_NONE;
+        return;
+    }
+    if (frame.disposal == DISPOSE_PREVIOUS)
+        copyRect(pixels, saved, rect);
+    pendingRect = rect;
+    pendingDisposal = frame.disposal;
+
+    int count = rect.right - rect.left;
+    src += (rect.top - frame.top) * stride + (ptrdiff_t)(rect.left - frame.left) * 4;
+    for (int y = rect.top; y < rect.bottom; y++, src += stride) {
+        uint8_t *dest = &pixels[((size_t)y * canvasWidth + rect.left) * 4];
+        if (!frame.blend) {
+            memcpy(dest, src, (size_t)count * 4);
+            continue;
+        }
+        const uint8_t *s = src;
+        for (int x = 0; x < count; x++, s += 4, dest += 4) {
+            uint32_t alpha = s[3];
+            if (alpha == 255) {
+                memcpy(dest, s, 4);
+            } else if (alpha != 0) {
+                // premultiplied source over destination
+                uint32_t inv = 255 - alpha;
+                for (int c = 0; c < 4; c++)
+                    dest[c] = (uint8_t)std::min(s[c] + div255(dest[c] * inv), 255u);
+            }
+        }
+    }
+}
+
+FrameRing::FrameRing(size_t frameBytes, size_t budget, int maxFrames)
+        : frameBytes(frameBytes),
+          frames((int)std::max((size_t)2, std::min(budget / std::max(frameBytes, (size_t)1),
+              (size_t)std::max(maxFrames, 2)))),
+          buffers(new uint8_t[frameBytes * frames]), delays(new int[frames]) {}
+
+int FrameRing::capacity() const {
+    return frames;
+}
+
+int FrameRing::count() const {
+    return size;
+}
+
+bool FrameRing::full() const {
+    return size == frames;
+}
+
+uint8_t * FrameRing::back() {
+    return &buffers[frameBytes * ((head + size) % frames)];
+}
+
+void FrameRing::push(int delay) {
+    if (full())
+        return;
+    delays[(head + size) % frames] = delay;
+    size++;
+}
+
+const uint8_t * FrameRing::front(int *delay) const {
+    if (size == 0)
+        return nullptr;
+    if (delay)
+        *delay = delays[head];
+    return &buffers[frameBytes * head];
+}
+
+void FrameRing::pop() {
+    if (size == 0)
+        return;
+    head = (head + 1) % frames;
+    size--;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size) {
+    static const struct CRCTable {
+        uint32_t values[256];
+        CRCTable() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                values[n] = c;
+            }
+        }
+    } table;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// append a chunk with its length, type and CRC
+static void appendChunk(std::vector<uint8_t> *png, const char *type, const uint8_t *data,
+        uint32_t length) {
+    uint8_t header[8];
+    putBE32(header, length);
+    memcpy(header + 4, type, 4);
+    png->insert(png->end(), header, header + 8);
+    png->insert(png->end(), data, data + length);
+    uint8_t crc[4];
+    putBE32(crc, crc32(0, png->data() + png->size() - length - 4, length + 4));
+    png->insert(png->end(), crc, crc + 4);
+}
+
+bool isAnimatedPNG(const uint8_t *data, size_t size) {
+    if (size < 8 || memcmp(data, "\x89PNG\r\n\x1A\n", 8))
+        return false;
+    size_t pos = 8;
+    while (size - pos >= 8) {
+        if (!memcmp(data + pos + 4, "acTL", 4))
+            return true;
+        if (!memcmp(data + pos + 4, "IDAT", 4))
+            return false;
+        uint64_t next = (uint64_t)pos + 12 + be32(data + pos); // length, type, data, CRC
+        if (next > size)
+            return false;
+        pos = (size_t)next;
+    }
+    return false;
+}
+
+bool APNGReader::open(const ImageReadFunc &read) {
+    readFunc = read;
+    header.clear();
+    extraChunks.clear();
+    frames.clear();
+
+    uint8_t buffer[26];
+    if (read(0, buffer, 8) != 8 || memcmp(buffer, "\x89PNG\r\n\x1A\n", 8))
+        return false;
+    uint64_t pos = 8;
+    bool seenData = false; // IDAT
+    while (read(pos, buffer, 8) == 8) {
+        uint32_t length = be32(buffer);
+        if (length > 0x7FFFFFFF)
+            return false;
+        char type[4];
+        memcpy(type, buffer + 4, 4);
+        uint64_t dataPos = pos + 8;
+        if (!memcmp(type, "IHDR", 4)) {
+            if (length != 13)
+                return false;
+            header.resize(13);
+            if (read(dataPos, header.data(), 13) != 13)
+                return false;
+        } else if (!memcmp(type, "fcTL", 4)) {
+            if (length != 26 || read(dataPos, buffer, 26) != 26)
+                return false;
+            Frame frame;
+            frame.info.width = (int)std::min(be32(buffer + 4), 0x7FFFFFFFu);
+            frame.info.height = (int)std::min(be32(buffer + 8), 0x7FFFFFFFu);
+            frame.info.left = (int)std::min(be32(buffer + 12), 0x7FFFFFFFu);
+            frame.info.top = (int)std::min(be32(buffer + 16), 0x7FFFFFFFu);
+            uint32_t num = be16(buffer + 20), den = be16(buffer + 22);
+            int delay = (int)(num * 1000 / (den ? den : 100));
+            frame.info.delay = delay < MIN_FRAME_DELAY ? DEFAULT_FRAME_DELAY : delay;
+            frame.info.disposal = buffer[24] == 1 ? DISPOSE_BACKGROUND
+                : buffer[24] == 2 ? DISPOSE_PREVIOUS : DISPOSE_NONE;
+            if (frames.empty() && frame.info.disposal == DISPOSE_PREVIOUS)
+                frame.info.disposal = DISPOSE_BACKGROUND; // nothing to restore
+            frame.info.blend = buffer[25] == 1;
+            if (frame.info.width == 0 || frame.info.height == 0)
+                return false;
+            frames.push_back(frame);
+        } else if (!memcmp(type, "IDAT", 4)) {
+            seenData = true;
+            // the default image is the first frame only if its fcTL comes first
+            if (frames.size() == 1)
+                frames[0].data.push_back({dataPos, length});
+        } else if (!memcmp(type, "fdAT", 4)) {
+            if (length < 4 || frames.empty())
+                return false;
+            frames.back().data.push_back({dataPos + 4, length - 4});
+        } else if (!seenData && (!memcmp(type, "PLTE", 4) || !memcmp(type, "tRNS", 4))) {
+            size_t chunkSize = (size_t)length + 12;
+            if (extraChunks.size() + chunkSize > MAX_EXTRA_CHUNKS)
+                return false;
+            size_t start = extraChunks.size();
+            extraChunks.resize(start + chunkSize);
+            if (read(pos, &extraChunks[start], chunkSize) != chunkSize)
+                return false;
+        } else if (!memcmp(type, "IEND", 4)) {
+            break;
+        }
+        pos = dataPos + length + 4;
+    }
+    if (header.empty() || frames.size() < 2)
+        return false;
+    if (width() <= 0 || height() <= 0)
+        return false;
+    for (const Frame &frame : frames) {
+        if (frame.data.empty() || (int64_t)frame.info.left + frame.info.width > width()
+                || (int64_t)frame.info.top + frame.info.height > height())
+            return false;
+    }
+    return true;
+}
+
+int APNGReader::width() const {
+    return (int)std::min(be32(&header[0]), 0x7FFFFFFFu);
+}
+
+int APNGReader::height() const {
+    return (int)std::min(be32(&header[4]), 0x7FFFFFFFu);
+}
+
+int APNGReader::frameCount() const {
+    return (int)frames.size();
+}
+
+bool APNGReader::readFrame(int index, FrameInfo *info, std::vector<uint8_t> *png) const {
+    if (index < 0 || index >= (int)frames.size())
+        return false;
+    const Frame &frame = frames[index];
+    *info = frame.info;
+    uint64_t dataSize = 0;
+    for (const Segment &segment : frame.data)
+        dataSize += segment.length;
+    if (dataSize > MAX_FRAME_DATA)
+        return false;
+
+    png->clear();
+    png->reserve((size_t)(8 + 25 + extraChunks.size() + dataSize + frame.data.size() * 12 + 12));
+    const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    png->insert(png->end(), signature, signature + 8);
+    uint8_t frameHeader[13];
+    memcpy(frameHeader, header.data(), 13);
+    putBE32(frameHeader, (uint32_t)frame.info.width);
+    putBE32(frameHeader + 4, (uint32_t)frame.info.height);
+    appendChunk(png, "IHDR", frameHeader, 13);
+    png->insert(png->end(), extraChunks.begin(), extraChunks.end());
+    std::vector<uint8_t> data;
+    for (const Segment &segment : frame.data) {
+        data.resize(segment.length);
+        if (readFunc(segment.offset, data.data(), segment.length) != segment.length)
+            return false;
+        appendChunk(png, "IDAT", data.data(), segment.length);
+    }
+    appendChunk(png, "IEND", nullptr, 0);
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,109 @@
+#pragma once
+#include <common.h>
+
+#include "ImageInfo.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace chromafiler {
+
+const int MIN_FRAME_DELAY = 20; // milliseconds, shorter delays are treated as the default
+const int DEFAULT_FRAME_DELAY = 100; // what browsers use for delays that are too short
+
+enum FrameDisposal {
+    DISPOSE_NONE, // leave the frame in place
+    DISPOSE_BACKGROUND, // clear the frame's area to transparent
+    DISPOSE_PREVIOUS, // restore the area to what it was before the frame
+};
+
+struct FrameInfo {
+    int left, top, width, height; // within the canvas
+    int delay; // milliseconds
+    FrameDisposal disposal; // applied before the next frame
+    bool blend; // composite over the canvas, otherwise replace
+};
+
+// Builds each frame of an animation on a canvas of premultiplied 32-bit BGRA pixels, applying the
+// previous frame's disposal in place. Memory use is two canvases regardless of the frame count.
+class FrameCompositor {
+public:
+    FrameCompositor(int width, int height);
+    void reset(); // transparent canvas, for the first frame
+    // frame pixels are premultiplied BGRA. the frame is clipped to the canvas
+    void compose(const FrameInfo &frame, const uint8_t *pixels, ptrdiff_t stride);
+    const uint8_t * canvas() const; // top-down, stride is width * 4
+    int width() const;
+    int height() const;
+
+private:
+    struct Rect {
+        int left, top, right, bottom;
+    };
+    void copyRect(const std::vector<uint8_t> &src, std::vector<uint8_t> &dest, const Rect &rect);
+    void clearRect(const Rect &rect);
+
+    int canvasWidth, canvasHeight;
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> saved; // area under the previous frame, for DISPOSE_PREVIOUS
+    Rect pendingRect = {};
+    FrameDisposal pendingDisposal = DISPOSE_NONE;
+};
+
+// Fixed number of frame buffers used as a FIFO queue, so decoding can run ahead of playback
+// without allocating. Not thread-safe; the buffer returned by back() may be filled without a
+// lock since the consumer can't see it until push().
+class FrameRing {
+public:
+    // capacity is how many frames fit in budget, clamped to [2, maxFrames]
+    FrameRing(size_t frameBytes, size_t budget, int maxFrames);
+    int capacity() const;
+    int count() const;
+    bool full() const;
+    uint8_t * back(); // next buffer to fill, if not full
+    void push(int delay);
+    const uint8_t * front(int *delay) const; // null if empty
+    void pop();
+
+private:
+    size_t frameBytes;
+    int frames;
+    std::unique_ptr<uint8_t[]> buffers;
+    std::unique_ptr<int[]> delays;
+    int head = 0, size = 0;
+};
+
+// Splits an animated PNG into standalone PNG images, one per frame, which any PNG decoder can
+// read. Only chunk positions are kept in memory; frame data is read when it's needed.
+class APNGReader {
+public:
+    // returns false if the file isn't a PNG with more than one frame
+    bool open(const ImageReadFunc &read);
+    int width() const;
+    int height() const;
+    int frameCount() const;
+    // build the PNG for a frame. returns false if it can't be read
+    bool readFrame(int index, FrameInfo *info, std::vector<uint8_t> *png) const;
+
+private:
+    struct Segment {
+        uint64_t offset;
+        uint32_t length;
+    };
+    struct Frame {
+        FrameInfo info;
+        std::vector<Segment> data; // compressed image data
+    };
+
+    ImageReadFunc readFunc;
+    std::vector<uint8_t> header; // IHDR data
+    std::vector<uint8_t> extraChunks; // PLTE and tRNS, copied to every frame
+    std::vector<Frame> frames;
+};
+
+// true if the start of a file (eg. the first IMAGE_INFO_BLOCK_SIZE bytes) is a PNG with an acTL
+// chunk, which must come before the image data. false if the chunk isn't found within size
+bool isAnimatedPNG(const uint8_t *data, size_t size);
+
+} // namespace
@@ -0,0 +1,470 @@
+#include "ContactSheetView.h"
+#include "CreateItemWindow.h"
+#include "DPI.h"
+#include "GeomUtils.h"
+#include "ShellUtils.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailView.h"
+#include "WinUtils.h"
+#include <climits>
+#include <windowsx.h>
+#include <shlobj.h>
+
+namespace chromafiler {
+
+const wchar_t CONTACT_SHEET_CLASS[] = L"ChromaFiler Contact Sheet";
+
+const int THUMBNAIL_SIZE = 128; // dp
+const int CELL_PADDING = 8; // dp
+const int ENUM_BATCH_SIZE = 64; // items added to the window at a time
+
+const int SHEET_PRIORITY_BACKGROUND = 0;
+const int SHEET_PRIORITY_FOREGROUND = 1;
+
+static ClassFactoryImpl<ContactSheetView, false> factory;
+static DWORD regCookie = 0;
+static CComPtr<WorkerPool> sheetPool;
+static int jobCount = 0; // thumbnails loaded in parallel per window
+static HFONT labelFont = nullptr;
+
+void ContactSheetView::init() {
+    WNDCLASS sheetClass = {};
+    sheetClass.lpfnWndProc = windowProc;
+    sheetClass.hInstance = GetModuleHandle(nullptr);
+    sheetClass.lpszClassName = CONTACT_SHEET_CLASS;
+    sheetClass.style = CS_DBLCLKS;
+    sheetClass.hCursor = LoadCursor(nullptr, IDC_ARROW);
+    RegisterClass(&sheetClass);
+
+    NONCLIENTMETRICS metrics = {sizeof(metrics)};
+    SystemParametersInfo(SPI_GETNONCLIENTMETRICS, sizeof(metrics), &metrics, 0);
+    labelFont = CreateFontIndirect(&metrics.lfMessageFont);
+
+    // each view runs one job per thread, so a single sheet can keep the whole pool busy
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    jobCount = max(2, min(6, (int)systemInfo.dwNumberOfProcessors - 1));
+    sheetPool.Attach(new WorkerPool(jobCount));
+    sheetPool->start();
+
+    checkHR(CoRegisterClassObject(CLSID_ContactSheetView, &factory,
+        CLSCTX_LOCAL_SERVER, REGCLS_MULTIPLEUSE, &regCookie));
+}
+
+void ContactSheetView::uninit() {
+    checkHR(CoRevokeClassObject(regCookie));
+    sheetPool->shutdown();
+    if (labelFont)
+        DeleteFont(labelFont);
+}
+
+ContactSheetView::~ContactSheetView() {}
+
+const wchar_t * ContactSheetView::className() const {
+    return CONTACT_SHEET_CLASS;
+}
+
+DWORD ContactSheetView::windowStyle() const {
+    return PreviewHandlerImpl::windowStyle() | WS_VSCROLL;
+}
+
+LRESULT ContactSheetView::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
+    switch (message) {
+        case WM_CREATE: {
+            int sizeBucket = thumbnailSizeBucket({scaleDPI(THUMBNAIL_SIZE),
+                scaleDPI(THUMBNAIL_SIZE)});
+            sheet.Attach(new Sheet(item, this, sizeBucket));
+            enumTask.Attach(new EnumTask(sheet));
+            for (int i = 0; i < jobCount; i++) {
+                CComPtr<ThumbnailJob> job;
+                job.Attach(new ThumbnailJob(sheet));
+                jobs.push_back(job);
+            }
+            updateLayout();
+            sheetPool->submit(enumTask, taskPriority());
+            return 0;
+        }
+        case WM_DESTROY:
+            sheetPool->cancel(enumTask);
+            for (auto &job : jobs)
+                sheetPool->cancel(job);
+            sheet->stop();
+            return 0;
+        case WM_SIZE:
+            updateLayout();
+            return 0;
+        case WM_ERASEBKGND:
+            return 1; // painted with double buffering
+        case WM_PAINT:
+            PAINTSTRUCT paint;
+            BeginPaint(hwnd, &paint);
+            onPaint(paint);
+            EndPaint(hwnd, &paint);
+            return 0;
+        case WM_VSCROLL: {
+            SIZE size = clientSize(hwnd);
+            switch (LOWORD(wParam)) {
+                case SB_LINEUP: setScroll(scrollPos - cellHeight); break;
+                case SB_LINEDOWN: setScroll(scrollPos + cellHeight); break;
+                case SB_PAGEUP: setScroll(scrollPos - size.cy); break;
+                case SB_PAGEDOWN: setScroll(scrollPos + size.cy); break;
+                case SB_TOP: setScroll(0); break;
+                case SB_BOTTOM: setScroll(INT_MAX); break;
+                case SB_THUMBTRACK: {
+                    SCROLLINFO info = {sizeof(info), SIF_TRACKPOS};
+                    GetScrollInfo(hwnd, SB_VERT, &info);
+                    setScroll(info.nTrackPos);
+                    break;
+                }
+            }
+            return 0;
+        }
+        case WM_MOUSEWHEEL:
+            // one row per notch
+            setScroll(scrollPos - GET_WHEEL_DELTA_WPARAM(wParam) * cellHeight / WHEEL_DELTA);
+            return 0;
+        case WM_KEYDOWN:
+            switch (wParam) {
+                case VK_PRIOR: setScroll(scrollPos - clientSize(hwnd).cy); return 0;
+                case VK_NEXT: setScroll(scrollPos + clientSize(hwnd).cy); return 0;
+                case VK_UP: setScroll(scrollPos - cellHeight); return 0;
+                case VK_DOWN: setScroll(scrollPos + cellHeight); return 0;
+                case VK_HOME: setScroll(0); return 0;
+                case VK_END: setScroll(INT_MAX); return 0;
+            }
+            break;
+        case WM_LBUTTONDOWN:
+            SetFocus(hwnd);
+            return 0;
+        case WM_LBUTTONDBLCLK: {
+            int index = hitTest(pointFromLParam(lParam));
+            if (index >= 0)
+                openItem(index);
+            return 0;
+        }
+        case MSG_ITEMS_ADDED:
+            itemCount = sheet->count();
+            updateLayout();
+            InvalidateRect(hwnd, nullptr, FALSE);
+            return 0;
+        case MSG_THUMBNAILS_UPDATED:
+            sheet->acknowledgeUpdate();
+            InvalidateRect(hwnd, nullptr, FALSE);
+            return 0;
+    }
+    return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+void ContactSheetView::updateLayout() {
+    SIZE size = clientSize(hwnd);
+    HDC hdc = GetDC(hwnd);
+    HFONT oldFont = SelectFont(hdc, labelFont);
+    TEXTMETRIC metrics;
+    GetTextMetrics(hdc, &metrics);
+    SelectFont(hdc, oldFont);
+    ReleaseDC(hwnd, hdc);
+
+    int padding = scaleDPI(CELL_PADDING);
+    thumbSize = scaleDPI(THUMBNAIL_SIZE);
+    cellWidth = thumbSize + padding * 2;
+    cellHeight = thumbSize + metrics.tmHeight + padding * 3;
+    columns = max(1, size.cx / cellWidth);
+    rows = (itemCount + columns - 1) / columns;
+
+    SCROLLINFO info = {sizeof(info), SIF_RANGE | SIF_PAGE};
+    info.nMin = 0;
+    info.nMax = max(0, rows * cellHeight - 1);
+    info.nPage = (UINT)max(0, (int)size.cy);
+    SetScrollInfo(hwnd, SB_VERT, &info, TRUE);
+    setScroll(scrollPos);
+    updateVisibleRange(); // even if the scroll position didn't change
+}
+
+void ContactSheetView::setScroll(int pos) {
+    SIZE size = clientSize(hwnd);
+    int maxScroll = max(0, rows * cellHeight - (int)size.cy);
+    pos = max(0, min(maxScroll, pos));
+    if (pos == scrollPos)
+        return;
+    scrollPos = pos;
+    SCROLLINFO info = {sizeof(info), SIF_POS};
+    info.nPos = pos;
+    SetScrollInfo(hwnd, SB_VERT, &info, TRUE);
+    InvalidateRect(hwnd, nullptr, FALSE);
+    updateVisibleRange();
+}
+
+void ContactSheetView::updateVisibleRange() {
+    if (cellHeight == 0)
+        return;
+    SIZE size = clientSize(hwnd);
+    int firstRow = scrollPos / cellHeight;
+    int lastRow = (scrollPos + max(0, (int)size.cy - 1)) / cellHeight;
+    int first = firstRow * columns;
+    int last = min(itemCount, (lastRow + 1) * columns);
+    // keep one page above and below, so scrolling a little doesn't show placeholders
+    sheet->setVisibleRange(first, last, (lastRow - firstRow + 1) * columns);
+    submitJobs();
+}
+
+int ContactSheetView::taskPriority() {
+    HWND foreground = GetForegroundWindow();
+    bool isForeground = foreground
+        && GetAncestor(foreground, GA_ROOTOWNER) == GetAncestor(hwnd, GA_ROOTOWNER);
+    return isForeground ? SHEET_PRIORITY_FOREGROUND : SHEET_PRIORITY_BACKGROUND;
+}
+
+void ContactSheetView::submitJobs() {
+    int priority = taskPriority();
+    InterlockedExchange(&sheet->priority, priority);
+    // jobs that are already queued or running are not duplicated
+    for (auto &job : jobs)
+        sheetPool->submit(job, priority);
+}
+
+int ContactSheetView::hitTest(POINT pos) {
+    if (cellWidth == 0 || cellHeight == 0)
+        return -1;
+    int left = (clientSize(hwnd).cx - columns * cellWidth) / 2;
+    int column = (pos.x - left) / cellWidth, row = (pos.y + scrollPos) / cellHeight;
+    if (pos.x < left || column >= columns || pos.y + scrollPos < 0)
+        return -1;
+    int index = row * columns + column;
+    return index < itemCount ? index : -1;
+}
+
+void ContactSheetView::openItem(int index) {
+    CComHeapPtr<ITEMIDLIST> itemIDList;
+    itemIDList.Attach(sheet->cloneItemIDList(index));
+    CComPtr<IShellItem> openItem;
+    if (!itemIDList || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&openItem))))
+        return;
+    CComPtr<ItemWindow> window = createItemWindow(nullptr, openItem);
+    window->create(window->requestedRect(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST)),
+        SW_SHOWNORMAL);
+}
+
+void ContactSheetView::onPaint(PAINTSTRUCT paint) {
+    SIZE size = clientSize(hwnd);
+    HDC hdcBuffer = CreateCompatibleDC(paint.hdc);
+    HBITMAP buffer = CreateCompatibleBitmap(paint.hdc, size.cx, size.cy);
+    HBITMAP oldBitmap = SelectBitmap(hdcBuffer, buffer);
+    FillRect(hdcBuffer, tempPtr(RECT{0, 0, size.cx, size.cy}), (HBRUSH)(COLOR_WINDOW + 1));
+
+    if (cellHeight > 0 && itemCount > 0) {
+        HFONT oldFont = SelectFont(hdcBuffer, labelFont);
+        SetBkMode(hdcBuffer, TRANSPARENT);
+        SetTextColor(hdcBuffer, GetSysColor(COLOR_WINDOWTEXT));
+        SetStretchBltMode(hdcBuffer, HALFTONE);
+        int padding = scaleDPI(CELL_PADDING);
+        int left = (size.cx - columns * cellWidth) / 2;
+        int firstRow = (scrollPos + paint.rcPaint.top) / cellHeight;
+        int lastRow = min(rows - 1, (scrollPos + paint.rcPaint.bottom) / cellHeight);
+
+        AcquireSRWLockShared(&sheet->lock);
+        for (int row = firstRow; row <= lastRow; row++) {
+            for (int column = 0; column < columns; column++) {
+                int index = row * columns + column;
+                if (index >= itemCount)
+                    break;
+                int x = left + column * cellWidth + padding;
+                int y = row * cellHeight - scrollPos + padding;
+                RECT thumbRect = {x, y, x + thumbSize, y + thumbSize};
+                const wchar_t *name;
+                const ThumbnailBitmap *thumbnail = sheet->getThumbnail(index, &name);
+                DIBSECTION dib;
+                if (thumbnail && GetObject(thumbnail->bitmap, sizeof(dib), &dib)
+                        && dib.dsBm.bmBits) {
+                    // read directly from the DIB since the bitmap may be shared with other views
+                    RECT dest = fitRect(thumbnail->size, {thumbSize, thumbSize});
+                    StretchDIBits(hdcBuffer, x + dest.left, y + dest.top,
+                        rectWidth(dest), rectHeight(dest),
+                        0, 0, thumbnail->size.cx, thumbnail->size.cy, dib.dsBm.bmBits,
+                        (BITMAPINFO *)&dib.dsBmih, DIB_RGB_COLORS, SRCCOPY);
+                } else {
+                    FillRect(hdcBuffer, &thumbRect, GetSysColorBrush(COLOR_3DFACE));
+                }
+                RECT labelRect = {x - padding / 2, y + thumbSize + padding,
+                    x + thumbSize + padding / 2, y + cellHeight - padding};
+                DrawText(hdcBuffer, name, -1, &labelRect,
+                    DT_CENTER | DT_SINGLELINE | DT_END_ELLIPSIS | DT_NOPREFIX);
+            }
+        }
+        ReleaseSRWLockShared(&sheet->lock);
+        SelectFont(hdcBuffer, oldFont);
+    }
+
+    BitBlt(paint.hdc, 0, 0, size.cx, size.cy, hdcBuffer, 0, 0, SRCCOPY);
+    SelectBitmap(hdcBuffer, oldBitmap);
+    DeleteBitmap(buffer);
+    DeleteDC(hdcBuffer);
+}
+
+ContactSheetView::Sheet::Sheet(IShellItem *const folder, ContactSheetView *const callbackWindow,
+        int sizeBucket)
+        : sizeBucket(sizeBucket), callbackWindow(callbackWindow) {
+    checkHR(SHGetIDListFromObject(folder, &folderIDList));
+}
+
+void ContactSheetView::Sheet::stop() {
+    AcquireSRWLockExclusive(&stopLock);
+    stopped = true;
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+void ContactSheetView::Sheet::postToWindow(UINT message) {
+    // ensure the window is not closed before the message is posted
+    AcquireSRWLockExclusive(&stopLock);
+    if (!stopped)
+        PostMessage(callbackWindow->hwnd, message, 0, 0);
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+int ContactSheetView::Sheet::count() {
+    AcquireSRWLockShared(&lock);
+    int result = (int)items.size();
+    ReleaseSRWLockShared(&lock);
+    return result;
+}
+
+bool ContactSheetView::Sheet::inRange(int index) const {
+    return index >= first - margin && index < last + margin;
+}
+
+void ContactSheetView::Sheet::setVisibleRange(int newFirst, int newLast, int newMargin) {
+    AcquireSRWLockExclusive(&lock);
+    first = newFirst;
+    last = newLast;
+    margin = newMargin;
+    // thumbnails far from the viewport are released, they're still in the thumbnail cache
+    for (int i = 0; i < (int)items.size(); i++) {
+        Item &item = *items[i];
+        if (item.state == ITEM_LOADED && !inRange(i)) {
+            item.thumbnail = nullptr;
+            item.state = ITEM_NONE;
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+void ContactSheetView::Sheet::acknowledgeUpdate() {
+    AcquireSRWLockExclusive(&lock);
+    updatePosted = false;
+    ReleaseSRWLockExclusive(&lock);
+}
+
+const ThumbnailBitmap * ContactSheetView::Sheet::getThumbnail(int index, const wchar_t **name) {
+    const Item &item = *items[index];
+    *name = item.name.c_str();
+    return item.thumbnail.get();
+}
+
+PIDLIST_ABSOLUTE ContactSheetView::Sheet::cloneItemIDList(int index) {
+    AcquireSRWLockShared(&lock);
+    PIDLIST_ABSOLUTE result = nullptr;
+    if (index >= 0 && index < (int)items.size())
+        result = ILCloneFull(items[index]->itemIDList);
+    ReleaseSRWLockShared(&lock);
+    return result;
+}
+
+void ContactSheetView::Sheet::enumerate() {
+    CComPtr<IShellItem> folder;
+    CComPtr<IEnumShellItems> enumItems;
+    if (!folderIDList || !checkHR(SHCreateItemFromIDList(folderIDList, IID_PPV_ARGS(&folder)))
+            || !checkHR(folder->BindToHandler(nullptr, BHID_EnumItems,
+                IID_PPV_ARGS(&enumItems))))
+        return;
+    std::vector<std::unique_ptr<Item>> batch;
+    CComPtr<IShellItem> child;
+    while (!stopped) {
+        bool done = enumItems->Next(1, &child, nullptr) != S_OK;
+        if (!done && isImageItem(child)) {
+            std::unique_ptr<Item> newItem(new Item());
+            CComHeapPtr<wchar_t> name;
+            if (checkHR(SHGetIDListFromObject(child, &newItem->itemIDList))
+                    && checkHR(child->GetDisplayName(SIGDN_NORMALDISPLAY, &name))) {
+                newItem->name = name;
+                batch.push_back(std::move(newItem));
+            }
+        }
+        child = nullptr;
+        if ((done && !batch.empty()) || (int)batch.size() == ENUM_BATCH_SIZE) {
+            AcquireSRWLockExclusive(&lock);
+            for (auto &batchItem : batch)
+                items.push_back(std::move(batchItem));
+            ReleaseSRWLockExclusive(&lock);
+            batch.clear();
+            postToWindow(MSG_ITEMS_ADDED);
+        }
+        if (done)
+            break;
+    }
+}
+
+int ContactSheetView::Sheet::nextRequest() {
+    if (stopped)
+        return -1;
+    AcquireSRWLockExclusive(&lock);
+    int count = (int)items.size();
+    int visibleEnd = min(last, count);
+    int found = -1;
+    // visible items in order, then alternating outward from the visible range
+    for (int i = max(first, 0); i < visibleEnd && found < 0; i++) {
+        if (items[i]->state == ITEM_NONE)
+            found = i;
+    }
+    int start = max(0, first - margin), end = min(count, last + margin);
+    for (int d = 0; found < 0 && (visibleEnd + d < end || first - 1 - d >= start); d++) {
+        int after = visibleEnd + d, before = first - 1 - d;
+        if (after < end && items[after]->state == ITEM_NONE) {
+            found = after;
+        } else if (before >= start && items[before]->state == ITEM_NONE) {
+            found = before;
+        }
+    }
+    if (found >= 0)
+        items[found]->state = ITEM_LOADING;
+    ReleaseSRWLockExclusive(&lock);
+    return found;
+}
+
+void ContactSheetView::Sheet::finishRequest(int index,
+        std::shared_ptr<ThumbnailBitmap> thumbnail) {
+    bool post = false;
+    AcquireSRWLockExclusive(&lock);
+    Item &item = *items[index];
+    if (!thumbnail) {
+        item.state = ITEM_FAILED; // stays a placeholder
+    } else if (inRange(index)) {
+        item.state = ITEM_LOADED;
+        item.thumbnail = std::move(thumbnail);
+        if (index >= first && index < last && !updatePosted)
+            post = updatePosted = true;
+    } else {
+        item.state = ITEM_NONE; // scrolled away, loaded from the cache if it comes back
+    }
+    ReleaseSRWLockExclusive(&lock);
+    if (post)
+        postToWindow(MSG_THUMBNAILS_UPDATED);
+}
+
+void ContactSheetView::EnumTask::run() {
+    sheet->enumerate();
+}
+
+void ContactSheetView::ThumbnailJob::run() {
+    int index = sheet->nextRequest();
+    if (index < 0)
+        return; // resubmitted when the visible range changes
+    CComHeapPtr<ITEMIDLIST> itemIDList;
+    itemIDList.Attach(sheet->cloneItemIDList(index));
+    CComPtr<IShellItem> item;
+    std::shared_ptr<ThumbnailBitmap> thumbnail;
+    if (itemIDList && checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item))))
+        thumbnail = ThumbnailView::loadThumbnail(item, sheet->sizeBucket);
+    sheet->finishRequest(index, std::move(thumbnail));
+    sheetPool->submit(this, sheet->priority);
+}
+
+} // namespace
@@ -0,0 +1,123 @@
+#pragma once
+#include <common.h>
+
+#include "PreviewHandler.h"
+#include "WorkerPool.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace chromafiler {
+
+class ThumbnailBitmap;
+
+// {3c1e8a62-5b0d-4f7e-9a41-6d2f0c8b7e15}
+const CLSID CLSID_ContactSheetView =
+    {0x3c1e8a62, 0x5b0d, 0x4f7e, {0x9a, 0x41, 0x6d, 0x2f, 0x0c, 0x8b, 0x7e, 0x15}};
+// Scrolling grid of thumbnails for the images in a folder. Thumbnails are generated in parallel
+// on a worker pool, nearest to the visible rows first, and only rows near the viewport keep
+// their bitmaps; the rest stay in the thumbnail cache. Cells without a thumbnail yet are drawn
+// as placeholders.
+class ContactSheetView : public PreviewHandlerImpl {
+public:
+    static void init();
+    static void uninit();
+
+    ~ContactSheetView();
+
+protected:
+    enum UserMessage {
+        // WPARAM: 0, LPARAM: 0
+        MSG_ITEMS_ADDED = WM_USER,
+        // WPARAM: 0, LPARAM: 0
+        MSG_THUMBNAILS_UPDATED,
+        MSG_LAST
+    };
+    const wchar_t * className() const override;
+    DWORD windowStyle() const override;
+    LRESULT handleMessage(UINT message, WPARAM wParam, LPARAM lParam) override;
+
+private:
+    class Sheet;
+
+    void onPaint(PAINTSTRUCT paint);
+    void updateLayout();
+    void setScroll(int pos); // clamped
+    void updateVisibleRange(); // after scrolling or layout changes
+    int hitTest(POINT pos); // item index, or -1
+    void openItem(int index);
+    int taskPriority();
+    void submitJobs();
+
+    int cellWidth = 0, cellHeight = 0, thumbSize = 0; // pixels
+    int columns = 1, rows = 0;
+    int scrollPos = 0; // pixels
+    int itemCount = 0; // as of the last MSG_ITEMS_ADDED
+
+    CComPtr<Sheet> sheet;
+
+    // state shared by the window and the tasks working for it
+    class Sheet : public UnknownImpl {
+    public:
+        Sheet(IShellItem *folder, ContactSheetView *callbackWindow, int sizeBucket);
+        void stop();
+        int count();
+        // rows of items that should be loaded, the rest have their thumbnails released
+        void setVisibleRange(int first, int last, int margin);
+        void acknowledgeUpdate(); // when MSG_THUMBNAILS_UPDATED is received
+        // returns the thumbnail if loaded, and the name. lock must be held
+        const ThumbnailBitmap * getThumbnail(int index, const wchar_t **name);
+        PIDLIST_ABSOLUTE cloneItemIDList(int index); // null if out of range
+
+        SRWLOCK lock = SRWLOCK_INIT; // for items and the visible range
+        CComHeapPtr<ITEMIDLIST> folderIDList;
+        const int sizeBucket;
+        volatile LONG priority = 0; // for jobs resubmitting themselves
+
+        // tasks
+        void enumerate(); // adds items in batches
+        int nextRequest(); // marks the item as loading, returns -1 if none are needed
+        void finishRequest(int index, std::shared_ptr<ThumbnailBitmap> thumbnail);
+
+    private:
+        enum ItemState {ITEM_NONE, ITEM_LOADING, ITEM_LOADED, ITEM_FAILED};
+        struct Item {
+            CComHeapPtr<ITEMIDLIST> itemIDList;
+            std::wstring name;
+            ItemState state = ITEM_NONE;
+            std::shared_ptr<ThumbnailBitmap> thumbnail;
+        };
+        bool inRange(int index) const; // lock must be held
+        void postToWindow(UINT message);
+
+        ContactSheetView *callbackWindow;
+        SRWLOCK stopLock = SRWLOCK_INIT; // task will not be stopped while held
+        bool stopped = false;
+        bool updatePosted = false; // MSG_THUMBNAILS_UPDATED is waiting, guarded by lock
+
+        std::vector<std::unique_ptr<Item>> items;
+        int first = 0, last = 0, margin = 0; // item indices
+    };
+
+    class EnumTask : public PoolTask {
+    public:
+        explicit EnumTask(Sheet *sheet) : sheet(sheet) {}
+        void run() override;
+    private:
+        CComPtr<Sheet> sheet;
+    };
+
+    // several of these run in parallel, each loading one thumbnail per run
+    class ThumbnailJob : public PoolTask {
+    public:
+        explicit ThumbnailJob(Sheet *sheet) : sheet(sheet) {}
+        void run() override;
+    private:
+        CComPtr<Sheet> sheet;
+    };
+
+    CComPtr<EnumTask> enumTask;
+    std::vector<CComPtr<ThumbnailJob>> jobs;
+};
+
+} // namespace
@@ -1,8 +1,12 @@
 #include "CreateItemWindow.h"
 #include "FolderWindow.h"
 #include "ThumbnailView.h"
+#include "ImageView.h"
+#include "ContactSheetView.h"
+#include "TextPreview.h"
 #include "PreviewWindow.h"
 #include "TextWindow.h"
+#include "RasterDecoder.h"
 #include "Settings.h"
 #include "ShellUtils.h"
 #include "UIStrings.h"
@@ -23,36 +27,63 @@ const CLSID TXT_PREVIEWER_CLSID =
 bool previewHandlerCLSID(wchar_t *type, CLSID *previewID);
 bool isCFWindow(HWND hwnd);
 
-CComPtr<ItemWindow> createItemWindow(ItemWindow *const parent, IShellItem *const item) {
-    CComPtr<ItemWindow> window;
+ItemWindowType itemWindowType(IShellItem *const item, CLSID *const previewID) {
     SFGAOF attr;
-    if (checkHR(item->GetAttributes(SFGAO_FOLDER, &attr)) && (attr & SFGAO_FOLDER)) {
-        window.Attach(new FolderWindow(parent, item));
-        return window;
-    }
+    if (checkHR(item->GetAttributes(SFGAO_FOLDER, &attr)) && (attr & SFGAO_FOLDER))
+        return ITEM_WINDOW_FOLDER;
 
     bool previewsEnabled = settings::getPreviewsEnabled();
     bool textEditorEnabled = settings::getTextEditorEnabled();
-    if (previewsEnabled || textEditorEnabled) {
-        CComQIPtr<IShellItem2> item2(item);
-        CComHeapPtr<wchar_t> type;
-        if (item2 && SUCCEEDED(item2->GetString(PKEY_ItemType, &type))) {
-            CLSID previewID;
+    CComQIPtr<IShellItem2> item2(item);
+    CComHeapPtr<wchar_t> type;
+    if (item2 && SUCCEEDED(item2->GetString(PKEY_ItemType, &type))) {
+        if (previewsEnabled || textEditorEnabled) {
             if (textEditorEnabled && lstrcmp(type, L".") == 0) { // no extension
-                window.Attach(new TextWindow(parent, item));
-                return window;
-            } else if (previewHandlerCLSID(type, &previewID)) {
-                if (textEditorEnabled && previewID == TXT_PREVIEWER_CLSID) {
-                    window.Attach(new TextWindow(parent, item));
-                    return window;
+                return ITEM_WINDOW_TEXT;
+            } else if (previewHandlerCLSID(type, previewID)) {
+                if (textEditorEnabled && *previewID == TXT_PREVIEWER_CLSID) {
+                    return ITEM_WINDOW_TEXT;
                 } else if (previewsEnabled) {
-                    window.Attach(new PreviewWindow(parent, item, previewID));
-                    return window;
+                    // read-only preview in this process, instead of starting the system previewer
+                    if (*previewID == TXT_PREVIEWER_CLSID)
+                        *previewID = CLSID_TextPreview;
+                    return ITEM_WINDOW_PREVIEW;
                 }
             }
         }
+        // animations, stats and the built-in raster decoders are only in ThumbnailView
+        if (ImageView::canDecode(type) && !settings::getImageStatsEnabled()
+                && !RasterDecoder::isRasterExtension(type)
+                && !ThumbnailView::isAnimationExtension(type)) {
+            *previewID = CLSID_ImageView;
+            return ITEM_WINDOW_PREVIEW;
+        }
+    }
+    *previewID = CLSID_ThumbnailView;
+    return ITEM_WINDOW_PREVIEW;
+}
+
+bool isBuiltInPreview(CLSID previewID) {
+    return previewID == CLSID_ThumbnailView || previewID == CLSID_ImageView
+        || previewID == CLSID_ContactSheetView || previewID == CLSID_TextPreview;
+}
+
+CComPtr<ItemWindow> createItemWindow(ItemWindow *const parent, IShellItem *const item) {
+    CComPtr<ItemWindow> window;
+    CLSID previewID;
+    switch (itemWindowType(item, &previewID)) {
+        case ITEM_WINDOW_FOLDER:
+            window.Attach(new FolderWindow(parent, item));
+            break;
+        case ITEM_WINDOW_TEXT:
+            window.Attach(new TextWindow(parent, item));
+            break;
+        case ITEM_WINDOW_PREVIEW:
+            // built-in previews load asynchronously on their own
+            window.Attach(new PreviewWindow(parent, item, previewID,
+                !isBuiltInPreview(previewID)));
+            break;
     }
-    window.Attach(new PreviewWindow(parent, item, CLSID_ThumbnailView, false));
     return window;
 }
 
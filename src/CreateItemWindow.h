@@ -6,6 +6,11 @@
 
 namespace chromafiler {
 
+enum ItemWindowType { ITEM_WINDOW_FOLDER, ITEM_WINDOW_TEXT, ITEM_WINDOW_PREVIEW };
+// type of window createItemWindow() would open. previewID is set for ITEM_WINDOW_PREVIEW
+// (CLSID_ImageView or CLSID_ThumbnailView if there is no preview handler)
+ItemWindowType itemWindowType(IShellItem *item, CLSID *previewID);
+bool isBuiltInPreview(CLSID previewID); // implemented in this process, loaded synchronously
 CComPtr<ItemWindow> createItemWindow(ItemWindow *parent, IShellItem *item);
 bool showItemWindow(IShellItem *item, IShellWindows *shellWindows, int showCmd);
 CComPtr<IShellItem> resolveLink(IShellItem *linkItem);
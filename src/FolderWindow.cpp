@@ -1,4 +1,6 @@
 #include "FolderWindow.h"
+#include "ContactSheetView.h"
+#include "PreviewWindow.h"
 #include "GeomUtils.h"
 #include "WinUtils.h"
 #include "Settings.h"
@@ -22,6 +24,8 @@ const wchar_t PROP_ICON_POS[] = L"IconPos";
 
 const EXPLORER_BROWSER_OPTIONS BROWSER_OPTIONS = EBO_NOBORDER | EBO_NOTRAVELLOG;
 
+const int PREFETCH_DISTANCE = 2; // items on either side of the selection
+
 // on the Desktop only
 const wchar_t * const HIDDEN_ITEM_PARSE_NAMES[] = {
     L"::{26EE0668-A00A-44D7-9371-BEB064C98683}", // Control Panel (must be 0)
@@ -439,6 +443,7 @@ void FolderWindow::onDestroy() {
         checkHR(browser->SetPropertyBag(L""));
     }
     ItemWindow::onDestroy();
+    cancelPrefetch();
     if (browser) {
         checkHR(browser->Unadvise(eventsCookie));
         checkHR(IUnknown_SetSite(browser, nullptr));
@@ -455,6 +460,9 @@ bool FolderWindow::onCommand(WORD command) {
         case IDM_NEW_TEXT_FILE:
             newItem(".txt");
             return true;
+        case IDM_CONTACT_SHEET:
+            openContactSheet();
+            return true;
     }
     return ItemWindow::onCommand(command);
 }
@@ -558,14 +566,17 @@ void FolderWindow::updateSelection() {
                 selected = newSelected;
                 // openChild() could cause a permission dialog to appear,
                 // so don't call it more than necessary!
-                if (compare)
+                if (compare) {
                     openChild(selected);
+                    prefetchNeighbors(folderView);
+                }
             }
         }
     } else {
         // 0 or more than 1 item selected
         selected = nullptr;
         closeChild();
+        cancelPrefetch();
     }
 
     // note: sometimes the first selection change event occurs before navigation is complete and
@@ -591,6 +602,34 @@ void FolderWindow::updateStatus() {
     setStatusText(status.get());
 }
 
+void FolderWindow::prefetchNeighbors(IFolderView2 *const folderView) {
+    // the user is likely to move the selection to an adjacent item next
+    int focused, numItems;
+    if (FAILED(folderView->GetFocusedItem(&focused))
+            || !checkHR(folderView->ItemCount(SVGIO_ALLVIEW, &numItems)))
+        return;
+    std::unique_ptr<CComHeapPtr<ITEMIDLIST>[]> items(
+        new CComHeapPtr<ITEMIDLIST>[PREFETCH_DISTANCE * 2]);
+    int count = 0;
+    for (int distance = 1; distance <= PREFETCH_DISTANCE; distance++) {
+        for (int index : {focused + distance, focused - distance}) {
+            CComPtr<IShellItem> item;
+            if (index >= 0 && index < numItems
+                    && SUCCEEDED(folderView->GetItem(index, IID_PPV_ARGS(&item)))
+                    && checkHR(SHGetIDListFromObject(item, &items[count])))
+                count++;
+        }
+    }
+    if (!prefetch)
+        prefetch.Attach(new ItemPrefetch());
+    prefetch->prefetch(std::move(items), count);
+}
+
+void FolderWindow::cancelPrefetch() {
+    if (prefetch)
+        prefetch->cancel();
+}
+
 void FolderWindow::clearSelection() {
     if (shellView)
         checkHR(shellView->SelectItem(nullptr, SVSI_DESELECTOTHERS)); // keep focus
@@ -608,6 +647,7 @@ IDispatch * FolderWindow::getShellViewDispatch() {
 
 void FolderWindow::onItemChanged() {
     ItemWindow::onItemChanged();
+    cancelPrefetch();
     if (browser) {
         CComPtr<IFolderView2> folderView;
         if (checkHR(browser->GetCurrentView(IID_PPV_ARGS(&folderView)))) {
@@ -689,6 +729,10 @@ void FolderWindow::trackContextMenu(POINT pos) {
     HMENU menu = CreatePopupMenu();
     if (menu && checkHR(contextMenu->QueryContextMenu(menu, 0, IDM_SHELL_FIRST, IDM_SHELL_LAST,
             contextFlags))) {
+        if (!(contextFlags & CMF_ITEMMENU)) {
+            AppendMenu(menu, MF_SEPARATOR, 0, nullptr);
+            AppendMenu(menu, MF_STRING, IDM_CONTACT_SHEET, getString(IDS_CONTACT_SHEET_COMMAND));
+        }
         contextMenu2 = contextMenu;
         contextMenu3 = contextMenu;
         int cmd = ItemWindow::trackContextMenu(pos, menu);
@@ -787,6 +831,14 @@ void FolderWindow::openViewMenu(POINT point) {
     checkLE(DestroyMenu(popupMenu));
 }
 
+void FolderWindow::openContactSheet() {
+    // opens in its own window rather than as a child, since it shows the same folder
+    CComPtr<ItemWindow> sheet;
+    sheet.Attach(new PreviewWindow(nullptr, item, CLSID_ContactSheetView, false));
+    sheet->create(sheet->requestedRect(MonitorFromWindow(hwnd, MONITOR_DEFAULTTONEAREST)),
+        SW_SHOWNORMAL);
+}
+
 void FolderWindow::openBackgroundSubMenu(IContextMenu *const contextMenu, HMENU subMenu,
         POINT point) {
     int cmd = TrackPopupMenuEx(subMenu, TPM_RETURNCMD | TPM_RIGHTBUTTON,
@@ -2,6 +2,7 @@
 #include <common.h>
 
 #include "ItemWindow.h"
+#include "ThumbnailView.h"
 #include <memory>
 #include <ExDisp.h>
 #include <shlobj_core.h>
@@ -179,11 +180,14 @@ private:
     void updateSelection();
     void clearSelection();
     void updateStatus();
+    void prefetchNeighbors(IFolderView2 *folderView);
+    void cancelPrefetch();
 
     CComPtr<IContextMenu> queryBackgroundMenu(HMENU *popupMenu);
     void newItem(const char *verb);
     void openNewItemMenu(POINT point);
     void openViewMenu(POINT point);
+    void openContactSheet();
     void openBackgroundSubMenu(IContextMenu *contextMenu, HMENU subMenu, POINT point);
 
     CComPtr<IExplorerBrowser> browser; // will be null if browser can't be initialized!
@@ -191,6 +195,7 @@ private:
     CComPtr<IShellFolderViewCB> prevCB;
 
     CComPtr<IShellItem> selected; // links are not resolved unlike child->item
+    CComPtr<ItemPrefetch> prefetch; // null until something is selected
 
     // jank flags
     bool ignoreInitialSelection = false;
@@ -1,10 +1,26 @@
 #include "GDIUtils.h"
 #include "GeomUtils.h"
+#include "PixelOps.h"
+#include "Resample.h"
+#include "ThreadUtils.h"
 #include <windowsx.h>
 #include <cstdint>
+#include <list>
+#include <unordered_map>
 
 namespace chromafiler {
 
+const size_t MAX_ICON_BITMAPS = 64; // more than a parent menu ever shows
+
+struct IconBitmapEntry {
+    uint64_t key; // size, overlay and image list index
+    HBITMAP bitmap;
+};
+
+static SRWLOCK iconCacheLock = SRWLOCK_INIT;
+static std::list<IconBitmapEntry> iconLRU; // most recently used first
+static std::unordered_map<uint64_t, std::list<IconBitmapEntry>::iterator> iconCache;
+
 void makeBitmapOpaque(HDC hdc, const RECT &rect) {
     // https://devblogs.microsoft.com/oldnewthing/20210915-00/?p=105687
     // thank you Raymond Chen :)
@@ -15,35 +31,123 @@ void makeBitmapOpaque(HDC hdc, const RECT &rect) {
                   DIB_RGB_COLORS, SRCPAINT);
 }
 
+static bool hasAlpha(const uint8_t *pixels, int width, int height) {
+    for (int i = 0; i < width * height; i++) {
+        if (pixels[i * 4 + 3])
+            return true;
+    }
+    return false;
+}
+
 HBITMAP iconToPARGB32Bitmap(HICON icon, int width, int height) {
     HDC hdcMem = CreateCompatibleDC(nullptr);
     BITMAPINFO bitmapInfo = {{sizeof(BITMAPINFOHEADER), width, -height, 1, 32, BI_RGB}};
     HBITMAP bitmap = nullptr;
+    uint8_t *pixels;
     if ((bitmap = checkLE(CreateDIBSection(hdcMem, &bitmapInfo, DIB_RGB_COLORS,
-                                           nullptr, nullptr, 0))) != nullptr) {
-        SelectBitmap(hdcMem, bitmap);
+                                           (void **)&pixels, nullptr, 0))) != nullptr) {
+        HBITMAP oldBitmap = SelectBitmap(hdcMem, bitmap);
         checkLE(DrawIconEx(hdcMem, 0, 0, icon, width, height, 0, nullptr, DI_NORMAL));
-        // TODO convert to premultiplied alpha?
+        GdiFlush();
+        // icons with an alpha channel are blended onto the (transparent) DIB as premultiplied
+        // alpha already. Others leave alpha at zero, so get it from the icon mask.
+        if (!hasAlpha(pixels, width, height)) {
+            uint8_t *mask;
+            HBITMAP maskBitmap = checkLE(CreateDIBSection(hdcMem, &bitmapInfo, DIB_RGB_COLORS,
+                                                          (void **)&mask, nullptr, 0));
+            if (maskBitmap) {
+                SelectBitmap(hdcMem, maskBitmap);
+                checkLE(DrawIconEx(hdcMem, 0, 0, icon, width, height, 0, nullptr, DI_MASK));
+                GdiFlush();
+                for (int i = 0; i < width * height; i++)
+                    pixels[i * 4 + 3] = mask[i * 4] ? 0 : 255; // mask is white where transparent
+                premultiplyAlpha(pixels, width, height, width * 4);
+                SelectBitmap(hdcMem, bitmap);
+                DeleteBitmap(maskBitmap);
+            }
+        }
+        SelectBitmap(hdcMem, oldBitmap);
     }
     DeleteDC(hdcMem);
     return bitmap;
 }
 
-void compositeBackground(const BITMAP &bitmap) {
-    uint8_t *pixels = (uint8_t *)bitmap.bmBits;
-    int rowIndex = 0;
-    for (int y = 0; y < bitmap.bmHeight; y++, rowIndex += bitmap.bmWidthBytes) {
-        int i = rowIndex;
-        for (int x = 0; x < bitmap.bmWidth; x++, i += 4) {
-            int alpha = pixels[i + 3];
-            if (alpha == 255)
-                continue;
-            int c = 255 - alpha;
-            pixels[i + 0] = (uint8_t)((int)(pixels[i + 0]) * alpha / 255 + c);
-            pixels[i + 1] = (uint8_t)((int)(pixels[i + 1]) * alpha / 255 + c);
-            pixels[i + 2] = (uint8_t)((int)(pixels[i + 2]) * alpha / 255 + c);
-        }
+static uint64_t iconBitmapKey(int iconIndex, int overlay, int size) {
+    return ((uint64_t)(uint32_t)size << 32) | ((uint64_t)(overlay & 0xFF) << 24)
+        | ((uint32_t)iconIndex & 0xFFFFFF);
+}
+
+HBITMAP findIconBitmap(int iconIndex, int overlay, int size) {
+    HBITMAP result = nullptr;
+    AcquireSRWLockExclusive(&iconCacheLock);
+    auto found = iconCache.find(iconBitmapKey(iconIndex, overlay, size));
+    if (found != iconCache.end()) {
+        iconLRU.splice(iconLRU.begin(), iconLRU, found->second);
+        result = iconLRU.front().bitmap;
+    }
+    ReleaseSRWLockExclusive(&iconCacheLock);
+    return result;
+}
+
+HBITMAP cacheIconBitmap(int iconIndex, int overlay, int size, HICON icon) {
+    uint64_t key = iconBitmapKey(iconIndex, overlay, size);
+    HBITMAP bitmap = iconToPARGB32Bitmap(icon, size, size);
+    if (!bitmap)
+        return nullptr;
+    AcquireSRWLockExclusive(&iconCacheLock);
+    auto found = iconCache.find(key);
+    if (found != iconCache.end()) { // converted again, eg. by another thread
+        DeleteBitmap(found->second->bitmap);
+        iconLRU.erase(found->second);
+    }
+    iconLRU.push_front({key, bitmap});
+    iconCache[key] = iconLRU.begin();
+    while (iconLRU.size() > MAX_ICON_BITMAPS) {
+        DeleteBitmap(iconLRU.back().bitmap);
+        iconCache.erase(iconLRU.back().key);
+        iconLRU.pop_back();
+    }
+    ReleaseSRWLockExclusive(&iconCacheLock);
+    return bitmap;
+}
+
+void clearIconBitmapCache() {
+    AcquireSRWLockExclusive(&iconCacheLock);
+    for (auto &entry : iconLRU)
+        DeleteBitmap(entry.bitmap);
+    iconLRU.clear();
+    iconCache.clear();
+    ReleaseSRWLockExclusive(&iconCacheLock);
+}
+
+void compositeBackground(const BITMAP &bitmap, COLORREF color) {
+    uint32_t background = (GetRValue(color) << 16) | (GetGValue(color) << 8) | GetBValue(color);
+    compositeOnColor((uint8_t *)bitmap.bmBits, bitmap.bmWidth, bitmap.bmHeight,
+        bitmap.bmWidthBytes, background);
+}
+
+HBITMAP resampleBitmap(HBITMAP bitmap, int width, int height) {
+    DIBSECTION dib;
+    if (!checkLE(GetObject(bitmap, sizeof(dib), &dib)) || !dib.dsBm.bmBits
+            || dib.dsBm.bmBitsPixel != 32)
+        return nullptr;
+    const uint8_t *srcPixels = (const uint8_t *)dib.dsBm.bmBits;
+    ptrdiff_t srcStride = dib.dsBm.bmWidthBytes;
+    if (dib.dsBmih.biHeight > 0) { // bottom-up
+        srcPixels += srcStride * (dib.dsBm.bmHeight - 1);
+        srcStride = -srcStride;
+    }
+
+    BITMAPINFO bitmapInfo = {{sizeof(BITMAPINFOHEADER), width, -height, 1, 32, BI_RGB}};
+    uint8_t *pixels;
+    HBITMAP result = checkLE(CreateDIBSection(nullptr, &bitmapInfo, DIB_RGB_COLORS,
+                                              (void **)&pixels, nullptr, 0));
+    if (result) {
+        GdiFlush();
+        resamplePixels(srcPixels, dib.dsBm.bmWidth, dib.dsBm.bmHeight, srcStride,
+            pixels, width, height, width * 4, RESAMPLE_LANCZOS3, parallelFor);
     }
+    return result;
 }
 
 } // namespace
@@ -7,7 +7,16 @@ namespace chromafiler {
 
 void makeBitmapOpaque(HDC hdc, const RECT &rect);
 HBITMAP iconToPARGB32Bitmap(HICON icon, int width, int height);
-// use alpha channel to composite onto a white background
-void compositeBackground(const BITMAP &bitmap);
+// Premultiplied bitmaps of system image list icons for use in menus, cached by index, overlay and
+// size so the icon only has to be extracted and converted once. The bitmap is owned by the
+// cache, and stays valid until it's evicted by more recently used icons or the cache is cleared.
+HBITMAP findIconBitmap(int iconIndex, int overlay, int size); // null if not cached
+HBITMAP cacheIconBitmap(int iconIndex, int overlay, int size, HICON icon); // converts the icon
+// after the theme or DPI changes, or the system image list is updated (SHCNE_UPDATEIMAGE)
+void clearIconBitmapCache();
+// use alpha channel to composite a 32bpp DIB onto a solid background color
+void compositeBackground(const BITMAP &bitmap, COLORREF color);
+// high quality resize of a 32bpp DIB section into a new top-down DIB section
+HBITMAP resampleBitmap(HBITMAP bitmap, int width, int height);
 
 } // namespace
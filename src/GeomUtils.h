@@ -34,4 +34,19 @@ constexpr SIZE sizeFromLParam(LPARAM lp) {
     return {GET_X_LPARAM(lp), GET_Y_LPARAM(lp)};
 }
 
+// largest rect with the aspect ratio of image, centered in frame
+inline RECT fitRect(SIZE image, SIZE frame) {
+    float wScale = (float)frame.cx / image.cx;
+    float hScale = (float)frame.cy / image.cy;
+    if (wScale < hScale) {
+        int height = (int)(wScale * image.cy);
+        int y = (frame.cy - height) / 2;
+        return {0, y, frame.cx, y + height};
+    } else {
+        int width = (int)(hScale * image.cx);
+        int x = (frame.cx - width) / 2;
+        return {x, 0, x + width, frame.cy};
+    }
+}
+
 } // namespace
@@ -0,0 +1,326 @@
+#include "ImageInfo.h"
+#include <cstring>
+#include <cwctype>
+
+namespace chromafiler {
+
+namespace {
+
+// Caches one block of the file so small reads near each other don't call read() again
+class BlockReader {
+public:
+    BlockReader(const ImageReadFunc &read) : readFunc(read) {}
+
+    // returns nullptr if the range is past the end of the file or the read limit is exceeded
+    const uint8_t * get(uint64_t offset, size_t size) {
+        if (size > IMAGE_INFO_BLOCK_SIZE)
+            return nullptr;
+        if (offset >= blockOffset && offset - blockOffset + size <= blockSize)
+            return block + (offset - blockOffset);
+        if (reads >= IMAGE_INFO_MAX_READS)
+            return nullptr;
+        reads++;
+        blockOffset = offset;
+        blockSize = readFunc(offset, block, IMAGE_INFO_BLOCK_SIZE);
+        if (blockSize > IMAGE_INFO_BLOCK_SIZE)
+            blockSize = 0;
+        return size <= blockSize ? block : nullptr;
+    }
+
+private:
+    const ImageReadFunc &readFunc;
+    uint8_t block[IMAGE_INFO_BLOCK_SIZE];
+    uint64_t blockOffset = 0;
+    size_t blockSize = 0;
+    int reads = 0;
+};
+
+uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+bool readPNG(const uint8_t *header, ImageInfo *info) {
+    // signature (8), IHDR length (4), "IHDR", width, height, bit depth, color type
+    if (memcmp(header + 12, "IHDR", 4))
+        return false;
+    info->format = IMAGE_FORMAT_PNG;
+    info->width = be32(header + 16);
+    info->height = be32(header + 20);
+    int channels;
+    switch (header[25]) {
+        case 0: channels = 1; break; // grayscale
+        case 2: channels = 3; break; // RGB
+        case 3: channels = 1; break; // palette
+        case 4: channels = 2; break; // grayscale + alpha
+        case 6: channels = 4; break; // RGBA
+        default: return false;
+    }
+    info->bitDepth = header[24] * channels;
+    return true;
+}
+
+bool readGIF(const uint8_t *header, ImageInfo *info) {
+    info->format = IMAGE_FORMAT_GIF;
+    info->width = le16(header + 6);
+    info->height = le16(header + 8);
+    uint8_t flags = header[10];
+    if (flags & 0x80) {
+        info->bitDepth = (flags & 7) + 1; // global color table size
+    } else {
+        info->bitDepth = ((flags >> 4) & 7) + 1; // color resolution
+    }
+    return true;
+}
+
+bool readBMP(const uint8_t *header, ImageInfo *info) {
+    uint32_t dibSize = le32(header + 14);
+    info->format = IMAGE_FORMAT_BMP;
+    if (dibSize == 12) { // BITMAPCOREHEADER
+        info->width = le16(header + 18);
+        info->height = le16(header + 20);
+        info->bitDepth = le16(header + 24);
+    } else if (dibSize >= 40) {
+        int32_t width = (int32_t)le32(header + 18);
+        int32_t height = (int32_t)le32(header + 22); // negative for top-down
+        if (width <= 0 || height == INT32_MIN)
+            return false;
+        info->width = (uint32_t)width;
+        info->height = (uint32_t)(height < 0 ? -height : height);
+        info->bitDepth = le16(header + 28);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parse a TIFF structure starting at base (the file start for TIFF, the Exif block for JPEG and
+// WebP). Only the first IFD is read.
+bool readTIFF(BlockReader &reader, uint64_t base, bool orientationOnly, ImageInfo *info) {
+    const uint8_t *header = reader.get(base, 8);
+    if (!header)
+        return false;
+    bool little;
+    if (!memcmp(header, "II*\0", 4)) {
+        little = true;
+    } else if (!memcmp(header, "MM\0*", 4)) {
+        little = false;
+    } else {
+        return false;
+    }
+    auto get16 = [little](const uint8_t *p) { return little ? le16(p) : be16(p); };
+    auto get32 = [little](const uint8_t *p) { return little ? le32(p) : be32(p); };
+
+    uint64_t ifd = base + get32(header + 4);
+    const uint8_t *countPtr = reader.get(ifd, 2);
+    if (!countPtr)
+        return false;
+    uint16_t count = get16(countPtr);
+    uint32_t width = 0, height = 0, bitsPerSample = 1, samplesPerPixel = 1;
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t *entry = reader.get(ifd + 2 + i * 12, 12);
+        if (!entry)
+            return false;
+        uint16_t tag = get16(entry), type = get16(entry + 2);
+        // SHORT values are left-aligned in the 4-byte value field
+        uint32_t value = (type == 3) ? get16(entry + 8) : get32(entry + 8);
+        if (type == 3 && tag == 258 && get32(entry + 4) > 2) {
+            // more than two BitsPerSample values are stored at an offset; assume they're equal
+            const uint8_t *bits = reader.get(base + get32(entry + 8), 2);
+            if (!bits)
+                return false;
+            value = get16(bits);
+        }
+        switch (tag) {
+            case 256: width = value; break;
+            case 257: height = value; break;
+            case 258: bitsPerSample = value; break;
+            case 274:
+                if (value >= 1 && value <= 8)
+                    info->orientation = (int)value;
+                break;
+            case 277: samplesPerPixel = value; break;
+        }
+    }
+    if (orientationOnly)
+        return true;
+    if (width == 0 || height == 0)
+        return false;
+    info->format = IMAGE_FORMAT_TIFF;
+    info->width = width;
+    info->height = height;
+    info->bitDepth = (int)(bitsPerSample * samplesPerPixel);
+    return true;
+}
+
+bool readJPEG(BlockReader &reader, ImageInfo *info) {
+    uint64_t pos = 2; // after SOI
+    while (true) {
+        const uint8_t *marker = reader.get(pos, 4);
+        if (!marker || marker[0] != 0xFF)
+            return false;
+        uint8_t type = marker[1];
+        if (type == 0xFF) { // fill byte
+            pos++;
+            continue;
+        }
+        if (type == 0x01 || (type >= 0xD0 && type <= 0xD7)) { // no length
+            pos += 2;
+            continue;
+        }
+        if (type == 0xD9 || type == 0xDA) // EOI or start of scan, no frame header found
+            return false;
+        uint16_t length = be16(marker + 2);
+        if (length < 2)
+            return false;
+        if (type == 0xE1 && length >= 16) {
+            const uint8_t *exif = reader.get(pos + 4, 6);
+            if (exif && !memcmp(exif, "Exif\0\0", 6))
+                readTIFF(reader, pos + 10, true, info); // orientation is optional
+        } else if (type >= 0xC0 && type <= 0xCF
+                && type != 0xC4 && type != 0xC8 && type != 0xCC) { // SOFn
+            const uint8_t *frame = reader.get(pos + 4, 6);
+            if (!frame)
+                return false;
+            info->format = IMAGE_FORMAT_JPEG;
+            info->height = be16(frame + 1);
+            info->width = be16(frame + 3);
+            info->bitDepth = frame[0] * frame[5]; // precision * components
+            return info->width != 0; // height may be defined later by DNL, but width can't
+        }
+        pos += 2 + length;
+    }
+}
+
+bool readWebP(BlockReader &reader, const uint8_t *header, ImageInfo *info) {
+    // RIFF header (12), chunk FourCC, chunk size, data
+    const uint8_t *data = header + 20;
+    if (!memcmp(header + 12, "VP8 ", 4)) {
+        // frame tag (3), start code
+        if (data[3] != 0x9D || data[4] != 0x01 || data[5] != 0x2A)
+            return false;
+        info->width = le16(data + 6) & 0x3FFF;
+        info->height = le16(data + 8) & 0x3FFF;
+        info->bitDepth = 24;
+    } else if (!memcmp(header + 12, "VP8L", 4)) {
+        if (data[0] != 0x2F)
+            return false;
+        uint32_t bits = le32(data + 1);
+        info->width = (bits & 0x3FFF) + 1;
+        info->height = ((bits >> 14) & 0x3FFF) + 1;
+        info->bitDepth = (bits & (1 << 28)) ? 32 : 24;
+    } else if (!memcmp(header + 12, "VP8X", 4)) {
+        uint8_t flags = data[0];
+        info->width = (le32(data + 4) & 0xFFFFFF) + 1;
+        info->height = (le32(data + 7) & 0xFFFFFF) + 1;
+        info->bitDepth = (flags & 0x10) ? 32 : 24;
+        if (flags & 0x08) { // has EXIF chunk, usually after the image data
+            uint64_t riffEnd = (uint64_t)le32(header + 4) + 8;
+            uint64_t pos = 12;
+            const uint8_t *chunk;
+            while (pos + 8 <= riffEnd && (chunk = reader.get(pos, 8)) != nullptr) {
+                uint32_t chunkSize = le32(chunk + 4);
+                if (!memcmp(chunk, "EXIF", 4)) {
+                    // some encoders include the JPEG APP1 identifier
+                    const uint8_t *exif = reader.get(pos + 8, 6);
+                    uint64_t tiff = pos + 8;
+                    if (exif && !memcmp(exif, "Exif\0\0", 6))
+                        tiff += 6;
+                    readTIFF(reader, tiff, true, info);
+                    break;
+                }
+                pos += 8 + chunkSize + (chunkSize & 1);
+            }
+        }
+    } else {
+        return false;
+    }
+    info->format = IMAGE_FORMAT_WEBP;
+    return true;
+}
+
+} // namespace
+
+bool ImageInfo::swapsAxes() const {
+    return orientation >= 5 && orientation <= 8;
+}
+
+uint32_t ImageInfo::displayWidth() const {
+    return swapsAxes() ? height : width;
+}
+
+uint32_t ImageInfo::displayHeight() const {
+    return swapsAxes() ? width : height;
+}
+
+bool readImageInfo(const ImageReadFunc &read, ImageInfo *info) {
+    *info = ImageInfo();
+    BlockReader reader(read);
+    // enough for every fixed-size header
+    const uint8_t *header = reader.get(0, 32);
+    bool result;
+    if (!header) {
+        result = false;
+    } else if (!memcmp(header, "\x89PNG\r\n\x1A\n", 8)) {
+        result = readPNG(header, info);
+    } else if (header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF) {
+        result = readJPEG(reader, info);
+    } else if (!memcmp(header, "GIF87a", 6) || !memcmp(header, "GIF89a", 6)) {
+        result = readGIF(header, info);
+    } else if (header[0] == 'B' && header[1] == 'M') {
+        result = readBMP(header, info);
+    } else if (!memcmp(header, "RIFF", 4) && !memcmp(header + 8, "WEBP", 4)) {
+        // copy because reading EXIF may replace the block
+        uint8_t webpHeader[32];
+        memcpy(webpHeader, header, sizeof(webpHeader));
+        result = readWebP(reader, webpHeader, info);
+    } else {
+        result = readTIFF(reader, 0, false, info);
+    }
+    if (!result || info->width == 0 || info->height == 0) {
+        *info = ImageInfo();
+        return false;
+    }
+    return true;
+}
+
+bool readImageInfo(const void *data, size_t size, ImageInfo *info) {
+    return readImageInfo([data, size](uint64_t offset, void *buffer, size_t readSize) -> size_t {
+        if (offset >= size)
+            return 0;
+        if (readSize > size - offset)
+            readSize = (size_t)(size - offset);
+        memcpy(buffer, (const uint8_t *)data + offset, readSize);
+        return readSize;
+    }, info);
+}
+
+bool isImageInfoExtension(const wchar_t *extension) {
+    static const wchar_t *const EXTENSIONS[] = {L".png", L".jpg", L".jpeg", L".jpe", L".jfif",
+        L".gif", L".bmp", L".dib", L".webp", L".tif", L".tiff"};
+    if (!extension)
+        return false;
+    for (const wchar_t *ext : EXTENSIONS) {
+        const wchar_t *a = ext, *b = extension;
+        while (*a && *b && *a == (wchar_t)towlower(*b)) {
+            a++;
+            b++;
+        }
+        if (!*a && !*b)
+            return true;
+    }
+    return false;
+}
+
+} // namespace
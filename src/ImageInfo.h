@@ -0,0 +1,44 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace chromafiler {
+
+enum ImageFormat {
+    IMAGE_FORMAT_UNKNOWN, IMAGE_FORMAT_PNG, IMAGE_FORMAT_JPEG, IMAGE_FORMAT_GIF, IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_WEBP, IMAGE_FORMAT_TIFF
+};
+
+struct ImageInfo {
+    ImageFormat format = IMAGE_FORMAT_UNKNOWN;
+    uint32_t width = 0, height = 0; // as stored, before orientation is applied
+    int bitDepth = 0; // bits per pixel, 0 if unknown
+    int orientation = 1; // EXIF orientation 1-8, 1 is upright
+
+    bool swapsAxes() const; // orientation is rotated by 90 degrees
+    // size as displayed, after orientation is applied
+    uint32_t displayWidth() const;
+    uint32_t displayHeight() const;
+};
+
+// Maximum size of a single read, and the maximum number of reads for one file. Most headers are
+// parsed from the first block; JPEG and TIFF may need to seek past segments or follow offsets.
+const size_t IMAGE_INFO_BLOCK_SIZE = 4096;
+const int IMAGE_INFO_MAX_READS = 8;
+
+// Reads up to size bytes at offset, returns the number of bytes read (less than size at EOF)
+typedef std::function<size_t(uint64_t offset, void *buffer, size_t size)> ImageReadFunc;
+
+// Parse dimensions, bit depth and orientation from the header of a PNG, JPEG, GIF, BMP, WebP or
+// TIFF file without decoding any pixels. Returns false if the format is not recognized or the
+// header is invalid.
+bool readImageInfo(const ImageReadFunc &read, ImageInfo *info);
+bool readImageInfo(const void *data, size_t size, ImageInfo *info);
+// eg. L".png", case-insensitive. Other files may still be parsed (format is detected from the
+// contents) but this avoids opening files which are unlikely to be supported.
+bool isImageInfoExtension(const wchar_t *extension);
+
+} // namespace
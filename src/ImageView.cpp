@@ -0,0 +1,771 @@
+#include "ImageView.h"
+#include "GeomUtils.h"
+#include "WinUtils.h"
+#include "PixelOps.h"
+#include "ImageInfo.h"
+#include "ThumbnailCache.h"
+#include "Animation.h"
+#include "PreviewWindow.h"
+#include "Resample.h"
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <string>
+#include <utility>
+#include <windowsx.h>
+#include <shlobj.h>
+#include <propkey.h>
+#include <shlwapi.h>
+
+namespace chromafiler {
+
+const wchar_t IMAGE_VIEW_CLASS[] = L"ChromaFiler Image";
+
+const int TILE_SIZE = 256;
+const size_t TILE_CACHE_SIZE = 256 << 20; // shared by all images
+// the first level up to this size is decoded all at once, which is much faster than tile by tile,
+// and the smaller levels are reduced from it
+const int64_t FULL_DECODE_PIXELS = 2048 * 2048;
+// images that can't be read from a file stream are decoded into memory all at once, so larger
+// ones are left to ThumbnailView
+const uint64_t MAX_MEMORY_DECODE_BYTES = TILE_CACHE_SIZE / 2;
+const double ZOOM_STEP = 1.25; // per mouse wheel notch
+const double MAX_SCALE = 32;
+const size_t MAX_SHARED_IMAGES = 64;
+
+static ClassFactoryImpl<ImageView, false> factory;
+static DWORD regCookie = 0;
+static CComPtr<WorkerPool> tilePool;
+static volatile LONG nextImageID = 0;
+
+static SRWLOCK tileCacheLock = SRWLOCK_INIT;
+static TileCache tileCache(TILE_CACHE_SIZE);
+
+struct SharedImage {
+    ThumbnailKey key; // identifies the file version and background, size bucket is unused
+    uint32_t id;
+};
+static SRWLOCK sharedImagesLock = SRWLOCK_INIT;
+static std::list<SharedImage> sharedImages; // most recently used first
+
+static SRWLOCK decodableLock = SRWLOCK_INIT;
+static bool decodableLoaded = false;
+static std::vector<std::wstring> decodableExtensions;
+
+void ImageView::init() {
+    WNDCLASS imageClass = {};
+    imageClass.lpfnWndProc = windowProc;
+    imageClass.hInstance = GetModuleHandle(nullptr);
+    imageClass.lpszClassName = IMAGE_VIEW_CLASS;
+    imageClass.style = CS_HREDRAW | CS_VREDRAW | CS_DBLCLKS;
+    imageClass.hCursor = LoadCursor(nullptr, IDC_ARROW);
+    RegisterClass(&imageClass);
+
+    // each image decodes one tile at a time, so this is how many images can load in parallel
+    tilePool.Attach(new WorkerPool(2));
+    tilePool->start();
+
+    checkHR(CoRegisterClassObject(CLSID_ImageView, &factory,
+        CLSCTX_LOCAL_SERVER, REGCLS_MULTIPLEUSE, &regCookie));
+}
+
+void ImageView::uninit() {
+    checkHR(CoRevokeClassObject(regCookie));
+    tilePool->shutdown();
+}
+
+static void loadDecodableExtensions() {
+    CComPtr<IWICImagingFactory> wicFactory;
+    CComPtr<IEnumUnknown> components;
+    if (!checkHR(wicFactory.CoCreateInstance(CLSID_WICImagingFactory))
+            || !checkHR(wicFactory->CreateComponentEnumerator(
+                WICDecoder, WICComponentEnumerateDefault, &components)))
+        return;
+    CComPtr<IUnknown> component;
+    while (components->Next(1, &component, nullptr) == S_OK) {
+        CComQIPtr<IWICBitmapCodecInfo> codecInfo(component);
+        component.Release();
+        UINT length = 0;
+        if (!codecInfo || FAILED(codecInfo->GetFileExtensions(0, nullptr, &length)) || !length)
+            continue;
+        wstr_ptr extensions(new wchar_t[length]);
+        if (FAILED(codecInfo->GetFileExtensions(length, extensions.get(), &length)))
+            continue;
+        // comma-separated, eg. ".jpeg,.jpe,.jpg"
+        wchar_t *start = extensions.get();
+        for (wchar_t *c = start; ; c++) {
+            if (*c == L',' || *c == 0) {
+                if (c != start)
+                    decodableExtensions.emplace_back(start, c - start);
+                if (*c == 0)
+                    break;
+                start = c + 1;
+            }
+        }
+    }
+}
+
+bool ImageView::canDecode(const wchar_t *extension) {
+    AcquireSRWLockExclusive(&decodableLock);
+    if (!decodableLoaded) {
+        loadDecodableExtensions();
+        decodableLoaded = true;
+    }
+    bool found = false;
+    for (auto &decodable : decodableExtensions) {
+        if (_wcsicmp(decodable.c_str(), extension) == 0) {
+            found = true;
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&decodableLock);
+    return found;
+}
+
+// files with a known modification time get the same image ID in every view and prefetch, so
+// their tiles can be reused. returns 0 if the item can't be identified
+static uint32_t sharedImageID(IShellItem *item) {
+    ThumbnailKey key;
+    if (!getThumbnailKey(item, 0, &key) || key.modified == 0)
+        return 0;
+    uint32_t id = 0;
+    AcquireSRWLockExclusive(&sharedImagesLock);
+    for (auto it = sharedImages.begin(); it != sharedImages.end(); it++) {
+        if (it->key == key) {
+            id = it->id;
+            sharedImages.splice(sharedImages.begin(), sharedImages, it);
+            break;
+        }
+    }
+    if (!id) {
+        id = (uint32_t)InterlockedIncrement(&nextImageID);
+        sharedImages.push_front({key, id});
+        if (sharedImages.size() > MAX_SHARED_IMAGES)
+            sharedImages.pop_back(); // its tiles age out of the tile cache
+    }
+    ReleaseSRWLockExclusive(&sharedImagesLock);
+    return id;
+}
+
+size_t ImageView::prefetchImage(IShellItem *const item) {
+    uint32_t image = sharedImageID(item);
+    if (!image)
+        return 0; // a view couldn't find the tiles
+    CComPtr<TileLoader> prefetchLoader;
+    prefetchLoader.Attach(new TileLoader(item, nullptr));
+    return prefetchLoader->prefetch(image);
+}
+
+ImageView::~ImageView() {
+    if (!sharedImage) { // otherwise tiles are kept for other views until they're evicted
+        AcquireSRWLockExclusive(&tileCacheLock);
+        tileCache.removeImage(imageID);
+        ReleaseSRWLockExclusive(&tileCacheLock);
+    }
+}
+
+const wchar_t * ImageView::className() const {
+    return IMAGE_VIEW_CLASS;
+}
+
+LRESULT ImageView::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
+    switch (message) {
+        case WM_CREATE:
+            imageID = sharedImageID(item);
+            sharedImage = imageID != 0;
+            if (!sharedImage)
+                imageID = (uint32_t)InterlockedIncrement(&nextImageID);
+            loader.Attach(new TileLoader(item, this));
+            tilePool->submit(loader, 0); // opens the image
+            return 0;
+        case WM_DESTROY:
+            tilePool->cancel(loader);
+            loader->stop();
+            return 0;
+        case WM_SIZE:
+            if (pyramid) {
+                if (fit)
+                    scale = fitScale();
+                setScroll(scrollX, scrollY);
+            }
+            return 0;
+        case WM_ERASEBKGND:
+            return 1; // painted with double buffering
+        case WM_PAINT:
+            PAINTSTRUCT paint;
+            BeginPaint(hwnd, &paint);
+            onPaint(paint);
+            EndPaint(hwnd, &paint);
+            return 0;
+        case WM_MOUSEWHEEL:
+            if (pyramid) {
+                POINT pos = screenToClient(hwnd, {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)});
+                double steps = (double)GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA;
+                setScale(scale * pow(ZOOM_STEP, steps), pos);
+            }
+            return 0;
+        case WM_LBUTTONDOWN:
+            SetFocus(hwnd);
+            SetCapture(hwnd);
+            dragging = true;
+            dragPos = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
+            return 0;
+        case WM_MOUSEMOVE:
+            if (dragging && pyramid) {
+                POINT pos = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
+                setScroll(scrollX - (pos.x - dragPos.x), scrollY - (pos.y - dragPos.y));
+                dragPos = pos;
+            }
+            return 0;
+        case WM_LBUTTONUP:
+            ReleaseCapture();
+            return 0;
+        case WM_CAPTURECHANGED:
+            dragging = false;
+            InvalidateRect(hwnd, nullptr, FALSE); // redraw at full quality
+            return 0;
+        case WM_LBUTTONDBLCLK:
+            // toggle between fit to window and actual size
+            if (pyramid) {
+                if (fit || scale < 1) {
+                    setScale(1, {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)});
+                } else {
+                    fit = true;
+                    scale = fitScale();
+                    setScroll(0, 0);
+                }
+            }
+            return 0;
+        case MSG_IMAGE_OPENED:
+            imageSize = loader->getImageSize();
+            pyramid = std::make_unique<TilePyramid>(imageSize.cx, imageSize.cy, TILE_SIZE);
+            fit = true;
+            scale = fitScale();
+            setScroll(0, 0);
+            return 0;
+        case MSG_TILE_LOADED:
+            InvalidateRect(hwnd, nullptr, FALSE);
+            return 0;
+        case MSG_USE_THUMBNAIL_VIEW:
+            PreviewWindow::useThumbnailView(hwnd); // which can play it or show it downscaled
+            return 0;
+    }
+    return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+double ImageView::fitScale() const {
+    SIZE size = clientSize(hwnd);
+    if (imageSize.cx <= 0 || imageSize.cy <= 0 || size.cx <= 0 || size.cy <= 0)
+        return 1;
+    return min((double)size.cx / imageSize.cx, (double)size.cy / imageSize.cy);
+}
+
+void ImageView::setScale(double newScale, POINT anchor) {
+    newScale = max(min(fitScale(), 1.0), min(newScale, MAX_SCALE));
+    double imageX = (anchor.x + scrollX) / scale, imageY = (anchor.y + scrollY) / scale;
+    scale = newScale;
+    fit = false;
+    setScroll(imageX * scale - anchor.x, imageY * scale - anchor.y);
+}
+
+void ImageView::setScroll(double x, double y) {
+    SIZE size = clientSize(hwnd);
+    double width = imageSize.cx * scale, height = imageSize.cy * scale;
+    // center the image if it's smaller than the window
+    scrollX = width <= size.cx ? (width - size.cx) / 2 : max(0.0, min(x, width - size.cx));
+    scrollY = height <= size.cy ? (height - size.cy) / 2 : max(0.0, min(y, height - size.cy));
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+RECT ImageView::tileDisplayRect(int level, const TileRect &rect) const {
+    // levels are rounded up, so they don't scale by exactly 1/2^level
+    double xScale = scale * imageSize.cx / pyramid->levelWidth(level);
+    double yScale = scale * imageSize.cy / pyramid->levelHeight(level);
+    return {(LONG)floor(rect.left * xScale - scrollX), (LONG)floor(rect.top * yScale - scrollY),
+        (LONG)floor(rect.right * xScale - scrollX), (LONG)floor(rect.bottom * yScale - scrollY)};
+}
+
+static void drawTile(HDC hdc, const Tile &tile, const RECT &dest) {
+    BITMAPINFO info = {};
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = tile.width;
+    info.bmiHeader.biHeight = -tile.height; // top-down
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    StretchDIBits(hdc, dest.left, dest.top, rectWidth(dest), rectHeight(dest),
+        0, 0, tile.width, tile.height, tile.pixels.get(), &info, DIB_RGB_COLORS, SRCCOPY);
+}
+
+bool ImageView::paintTile(HDC hdc, const TileKey &key) {
+    RECT dest = tileDisplayRect(key.level, pyramid->tileRect(key.level, key.x, key.y));
+    for (int level = key.level; level < pyramid->levelCount(); level++) {
+        int shift = level - key.level;
+        TileKey sourceKey = {key.image, level, key.x >> shift, key.y >> shift};
+        std::shared_ptr<const Tile> tile = tileCache.find(sourceKey);
+        if (!tile)
+            continue;
+        RECT sourceDest = tileDisplayRect(level,
+            pyramid->tileRect(level, sourceKey.x, sourceKey.y));
+        if (level == key.level) {
+            drawTile(hdc, *tile, sourceDest);
+            return true;
+        }
+        // stretch the lower resolution tile, only where this tile would be
+        int saved = SaveDC(hdc);
+        IntersectClipRect(hdc, dest.left, dest.top, dest.right, dest.bottom);
+        drawTile(hdc, *tile, sourceDest);
+        RestoreDC(hdc, saved);
+        return false;
+    }
+    return false;
+}
+
+void ImageView::onPaint(PAINTSTRUCT paint) {
+    SIZE size = clientSize(hwnd);
+    HDC hdcBuffer = CreateCompatibleDC(paint.hdc);
+    HBITMAP buffer = CreateCompatibleBitmap(paint.hdc, size.cx, size.cy);
+    HBITMAP oldBitmap = SelectBitmap(hdcBuffer, buffer);
+    FillRect(hdcBuffer, tempPtr(RECT{0, 0, size.cx, size.cy}), (HBRUSH)(COLOR_WINDOW + 1));
+
+    if (pyramid) {
+        // halftone is too slow to keep up with dragging
+        SetStretchBltMode(hdcBuffer, dragging ? COLORONCOLOR : HALFTONE);
+        int level = pyramid->levelForScale(scale);
+        TileRect view = {(int)floor(scrollX / scale), (int)floor(scrollY / scale),
+            (int)ceil((scrollX + size.cx) / scale), (int)ceil((scrollY + size.cy) / scale)};
+        pyramid->visibleTiles(level, view, imageID, &visibleTiles);
+
+        std::vector<TileKey> missing;
+        // the lowest resolution level covers everything until the rest is loaded
+        TileKey lowest = {imageID, pyramid->levelCount() - 1, 0, 0};
+        AcquireSRWLockExclusive(&tileCacheLock);
+        if (!tileCache.contains(lowest))
+            missing.push_back(lowest);
+        for (auto &key : visibleTiles) {
+            if (!paintTile(hdcBuffer, key))
+                missing.push_back(key);
+        }
+        ReleaseSRWLockExclusive(&tileCacheLock);
+        if (!missing.empty()) {
+            loader->requestTiles(missing);
+            tilePool->submit(loader, 0);
+        }
+    }
+
+    BitBlt(paint.hdc, 0, 0, size.cx, size.cy, hdcBuffer, 0, 0, SRCCOPY);
+    SelectBitmap(hdcBuffer, oldBitmap);
+    DeleteBitmap(buffer);
+    DeleteDC(hdcBuffer);
+}
+
+ImageView::TileLoader::TileLoader(IShellItem *const item, ImageView *const callbackWindow)
+        : callbackWindow(callbackWindow) {
+    checkHR(SHGetIDListFromObject(item, &itemIDList));
+}
+
+void ImageView::TileLoader::requestTiles(const std::vector<TileKey> &tiles) {
+    AcquireSRWLockExclusive(&requestLock);
+    requestedTiles = tiles;
+    ReleaseSRWLockExclusive(&requestLock);
+}
+
+void ImageView::TileLoader::stop() {
+    AcquireSRWLockExclusive(&stopLock);
+    stopped = true;
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+SIZE ImageView::TileLoader::getImageSize() {
+    AcquireSRWLockExclusive(&requestLock);
+    SIZE size = imageSize;
+    ReleaseSRWLockExclusive(&requestLock);
+    return size;
+}
+
+void ImageView::TileLoader::postToWindow(UINT message) {
+    // ensure the window is not closed before the message is posted
+    AcquireSRWLockExclusive(&stopLock);
+    if (!stopped)
+        PostMessage(callbackWindow->hwnd, message, 0, 0);
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+void ImageView::TileLoader::run() {
+    if (failed || stopped)
+        return;
+    if (!source) {
+        if (!open()) {
+            failed = true;
+            if (useThumbnail)
+                postToWindow(MSG_USE_THUMBNAIL_VIEW);
+            return;
+        }
+        postToWindow(MSG_IMAGE_OPENED); // window will request tiles when it paints
+        return;
+    }
+
+    // one tile per task, so other images get a turn
+    while (true) {
+        TileKey key;
+        AcquireSRWLockExclusive(&requestLock);
+        bool empty = requestedTiles.empty();
+        if (!empty) {
+            key = requestedTiles.front();
+            requestedTiles.erase(requestedTiles.begin());
+        }
+        ReleaseSRWLockExclusive(&requestLock);
+        if (empty)
+            return;
+
+        AcquireSRWLockShared(&tileCacheLock);
+        bool cached = tileCache.contains(key);
+        ReleaseSRWLockShared(&tileCacheLock);
+        if (!cached) {
+            if (decodeTile(key))
+                postToWindow(MSG_TILE_LOADED);
+            tilePool->submit(this, 0);
+            return;
+        }
+    }
+}
+
+// position in the stored image of the pixel displayed at (x, y) for an EXIF orientation (1-8).
+// width and height are the stored size
+static POINT orientedToStored(int orientation, int x, int y, int width, int height) {
+    switch (orientation) {
+        case 2: return {width - 1 - x, y}; // flip horizontal
+        case 3: return {width - 1 - x, height - 1 - y}; // rotate 180
+        case 4: return {x, height - 1 - y}; // flip vertical
+        case 5: return {y, x}; // transpose
+        case 6: return {y, height - 1 - x}; // rotate 90 clockwise
+        case 7: return {width - 1 - y, height - 1 - x}; // transverse
+        case 8: return {width - 1 - y, x}; // rotate 270 clockwise
+        default: return {x, y};
+    }
+}
+
+static bool isTransposed(int orientation) {
+    return orientation >= 5 && orientation <= 8;
+}
+
+// rotate and flip stored pixels to display them upright. dest has the stored size, swapped if
+// the orientation is transposed
+static void orientPixels(const uint32_t *stored, int width, int height, int orientation,
+        uint32_t *dest) {
+    int destWidth = isTransposed(orientation) ? height : width;
+    int destHeight = isTransposed(orientation) ? width : height;
+    for (int y = 0; y < destHeight; y++) {
+        for (int x = 0; x < destWidth; x++) {
+            POINT p = orientedToStored(orientation, x, y, width, height);
+            *dest++ = stored[(size_t)p.y * width + p.x];
+        }
+    }
+}
+
+// same header parsing as the status bar, so the reported size always matches the display
+static int readOrientation(const wchar_t *type, IStream *stream) {
+    if (!isImageInfoExtension(type))
+        return 1;
+    ImageInfo info;
+    bool found = readImageInfo([stream](uint64_t offset, void *buffer, size_t size) {
+        LARGE_INTEGER move;
+        move.QuadPart = (LONGLONG)offset;
+        ULONG read = 0;
+        if (FAILED(stream->Seek(move, STREAM_SEEK_SET, nullptr))
+                || FAILED(stream->Read(buffer, (ULONG)size, &read)))
+            return (size_t)0;
+        return (size_t)read;
+    }, &info);
+    LARGE_INTEGER zero = {};
+    if (FAILED(stream->Seek(zero, STREAM_SEEK_SET, nullptr)))
+        return 1;
+    return found ? info.orientation : 1;
+}
+
+// animated PNGs are routed here by extension, since the file can't be read on the UI thread
+static bool isAnimated(const wchar_t *type, IStream *stream) {
+    if (_wcsicmp(type, L".png") != 0)
+        return false;
+    uint8_t header[IMAGE_INFO_BLOCK_SIZE];
+    ULONG read = 0;
+    bool animated = SUCCEEDED(stream->Read(header, sizeof(header), &read))
+        && isAnimatedPNG(header, read);
+    LARGE_INTEGER zero = {};
+    return SUCCEEDED(stream->Seek(zero, STREAM_SEEK_SET, nullptr)) && animated;
+}
+
+bool ImageView::TileLoader::open() {
+    CComPtr<IShellItem> item;
+    CComPtr<IStream> stream;
+    CComPtr<IWICBitmapDecoder> decoder;
+    CComPtr<IWICBitmapFrameDecode> frame;
+    CComPtr<IWICFormatConverter> converter;
+    if (!itemIDList || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item))))
+        return false;
+    // the decoder keeps reading from the stream as tiles are decoded, on whichever pool thread
+    // runs the task. a file stream only wraps a handle so it can be used from any thread, but
+    // a BHID_Stream from a shell folder may belong to this thread's apartment
+    CComHeapPtr<wchar_t> path;
+    bool agile = SUCCEEDED(item->GetDisplayName(SIGDN_FILESYSPATH, &path))
+        && SUCCEEDED(SHCreateStreamOnFileEx(path, STGM_READ | STGM_SHARE_DENY_NONE,
+            FILE_ATTRIBUTE_NORMAL, FALSE, nullptr, &stream));
+    if (!agile && !checkHR(item->BindToHandler(nullptr, BHID_Stream, IID_PPV_ARGS(&stream))))
+        return false;
+    CComQIPtr<IShellItem2> item2(item);
+    CComHeapPtr<wchar_t> type; // null if unknown
+    if (item2)
+        item2->GetString(PKEY_ItemType, &type);
+    if (type && isAnimated(type, stream)) {
+        useThumbnail = true;
+        return false;
+    }
+    orientation = type ? readOrientation(type, stream) : 1;
+    if (!checkHR(factory.CoCreateInstance(CLSID_WICImagingFactory))
+            || !checkHR(factory->CreateDecoderFromStream(stream, nullptr,
+                WICDecodeMetadataCacheOnDemand, &decoder))
+            || !checkHR(decoder->GetFrame(0, &frame))
+            || !checkHR(factory->CreateFormatConverter(&converter))
+            || !checkHR(converter->Initialize(frame, GUID_WICPixelFormat32bppBGRA,
+                WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom)))
+        return false;
+    UINT width, height;
+    if (!checkHR(converter->GetSize(&width, &height)) || width == 0 || height == 0
+            || width > INT_MAX / 2 || height > INT_MAX / 2)
+        return false;
+    if (!agile) {
+        if ((uint64_t)width * height * 4 > MAX_MEMORY_DECODE_BYTES) {
+            useThumbnail = true;
+            return false;
+        }
+        // decode everything now so the stream isn't used after this task returns
+        CComPtr<IWICBitmap> bitmap;
+        if (!checkHR(factory->CreateBitmapFromSource(converter, WICBitmapCacheOnLoad, &bitmap)))
+            return false;
+        source = bitmap;
+    } else {
+        source = converter;
+        frame->QueryInterface(IID_PPV_ARGS(&sourceTransform)); // optional
+    }
+    if (isTransposed(orientation))
+        std::swap(width, height);
+    pyramid = std::make_unique<TilePyramid>((int)width, (int)height, TILE_SIZE);
+    firstSmallLevel = 0;
+    while (firstSmallLevel < pyramid->levelCount() - 1
+            && (int64_t)pyramid->levelWidth(firstSmallLevel)
+                * pyramid->levelHeight(firstSmallLevel) > FULL_DECODE_PIXELS)
+        firstSmallLevel++;
+    AcquireSRWLockExclusive(&requestLock);
+    imageSize = {(LONG)width, (LONG)height};
+    ReleaseSRWLockExclusive(&requestLock);
+    return true;
+}
+
+size_t ImageView::TileLoader::prefetch(uint32_t image) {
+    if (!open())
+        return 0;
+    TileKey key = {image, pyramid->levelCount() - 1, 0, 0}; // a single tile
+    AcquireSRWLockShared(&tileCacheLock);
+    bool cached = tileCache.contains(key);
+    ReleaseSRWLockShared(&tileCacheLock);
+    if (cached || !decodeTile(key))
+        return 0;
+    size_t bytes = 0; // every small level is decoded along with the last one
+    for (int level = firstSmallLevel; level < pyramid->levelCount(); level++)
+        bytes += (size_t)pyramid->levelWidth(level) * pyramid->levelHeight(level) * 4;
+    return bytes;
+}
+
+static std::shared_ptr<Tile> createTile(int width, int height) {
+    auto tile = std::make_shared<Tile>();
+    tile->width = width;
+    tile->height = height;
+    tile->pixels.reset(new uint32_t[(size_t)width * height]);
+    return tile;
+}
+
+static uint32_t backgroundPixel() {
+    COLORREF bg = GetSysColor(COLOR_WINDOW); // matches onPaint background
+    return (GetRValue(bg) << 16) | (GetGValue(bg) << 8) | GetBValue(bg);
+}
+
+std::shared_ptr<const Tile> ImageView::TileLoader::loadTile(const TileKey &key) {
+    AcquireSRWLockExclusive(&tileCacheLock);
+    std::shared_ptr<const Tile> tile = tileCache.find(key);
+    ReleaseSRWLockExclusive(&tileCacheLock);
+    return tile ? tile : decodeTile(key);
+}
+
+std::shared_ptr<const Tile> ImageView::TileLoader::decodeTile(const TileKey &key) {
+    if (key.level >= firstSmallLevel)
+        return decodeSmallLevels(key);
+    if (key.level > 0)
+        return downscaleTiles(key);
+
+    TileRect rect = pyramid->tileRect(0, key.x, key.y);
+    auto tile = createTile(rect.right - rect.left, rect.bottom - rect.top);
+    if (!decodeStoredRect(rect, tile->pixels.get()))
+        return nullptr;
+    compositeOnColor((uint8_t *)tile->pixels.get(), tile->width, tile->height,
+        tile->width * 4, backgroundPixel());
+    AcquireSRWLockExclusive(&tileCacheLock);
+    tileCache.insert(key, tile);
+    ReleaseSRWLockExclusive(&tileCacheLock);
+    return tile;
+}
+
+bool ImageView::TileLoader::decodeStoredRect(const TileRect &rect, uint32_t *pixels) {
+    int width = rect.right - rect.left, height = rect.bottom - rect.top;
+    UINT bytes = (UINT)width * height * 4;
+    if (orientation == 1) {
+        WICRect wicRect = {rect.left, rect.top, width, height};
+        return checkHR(source->CopyPixels(&wicRect, width * 4, bytes, (BYTE *)pixels));
+    }
+    // read the stored rows covering the rect and orient them here, a flip rotator would buffer
+    // the whole image to rotate it
+    UINT storedWidth, storedHeight;
+    if (!checkHR(source->GetSize(&storedWidth, &storedHeight)))
+        return false;
+    POINT a = orientedToStored(orientation, rect.left, rect.top,
+        (int)storedWidth, (int)storedHeight);
+    POINT b = orientedToStored(orientation, rect.right - 1, rect.bottom - 1,
+        (int)storedWidth, (int)storedHeight);
+    WICRect wicRect = {(INT)min(a.x, b.x), (INT)min(a.y, b.y),
+        (INT)(max(a.x, b.x) - min(a.x, b.x) + 1), (INT)(max(a.y, b.y) - min(a.y, b.y) + 1)};
+    std::unique_ptr<uint32_t[]> stored(new uint32_t[(size_t)width * height]);
+    if (!checkHR(source->CopyPixels(&wicRect, wicRect.Width * 4, bytes, (BYTE *)stored.get())))
+        return false;
+    orientPixels(stored.get(), wicRect.Width, wicRect.Height, orientation, pixels);
+    return true;
+}
+
+std::shared_ptr<const Tile> ImageView::TileLoader::downscaleTiles(const TileKey &key) {
+    int finer = key.level - 1, size = pyramid->tileSize();
+    TileRect rect = pyramid->tileRect(key.level, key.x, key.y);
+    int finerWidth = min(rect.right * 2, pyramid->levelWidth(finer)) - rect.left * 2;
+    int finerHeight = min(rect.bottom * 2, pyramid->levelHeight(finer)) - rect.top * 2;
+    BoxDownscaler scaler(finerWidth, finerHeight, rect.right - rect.left, rect.bottom - rect.top);
+    std::unique_ptr<uint32_t[]> row(new uint32_t[finerWidth]);
+    for (int ty = 0; ty < 2 && key.y * 2 + ty < pyramid->tilesDown(finer); ty++) {
+        std::shared_ptr<const Tile> tiles[2];
+        for (int tx = 0; tx < 2 && key.x * 2 + tx < pyramid->tilesAcross(finer); tx++) {
+            tiles[tx] = loadTile({key.image, finer, key.x * 2 + tx, key.y * 2 + ty});
+            if (!tiles[tx])
+                return nullptr;
+        }
+        for (int y = 0; y < tiles[0]->height; y++) {
+            memcpy(row.get(), tiles[0]->pixels.get() + (size_t)y * tiles[0]->width,
+                tiles[0]->width * 4);
+            if (tiles[1]) {
+                memcpy(row.get() + tiles[0]->width,
+                    tiles[1]->pixels.get() + (size_t)y * tiles[1]->width, tiles[1]->width * 4);
+            }
+            scaler.addRow(ty * size + y, (const uint8_t *)row.get());
+        }
+    }
+    auto tile = createTile(rect.right - rect.left, rect.bottom - rect.top);
+    scaler.finish((uint8_t *)tile->pixels.get(), tile->width * 4);
+    AcquireSRWLockExclusive(&tileCacheLock);
+    tileCache.insert(key, tile);
+    ReleaseSRWLockExclusive(&tileCacheLock);
+    return tile;
+}
+
+std::shared_ptr<const Tile> ImageView::TileLoader::decodeSmallLevels(const TileKey &key) {
+    int level = firstSmallLevel;
+    int width = pyramid->levelWidth(level), height = pyramid->levelHeight(level);
+    std::unique_ptr<uint32_t[]> pixels(new uint32_t[(size_t)width * height]);
+    if (orientation == 1) {
+        if (!decodeReduced(width, height, pixels.get()))
+            return nullptr;
+    } else {
+        std::unique_ptr<uint32_t[]> stored(new uint32_t[(size_t)width * height]);
+        int storedWidth = isTransposed(orientation) ? height : width;
+        int storedHeight = isTransposed(orientation) ? width : height;
+        if (!decodeReduced(storedWidth, storedHeight, stored.get()))
+            return nullptr;
+        orientPixels(stored.get(), storedWidth, storedHeight, orientation, pixels.get());
+    }
+    compositeOnColor((uint8_t *)pixels.get(), width, height, width * 4, backgroundPixel());
+
+    std::shared_ptr<const Tile> keyTile;
+    while (true) {
+        AcquireSRWLockExclusive(&tileCacheLock);
+        for (int y = 0; y < pyramid->tilesDown(level); y++) {
+            for (int x = 0; x < pyramid->tilesAcross(level); x++) {
+                TileRect rect = pyramid->tileRect(level, x, y);
+                auto tile = createTile(rect.right - rect.left, rect.bottom - rect.top);
+                for (int row = 0; row < tile->height; row++) {
+                    memcpy(tile->pixels.get() + (size_t)row * tile->width,
+                        pixels.get() + (size_t)(rect.top + row) * width + rect.left,
+                        tile->width * 4);
+                }
+                tileCache.insert({key.image, level, x, y}, tile);
+                if (level == key.level && x == key.x && y == key.y)
+                    keyTile = tile;
+            }
+        }
+        ReleaseSRWLockExclusive(&tileCacheLock);
+        if (++level >= pyramid->levelCount())
+            return keyTile;
+
+        // each level is reduced from the one before it rather than decoded again
+        int nextWidth = pyramid->levelWidth(level), nextHeight = pyramid->levelHeight(level);
+        BoxDownscaler scaler(width, height, nextWidth, nextHeight);
+        for (int y = 0; y < height; y++)
+            scaler.addRow(y, (const uint8_t *)(pixels.get() + (size_t)y * width));
+        width = nextWidth;
+        height = nextHeight;
+        pixels.reset(new uint32_t[(size_t)width * height]);
+        scaler.finish((uint8_t *)pixels.get(), width * 4);
+    }
+}
+
+bool ImageView::TileLoader::decodeReduced(int width, int height, uint32_t *pixels) {
+    CComPtr<IWICBitmapSource> reduced = source;
+    UINT storedWidth, storedHeight, closestWidth = width, closestHeight = height;
+    if (!checkHR(source->GetSize(&storedWidth, &storedHeight)))
+        return false;
+    // eg. JPEG can decode at 1/2, 1/4 or 1/8 scale for much less than the cost of a full decode
+    if (sourceTransform && (UINT)width < storedWidth
+            && SUCCEEDED(sourceTransform->GetClosestSize(&closestWidth, &closestHeight))
+            && closestWidth >= (UINT)width && closestHeight >= (UINT)height
+            && closestWidth < storedWidth) {
+        WICPixelFormatGUID format = GUID_WICPixelFormat32bppBGRA;
+        CComPtr<IWICBitmap> bitmap;
+        CComPtr<IWICFormatConverter> converter;
+        bool decoded = false;
+        if (SUCCEEDED(sourceTransform->GetClosestPixelFormat(&format))
+                && checkHR(factory->CreateBitmap(closestWidth, closestHeight, format,
+                    WICBitmapCacheOnLoad, &bitmap))) {
+            CComPtr<IWICBitmapLock> lock;
+            UINT stride, size;
+            BYTE *data;
+            decoded = checkHR(bitmap->Lock(nullptr, WICBitmapLockWrite, &lock))
+                && checkHR(lock->GetStride(&stride))
+                && checkHR(lock->GetDataPointer(&size, &data))
+                && checkHR(sourceTransform->CopyPixels(nullptr, closestWidth, closestHeight,
+                    &format, WICBitmapTransformRotate0, stride, size, data));
+        } // unlocked
+        if (decoded && checkHR(factory->CreateFormatConverter(&converter))
+                && checkHR(converter->Initialize(bitmap, GUID_WICPixelFormat32bppBGRA,
+                    WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom)))
+            reduced = converter;
+    }
+    UINT reducedWidth, reducedHeight;
+    if (!checkHR(reduced->GetSize(&reducedWidth, &reducedHeight)))
+        return false;
+    if (reducedWidth != (UINT)width || reducedHeight != (UINT)height) {
+        CComPtr<IWICBitmapScaler> scaler;
+        if (!checkHR(factory->CreateBitmapScaler(&scaler))
+                || !checkHR(scaler->Initialize(reduced, width, height,
+                    WICBitmapInterpolationModeFant)))
+            return false;
+        reduced = scaler;
+    }
+    return checkHR(reduced->CopyPixels(nullptr, width * 4, (UINT)width * height * 4,
+        (BYTE *)pixels));
+}
+
+} // namespace
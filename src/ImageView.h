@@ -0,0 +1,112 @@
+#pragma once
+#include <common.h>
+
+#include "PreviewHandler.h"
+#include "TileCache.h"
+#include "WorkerPool.h"
+#include <memory>
+#include <vector>
+#include <wincodec.h>
+
+namespace chromafiler {
+
+// {dcbc7d79-23db-4717-ac09-47de487e6154}
+const CLSID CLSID_ImageView =
+    {0xdcbc7d79, 0x23db, 0x4717, {0xac, 0x09, 0x47, 0xde, 0x48, 0x7e, 0x61, 0x54}};
+// Zoomable image viewer for anything WIC can decode. The image is divided into a mipmap pyramid
+// of tiles (see TilePyramid) which are decoded on demand on worker threads, so very large
+// images open quickly and only the visible part is kept in memory.
+class ImageView : public PreviewHandlerImpl {
+public:
+    static void init();
+    static void uninit();
+    static bool canDecode(const wchar_t *extension); // eg. L".png", thread-safe
+    // decode the lowest levels of the pyramid into the tile cache, so they can be shown as soon
+    // as a view opens the item. returns the number of bytes added. called on a worker thread
+    static size_t prefetchImage(IShellItem *item);
+
+    ~ImageView();
+
+protected:
+    enum UserMessage {
+        // WPARAM: 0, LPARAM: 0
+        MSG_IMAGE_OPENED = WM_USER,
+        // WPARAM: 0, LPARAM: 0
+        MSG_TILE_LOADED,
+        // WPARAM: 0, LPARAM: 0
+        MSG_USE_THUMBNAIL_VIEW,
+        MSG_LAST
+    };
+    const wchar_t * className() const override;
+    LRESULT handleMessage(UINT message, WPARAM wParam, LPARAM lParam) override;
+
+private:
+    void onPaint(PAINTSTRUCT paint);
+    // draw a tile, or the part of a lower resolution tile covering it if it's not loaded yet.
+    // returns false if the tile itself is not loaded. tile cache lock must be held
+    bool paintTile(HDC hdc, const TileKey &key);
+    RECT tileDisplayRect(int level, const TileRect &rect) const;
+
+    double fitScale() const;
+    void setScale(double newScale, POINT anchor); // anchor in client coordinates stays fixed
+    void setScroll(double x, double y); // clamped to the image
+
+    uint32_t imageID;
+    bool sharedImage = false; // imageID may be used by other views and prefetches
+    SIZE imageSize = {}; // empty until the image is opened
+    std::unique_ptr<TilePyramid> pyramid;
+    bool fit = true; // scale follows the window size
+    double scale = 1; // display pixels per image pixel
+    double scrollX = 0, scrollY = 0; // client origin in scaled image pixels
+    bool dragging = false;
+    POINT dragPos = {};
+    std::vector<TileKey> visibleTiles; // reused between paints
+
+    // runs on the image worker pool
+    class TileLoader : public PoolTask {
+    public:
+        TileLoader(IShellItem *item, ImageView *callbackWindow); // window is null to prefetch
+        void requestTiles(const std::vector<TileKey> &tiles); // replaces previous requests
+        void stop();
+        void run() override;
+        SIZE getImageSize(); // after MSG_IMAGE_OPENED
+        size_t prefetch(uint32_t image); // instead of run(), see prefetchImage()
+    private:
+        bool open();
+        // decode a tile and add it to the cache, along with any others decoded with it
+        std::shared_ptr<const Tile> decodeTile(const TileKey &key);
+        std::shared_ptr<const Tile> loadTile(const TileKey &key); // from the cache if possible
+        bool decodeStoredRect(const TileRect &rect, uint32_t *pixels); // of level 0, oriented
+        // reduce the four tiles of the previous level covering a tile
+        std::shared_ptr<const Tile> downscaleTiles(const TileKey &key);
+        // decode firstSmallLevel whole, and reduce it for each level after it
+        std::shared_ptr<const Tile> decodeSmallLevels(const TileKey &key);
+        // decode the whole source at a smaller size (as stored, not oriented)
+        bool decodeReduced(int width, int height, uint32_t *pixels);
+        void postToWindow(UINT message);
+
+        CComHeapPtr<ITEMIDLIST> itemIDList;
+        ImageView *callbackWindow;
+        SRWLOCK requestLock = SRWLOCK_INIT;
+        std::vector<TileKey> requestedTiles; // in order of importance
+        SIZE imageSize = {};
+        SRWLOCK stopLock = SRWLOCK_INIT; // task will not be stopped while held
+        bool stopped = false;
+
+        // only used by run(). tasks may run on a different pool thread each time, so the
+        // source only reads from a file stream or from memory, never from a shell stream
+        bool failed = false;
+        bool useThumbnail = false; // open() failed because ThumbnailView should show the image
+        CComPtr<IWICImagingFactory> factory;
+        CComPtr<IWICBitmapSource> source; // full resolution, 32bpp BGRA, as stored
+        // of the frame, to decode at a reduced size. null if unsupported or decoded into memory
+        CComPtr<IWICBitmapSourceTransform> sourceTransform;
+        int orientation = 1; // EXIF, applied to pixels as they're decoded
+        std::unique_ptr<TilePyramid> pyramid; // of the oriented image
+        int firstSmallLevel = 0; // up to FULL_DECODE_PIXELS, later levels are reduced from it
+    };
+
+    CComPtr<TileLoader> loader;
+};
+
+} // namespace
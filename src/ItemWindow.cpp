@@ -171,6 +171,7 @@ void ItemWindow::init() {
 
 void ItemWindow::uninit() {
     ProxyIcon::uninit();
+    clearIconBitmapCache();
     if (symbolFont)
         DeleteFont(symbolFont);
     if (symbolFontHandle)
@@ -238,6 +239,10 @@ bool ItemWindow::stickToChild() const {
     return true;
 }
 
+bool ItemWindow::registersShellWindow() const {
+    return true;
+}
+
 bool ItemWindow::useDefaultStatusText() const {
     return true;
 }
@@ -557,8 +562,12 @@ LRESULT ItemWindow::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
             EndPaint(hwnd, &paint);
             return 0;
         }
+        case WM_DPICHANGED:
+            clearIconBitmapCache(); // menu icons are converted at the old size
+            break;
         case WM_THEMECHANGED:
             // TODO: duplicate code, must be kept in sync with onCreate()
+            clearIconBitmapCache();
             // reset fonts
             proxyIcon.onThemeChanged();
             if (statusText && statusFont)
@@ -683,7 +692,11 @@ LRESULT ItemWindow::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
             LONG event;
             ITEMIDLIST **idls;
             HANDLE lock = SHChangeNotification_Lock((HANDLE)wParam, (DWORD)lParam, &idls, &event);
-            if (lock) {
+            if (lock && (event & SHCNE_UPDATEIMAGE)) {
+                // a global event, the ID lists don't identify an item
+                SHChangeNotification_Unlock(lock);
+                clearIconBitmapCache(); // slots in the system image list have changed
+            } else if (lock) {
                 CComPtr<IShellItem> item1, item2;
                 if (idls[0])
                     checkHR(SHCreateItemFromIDList(idls[0], IID_PPV_ARGS(&item1)));
@@ -1461,7 +1474,7 @@ void ItemWindow::onViewReady() {
 void ItemWindow::registerShellWindow() {
     // https://www.vbforums.com/showthread.php?894889-VB6-Using-IShellWindows-to-register-for-SHOpenFolderAndSelectItems
     // https://github.com/derceg/explorerplusplus/blob/55208360ccbad78f561f22bdb3572ed7b0780fa0/Explorer%2B%2B/Explorer%2B%2B/ShellBrowser/BrowsingHandler.cpp#L238
-    if (shellWindowCookie)
+    if (shellWindowCookie || !registersShellWindow())
         return;
     CComQIPtr<IPersistIDList> persistIDList(item);
     CComPtr<IShellWindows> shellWindows;
@@ -1491,7 +1504,8 @@ void ItemWindow::registerShellNotify() {
         SHChangeNotifyEntry notifEntry = {idList, FALSE};
         shellNotifyID = SHChangeNotifyRegister(hwnd,
             SHCNRF_ShellLevel | SHCNRF_InterruptLevel | SHCNRF_NewDelivery,
-            SHCNE_DELETE | SHCNE_RENAMEITEM | (isFolder() ? (SHCNE_RMDIR | SHCNE_RENAMEFOLDER) : 0),
+            SHCNE_DELETE | SHCNE_RENAMEITEM | SHCNE_UPDATEIMAGE
+                | (isFolder() ? (SHCNE_RMDIR | SHCNE_RENAMEFOLDER) : 0),
             MSG_SHELL_NOTIFY, 1, &notifEntry);
     }
 }
@@ -1606,19 +1620,33 @@ void ItemWindow::openParentMenu() {
         if (!checkHR(curItem->GetDisplayName(SIGDN_NORMALDISPLAY, &name)))
             continue;
         AppendMenu(menu, MF_STRING, id, name);
-        SHFILEINFO fileInfo = {};
         CComHeapPtr<ITEMIDLIST> idList;
-        if (checkHR(SHGetIDListFromObject(curItem, &idList))) {
-            checkLE(SHGetFileInfo((wchar_t *)(ITEMIDLIST *)idList, 0, &fileInfo, sizeof(fileInfo),
-                SHGFI_PIDL | SHGFI_ICON | SHGFI_ADDOVERLAYS | SHGFI_SMALLICON));
-        }
-        if (fileInfo.hIcon) {
+        SHFILEINFO fileInfo = {};
+        if (!checkHR(SHGetIDListFromObject(curItem, &idList))
+                || !SHGetFileInfo((wchar_t *)(ITEMIDLIST *)idList, 0, &fileInfo, sizeof(fileInfo),
+                    SHGFI_PIDL | SHGFI_SYSICONINDEX | SHGFI_SMALLICON))
+            continue;
+        int iconIndex = fileInfo.iIcon;
+        // the index alone doesn't include overlays (eg. sync status)
+        int overlay = 0;
+        CComPtr<IShellIconOverlay> overlayFolder;
+        PCUITEMID_CHILD child;
+        if (FAILED(SHBindToParent(idList, IID_PPV_ARGS(&overlayFolder), &child))
+                || overlayFolder->GetOverlayIndex(child, &overlay) != S_OK)
+            overlay = 0;
+        HBITMAP bitmap = findIconBitmap(iconIndex, overlay, iconSize);
+        if (!bitmap && SHGetFileInfo((wchar_t *)(ITEMIDLIST *)idList, 0, &fileInfo,
+                sizeof(fileInfo), SHGFI_PIDL | SHGFI_ICON | SHGFI_ADDOVERLAYS | SHGFI_SMALLICON)
+                && fileInfo.hIcon) {
             // http://shellrevealed.com:80/blogs/shellblog/archive/2007/02/06/Vista-Style-Menus_2C00_-Part-1-_2D00_-Adding-icons-to-standard-menus.aspx
             // icon must have alpha channel; SHGetFileInfo doesn't do this
+            bitmap = cacheIconBitmap(iconIndex, overlay, iconSize, fileInfo.hIcon);
+            DestroyIcon(fileInfo.hIcon);
+        }
+        if (bitmap) {
             MENUITEMINFO itemInfo = {sizeof(itemInfo)};
             itemInfo.fMask = MIIM_BITMAP;
-            itemInfo.hbmpItem = iconToPARGB32Bitmap(fileInfo.hIcon, iconSize, iconSize);
-            DestroyIcon(fileInfo.hIcon);
+            itemInfo.hbmpItem = bitmap;
             SetMenuItemInfo(menu, id, FALSE, &itemInfo);
         }
     }
@@ -1648,14 +1676,7 @@ void ItemWindow::openParentMenu() {
         parentWindow = parentWindow->parent;
     }
 
-    // destroy bitmaps
-    for (int i = 0, count = GetMenuItemCount(menu); i < count; i++) {
-        MENUITEMINFO itemInfo = {sizeof(itemInfo)};
-        itemInfo.fMask = MIIM_BITMAP;
-        if (checkLE(GetMenuItemInfo(menu, i, TRUE, &itemInfo)) && itemInfo.hbmpItem)
-            DeleteBitmap(itemInfo.hbmpItem);
-    }
-    checkLE(DestroyMenu(menu));
+    checkLE(DestroyMenu(menu)); // bitmaps are owned by the icon cache
 }
 
 void ItemWindow::invokeProxyDefaultVerb() {
@@ -1835,6 +1856,19 @@ void ItemWindow::StatusTextThread::run() {
         return;
     itemIDList.Free();
 
+    // show image dimensions from the file header while waiting for the (slow) info tip
+    ImageInfo imageInfo;
+    if (readImageInfo(localItem, &imageInfo)) {
+        // the same orientation ImageView applies when displaying the image
+        UINT width = imageInfo.displayWidth(), height = imageInfo.displayHeight();
+        local_wstr_ptr status = imageInfo.bitDepth
+            ? formatString(IDS_IMAGE_STATUS_DEPTH, width, height, imageInfo.bitDepth)
+            : formatString(IDS_IMAGE_STATUS, width, height);
+        CComHeapPtr<wchar_t> imageText;
+        if (status && checkHR(SHStrDup(status.get(), &imageText)))
+            postStatusText(imageText);
+    }
+
     CComPtr<IQueryInfo> queryInfo;
     if (!checkHR(localItem->BindToHandler(nullptr, BHID_SFUIObject, IID_PPV_ARGS(&queryInfo))))
         return;
@@ -1846,7 +1880,29 @@ void ItemWindow::StatusTextThread::run() {
         if (*c == '\n')
             *c = '\t';
     }
+    postStatusText(text);
+}
 
+bool ItemWindow::StatusTextThread::readImageInfo(IShellItem *const item, ImageInfo *const info) {
+    CComQIPtr<IShellItem2> item2(item);
+    CComHeapPtr<wchar_t> type;
+    if (!item2 || FAILED(item2->GetString(PKEY_ItemType, &type)) || !isImageInfoExtension(type))
+        return false;
+    CComPtr<IStream> stream;
+    if (!checkHR(item->BindToHandler(nullptr, BHID_Stream, IID_PPV_ARGS(&stream))))
+        return false;
+    return chromafiler::readImageInfo([&stream](uint64_t offset, void *buffer, size_t size) {
+        LARGE_INTEGER move;
+        move.QuadPart = (LONGLONG)offset;
+        ULONG read = 0;
+        if (FAILED(stream->Seek(move, STREAM_SEEK_SET, nullptr))
+                || FAILED(stream->Read(buffer, (ULONG)size, &read)))
+            return (size_t)0;
+        return (size_t)read;
+    }, info);
+}
+
+void ItemWindow::StatusTextThread::postStatusText(CComHeapPtr<wchar_t> &text) {
     AcquireSRWLockExclusive(&stopLock);
     if (!isStopped()) {
         AcquireSRWLockExclusive(&callbackWindow->defaultStatusTextLock);
@@ -3,6 +3,7 @@
 
 #include "COMUtils.h"
 #include "ChainWindow.h"
+#include "ImageInfo.h"
 #include "ProxyIcon.h"
 #include "SettingsDialog.h"
 #include "WinUtils.h"
@@ -80,6 +81,8 @@ protected:
     // a window that stays open and is not shown in taskbar. currently only used by TrayWindow
     virtual bool paletteWindow() const;
     virtual bool stickToChild() const; // for windows that override childPos
+    // register with IShellWindows as a browser for the item when it's the only window
+    virtual bool registersShellWindow() const;
 
     virtual bool useDefaultStatusText() const;
     virtual SettingsPage settingsStartPage() const;
@@ -232,6 +235,9 @@ private:
     protected:
         void run() override;
     private:
+        static bool readImageInfo(IShellItem *item, ImageInfo *info);
+        void postStatusText(CComHeapPtr<wchar_t> &text); // takes ownership
+
         CComHeapPtr<ITEMIDLIST> itemIDList;
         ItemWindow *callbackWindow;
     };
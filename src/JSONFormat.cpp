@@ -0,0 +1,368 @@
+#include "JSONFormat.h"
+#include <cstring>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace chromafiler {
+
+wchar_t * ChunkedTextBuffer::reserve(size_t *available) {
+    if (lastChunkUsed == CHUNK_SIZE) {
+        chunks.emplace_back(new wchar_t[CHUNK_SIZE]);
+        lastChunkUsed = 0;
+    }
+    *available = CHUNK_SIZE - lastChunkUsed;
+    return chunks.back().get() + lastChunkUsed;
+}
+
+void ChunkedTextBuffer::append(wchar_t c) {
+    size_t available;
+    *reserve(&available) = c;
+    lastChunkUsed++;
+    totalSize++;
+}
+
+void ChunkedTextBuffer::append(const wchar_t *text, size_t length) {
+    while (length) {
+        size_t available;
+        wchar_t *dest = reserve(&available);
+        size_t count = length < available ? length : available;
+        memcpy(dest, text, count * sizeof(wchar_t));
+        text += count;
+        length -= count;
+        lastChunkUsed += count;
+        totalSize += count;
+    }
+}
+
+void ChunkedTextBuffer::appendRepeat(wchar_t c, size_t count) {
+    while (count) {
+        size_t available;
+        wchar_t *dest = reserve(&available);
+        size_t n = count < available ? count : available;
+        for (size_t i = 0; i < n; i++)
+            dest[i] = c;
+        count -= n;
+        lastChunkUsed += n;
+        totalSize += n;
+    }
+}
+
+size_t ChunkedTextBuffer::size() const {
+    return totalSize;
+}
+
+void ChunkedTextBuffer::copyTo(wchar_t *dest) const {
+    size_t remaining = totalSize;
+    for (auto &chunk : chunks) {
+        size_t count = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+        memcpy(dest, chunk.get(), count * sizeof(wchar_t));
+        dest += count;
+        remaining -= count;
+    }
+}
+
+static inline bool isJSONSpace(wchar_t c) {
+    return c == L' ' || c == L'\t' || c == L'\r' || c == L'\n';
+}
+
+static inline bool isDigit(wchar_t c) {
+    return c >= L'0' && c <= L'9';
+}
+
+static inline bool isHexDigit(wchar_t c) {
+    return isDigit(c) || (c >= L'a' && c <= L'f') || (c >= L'A' && c <= L'F');
+}
+
+static const wchar_t * skipSpace(const wchar_t *p, const wchar_t *end) {
+#if defined(_M_IX86) || defined(_M_X64)
+    // long runs of indentation are common in already-formatted files
+    if (end - p >= 8 && isJSONSpace(*p)) {
+        const __m128i space = _mm_set1_epi16(L' '), tab = _mm_set1_epi16(L'\t'),
+            cr = _mm_set1_epi16(L'\r'), lf = _mm_set1_epi16(L'\n');
+        while (end - p >= 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            __m128i isSpace = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi16(v, space), _mm_cmpeq_epi16(v, tab)),
+                _mm_or_si128(_mm_cmpeq_epi16(v, cr), _mm_cmpeq_epi16(v, lf)));
+            int mask = _mm_movemask_epi8(isSpace);
+            if (mask != 0xFFFF) {
+                unsigned long bit;
+                _BitScanForward(&bit, ~mask & 0xFFFF);
+                return p + bit / 2;
+            }
+            p += 8;
+        }
+    }
+#endif
+    while (p < end && isJSONSpace(*p))
+        p++;
+    return p;
+}
+
+// returns pointer to the closing quote, or the position of the error
+static const wchar_t * scanString(const wchar_t *p, const wchar_t *end, JSONStatus *status) {
+    // p points after the opening quote
+    while (true) {
+#if defined(_M_IX86) || defined(_M_X64)
+        // skip ahead to the next quote, backslash, or control character
+        const __m128i quote = _mm_set1_epi16(L'"'), backslash = _mm_set1_epi16(L'\\'),
+            maxControl = _mm_set1_epi16(0x1F), zero = _mm_setzero_si128();
+        while (end - p >= 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi16(v, quote), _mm_cmpeq_epi16(v, backslash)),
+                _mm_cmpeq_epi16(_mm_subs_epu16(v, maxControl), zero)); // unsigned c <= 0x1F
+            int mask = _mm_movemask_epi8(special);
+            if (mask) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                p += bit / 2;
+                break;
+            }
+            p += 8;
+        }
+#endif
+        while (p < end && *p != L'"' && *p != L'\\' && *p >= 0x20)
+            p++;
+        if (p == end) {
+            *status = JSON_UNEXPECTED_END;
+            return p;
+        } else if (*p == L'"') {
+            return p;
+        } else if (*p == L'\\') {
+            p++;
+            if (p == end) {
+                *status = JSON_UNEXPECTED_END;
+                return p;
+            }
+            switch (*p) {
+                case L'"': case L'\\': case L'/': case L'b': case L'f': case L'n': case L'r':
+                case L't':
+                    p++;
+                    break;
+                case L'u':
+                    p++;
+                    for (int i = 0; i < 4; i++, p++) {
+                        if (p == end) {
+                            *status = JSON_UNEXPECTED_END;
+                            return p;
+                        } else if (!isHexDigit(*p)) {
+                            *status = JSON_BAD_ESCAPE;
+                            return p;
+                        }
+                    }
+                    break;
+                default:
+                    *status = JSON_BAD_ESCAPE;
+                    return p;
+            }
+        } else { // control character
+            *status = JSON_BAD_STRING;
+            return p;
+        }
+    }
+}
+
+// returns pointer after the number, or the position of the error
+static const wchar_t * scanNumber(const wchar_t *p, const wchar_t *end, JSONStatus *status) {
+    if (p < end && *p == L'-')
+        p++;
+    if (p == end) {
+        *status = JSON_UNEXPECTED_END;
+        return p;
+    }
+    if (*p == L'0') {
+        p++;
+    } else if (isDigit(*p)) {
+        while (p < end && isDigit(*p))
+            p++;
+    } else {
+        *status = JSON_BAD_NUMBER;
+        return p;
+    }
+    if (p < end && *p == L'.') {
+        p++;
+        if (p == end || !isDigit(*p)) {
+            *status = p == end ? JSON_UNEXPECTED_END : JSON_BAD_NUMBER;
+            return p;
+        }
+        while (p < end && isDigit(*p))
+            p++;
+    }
+    if (p < end && (*p == L'e' || *p == L'E')) {
+        p++;
+        if (p < end && (*p == L'+' || *p == L'-'))
+            p++;
+        if (p == end || !isDigit(*p)) {
+            *status = p == end ? JSON_UNEXPECTED_END : JSON_BAD_NUMBER;
+            return p;
+        }
+        while (p < end && isDigit(*p))
+            p++;
+    }
+    return p;
+}
+
+static const wchar_t * scanLiteral(const wchar_t *p, const wchar_t *end, JSONStatus *status) {
+    const wchar_t *literal;
+    switch (*p) {
+        case L't': literal = L"true"; break;
+        case L'f': literal = L"false"; break;
+        case L'n': literal = L"null"; break;
+        default:
+            *status = JSON_UNEXPECTED_CHAR;
+            return p;
+    }
+    for (; *literal; literal++, p++) {
+        if (p == end) {
+            *status = JSON_UNEXPECTED_END;
+            return p;
+        } else if (*p != *literal) {
+            *status = JSON_UNEXPECTED_CHAR;
+            return p;
+        }
+    }
+    return p;
+}
+
+static void findLineColumn(const wchar_t *text, size_t offset, JSONResult *result) {
+    int line = 1;
+    size_t lineStart = 0;
+    for (size_t i = 0; i < offset; i++) {
+        if (text[i] == L'\n' || (text[i] == L'\r' && !(i + 1 < offset && text[i + 1] == L'\n'))) {
+            line++;
+            lineStart = i + 1;
+        }
+    }
+    result->errorLine = line;
+    result->errorColumn = (int)(offset - lineStart + 1);
+}
+
+// parse an object member key and the following colon
+static const wchar_t * scanMemberKey(const wchar_t *p, const wchar_t *end,
+        ChunkedTextBuffer *output, JSONStatus *status) {
+    p = skipSpace(p, end);
+    if (p == end) {
+        *status = JSON_UNEXPECTED_END;
+        return p;
+    } else if (*p != L'"') {
+        *status = JSON_UNEXPECTED_CHAR;
+        return p;
+    }
+    const wchar_t *start = p;
+    p = scanString(p + 1, end, status);
+    if (*status != JSON_OK)
+        return p;
+    p++;
+    if (output)
+        output->append(start, p - start);
+    p = skipSpace(p, end);
+    if (p == end) {
+        *status = JSON_UNEXPECTED_END;
+        return p;
+    } else if (*p != L':') {
+        *status = JSON_UNEXPECTED_CHAR;
+        return p;
+    }
+    if (output)
+        output->append(L": ", 2);
+    return p + 1;
+}
+
+JSONResult processJSON(const wchar_t *text, size_t length, ChunkedTextBuffer *output,
+        wchar_t newline) {
+    // explicit stack instead of recursion, so deeply nested input can't overflow
+    std::vector<wchar_t> stack; // closing bracket for each open container
+    const wchar_t *p = text, *end = text + length;
+    JSONStatus status = JSON_OK;
+    bool expectValue = true;
+
+    while (status == JSON_OK) {
+        p = skipSpace(p, end);
+        if (expectValue) {
+            if (p == end) {
+                status = JSON_UNEXPECTED_END;
+                break;
+            }
+            wchar_t c = *p;
+            const wchar_t *start = p;
+            if (c == L'{' || c == L'[') {
+                stack.push_back(c == L'{' ? L'}' : L']');
+                if (output)
+                    output->append(c);
+                p = skipSpace(p + 1, end);
+                if (p < end && *p == stack.back()) {
+                    // empty container stays on one line
+                    if (output)
+                        output->append(*p);
+                    p++;
+                    stack.pop_back();
+                    expectValue = false;
+                } else {
+                    if (output) {
+                        output->append(newline);
+                        output->appendRepeat(L'\t', stack.size());
+                    }
+                    if (c == L'{')
+                        p = scanMemberKey(p, end, output, &status);
+                }
+                continue;
+            } else if (c == L'"') {
+                p = scanString(p + 1, end, &status);
+                if (status == JSON_OK)
+                    p++;
+            } else if (c == L'-' || isDigit(c)) {
+                p = scanNumber(p, end, &status);
+            } else {
+                p = scanLiteral(p, end, &status);
+            }
+            if (status != JSON_OK)
+                break;
+            if (output)
+                output->append(start, p - start);
+            expectValue = false;
+        } else {
+            // after a value
+            if (stack.empty()) {
+                if (p != end)
+                    status = JSON_TRAILING_DATA;
+                break;
+            } else if (p == end) {
+                status = JSON_UNEXPECTED_END;
+                break;
+            }
+            wchar_t c = *p;
+            if (c == stack.back()) {
+                stack.pop_back();
+                p++;
+                if (output) {
+                    output->append(newline);
+                    output->appendRepeat(L'\t', stack.size());
+                    output->append(c);
+                }
+            } else if (c == L',') {
+                p++;
+                if (output) {
+                    output->append(L',');
+                    output->append(newline);
+                    output->appendRepeat(L'\t', stack.size());
+                }
+                if (stack.back() == L'}')
+                    p = scanMemberKey(p, end, output, &status);
+                expectValue = true;
+            } else {
+                status = JSON_UNEXPECTED_CHAR;
+            }
+        }
+    }
+
+    JSONResult result = {status, 0, 0, 0};
+    if (status != JSON_OK) {
+        result.errorOffset = p - text;
+        findLineColumn(text, result.errorOffset, &result);
+    }
+    return result;
+}
+
+} // namespace
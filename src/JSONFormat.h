@@ -0,0 +1,53 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace chromafiler {
+
+// append-only text buffer made of fixed-size chunks, so large output is never reallocated/copied
+class ChunkedTextBuffer {
+public:
+    void append(wchar_t c);
+    void append(const wchar_t *text, size_t length);
+    void appendRepeat(wchar_t c, size_t count);
+    size_t size() const;
+    void copyTo(wchar_t *dest) const; // dest must have room for size() characters
+
+private:
+    static const size_t CHUNK_SIZE = 1 << 16;
+    wchar_t * reserve(size_t *available);
+
+    std::vector<std::unique_ptr<wchar_t[]>> chunks;
+    size_t lastChunkUsed = CHUNK_SIZE;
+    size_t totalSize = 0;
+};
+
+// corresponds to IDS_JSON_STATUS_*
+enum JSONStatus {
+    JSON_OK,
+    JSON_UNEXPECTED_CHAR,
+    JSON_UNEXPECTED_END,
+    JSON_BAD_STRING,
+    JSON_BAD_ESCAPE,
+    JSON_BAD_NUMBER,
+    JSON_TRAILING_DATA,
+    JSON_STATUS_COUNT
+};
+
+struct JSONResult {
+    JSONStatus status;
+    size_t errorOffset;
+    int errorLine, errorColumn; // 1-based
+};
+
+// Validate JSON in a single pass. If output is not null, also write a pretty-printed copy
+// (indented with tabs) using the given newline character. Output is only complete if the
+// result status is JSON_OK.
+JSONResult processJSON(const wchar_t *text, size_t length, ChunkedTextBuffer *output,
+    wchar_t newline);
+
+} // namespace
@@ -0,0 +1,391 @@
+#include "PixelOps.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#include <cstring>
+
+namespace chromafiler {
+
+// round(x / 255) for x in [0, 255 * 255]
+static inline uint32_t div255(uint32_t x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static void compositeRowScalar(uint8_t *p, int count, const uint8_t bg[3]) {
+    for (int i = 0; i < count; i++, p += 4) {
+        uint32_t alpha = p[3];
+        if (alpha == 255)
+            continue;
+        uint32_t inv = 255 - alpha;
+        p[0] = (uint8_t)div255(p[0] * alpha + bg[0] * inv);
+        p[1] = (uint8_t)div255(p[1] * alpha + bg[1] * inv);
+        p[2] = (uint8_t)div255(p[2] * alpha + bg[2] * inv);
+    }
+}
+
+static void premultiplyRowScalar(uint8_t *p, int count) {
+    for (int i = 0; i < count; i++, p += 4) {
+        uint32_t alpha = p[3];
+        p[0] = (uint8_t)div255(p[0] * alpha);
+        p[1] = (uint8_t)div255(p[1] * alpha);
+        p[2] = (uint8_t)div255(p[2] * alpha);
+    }
+}
+
+static void unpremultiplyRowScalar(uint8_t *p, int count) {
+    for (int i = 0; i < count; i++, p += 4) {
+        uint32_t alpha = p[3];
+        for (int c = 0; c < 3; c++) {
+            uint32_t value = alpha ? (p[c] * 255 + alpha / 2) / alpha : 0;
+            p[c] = (uint8_t)(value < 255 ? value : 255);
+        }
+    }
+}
+
+static void expandRGB24Scalar(const uint8_t *src, uint8_t *dest, int count, bool swapRB) {
+    int r = swapRB ? 0 : 2, b = swapRB ? 2 : 0;
+    for (int i = 0; i < count; i++, src += 3, dest += 4) {
+        dest[0] = src[b];
+        dest[1] = src[1];
+        dest[2] = src[r];
+        dest[3] = 255;
+    }
+}
+
+static void expandGray8Scalar(const uint8_t *src, uint8_t *dest, int count) {
+    for (int i = 0; i < count; i++, dest += 4) {
+        dest[0] = dest[1] = dest[2] = src[i];
+        dest[3] = 255;
+    }
+}
+
+// one set of histograms per pixel position mod 4
+struct HistogramTables {
+    uint32_t counts[4][3][256];
+};
+
+static inline void countPixel(HistogramTables &tables, int table, uint32_t pixel) {
+    tables.counts[table][0][pixel & 0xFF]++;
+    tables.counts[table][1][(pixel >> 8) & 0xFF]++;
+    tables.counts[table][2][(pixel >> 16) & 0xFF]++;
+}
+
+// returns the number of clipped pixels. fully transparent pixels are skipped
+static int histogramRowScalar(const uint8_t *p, int count, HistogramTables &tables) {
+    int clipped = 0;
+    for (int i = 0; i < count; i++, p += 4) {
+        if (p[3] == 0)
+            continue;
+        uint32_t pixel;
+        memcpy(&pixel, p, 4);
+        countPixel(tables, i & 3, pixel);
+        for (int c = 0; c < 3; c++) {
+            if (p[c] == 0 || p[c] == 255) {
+                clipped++;
+                break;
+            }
+        }
+    }
+    return clipped;
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+
+static bool cpuHasSSSE3() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+}
+
+static bool useSSSE3() {
+    static const bool hasSSSE3 = cpuHasSSSE3();
+    return hasSSSE3;
+}
+
+static bool cpuHasAVX2() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const int OSXSAVE = 1 << 27, AVX = 1 << 28;
+    if ((info[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX))
+        return false;
+    if ((_xgetbv(0) & 6) != 6) // OS saves XMM and YMM state
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+static bool useAVX2() {
+    static const bool hasAVX2 = cpuHasAVX2();
+    return hasAVX2;
+}
+
+// 16-bit lanes: (c * alpha + bg * (255 - alpha)) / 255, rounded
+static inline __m128i blend16(__m128i c, __m128i bg16, __m128i max16, __m128i round16) {
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xFF), 0xFF);
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(c, alpha),
+        _mm_mullo_epi16(bg16, _mm_sub_epi16(max16, alpha)));
+    x = _mm_add_epi16(x, round16);
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static int compositeRowSSE2(uint8_t *p, int count, uint32_t background) {
+    const __m128i zero = _mm_setzero_si128(), alphaMask = _mm_set1_epi32((int)0xFF000000);
+    const __m128i bg16 = _mm_unpacklo_epi8(_mm_set1_epi32((int)background), zero);
+    const __m128i max16 = _mm_set1_epi16(255), round16 = _mm_set1_epi16(128);
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alphaMask), alphaMask)) == 0xFFFF)
+            continue; // all opaque
+        __m128i lo = blend16(_mm_unpacklo_epi8(v, zero), bg16, max16, round16);
+        __m128i hi = blend16(_mm_unpackhi_epi8(v, zero), bg16, max16, round16);
+        __m128i result = _mm_packus_epi16(lo, hi);
+        result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(v, alphaMask));
+        _mm_storeu_si128((__m128i *)p, result);
+    }
+    return i;
+}
+
+static inline __m256i blend16(__m256i c, __m256i bg16, __m256i max16, __m256i round16) {
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xFF), 0xFF);
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(c, alpha),
+        _mm256_mullo_epi16(bg16, _mm256_sub_epi16(max16, alpha)));
+    x = _mm256_add_epi16(x, round16);
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+static int compositeRowAVX2(uint8_t *p, int count, uint32_t background) {
+    const __m256i zero = _mm256_setzero_si256(), alphaMask = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i bg16 = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)background), zero);
+    const __m256i max16 = _mm256_set1_epi16(255), round16 = _mm256_set1_epi16(128);
+    int i = 0;
+    for (; i + 8 <= count; i += 8, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i opaque = _mm256_cmpeq_epi32(_mm256_and_si256(v, alphaMask), alphaMask);
+        if (_mm256_movemask_epi8(opaque) == -1)
+            continue;
+        // unpack/pack work within 128-bit lanes, so the pixel order is preserved
+        __m256i lo = blend16(_mm256_unpacklo_epi8(v, zero), bg16, max16, round16);
+        __m256i hi = blend16(_mm256_unpackhi_epi8(v, zero), bg16, max16, round16);
+        __m256i result = _mm256_packus_epi16(lo, hi);
+        result = _mm256_or_si256(_mm256_andnot_si256(alphaMask, result),
+            _mm256_and_si256(v, alphaMask));
+        _mm256_storeu_si256((__m256i *)p, result);
+    }
+    return i;
+}
+
+static int premultiplyRowSSE2(uint8_t *p, int count) {
+    const __m128i zero = _mm_setzero_si128(), alphaMask = _mm_set1_epi32((int)0xFF000000);
+    const __m128i round16 = _mm_set1_epi16(128);
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i halves[2] = {_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero)};
+        for (auto &c : halves) {
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xFF), 0xFF);
+            __m128i x = _mm_add_epi16(_mm_mullo_epi16(c, alpha), round16);
+            c = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+        }
+        __m128i result = _mm_packus_epi16(halves[0], halves[1]);
+        result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(v, alphaMask));
+        _mm_storeu_si128((__m128i *)p, result);
+    }
+    return i;
+}
+
+static int unpremultiplyRowSSE2(uint8_t *p, int count) {
+    // one pixel per 32-bit lane; float division is exact enough that truncating
+    // (c * 255 + alpha / 2) / alpha gives the same result as integer division
+    const __m128i byteMask = _mm_set1_epi32(0xFF), zero = _mm_setzero_si128();
+    const __m128 maxValue = _mm_set1_ps(255.0f), one = _mm_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i alpha = _mm_srli_epi32(v, 24);
+        __m128i transparent = _mm_cmpeq_epi32(alpha, zero);
+        __m128 alphaF = _mm_max_ps(_mm_cvtepi32_ps(alpha), one); // avoid dividing by zero
+        __m128i half = _mm_srli_epi32(alpha, 1);
+        __m128i result = _mm_slli_epi32(alpha, 24);
+        for (int shift = 0; shift < 24; shift += 8) {
+            __m128i c = _mm_and_si128(_mm_srli_epi32(v, shift), byteMask);
+            __m128i num = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(c, 8), c), half);
+            __m128 q = _mm_min_ps(_mm_div_ps(_mm_cvtepi32_ps(num), alphaF), maxValue);
+            __m128i channel = _mm_andnot_si128(transparent, _mm_cvttps_epi32(q));
+            result = _mm_or_si128(result, _mm_slli_epi32(channel, shift));
+        }
+        _mm_storeu_si128((__m128i *)p, result);
+    }
+    return i;
+}
+
+static int expandRGB24SSSE3(const uint8_t *src, uint8_t *dest, int count, bool swapRB) {
+    const __m128i shuffle = swapRB
+        ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+        : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    int i = 0;
+    // each load is 16 bytes but only 12 are used, stop early so it doesn't read past the end
+    for (; i + 6 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        _mm_storeu_si128((__m128i *)(dest + i * 4),
+            _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alphaMask));
+    }
+    return i;
+}
+
+static int expandGray8SSE2(const uint8_t *src, uint8_t *dest, int count) {
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i g = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i pairs[2] = {_mm_unpacklo_epi8(g, g), _mm_unpackhi_epi8(g, g)};
+        uint8_t *p = dest + i * 4;
+        for (auto &pair : pairs) {
+            _mm_storeu_si128((__m128i *)p,
+                _mm_or_si128(_mm_unpacklo_epi16(pair, pair), alphaMask));
+            _mm_storeu_si128((__m128i *)(p + 16),
+                _mm_or_si128(_mm_unpackhi_epi16(pair, pair), alphaMask));
+            p += 32;
+        }
+    }
+    return i;
+}
+
+// returns the number of pixels processed, the number clipped is added to clipped
+static int histogramRowSSE2(const uint8_t *p, int count, HistogramTables &tables,
+        int *clipped) {
+    const __m128i zero = _mm_setzero_si128(), max8 = _mm_set1_epi8((char)0xFF);
+    const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    __m128i unclipped = zero; // negative count per lane
+    int vectorPixels = 0, scalarClipped = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alphaMask), zero))) {
+            // some are fully transparent, which is uncommon outside of the edges of an image
+            scalarClipped += histogramRowScalar(p, 4, tables);
+            continue;
+        }
+        vectorPixels += 4;
+        __m128i extreme = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, max8));
+        extreme = _mm_and_si128(extreme, colorMask);
+        unclipped = _mm_add_epi32(unclipped, _mm_cmpeq_epi32(extreme, zero));
+        uint32_t pixels[4];
+        _mm_storeu_si128((__m128i *)pixels, v);
+        countPixel(tables, 0, pixels[0]);
+        countPixel(tables, 1, pixels[1]);
+        countPixel(tables, 2, pixels[2]);
+        countPixel(tables, 3, pixels[3]);
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, unclipped);
+    *clipped += vectorPixels + (lanes[0] + lanes[1] + lanes[2] + lanes[3]) + scalarClipped;
+    return i;
+}
+
+#endif
+
+void expandRGB24(const uint8_t *src, uint8_t *dest, int count, bool swapRB) {
+    int done = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+    if (useSSSE3())
+        done = expandRGB24SSSE3(src, dest, count, swapRB);
+#endif
+    expandRGB24Scalar(src + done * 3, dest + done * 4, count - done, swapRB);
+}
+
+void expandGray8(const uint8_t *src, uint8_t *dest, int count) {
+    int done = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+    done = expandGray8SSE2(src, dest, count);
+#endif
+    expandGray8Scalar(src + done, dest + done * 4, count - done);
+}
+
+void premultiplyAlpha(uint8_t *pixels, int width, int height, ptrdiff_t stride) {
+    for (int y = 0; y < height; y++, pixels += stride) {
+        int done = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        done = premultiplyRowSSE2(pixels, width);
+#endif
+        premultiplyRowScalar(pixels + done * 4, width - done);
+    }
+}
+
+void unpremultiplyAlpha(uint8_t *pixels, int width, int height, ptrdiff_t stride) {
+    for (int y = 0; y < height; y++, pixels += stride) {
+        int done = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        done = unpremultiplyRowSSE2(pixels, width);
+#endif
+        unpremultiplyRowScalar(pixels + done * 4, width - done);
+    }
+}
+
+void compositeOnColor(uint8_t *pixels, int width, int height, ptrdiff_t stride,
+        uint32_t background) {
+    const uint8_t bg[3] = {(uint8_t)background, (uint8_t)(background >> 8),
+        (uint8_t)(background >> 16)};
+#if defined(_M_IX86) || defined(_M_X64)
+    bool avx2 = useAVX2();
+#endif
+    for (int y = 0; y < height; y++, pixels += stride) {
+        int done = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        if (avx2)
+            done = compositeRowAVX2(pixels, width, background);
+        done += compositeRowSSE2(pixels + done * 4, width - done, background);
+#endif
+        compositeRowScalar(pixels + done * 4, width - done, bg);
+    }
+}
+
+void computePixelStats(const uint8_t *pixels, int width, int height, ptrdiff_t stride,
+        PixelStats *stats) {
+    memset(stats->histogram, 0, sizeof(stats->histogram));
+    stats->clipped = 0;
+    addPixelStats(pixels, width, height, stride, stats);
+}
+
+void addPixelStats(const uint8_t *pixels, int width, int height, ptrdiff_t stride,
+        PixelStats *stats) {
+    HistogramTables tables = {};
+    uint64_t clipped = 0;
+    for (int y = 0; y < height; y++, pixels += stride) {
+        int done = 0, rowClipped = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+        done = histogramRowSSE2(pixels, width, tables, &rowClipped);
+#endif
+        rowClipped += histogramRowScalar(pixels + done * 4, width - done, tables);
+        clipped += rowClipped;
+    }
+
+    stats->clipped += clipped;
+    for (int c = 0; c < 3; c++) {
+        uint64_t sum = 0, count = 0;
+        stats->minValue[c] = 0;
+        stats->maxValue[c] = -1;
+        for (int v = 0; v < 256; v++) {
+            uint32_t n = stats->histogram[c][v] += tables.counts[0][c][v]
+                + tables.counts[1][c][v] + tables.counts[2][c][v] + tables.counts[3][c][v];
+            sum += (uint64_t)n * v;
+            count += n;
+            if (n) {
+                if (stats->maxValue[c] < 0)
+                    stats->minValue[c] = v;
+                stats->maxValue[c] = v;
+            }
+        }
+        stats->pixels = count; // the same for every channel
+        stats->mean[c] = count ? (double)sum / count : 0;
+    }
+}
+
+} // namespace
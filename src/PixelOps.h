@@ -0,0 +1,47 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chromafiler {
+
+// Kernels for 32-bit BGRA pixels (byte order B, G, R, A in memory, as in a 32bpp DIB).
+// Colors are passed as 0x00RRGGBB, matching the pixel layout read as a little-endian uint32.
+// Vectorized with SSE2, or SSSE3/AVX2 if the CPU supports it.
+
+// Composite pixels with straight (non-premultiplied) alpha onto an opaque background color.
+// Color channels are rounded exactly; alpha values are left unchanged.
+void compositeOnColor(uint8_t *pixels, int width, int height, ptrdiff_t stride,
+    uint32_t background);
+// Convert straight alpha to premultiplied alpha (color * alpha / 255, rounded).
+void premultiplyAlpha(uint8_t *pixels, int width, int height, ptrdiff_t stride);
+// Convert premultiplied alpha to straight alpha (color * 255 / alpha, rounded, at most 255).
+// Fully transparent pixels become transparent black.
+void unpremultiplyAlpha(uint8_t *pixels, int width, int height, ptrdiff_t stride);
+
+// Expand one row of 24-bit pixels (B, G, R order, or R, G, B if swapRB is set) to opaque
+// 32-bit BGRA. Uses SSSE3 if the CPU supports it.
+void expandRGB24(const uint8_t *src, uint8_t *dest, int count, bool swapRB);
+// Expand one row of 8-bit grayscale pixels to opaque 32-bit BGRA.
+void expandGray8(const uint8_t *src, uint8_t *dest, int count);
+
+// Per-channel statistics of 32-bit BGRA pixels with straight alpha. Fully transparent pixels
+// are skipped, since their color isn't visible; other alpha values are ignored.
+struct PixelStats {
+    uint32_t histogram[3][256]; // indexed by channel in memory order (B, G, R), then value
+    uint64_t pixels; // not fully transparent
+    uint64_t clipped; // pixels with any color channel at 0 or 255
+    // derived from the histogram
+    int minValue[3], maxValue[3]; // 0 and -1 if there are no pixels
+    double mean[3];
+};
+// Histogram pass over an image. The clipping test is vectorized with SSE2; histogram updates
+// are spread over separate tables so consecutive pixels don't wait on each other's counters.
+void computePixelStats(const uint8_t *pixels, int width, int height, ptrdiff_t stride,
+    PixelStats *stats);
+// Add more pixels of the same image (eg. the next strip) to stats from computePixelStats.
+void addPixelStats(const uint8_t *pixels, int width, int height, ptrdiff_t stride,
+    PixelStats *stats);
+
+} // namespace
@@ -1,8 +1,15 @@
 #include "PreviewWindow.h"
+#include "ContactSheetView.h"
+#include "ThumbnailView.h"
 #include "GeomUtils.h"
 #include "WinUtils.h"
+#include "Settings.h"
+#include "AffinityScheduler.h"
 #include <windowsx.h>
 #include <shlobj.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 namespace chromafiler {
 
@@ -10,24 +17,271 @@ namespace chromafiler {
 
 const wchar_t PREVIEW_CONTAINER_CLASS[] = L"ChromaFiler Preview Container";
 
-const int FACTORY_CACHE_SIZE = 4;
+// handlers of different types initialize in parallel, each type always on the same thread
+const int PREVIEW_THREAD_COUNT = 3;
+const int MAX_WARM_UP_FACTORIES = 16;
+const DWORD WARM_UP_IDLE_TIME = 2000; // ms without requests before each factory is loaded
+// handler instances created ahead of time, so the next preview of a type skips CreateInstance
+const LONG MAX_SPARE_HANDLERS = 4; // total for all threads
+const DWORD SPARE_IDLE_TIME = 250; // ms without requests before a spare is created
+const ULONGLONG SPARE_TIMEOUT = 5 * 60 * 1000; // ms, released if the type isn't used again
 
 enum WorkerUserMessage {
     // WPARAM: 0, LPARAM: InitPreviewRequest (calls free!)
     MSG_INIT_PREVIEW_REQUEST = WM_USER,
     // WPARAM: 0, LPARAM: IPreviewHandler (marshalled, calls Release!)
-    MSG_RELEASE_PREVIEW
+    MSG_RELEASE_PREVIEW,
+    // WPARAM: 0, LPARAM: CLSID (calls delete!)
+    MSG_PREFETCH_FACTORY
 };
 
 struct FactoryCacheEntry {
-    CLSID clsid = {};
+    CLSID clsid;
     CComPtr<IClassFactory> factory;
 };
 
-HANDLE PreviewWindow::initPreviewThread = nullptr;
-// used by worker thread:
-static FactoryCacheEntry factoryCache[FACTORY_CACHE_SIZE] = {};
-static int factoryCacheIndex = 0;
+// lookups for one handler during this session, kept after its factory is evicted
+struct FactoryCacheStats {
+    CLSID clsid;
+    int hits, misses;
+};
+
+// created but not initialized, each can be used for one preview
+struct SpareHandler {
+    CLSID clsid;
+    CComPtr<IPreviewHandler> handler;
+    ULONGLONG created; // GetTickCount64
+};
+
+// one STA thread that initializes preview handlers. class factories and spare handlers belong
+// to its apartment
+struct PreviewWorker {
+    HANDLE thread = nullptr;
+    // used by the worker thread:
+    // class factories keep the handler's server running, so creating another instance is fast.
+    // ordered from most to least recently used
+    std::vector<FactoryCacheEntry> factoryCache;
+    std::vector<FactoryCacheStats> factoryCacheStats;
+    int totalHits = 0, totalMisses = 0;
+    std::vector<CLSID> warmUpQueue; // most used last, filled before the thread starts
+    std::vector<SpareHandler> spares; // at most one per type
+    std::vector<CLSID> spareQueue; // types to create spares for when idle
+
+    IClassFactory * findFactory(CLSID clsid); // moves the entry to the front, null if not cached
+    void cacheFactory(CLSID clsid, IClassFactory *factory); // evicts least recently used if full
+    void uncacheFactory(CLSID clsid);
+    void countLookup(CLSID clsid, bool hit);
+    void loadFactory(CLSID clsid);
+
+    bool takeSpare(CLSID clsid, IPreviewHandler **handler); // returns false if there is none
+    void queueSpare(CLSID clsid); // after a handler of this type is used
+    void createSpare(CLSID clsid);
+    void releaseSpares(bool all); // otherwise only those past the timeout
+    // how long to wait without messages before calling idle(), or INFINITE if nothing to do
+    DWORD idleWait();
+    void idle(DWORD waited);
+};
+
+static PreviewWorker previewWorkers[PREVIEW_THREAD_COUNT];
+static volatile LONG spareCount = 0;
+static size_t factoryCacheSize = 0; // per worker
+static SRWLOCK schedulerLock = SRWLOCK_INIT;
+static AffinityScheduler scheduler(PREVIEW_THREAD_COUNT);
+
+static AffinityScheduler::Key schedulerKey(CLSID clsid) {
+    AffinityScheduler::Key key;
+    static_assert(sizeof(clsid) == sizeof(key), "CLSID size");
+    memcpy(key.data(), &clsid, sizeof(key));
+    return key;
+}
+
+static int workerForHandler(CLSID clsid) {
+    AcquireSRWLockExclusive(&schedulerLock);
+    int worker = scheduler.workerFor(schedulerKey(clsid));
+    ReleaseSRWLockExclusive(&schedulerLock);
+    return worker;
+}
+
+static void endRequest(int worker) {
+    AcquireSRWLockExclusive(&schedulerLock);
+    scheduler.end(worker);
+    ReleaseSRWLockExclusive(&schedulerLock);
+}
+
+static DWORD workerThreadID(int worker) {
+    HANDLE thread = (worker >= 0) ? previewWorkers[worker].thread : nullptr;
+    return thread ? GetThreadId(thread) : 0;
+}
+
+IClassFactory * PreviewWorker::findFactory(CLSID clsid) {
+    for (auto it = factoryCache.begin(); it != factoryCache.end(); it++) {
+        if (it->clsid == clsid) {
+            std::rotate(factoryCache.begin(), it, it + 1);
+            return factoryCache.front().factory;
+        }
+    }
+    return nullptr;
+}
+
+void PreviewWorker::cacheFactory(CLSID clsid, IClassFactory *factory) {
+    if (factoryCacheSize == 0)
+        return;
+    if (factoryCache.size() >= factoryCacheSize)
+        factoryCache.pop_back();
+    factoryCache.insert(factoryCache.begin(), {clsid, factory});
+}
+
+void PreviewWorker::uncacheFactory(CLSID clsid) {
+    factoryCache.erase(std::remove_if(factoryCache.begin(), factoryCache.end(),
+        [&](const FactoryCacheEntry &entry) { return entry.clsid == clsid; }),
+        factoryCache.end());
+}
+
+void PreviewWorker::countLookup(CLSID clsid, bool hit) {
+    auto it = std::find_if(factoryCacheStats.begin(), factoryCacheStats.end(),
+        [&](const FactoryCacheStats &stats) { return stats.clsid == clsid; });
+    if (it == factoryCacheStats.end())
+        it = factoryCacheStats.insert(factoryCacheStats.end(), {clsid, 0, 0});
+    (hit ? it->hits : it->misses)++;
+    (hit ? totalHits : totalMisses)++;
+    debugPrintf(L"Factory cache %s (%d hits, %d misses for handler; %d%% thread hit rate)\n",
+        hit ? L"hit" : L"miss", it->hits, it->misses,
+        totalHits * 100 / (totalHits + totalMisses));
+}
+
+void PreviewWorker::loadFactory(CLSID clsid) {
+    if (findFactory(clsid))
+        return;
+    CComPtr<IClassFactory> factory;
+    if (checkHR(CoGetClassObject(clsid, CLSCTX_LOCAL_SERVER, nullptr, IID_PPV_ARGS(&factory))))
+        cacheFactory(clsid, factory);
+}
+
+bool PreviewWorker::takeSpare(CLSID clsid, IPreviewHandler **handler) {
+    for (auto it = spares.begin(); it != spares.end(); it++) {
+        if (it->clsid == clsid) {
+            *handler = it->handler.Detach();
+            spares.erase(it);
+            InterlockedDecrement(&spareCount);
+            debugPrintf(L"Using spare preview handler\n");
+            return true;
+        }
+    }
+    return false;
+}
+
+void PreviewWorker::queueSpare(CLSID clsid) {
+    if (std::find(spareQueue.begin(), spareQueue.end(), clsid) == spareQueue.end())
+        spareQueue.push_back(clsid);
+}
+
+void PreviewWorker::createSpare(CLSID clsid) {
+    for (auto &spare : spares) {
+        if (spare.clsid == clsid)
+            return;
+    }
+    if (InterlockedIncrement(&spareCount) > MAX_SPARE_HANDLERS) {
+        InterlockedDecrement(&spareCount);
+        return;
+    }
+    loadFactory(clsid);
+    IClassFactory *factory = findFactory(clsid); // null if factories aren't cached
+    CComPtr<IPreviewHandler> handler;
+    if (factory && checkHR(factory->CreateInstance(nullptr, IID_PPV_ARGS(&handler)))) {
+        spares.push_back({clsid, handler, GetTickCount64()});
+    } else {
+        InterlockedDecrement(&spareCount);
+    }
+}
+
+void PreviewWorker::releaseSpares(bool all) {
+    ULONGLONG now = GetTickCount64();
+    for (auto it = spares.begin(); it != spares.end();) {
+        if (all || now - it->created >= SPARE_TIMEOUT) {
+            it = spares.erase(it);
+            InterlockedDecrement(&spareCount);
+        } else {
+            it++;
+        }
+    }
+}
+
+DWORD PreviewWorker::idleWait() {
+    DWORD wait = !spareQueue.empty() ? SPARE_IDLE_TIME
+        : !warmUpQueue.empty() ? WARM_UP_IDLE_TIME : INFINITE;
+    ULONGLONG now = GetTickCount64();
+    for (auto &spare : spares) {
+        ULONGLONG age = now - spare.created;
+        wait = min(wait, age < SPARE_TIMEOUT ? (DWORD)(SPARE_TIMEOUT - age) : 0);
+    }
+    return wait;
+}
+
+void PreviewWorker::idle(DWORD waited) {
+    releaseSpares(false);
+    if (!spareQueue.empty()) {
+        if (waited >= SPARE_IDLE_TIME) {
+            CLSID clsid = spareQueue.back();
+            spareQueue.pop_back();
+            createSpare(clsid);
+        }
+    } else if (!warmUpQueue.empty() && waited >= WARM_UP_IDLE_TIME) {
+        debugPrintf(L"Warming up preview handler\n");
+        loadFactory(warmUpQueue.back());
+        warmUpQueue.pop_back();
+    }
+}
+
+// create an instance of a handler, with a cached factory if possible
+static bool createHandler(CLSID clsid, PreviewWorker *worker, IPreviewHandler **handler) {
+    if (worker) {
+        IClassFactory *factory = worker->findFactory(clsid);
+        worker->countLookup(clsid, factory != nullptr);
+        if (factory) {
+            if (checkHR(factory->CreateInstance(nullptr, IID_PPV_ARGS(handler))))
+                return true;
+            worker->uncacheFactory(clsid); // the handler's server has exited, get a new factory
+        }
+    }
+    CComPtr<IClassFactory> factory;
+    if (!checkHR(CoGetClassObject(clsid, CLSCTX_LOCAL_SERVER, nullptr, IID_PPV_ARGS(&factory))))
+        return false;
+    if (!checkHR(factory->CreateInstance(nullptr, IID_PPV_ARGS(handler))))
+        return false;
+    if (worker) {
+        // https://stackoverflow.com/a/5002596/11525734
+        worker->cacheFactory(clsid, factory);
+    }
+    return true;
+}
+
+// queue the most used handlers to be loaded on their threads when those are idle
+static void queueWarmUp() {
+    int count = (int)min(min(settings::getHandlerWarmUp(), settings::getHandlerCacheSize()),
+        (DWORD)MAX_WARM_UP_FACTORIES);
+    CLSID clsids[MAX_WARM_UP_FACTORIES];
+    count = settings::getMostUsedHandlers(clsids, count);
+    for (int i = count - 1; i >= 0; i--) {
+        PreviewWorker &worker = previewWorkers[workerForHandler(clsids[i])];
+        if (worker.warmUpQueue.size() < factoryCacheSize)
+            worker.warmUpQueue.push_back(clsids[i]);
+    }
+}
+
+static void waitForThread(HANDLE thread) {
+    // Avoid deadlock when destroying objects created on the main thread
+    DWORD res;
+    do {
+        res = MsgWaitForMultipleObjects(1, &thread, FALSE, INFINITE, QS_ALLINPUT);
+        if (res == WAIT_OBJECT_0 + 1) {
+            MSG msg;
+            while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+        }
+    } while (res != WAIT_OBJECT_0 && res != WAIT_FAILED);
+}
 
 void PreviewWindow::init() {
     WNDCLASS containerClass = {};
@@ -37,30 +291,44 @@ void PreviewWindow::init() {
     containerClass.hCursor = LoadCursor(nullptr, IDC_ARROW);
     RegisterClass(&containerClass);
 
-    SHCreateThreadWithHandle(initPreviewThreadProc, nullptr, CTF_COINIT_STA, nullptr,
-        &initPreviewThread);
+    // the configured size is shared between the threads
+    DWORD cacheSize = settings::getHandlerCacheSize();
+    factoryCacheSize = cacheSize ? (cacheSize + PREVIEW_THREAD_COUNT - 1) / PREVIEW_THREAD_COUNT
+        : 0;
+    queueWarmUp();
+    for (auto &worker : previewWorkers) {
+        SHCreateThreadWithHandle(initPreviewThreadProc, &worker, CTF_COINIT_STA, nullptr,
+            &worker.thread);
+    }
 }
 
 void PreviewWindow::uninit() {
-    if (initPreviewThread) {
-        checkLE(PostThreadMessage(GetThreadId(initPreviewThread), WM_QUIT, 0, 0));
-        // Wait for thread to exit
-        // Avoid deadlock when destroying objects created on the main thread
-        DWORD res;
-        do {
-            res = MsgWaitForMultipleObjects(1, &initPreviewThread, FALSE, INFINITE, QS_ALLINPUT);
-            if (res == WAIT_OBJECT_0 + 1) {
-                MSG msg;
-                while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE)) {
-                    TranslateMessage(&msg);
-                    DispatchMessage(&msg);
-                }
-            }
-        } while (res != WAIT_OBJECT_0 && res != WAIT_FAILED);
-        checkLE(CloseHandle(initPreviewThread));
+    for (auto &worker : previewWorkers) {
+        if (worker.thread)
+            checkLE(PostThreadMessage(GetThreadId(worker.thread), WM_QUIT, 0, 0));
     }
-    for (auto &entry : factoryCache)
-        entry.factory.Release();
+    for (auto &worker : previewWorkers) {
+        if (worker.thread) {
+            waitForThread(worker.thread);
+            checkLE(CloseHandle(worker.thread));
+            worker.thread = nullptr;
+        }
+        worker.factoryCache.clear();
+    }
+}
+
+void PreviewWindow::useThumbnailView(HWND previewHwnd) {
+    // built-in previews aren't async, so they're direct children of the PreviewWindow
+    PostMessage(GetParent(previewHwnd), MSG_USE_THUMBNAIL_VIEW, 0, 0);
+}
+
+void PreviewWindow::prefetchFactory(CLSID previewID) {
+    DWORD threadID = workerThreadID(workerForHandler(previewID));
+    if (!threadID)
+        return;
+    CLSID *message = new CLSID(previewID);
+    if (!checkLE(PostThreadMessage(threadID, MSG_PREFETCH_FACTORY, 0, (LPARAM)message)))
+        delete message;
 }
 
 PreviewWindow::PreviewWindow(ItemWindow *const parent, IShellItem *const item,
@@ -69,6 +337,19 @@ PreviewWindow::PreviewWindow(ItemWindow *const parent, IShellItem *const item,
       previewID(previewID),
       async(async) {}
 
+const wchar_t * PreviewWindow::propBagName() const {
+    // contact sheets show folders, keep their size separate from the folder windows
+    if (previewID == CLSID_ContactSheetView)
+        return L"chromafiler.contactsheet";
+    return ItemWindow::propBagName();
+}
+
+bool PreviewWindow::registersShellWindow() const {
+    // a contact sheet isn't a browser for its folder, so the shell shouldn't navigate it or
+    // find it in place of a folder window
+    return previewID != CLSID_ContactSheetView;
+}
+
 void PreviewWindow::onCreate() {
     ItemWindow::onCreate();
 
@@ -131,20 +412,40 @@ LRESULT PreviewWindow::handleMessage(UINT message, WPARAM wParam, LPARAM lParam)
         // required for some preview handlers to render correctly initially (eg. SumatraPDF)
         checkHR(preview->SetRect(&previewRect));
         return 0;
+    } else if (message == MSG_USE_THUMBNAIL_VIEW) {
+        if (previewID != CLSID_ThumbnailView) {
+            destroyPreview();
+            previewID = CLSID_ThumbnailView;
+            requestPreview(container ? clientRect(container) : windowBody());
+        }
+        return 0;
     }
     return ItemWindow::handleMessage(message, wParam, lParam);
 }
 
 void PreviewWindow::requestPreview(RECT rect) {
+    // only the latest request is loaded, earlier ones are dropped by the worker
+    if (initRequest)
+        initRequest->cancel();
     initRequest.Attach(new InitPreviewRequest(item, previewID, this,
         container ? container : hwnd, rect));
-    if (async && initPreviewThread) {
+    if (async) {
+        AcquireSRWLockExclusive(&schedulerLock);
+        worker = scheduler.begin(schedulerKey(previewID));
+        ReleaseSRWLockExclusive(&schedulerLock);
+    }
+    DWORD threadID = async ? workerThreadID(worker) : 0;
+    if (threadID) {
         (*initRequest).AddRef(); // keep alive
-        checkLE(PostThreadMessage(GetThreadId(initPreviewThread),
-            MSG_INIT_PREVIEW_REQUEST, 0, (LPARAM)&*initRequest));
-    } else {
-        initPreview(initRequest, false);
+        if (checkLE(PostThreadMessage(threadID,
+                MSG_INIT_PREVIEW_REQUEST, 0, (LPARAM)&*initRequest)))
+            return;
+        (*initRequest).Release();
     }
+    if (async)
+        endRequest(worker);
+    if (!threadID)
+        initPreview(initRequest, nullptr);
 }
 
 void PreviewWindow::destroyPreview() {
@@ -154,12 +455,12 @@ void PreviewWindow::destroyPreview() {
 
         // Windows Media Player doesn't like if you delete another IPreviewHandler between
         // initializing and calling SetWindow. So ensure that preview handlers are deleted
-        // synchronously with the worker thread!
-        if (async && initPreviewThread) {
+        // synchronously with the worker thread! (handlers of each type always use the same one)
+        if (async && workerThreadID(worker)) {
             CComPtr<IStream> previewHandlerStream; // no CComPtr
             checkHR(CoMarshalInterThreadInterfaceInStream(__uuidof(IPreviewHandler), preview,
                 &previewHandlerStream));
-            checkLE(PostThreadMessage(GetThreadId(initPreviewThread),
+            checkLE(PostThreadMessage(workerThreadID(worker),
                 MSG_RELEASE_PREVIEW, 0, (LPARAM)previewHandlerStream.Detach()));
             CHROMAFILER_MEMLEAK_ALLOC;
         }
@@ -170,13 +471,11 @@ void PreviewWindow::destroyPreview() {
 
 void PreviewWindow::refresh() {
     ItemWindow::refresh();
-    initRequest->cancel();
     requestPreview(container ? clientRect(container) : windowBody());
 }
 
 void PreviewWindow::onItemChanged() {
     ItemWindow::onItemChanged();
-    initRequest->cancel();
     requestPreview(container ? clientRect(container) : windowBody());
 }
 
@@ -236,66 +535,88 @@ void PreviewWindow::InitPreviewRequest::cancel() {
     ReleaseSRWLockExclusive(&cancelLock);
 }
 
-DWORD WINAPI PreviewWindow::initPreviewThreadProc(void *) {
+bool PreviewWindow::InitPreviewRequest::isCancelled() {
+    return WaitForSingleObject(cancelEvent, 0) == WAIT_OBJECT_0;
+}
+
+DWORD WINAPI PreviewWindow::initPreviewThreadProc(void *param) {
+    PreviewWorker *worker = (PreviewWorker *)param;
     MSG msg;
-    while (GetMessage(&msg, nullptr, 0, 0)) {
+    while (true) {
+        // load handlers ahead of time and release unused ones, as long as nothing else is waiting
+        DWORD wait = worker->idleWait();
+        if (wait != INFINITE && !PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE)
+                && MsgWaitForMultipleObjects(0, nullptr, FALSE, wait, QS_ALLINPUT)
+                    == WAIT_TIMEOUT) {
+            worker->idle(wait);
+            continue;
+        }
+        if (!GetMessage(&msg, nullptr, 0, 0))
+            break;
         if (msg.hwnd == nullptr && msg.message == MSG_INIT_PREVIEW_REQUEST) {
             CComPtr<InitPreviewRequest> request;
             request.Attach((InitPreviewRequest *)msg.lParam);
-            initPreview(request, true);
+            initPreview(request, worker);
+            endRequest((int)(worker - previewWorkers));
         } else if (msg.hwnd == nullptr && msg.message == MSG_RELEASE_PREVIEW) {
             CComPtr<IPreviewHandler> preview;
             checkHR(CoGetInterfaceAndReleaseStream((IStream*)msg.lParam, IID_PPV_ARGS(&preview)));
             CHROMAFILER_MEMLEAK_FREE; // and immediately goes out of scope
+        } else if (msg.hwnd == nullptr && msg.message == MSG_PREFETCH_FACTORY) {
+            std::unique_ptr<CLSID> previewID((CLSID *)msg.lParam);
+            worker->loadFactory(*previewID);
         } else {
             // regular message loop is required by some preview handlers (eg. Windows Mime handler)
             TranslateMessage(&msg);
             DispatchMessage(&msg);
         }
     }
+    worker->releaseSpares(true); // before the apartment is uninitialized
     return 0;
 }
 
-void PreviewWindow::initPreview(InitPreviewRequest *const request, bool async) {
+// cancellation is checked between each step that may be slow, so when many requests are queued
+// (eg. while moving quickly through a folder) the ones that were superseded cost almost nothing
+void PreviewWindow::initPreview(InitPreviewRequest *const request, PreviewWorker *const worker) {
+    if (request->isCancelled())
+        return;
     CComPtr<IShellItem> item;
     if (!checkHR(SHCreateItemFromIDList(request->itemIDList, IID_PPV_ARGS(&item))))
         return;
     request->itemIDList.Free();
+    if (request->isCancelled())
+        return;
 
     CComPtr<IPreviewHandler> preview;
-    for (auto &entry : factoryCache) {
-        if (entry.clsid == request->previewID && entry.factory) {
-            debugPrintf(L"Found cached factory\n");
-            if (!checkHR(entry.factory->CreateInstance(nullptr, IID_PPV_ARGS(&preview)))) {
-                entry.clsid = {};
-                entry.factory = nullptr;
-            }
-        }
-    }
-    if (!preview) {
-        CComPtr<IClassFactory> factory;
-        if (!checkHR(CoGetClassObject(request->previewID, CLSCTX_LOCAL_SERVER, nullptr,
-                IID_PPV_ARGS(&factory))))
-            return;
-        if (!checkHR(factory->CreateInstance(nullptr, IID_PPV_ARGS(&preview))))
-            return;
-        if (async) {
-            // https://stackoverflow.com/a/5002596/11525734
-            factoryCache[factoryCacheIndex] = {request->previewID, factory};
-            factoryCacheIndex = (factoryCacheIndex + 1) % FACTORY_CACHE_SIZE;
-        }
-    }
+    bool spare = worker && worker->takeSpare(request->previewID, &preview);
+    if (!spare && !createHandler(request->previewID, worker, &preview))
+        return;
+    if (worker)
+        worker->queueSpare(request->previewID); // for the next preview of this type
 
-    if (WaitForSingleObject(request->cancelEvent, 0) == WAIT_OBJECT_0)
+    if (request->isCancelled())
         return; // early exit
-    if (!initPreviewWithItem(preview, item))
+    bool initialized = initPreviewWithItem(preview, item, request);
+    if (!initialized && spare && !request->isCancelled()) {
+        // the spare's server may have exited since it was created
+        preview = nullptr;
+        initialized = createHandler(request->previewID, worker, &preview)
+            && initPreviewWithItem(preview, item, request);
+    }
+    if (!initialized)
         return; // not initialized yet, no need to call Unload()
+    if (worker)
+        settings::addHandlerUse(request->previewID);
 
     CComQIPtr<IPreviewHandlerVisuals> visuals(preview);
     if (visuals) {
         checkHR(visuals->SetBackgroundColor(GetSysColor(COLOR_WINDOW)));
         visuals->SetTextColor(GetSysColor(COLOR_WINDOWTEXT)); // may not be implemented
     }
+    if (request->isCancelled()) {
+        checkHR(preview->Unload());
+        return; // early exit
+    }
 
     CComPtr<IStream> previewHandlerStream;
     checkHR(CoMarshalInterThreadInterfaceInStream(__uuidof(IPreviewHandler), preview,
@@ -303,7 +624,7 @@ void PreviewWindow::initPreview(InitPreviewRequest *const request, bool async) {
 
     // ensure the window is not closed before the message is posted
     AcquireSRWLockExclusive(&request->cancelLock);
-    if (WaitForSingleObject(request->cancelEvent, 0) == WAIT_OBJECT_0) {
+    if (request->isCancelled()) {
         ReleaseSRWLockExclusive(&request->cancelLock);
         checkHR(preview->Unload());
         return; // early exit
@@ -319,7 +640,8 @@ void PreviewWindow::initPreview(InitPreviewRequest *const request, bool async) {
     ReleaseSRWLockExclusive(&request->cancelLock);
 }
 
-bool PreviewWindow::initPreviewWithItem(IPreviewHandler *const preview, IShellItem *const item) {
+bool PreviewWindow::initPreviewWithItem(IPreviewHandler *const preview, IShellItem *const item,
+        InitPreviewRequest *const request) {
     CComPtr<IBindCtx> context;
     if (checkHR(CreateBindCtx(0, &context))) {
         BIND_OPTS options = {sizeof(BIND_OPTS), 0, STGM_READ | STGM_SHARE_DENY_NONE, 0};
@@ -327,7 +649,10 @@ bool PreviewWindow::initPreviewWithItem(IPreviewHandler *const preview, IShellIt
     }
     // try using stream first, it will be more secure by limiting file operations
     CComPtr<IStream> stream;
-    if (checkHR(item->BindToHandler(context, BHID_Stream, IID_PPV_ARGS(&stream)))) {
+    bool bound = checkHR(item->BindToHandler(context, BHID_Stream, IID_PPV_ARGS(&stream)));
+    if (request->isCancelled())
+        return false; // binding may have taken a while
+    if (bound) {
         CComQIPtr<IInitializeWithStream> streamInit(preview);
         if (streamInit) {
             if (checkHR(streamInit->Initialize(stream, STGM_READ))) {
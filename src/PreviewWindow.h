@@ -5,6 +5,8 @@
 
 namespace chromafiler {
 
+struct PreviewWorker;
+
 class PreviewWindow : public ItemWindow, public IPreviewHandlerFrame {
 
     struct InitPreviewRequest : public UnknownImpl {
@@ -12,6 +14,7 @@ class PreviewWindow : public ItemWindow, public IPreviewHandlerFrame {
             PreviewWindow *callbackWindow, HWND parent, RECT rect);
         ~InitPreviewRequest();
         void cancel(); // ok to call this multiple times
+        bool isCancelled();
 
         CComHeapPtr<ITEMIDLIST> itemIDList;
         const CLSID previewID;
@@ -25,6 +28,12 @@ class PreviewWindow : public ItemWindow, public IPreviewHandlerFrame {
 public:
     static void init();
     static void uninit();
+    // load the class factory for a preview handler in the background, so it opens sooner
+    static void prefetchFactory(CLSID previewID);
+    // called from a built-in preview's window when the item turns out to need ThumbnailView
+    // (eg. an animated PNG, or one too large to decode from a shell folder), to replace the
+    // preview. the preview is destroyed asynchronously
+    static void useThumbnailView(HWND previewHwnd);
 
     PreviewWindow(ItemWindow *parent, IShellItem *item, CLSID previewID, bool async = true);
 
@@ -40,10 +49,15 @@ protected:
     enum UserMessage {
         // WPARAM: 0, LPARAM: 0
         MSG_INIT_PREVIEW_COMPLETE = ItemWindow::MSG_LAST,
+        // WPARAM: 0, LPARAM: 0
+        MSG_USE_THUMBNAIL_VIEW,
         MSG_LAST
     };
     LRESULT handleMessage(UINT message, WPARAM wParam, LPARAM lParam) override;
 
+    const wchar_t * propBagName() const override;
+    bool registersShellWindow() const override;
+
     void onCreate() override;
     void onDestroy() override;
     void onActivate(WORD state, HWND prevWindow) override;
@@ -57,7 +71,8 @@ private:
     void destroyPreview();
 
     const bool async;
-    const CLSID previewID;
+    CLSID previewID; // only changed by MSG_USE_THUMBNAIL_VIEW
+    int worker = -1; // index of the thread that initializes the handler, if async
     CComPtr<InitPreviewRequest> initRequest;
     CComPtr<IPreviewHandler> preview; // will be null if preview can't be loaded!
     HWND container = nullptr;
@@ -65,11 +80,13 @@ private:
     SRWLOCK previewStreamLock = SRWLOCK_INIT;
     CComPtr<IStream> previewStream;
 
-    // worker thread
-    static HANDLE initPreviewThread;
+    // worker threads
     static DWORD WINAPI initPreviewThreadProc(void *);
-    static void initPreview(InitPreviewRequest *request, bool async);
-    static bool initPreviewWithItem(IPreviewHandler *preview, IShellItem *item);
+    // worker is null if called synchronously
+    static void initPreview(InitPreviewRequest *request, PreviewWorker *worker);
+    // returns false if the request was cancelled before the handler was initialized
+    static bool initPreviewWithItem(IPreviewHandler *preview, IShellItem *item,
+        InitPreviewRequest *request);
 };
 
 } // namespace
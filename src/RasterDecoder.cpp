@@ -0,0 +1,728 @@
+#include "RasterDecoder.h"
+#include "PixelOps.h"
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
+#include <vector>
+
+namespace chromafiler {
+
+const size_t RASTER_BUFFER_SIZE = 64 * 1024;
+
+// Buffered sequential input
+class RasterInput {
+public:
+    explicit RasterInput(const RasterReadFunc &read)
+        : readFunc(read), buffer(new uint8_t[RASTER_BUFFER_SIZE]) {}
+
+    // make size bytes available without consuming them. returns null if the input is too short
+    const uint8_t * peek(size_t size) {
+        if (end - pos < size && !fill(size))
+            return nullptr;
+        return &buffer[pos];
+    }
+
+    bool read(void *dest, size_t size) {
+        uint8_t *out = (uint8_t *)dest;
+        while (size) {
+            if (pos == end && !fill(1))
+                return false;
+            size_t count = std::min(size, end - pos);
+            memcpy(out, &buffer[pos], count);
+            pos += count;
+            out += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    int readByte() { // -1 at end
+        if (pos == end && !fill(1))
+            return -1;
+        return buffer[pos++];
+    }
+
+    bool skip(uint64_t size) {
+        while (size) {
+            if (pos == end && !fill(1))
+                return false;
+            size_t count = (size_t)std::min(size, (uint64_t)(end - pos));
+            pos += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    uint64_t position() const {
+        return consumed + pos;
+    }
+
+private:
+    bool fill(size_t size) {
+        if (size > RASTER_BUFFER_SIZE)
+            return false;
+        memmove(&buffer[0], &buffer[pos], end - pos);
+        consumed += pos;
+        end -= pos;
+        pos = 0;
+        while (end < size) {
+            size_t count = readFunc(&buffer[end], RASTER_BUFFER_SIZE - end);
+            if (count == 0 || count > RASTER_BUFFER_SIZE - end)
+                return false;
+            end += count;
+        }
+        return true;
+    }
+
+    RasterReadFunc readFunc;
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t pos = 0, end = 0;
+    uint64_t consumed = 0; // bytes before the start of the buffer
+};
+
+namespace {
+
+uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// pixel as 0xAARRGGBB, stored in BGRA byte order
+void storePixel(uint8_t *dest, uint32_t pixel) {
+    dest[0] = (uint8_t)pixel;
+    dest[1] = (uint8_t)(pixel >> 8);
+    dest[2] = (uint8_t)(pixel >> 16);
+    dest[3] = (uint8_t)(pixel >> 24);
+}
+
+uint32_t makePixel(uint32_t r, uint32_t g, uint32_t b, uint32_t a) {
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+uint8_t expand5(uint32_t value) {
+    return (uint8_t)((value << 3) | (value >> 2));
+}
+
+class BMPDecoder : public RasterDecoder {
+public:
+    explicit BMPDecoder(std::unique_ptr<RasterInput> input) : RasterDecoder(std::move(input)) {}
+    bool readRow(uint8_t *dest) override;
+protected:
+    bool readHeader() override;
+private:
+    struct Channel {
+        uint32_t mask;
+        int shift, bits;
+        uint8_t value(uint32_t pixel) const;
+    };
+    static Channel makeChannel(uint32_t mask);
+
+    int bitCount = 0;
+    bool bitfields = false;
+    Channel channels[4] = {}; // R, G, B, A
+    uint32_t palette[256];
+    size_t rowBytes = 0;
+    std::unique_ptr<uint8_t[]> row;
+};
+
+BMPDecoder::Channel BMPDecoder::makeChannel(uint32_t mask) {
+    Channel channel = {mask, 0, 0};
+    if (mask) {
+        while (!(mask & 1)) {
+            mask >>= 1;
+            channel.shift++;
+        }
+        while (mask & 1) {
+            mask >>= 1;
+            channel.bits++;
+        }
+    }
+    return channel;
+}
+
+uint8_t BMPDecoder::Channel::value(uint32_t pixel) const {
+    if (!bits)
+        return 0;
+    uint32_t value = (pixel & mask) >> shift;
+    if (bits >= 8)
+        return (uint8_t)(value >> (bits - 8));
+    uint32_t maxValue = (1u << bits) - 1;
+    return (uint8_t)(std::min(value, maxValue) * 255 / maxValue);
+}
+
+bool BMPDecoder::readHeader() {
+    // BITMAPFILEHEADER, then any version of BITMAPINFOHEADER (BITMAPV5HEADER is the largest)
+    const uint8_t *header = input->peek(18);
+    if (!header)
+        return false;
+    uint32_t dataOffset = le32(header + 10), infoSize = le32(header + 14);
+    if (infoSize != 12 && (infoSize < 40 || infoSize > 124))
+        return false;
+    if (!(header = input->peek(14 + infoSize)))
+        return false;
+
+    uint32_t compression = 0, colorsUsed = 0;
+    size_t paletteEntrySize = 4;
+    if (infoSize == 12) { // BITMAPCOREHEADER
+        imageWidth = le16(header + 18);
+        imageHeight = le16(header + 20);
+        bitCount = le16(header + 24);
+        paletteEntrySize = 3;
+        fromBottom = true;
+    } else {
+        int32_t width = (int32_t)le32(header + 18), height = (int32_t)le32(header + 22);
+        if (width <= 0 || width > MAX_RASTER_SIZE || height == 0
+                || height > MAX_RASTER_SIZE || height < -MAX_RASTER_SIZE)
+            return false;
+        imageWidth = width;
+        imageHeight = height < 0 ? -height : height;
+        fromBottom = height > 0;
+        bitCount = le16(header + 28);
+        compression = le32(header + 30);
+        colorsUsed = le32(header + 46);
+    }
+    if (imageWidth == 0 || imageHeight == 0)
+        return false;
+
+    const uint32_t BI_RGB = 0, BI_BITFIELDS = 3, BI_ALPHABITFIELDS = 6; // RLE is not supported
+    if (compression == BI_BITFIELDS || compression == BI_ALPHABITFIELDS) {
+        if (bitCount != 16 && bitCount != 32)
+            return false;
+        // masks follow a BITMAPINFOHEADER, or are part of later versions
+        bool hasAlphaMask = compression == BI_ALPHABITFIELDS || infoSize >= 56;
+        if (!(header = input->peek(14 + std::max(infoSize, 40u + (hasAlphaMask ? 16 : 12)))))
+            return false;
+        const uint8_t *masks = header + 14 + 40;
+        for (int c = 0; c < (hasAlphaMask ? 4 : 3); c++)
+            channels[c] = makeChannel(le32(masks + c * 4));
+        bitfields = true;
+        alpha = channels[3].mask != 0;
+    } else if (compression == BI_RGB) {
+        if (bitCount == 16) { // 5-5-5
+            channels[0] = makeChannel(0x7C00);
+            channels[1] = makeChannel(0x03E0);
+            channels[2] = makeChannel(0x001F);
+            bitfields = true;
+        } else if (bitCount != 1 && bitCount != 4 && bitCount != 8 && bitCount != 24
+                && bitCount != 32) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+    uint64_t headerSize = 14 + infoSize;
+    if (infoSize == 40 && bitfields && compression != BI_RGB)
+        headerSize += compression == BI_ALPHABITFIELDS ? 16 : 12;
+    if (!input->skip(headerSize))
+        return false;
+
+    for (uint32_t &entry : palette)
+        entry = 0xFF000000;
+    if (bitCount <= 8) {
+        uint32_t maxColors = 1u << bitCount;
+        uint32_t numColors = (colorsUsed && colorsUsed < maxColors) ? colorsUsed : maxColors;
+        for (uint32_t i = 0; i < numColors; i++) {
+            uint8_t entry[4];
+            if (!input->read(entry, paletteEntrySize))
+                return false;
+            palette[i] = makePixel(entry[2], entry[1], entry[0], 255);
+        }
+    }
+    if (dataOffset > input->position() && !input->skip(dataOffset - input->position()))
+        return false;
+
+    rowBytes = (((size_t)imageWidth * bitCount + 31) / 32) * 4;
+    row.reset(new uint8_t[rowBytes]);
+    return true;
+}
+
+bool BMPDecoder::readRow(uint8_t *dest) {
+    if (!input->read(row.get(), rowBytes))
+        return false;
+    const uint8_t *src = row.get();
+    if (bitCount <= 8) {
+        int mask = (1 << bitCount) - 1;
+        for (int x = 0; x < imageWidth; x++) {
+            int bit = x * bitCount;
+            int index = (src[bit / 8] >> (8 - bitCount - bit % 8)) & mask;
+            storePixel(dest + x * 4, palette[index]);
+        }
+    } else if (bitCount == 24) {
+        expandRGB24(src, dest, imageWidth, false);
+    } else if (!bitfields) { // 32 bit, alpha byte is unused
+        for (int x = 0; x < imageWidth; x++)
+            storePixel(dest + x * 4, le32(src + x * 4) | 0xFF000000);
+    } else {
+        for (int x = 0; x < imageWidth; x++) {
+            uint32_t value = bitCount == 16 ? le16(src + x * 2) : le32(src + x * 4);
+            storePixel(dest + x * 4, makePixel(channels[0].value(value),
+                channels[1].value(value), channels[2].value(value),
+                alpha ? channels[3].value(value) : 255));
+        }
+    }
+    if (alpha)
+        premultiplyAlpha(dest, imageWidth, 1, 0);
+    return true;
+}
+
+class TGADecoder : public RasterDecoder {
+public:
+    explicit TGADecoder(std::unique_ptr<RasterInput> input) : RasterDecoder(std::move(input)) {}
+    bool readRow(uint8_t *dest) override;
+protected:
+    bool readHeader() override;
+private:
+    uint32_t colorValue(const uint8_t *p, int depth) const;
+    uint32_t pixelValue(const uint8_t *p) const;
+
+    enum ImageType { TGA_COLOR_MAPPED = 1, TGA_TRUE_COLOR = 2, TGA_GRAYSCALE = 3 };
+    int imageType = 0, depth = 0, bytesPerPixel = 0;
+    bool rle = false, rightToLeft = false;
+    int paletteFirst = 0;
+    std::vector<uint32_t> palette;
+    std::unique_ptr<uint8_t[]> row;
+    // RLE packets may continue across rows
+    int packetRemaining = 0;
+    bool packetIsRun = false;
+    uint32_t runPixel = 0;
+};
+
+bool TGADecoder::readHeader() {
+    const uint8_t *header = input->peek(18);
+    if (!header)
+        return false;
+    int idLength = header[0], colorMapType = header[1];
+    imageType = header[2] & 7;
+    rle = (header[2] & 8) != 0;
+    paletteFirst = le16(header + 3);
+    int paletteLength = le16(header + 5), paletteDepth = header[7];
+    imageWidth = le16(header + 12);
+    imageHeight = le16(header + 14);
+    depth = header[16];
+    int descriptor = header[17];
+    fromBottom = !(descriptor & 0x20);
+    rightToLeft = (descriptor & 0x10) != 0;
+    bool alphaBits = (descriptor & 0xF) != 0;
+
+    if ((header[2] & ~0xB) != 0 || colorMapType > 1 || imageWidth == 0 || imageHeight == 0)
+        return false;
+    auto isColorDepth = [](int d) { return d == 15 || d == 16 || d == 24 || d == 32; };
+    switch (imageType) {
+        case TGA_COLOR_MAPPED:
+            if (colorMapType != 1 || !isColorDepth(paletteDepth) || (depth != 8 && depth != 16))
+                return false;
+            alpha = alphaBits && (paletteDepth == 16 || paletteDepth == 32);
+            break;
+        case TGA_TRUE_COLOR:
+            if (!isColorDepth(depth))
+                return false;
+            alpha = alphaBits && (depth == 16 || depth == 32);
+            break;
+        case TGA_GRAYSCALE:
+            if (depth != 8)
+                return false;
+            break;
+        default:
+            return false;
+    }
+    bytesPerPixel = (depth + 7) / 8;
+    if (!input->skip(18 + idLength))
+        return false;
+
+    if (colorMapType == 1) {
+        if (!isColorDepth(paletteDepth))
+            return false;
+        size_t entrySize = (paletteDepth + 7) / 8;
+        bool keep = imageType == TGA_COLOR_MAPPED;
+        if (keep)
+            palette.resize(paletteLength);
+        for (int i = 0; i < paletteLength; i++) {
+            uint8_t entry[4];
+            if (!input->read(entry, entrySize))
+                return false;
+            if (keep)
+                palette[i] = colorValue(entry, paletteDepth);
+        }
+    }
+    row.reset(new uint8_t[(size_t)imageWidth * bytesPerPixel]);
+    return true;
+}
+
+uint32_t TGADecoder::colorValue(const uint8_t *p, int colorDepth) const {
+    switch (colorDepth) {
+        case 15:
+        case 16: {
+            uint16_t value = le16(p);
+            uint32_t a = (alpha && !(value & 0x8000)) ? 0 : 255;
+            return makePixel(expand5((value >> 10) & 31), expand5((value >> 5) & 31),
+                expand5(value & 31), a);
+        }
+        case 24:
+            return makePixel(p[2], p[1], p[0], 255);
+        default:
+            return makePixel(p[2], p[1], p[0], alpha ? p[3] : 255);
+    }
+}
+
+uint32_t TGADecoder::pixelValue(const uint8_t *p) const {
+    if (imageType == TGA_GRAYSCALE) {
+        return makePixel(p[0], p[0], p[0], 255);
+    } else if (imageType == TGA_COLOR_MAPPED) {
+        int index = (depth == 8 ? p[0] : le16(p)) - paletteFirst;
+        return (index >= 0 && index < (int)palette.size()) ? palette[index] : 0xFF000000;
+    } else {
+        return colorValue(p, depth);
+    }
+}
+
+bool TGADecoder::readRow(uint8_t *dest) {
+    if (!rle) {
+        if (!input->read(row.get(), (size_t)imageWidth * bytesPerPixel))
+            return false;
+        if (imageType == TGA_TRUE_COLOR && depth == 24) {
+            expandRGB24(row.get(), dest, imageWidth, false);
+        } else if (imageType == TGA_GRAYSCALE) {
+            expandGray8(row.get(), dest, imageWidth);
+        } else {
+            for (int x = 0; x < imageWidth; x++)
+                storePixel(dest + x * 4, pixelValue(row.get() + x * bytesPerPixel));
+        }
+    } else {
+        uint8_t raw[4];
+        for (int x = 0; x < imageWidth; x++) {
+            if (packetRemaining == 0) {
+                int packet = input->readByte();
+                if (packet < 0)
+                    return false;
+                packetRemaining = (packet & 0x7F) + 1;
+                packetIsRun = (packet & 0x80) != 0;
+                if (packetIsRun) {
+                    if (!input->read(raw, bytesPerPixel))
+                        return false;
+                    runPixel = pixelValue(raw);
+                }
+            }
+            packetRemaining--;
+            if (packetIsRun) {
+                storePixel(dest + x * 4, runPixel);
+            } else {
+                if (!input->read(raw, bytesPerPixel))
+                    return false;
+                storePixel(dest + x * 4, pixelValue(raw));
+            }
+        }
+    }
+    if (rightToLeft) {
+        uint32_t *pixels = (uint32_t *)dest;
+        std::reverse(pixels, pixels + imageWidth);
+    }
+    if (alpha)
+        premultiplyAlpha(dest, imageWidth, 1, 0);
+    return true;
+}
+
+class PNMDecoder : public RasterDecoder {
+public:
+    explicit PNMDecoder(std::unique_ptr<RasterInput> input) : RasterDecoder(std::move(input)) {}
+    bool readRow(uint8_t *dest) override;
+protected:
+    bool readHeader() override;
+private:
+    bool skipSpace(); // whitespace and comments. returns false at end of input
+    bool readNumber(uint32_t *value);
+    uint8_t scale(uint32_t sample) const;
+
+    int type = 0; // 1-6
+    uint32_t maxValue = 1;
+    uint8_t scaleTable[256]; // for maxValue < 256
+    std::unique_ptr<uint8_t[]> row;
+};
+
+bool PNMDecoder::skipSpace() {
+    const uint8_t *c;
+    while ((c = input->peek(1)) != nullptr) {
+        if (*c == '#') {
+            int b;
+            do {
+                b = input->readByte();
+            } while (b >= 0 && b != '\n' && b != '\r');
+        } else if (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r' || *c == '\v'
+                || *c == '\f') {
+            input->readByte();
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PNMDecoder::readNumber(uint32_t *value) {
+    if (!skipSpace())
+        return false;
+    uint32_t result = 0;
+    int digits = 0;
+    const uint8_t *c;
+    while ((c = input->peek(1)) != nullptr && *c >= '0' && *c <= '9') {
+        if (++digits > 6)
+            return false;
+        result = result * 10 + (*c - '0');
+        input->readByte();
+    }
+    *value = result;
+    return digits > 0;
+}
+
+uint8_t PNMDecoder::scale(uint32_t sample) const {
+    if (sample >= maxValue)
+        return 255;
+    return (uint8_t)((sample * 255 + maxValue / 2) / maxValue);
+}
+
+bool PNMDecoder::readHeader() {
+    const uint8_t *magic = input->peek(2);
+    if (!magic || magic[0] != 'P' || magic[1] < '1' || magic[1] > '6')
+        return false;
+    type = magic[1] - '0';
+    input->skip(2);
+    uint32_t width, height;
+    if (!readNumber(&width) || !readNumber(&height))
+        return false;
+    if (type != 1 && type != 4) {
+        if (!readNumber(&maxValue) || maxValue == 0 || maxValue > 65535)
+            return false;
+    }
+    if (width == 0 || width > MAX_RASTER_SIZE || height == 0 || height > MAX_RASTER_SIZE)
+        return false;
+    imageWidth = (int)width;
+    imageHeight = (int)height;
+    if (type >= 4) {
+        // binary data follows a single whitespace character
+        int c = input->readByte();
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            return false;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        scaleTable[i] = scale(i);
+    int samples = type == 3 || type == 6 ? 3 : 1;
+    row.reset(new uint8_t[(size_t)imageWidth * samples * 2]);
+    return true;
+}
+
+bool PNMDecoder::readRow(uint8_t *dest) {
+    const uint32_t BLACK = 0xFF000000, WHITE = 0xFFFFFFFF;
+    switch (type) {
+        case 1: // ASCII bitmap, digits don't need to be separated
+            for (int x = 0; x < imageWidth; x++) {
+                if (!skipSpace())
+                    return false;
+                int c = input->readByte();
+                if (c != '0' && c != '1')
+                    return false;
+                storePixel(dest + x * 4, c == '1' ? BLACK : WHITE);
+            }
+            return true;
+        case 2:
+        case 3: {
+            int samples = type == 3 ? 3 : 1;
+            uint32_t value[3];
+            for (int x = 0; x < imageWidth; x++) {
+                for (int s = 0; s < samples; s++) {
+                    if (!readNumber(&value[s]))
+                        return false;
+                }
+                if (samples == 1) {
+                    uint8_t g = scale(value[0]);
+                    storePixel(dest + x * 4, makePixel(g, g, g, 255));
+                } else {
+                    storePixel(dest + x * 4,
+                        makePixel(scale(value[0]), scale(value[1]), scale(value[2]), 255));
+                }
+            }
+            return true;
+        }
+        case 4: { // binary bitmap, rows padded to whole bytes
+            uint8_t *src = row.get();
+            if (!input->read(src, ((size_t)imageWidth + 7) / 8))
+                return false;
+            for (int x = 0; x < imageWidth; x++)
+                storePixel(dest + x * 4, (src[x / 8] & (0x80 >> (x % 8))) ? BLACK : WHITE);
+            return true;
+        }
+        default: { // binary graymap or pixmap
+            int samples = type == 6 ? 3 : 1;
+            size_t count = (size_t)imageWidth * samples;
+            uint8_t *src = row.get();
+            if (maxValue < 256) {
+                if (!input->read(src, count))
+                    return false;
+                if (maxValue != 255) {
+                    for (size_t i = 0; i < count; i++)
+                        src[i] = scaleTable[src[i]];
+                }
+            } else { // 16-bit big endian samples
+                if (!input->read(src, count * 2))
+                    return false;
+                for (size_t i = 0; i < count; i++)
+                    src[i] = scale(((uint32_t)src[i * 2] << 8) | src[i * 2 + 1]);
+            }
+            if (samples == 3) {
+                expandRGB24(src, dest, imageWidth, true);
+            } else {
+                expandGray8(src, dest, imageWidth);
+            }
+            return true;
+        }
+    }
+}
+
+// https://qoiformat.org/qoi-specification.pdf
+class QOIDecoder : public RasterDecoder {
+public:
+    explicit QOIDecoder(std::unique_ptr<RasterInput> input) : RasterDecoder(std::move(input)) {}
+    bool readRow(uint8_t *dest) override;
+protected:
+    bool readHeader() override;
+private:
+    struct Color {
+        uint8_t r, g, b, a;
+    };
+
+    Color pixel = {0, 0, 0, 255};
+    Color index[64] = {};
+    int run = 0;
+};
+
+bool QOIDecoder::readHeader() {
+    const uint8_t *header = input->peek(14);
+    if (!header || memcmp(header, "qoif", 4))
+        return false;
+    uint32_t width = be32(header + 4), height = be32(header + 8);
+    int channels = header[12];
+    if (width == 0 || width > MAX_RASTER_SIZE || height == 0 || height > MAX_RASTER_SIZE
+            || (channels != 3 && channels != 4))
+        return false;
+    imageWidth = (int)width;
+    imageHeight = (int)height;
+    alpha = channels == 4;
+    return input->skip(14);
+}
+
+bool QOIDecoder::readRow(uint8_t *dest) {
+    const int OP_RGB = 0xFE, OP_RGBA = 0xFF;
+    const int OP_INDEX = 0, OP_DIFF = 1, OP_LUMA = 2, OP_RUN = 3; // top two bits
+    for (int x = 0; x < imageWidth; x++, dest += 4) {
+        if (run > 0) {
+            run--;
+        } else {
+            int b1 = input->readByte();
+            if (b1 < 0)
+                return false;
+            if (b1 == OP_RGB) {
+                if (!input->read(&pixel, 3))
+                    return false;
+            } else if (b1 == OP_RGBA) {
+                if (!input->read(&pixel, 4))
+                    return false;
+            } else {
+                switch (b1 >> 6) {
+                    case OP_INDEX:
+                        pixel = index[b1];
+                        break;
+                    case OP_DIFF:
+                        pixel.r += (uint8_t)(((b1 >> 4) & 3) - 2);
+                        pixel.g += (uint8_t)(((b1 >> 2) & 3) - 2);
+                        pixel.b += (uint8_t)((b1 & 3) - 2);
+                        break;
+                    case OP_LUMA: {
+                        int b2 = input->readByte();
+                        if (b2 < 0)
+                            return false;
+                        int dg = (b1 & 0x3F) - 32;
+                        pixel.r += (uint8_t)(dg - 8 + (b2 >> 4));
+                        pixel.g += (uint8_t)dg;
+                        pixel.b += (uint8_t)(dg - 8 + (b2 & 0xF));
+                        break;
+                    }
+                    case OP_RUN:
+                        run = b1 & 0x3F; // after this pixel
+                        break;
+                }
+            }
+            index[(pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64] = pixel;
+        }
+        dest[0] = pixel.b;
+        dest[1] = pixel.g;
+        dest[2] = pixel.r;
+        dest[3] = pixel.a;
+    }
+    if (alpha)
+        premultiplyAlpha(dest - imageWidth * 4, imageWidth, 1, 0);
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<RasterDecoder> RasterDecoder::open(const RasterReadFunc &read) {
+    std::unique_ptr<RasterInput> input(new RasterInput(read));
+    std::unique_ptr<RasterDecoder> decoder;
+    const uint8_t *magic;
+    if ((magic = input->peek(2)) != nullptr && magic[0] == 'B' && magic[1] == 'M') {
+        decoder.reset(new BMPDecoder(std::move(input)));
+    } else if (magic && magic[0] == 'P' && magic[1] >= '1' && magic[1] <= '6') {
+        decoder.reset(new PNMDecoder(std::move(input)));
+    } else if ((magic = input->peek(4)) != nullptr && !memcmp(magic, "qoif", 4)) {
+        decoder.reset(new QOIDecoder(std::move(input)));
+    } else {
+        // TGA has no signature, the header is validated instead
+        decoder.reset(new TGADecoder(std::move(input)));
+    }
+    if (!decoder->readHeader())
+        return nullptr;
+    return decoder;
+}
+
+bool RasterDecoder::isRasterExtension(const wchar_t *extension) {
+    static const wchar_t *const EXTENSIONS[] = {L".bmp", L".dib", L".tga", L".pbm", L".pgm",
+        L".ppm", L".pnm", L".qoi"};
+    if (!extension)
+        return false;
+    for (const wchar_t *ext : EXTENSIONS) {
+        const wchar_t *a = ext, *b = extension;
+        while (*a && *b && *a == (wchar_t)towlower(*b)) {
+            a++;
+            b++;
+        }
+        if (!*a && !*b)
+            return true;
+    }
+    return false;
+}
+
+RasterDecoder::RasterDecoder(std::unique_ptr<RasterInput> input) : input(std::move(input)) {}
+
+RasterDecoder::~RasterDecoder() = default;
+
+int RasterDecoder::width() const {
+    return imageWidth;
+}
+
+int RasterDecoder::height() const {
+    return imageHeight;
+}
+
+bool RasterDecoder::bottomUp() const {
+    return fromBottom;
+}
+
+bool RasterDecoder::hasAlpha() const {
+    return alpha;
+}
+
+} // namespace
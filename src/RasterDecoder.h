@@ -0,0 +1,44 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace chromafiler {
+
+// Reads up to size bytes from the current position, returns the number of bytes read (0 at EOF)
+typedef std::function<size_t(void *buffer, size_t size)> RasterReadFunc;
+
+const int MAX_RASTER_SIZE = 65535; // width or height
+
+class RasterInput;
+
+// Streaming decoder for simple raster formats: BMP (uncompressed), TGA, PNM (PBM/PGM/PPM) and
+// QOI. Rows are decoded one at a time into premultiplied 32-bit BGRA, so memory use depends on
+// the width of the image but not the height. Input is read sequentially in blocks.
+class RasterDecoder {
+public:
+    // returns null if the format is not recognized or the header is invalid
+    static std::unique_ptr<RasterDecoder> open(const RasterReadFunc &read);
+    static bool isRasterExtension(const wchar_t *extension); // eg. L".qoi", case-insensitive
+
+    virtual ~RasterDecoder();
+    int width() const;
+    int height() const;
+    bool bottomUp() const; // rows are decoded starting from the bottom of the image
+    bool hasAlpha() const;
+    // decode the next row into width() pixels. returns false if the data is invalid or truncated
+    virtual bool readRow(uint8_t *dest) = 0;
+
+protected:
+    explicit RasterDecoder(std::unique_ptr<RasterInput> input);
+    virtual bool readHeader() = 0;
+
+    std::unique_ptr<RasterInput> input;
+    int imageWidth = 0, imageHeight = 0;
+    bool fromBottom = false, alpha = false;
+};
+
+} // namespace
@@ -0,0 +1,267 @@
+#include "Resample.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace chromafiler {
+
+const int WEIGHT_BITS = 14;
+const int WEIGHT_ONE = 1 << WEIGHT_BITS;
+const int BAND_ROWS = 32;
+const double PI = 3.14159265358979323846;
+
+// weights of source pixels contributing to each destination pixel
+struct Contributions {
+    int maxTaps;
+    std::vector<int> start, count;
+    std::vector<int16_t> weights; // maxTaps per destination pixel
+};
+
+static double boxWeight(double x) {
+    return (x >= -0.5 && x < 0.5) ? 1.0 : 0.0;
+}
+
+static double sinc(double x) {
+    if (x == 0.0)
+        return 1.0;
+    x *= PI;
+    return sin(x) / x;
+}
+
+static double lanczos3Weight(double x) {
+    return (x > -3.0 && x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+static void computeContributions(int srcSize, int destSize, ResampleFilter filter,
+        Contributions *contrib) {
+    double (*weightFunc)(double) = filter == RESAMPLE_BOX ? boxWeight : lanczos3Weight;
+    double radius = filter == RESAMPLE_BOX ? 0.5 : 3.0;
+    double scale = (double)srcSize / destSize;
+    double filterScale = scale > 1.0 ? scale : 1.0; // widen the filter when reducing
+    double support = radius * filterScale;
+
+    contrib->maxTaps = (int)ceil(support) * 2 + 1;
+    contrib->start.resize(destSize);
+    contrib->count.resize(destSize);
+    contrib->weights.assign((size_t)destSize * contrib->maxTaps, 0);
+    std::vector<double> weights(contrib->maxTaps);
+    for (int i = 0; i < destSize; i++) {
+        double center = (i + 0.5) * scale;
+        int first = (int)floor(center - support), last = (int)ceil(center + support);
+        first = first < 0 ? 0 : first;
+        last = last > srcSize ? srcSize : last;
+        if (last - first > contrib->maxTaps)
+            last = first + contrib->maxTaps;
+
+        double total = 0;
+        int count = last - first;
+        for (int j = 0; j < count; j++) {
+            weights[j] = weightFunc((first + j + 0.5 - center) / filterScale);
+            total += weights[j];
+        }
+        // trim taps with no weight
+        while (count > 1 && weights[count - 1] == 0.0)
+            count--;
+        int skip = 0;
+        while (skip < count - 1 && weights[skip] == 0.0)
+            skip++;
+
+        int16_t *fixedWeights = contrib->weights.data() + (size_t)i * contrib->maxTaps;
+        int fixedTotal = 0, largest = skip;
+        for (int j = skip; j < count; j++) {
+            double w = total != 0.0 ? weights[j] / total : (j == skip ? 1.0 : 0.0);
+            fixedWeights[j - skip] = (int16_t)lround(w * WEIGHT_ONE);
+            fixedTotal += fixedWeights[j - skip];
+            if (weights[j] > weights[largest])
+                largest = j;
+        }
+        // make weights sum to exactly one so flat areas are unchanged
+        fixedWeights[largest - skip] += (int16_t)(WEIGHT_ONE - fixedTotal);
+        contrib->start[i] = first + skip;
+        contrib->count[i] = count - skip;
+    }
+}
+
+#if defined(_M_IX86) || defined(_M_X64)
+// for _mm_madd_epi16: w0 in the low half of each 32-bit lane, w1 in the high half
+static inline __m128i weightPair(int16_t w0, int16_t w1) {
+    return _mm_set1_epi32((int)(((uint32_t)(uint16_t)w1 << 16) | (uint16_t)w0));
+}
+#endif
+
+static inline uint8_t clampChannel(int sum) {
+    sum = (sum + (WEIGHT_ONE / 2)) >> WEIGHT_BITS;
+    return (uint8_t)(sum < 0 ? 0 : (sum > 255 ? 255 : sum));
+}
+
+static void resampleRowH(const uint8_t *src, uint8_t *dest, int destWidth,
+        const Contributions &contrib) {
+    for (int x = 0; x < destWidth; x++, dest += 4) {
+        const uint8_t *p = src + contrib.start[x] * 4;
+        const int16_t *w = contrib.weights.data() + (size_t)x * contrib.maxTaps;
+        int count = contrib.count[x];
+#if defined(_M_IX86) || defined(_M_X64)
+        // multiply-add two taps at a time, with channels of both pixels interleaved
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = _mm_setzero_si128();
+        int j = 0;
+        for (; j + 2 <= count; j += 2) {
+            __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + j * 4)), zero);
+            __m128i pairs = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+            __m128i weights = weightPair(w[j], w[j + 1]);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pairs, weights));
+        }
+        if (j < count) {
+            __m128i pixel = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(p + j * 4)), zero);
+            __m128i pairs = _mm_unpacklo_epi16(pixel, zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pairs, weightPair(w[j], 0)));
+        }
+        sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(WEIGHT_ONE / 2)), WEIGHT_BITS);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum, zero), zero);
+        *(int *)dest = _mm_cvtsi128_si32(packed);
+#else
+        int sum[4] = {};
+        for (int j = 0; j < count; j++) {
+            for (int c = 0; c < 4; c++)
+                sum[c] += p[j * 4 + c] * w[j];
+        }
+        for (int c = 0; c < 4; c++)
+            dest[c] = clampChannel(sum[c]);
+#endif
+    }
+}
+
+static void resampleRowV(const uint8_t *const *rows, const int16_t *w, int count,
+        uint8_t *dest, int width) {
+    int x = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+    // 4 pixels (16 channels) at a time, two rows per multiply-add
+    const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(WEIGHT_ONE / 2);
+    for (; x + 4 <= width; x += 4) {
+        __m128i sum[4] = {zero, zero, zero, zero};
+        int offset = x * 4;
+        for (int j = 0; j < count; j += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[j] + offset));
+            __m128i b = zero, weights;
+            if (j + 1 < count) {
+                b = _mm_loadu_si128((const __m128i *)(rows[j + 1] + offset));
+                weights = weightPair(w[j], w[j + 1]);
+            } else {
+                weights = weightPair(w[j], 0);
+            }
+            __m128i aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+            __m128i bLo = _mm_unpacklo_epi8(b, zero), bHi = _mm_unpackhi_epi8(b, zero);
+            sum[0] = _mm_add_epi32(sum[0], _mm_madd_epi16(_mm_unpacklo_epi16(aLo, bLo), weights));
+            sum[1] = _mm_add_epi32(sum[1], _mm_madd_epi16(_mm_unpackhi_epi16(aLo, bLo), weights));
+            sum[2] = _mm_add_epi32(sum[2], _mm_madd_epi16(_mm_unpacklo_epi16(aHi, bHi), weights));
+            sum[3] = _mm_add_epi32(sum[3], _mm_madd_epi16(_mm_unpackhi_epi16(aHi, bHi), weights));
+        }
+        for (auto &s : sum)
+            s = _mm_srai_epi32(_mm_add_epi32(s, round), WEIGHT_BITS);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum[0], sum[1]),
+            _mm_packs_epi32(sum[2], sum[3]));
+        _mm_storeu_si128((__m128i *)(dest + offset), packed);
+    }
+#endif
+    for (int i = x * 4; i < width * 4; i++) {
+        int sum = 0;
+        for (int j = 0; j < count; j++)
+            sum += rows[j][i] * w[j];
+        dest[i] = clampChannel(sum);
+    }
+}
+
+void resamplePixels(const uint8_t *src, int srcWidth, int srcHeight, ptrdiff_t srcStride,
+        uint8_t *dest, int destWidth, int destHeight, ptrdiff_t destStride,
+        ResampleFilter filter, ParallelForFunc parallel) {
+    if (srcWidth <= 0 || srcHeight <= 0 || destWidth <= 0 || destHeight <= 0)
+        return;
+    Contributions horizontal, vertical;
+    computeContributions(srcWidth, destWidth, filter, &horizontal);
+    computeContributions(srcHeight, destHeight, filter, &vertical);
+
+    // only the source rows used by the vertical pass need a horizontal pass
+    int firstRow = vertical.start[0];
+    int lastRow = vertical.start[destHeight - 1] + vertical.count[destHeight - 1];
+    int numRows = lastRow - firstRow;
+    ptrdiff_t tempStride = (ptrdiff_t)destWidth * 4;
+    std::unique_ptr<uint8_t[]> temp(new uint8_t[numRows * tempStride]);
+
+    size_t numBands = (numRows + BAND_ROWS - 1) / BAND_ROWS;
+    parallel(numBands, [&](size_t band) {
+        int end = (int)std::min((band + 1) * BAND_ROWS, (size_t)numRows);
+        for (int y = (int)band * BAND_ROWS; y < end; y++) {
+            resampleRowH(src + (firstRow + y) * srcStride, temp.get() + y * tempStride,
+                destWidth, horizontal);
+        }
+    });
+
+    numBands = (destHeight + BAND_ROWS - 1) / BAND_ROWS;
+    parallel(numBands, [&](size_t band) {
+        std::vector<const uint8_t *> rows(vertical.maxTaps);
+        int end = (int)std::min((band + 1) * BAND_ROWS, (size_t)destHeight);
+        for (int y = (int)band * BAND_ROWS; y < end; y++) {
+            int count = vertical.count[y];
+            for (int j = 0; j < count; j++)
+                rows[j] = temp.get() + (vertical.start[y] - firstRow + j) * tempStride;
+            resampleRowV(rows.data(), vertical.weights.data() + (size_t)y * vertical.maxTaps,
+                count, dest + y * destStride, destWidth);
+        }
+    });
+}
+
+BoxDownscaler::BoxDownscaler(int srcWidth, int srcHeight, int destWidth, int destHeight)
+        : srcWidth(srcWidth), srcHeight(srcHeight),
+          // limit the area of each destination pixel so sums of 8-bit values fit in 32 bits
+          destWidth(std::max(destWidth, (srcWidth + 4095) / 4096)),
+          destHeight(std::max(destHeight, (srcHeight + 4095) / 4096)) {
+    columnMap.resize(srcWidth);
+    columnCounts.assign(this->destWidth, 0);
+    for (int x = 0; x < srcWidth; x++) {
+        columnMap[x] = (int)((int64_t)x * this->destWidth / srcWidth);
+        columnCounts[columnMap[x]]++;
+    }
+    rowCounts.assign(this->destHeight, 0);
+    sums.assign((size_t)this->destWidth * this->destHeight * 4, 0);
+}
+
+int BoxDownscaler::width() const {
+    return destWidth;
+}
+
+int BoxDownscaler::height() const {
+    return destHeight;
+}
+
+void BoxDownscaler::addRow(int y, const uint8_t *pixels) {
+    if (y < 0 || y >= srcHeight)
+        return;
+    int destY = (int)((int64_t)y * destHeight / srcHeight);
+    rowCounts[destY]++;
+    uint32_t *row = &sums[(size_t)destY * destWidth * 4];
+    for (int x = 0; x < srcWidth; x++, pixels += 4) {
+        uint32_t *sum = row + columnMap[x] * 4;
+        sum[0] += pixels[0];
+        sum[1] += pixels[1];
+        sum[2] += pixels[2];
+        sum[3] += pixels[3];
+    }
+}
+
+void BoxDownscaler::finish(uint8_t *dest, ptrdiff_t destStride) const {
+    for (int y = 0; y < destHeight; y++, dest += destStride) {
+        const uint32_t *sum = &sums[(size_t)y * destWidth * 4];
+        uint8_t *p = dest;
+        for (int x = 0; x < destWidth; x++, sum += 4, p += 4) {
+            uint64_t count = (uint64_t)columnCounts[x] * rowCounts[y];
+            for (int c = 0; c < 4; c++)
+                p[c] = count ? (uint8_t)((sum[c] + count / 2) / count) : 0;
+        }
+    }
+}
+
+} // namespace
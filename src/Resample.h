@@ -0,0 +1,44 @@
+#pragma once
+#include <common.h>
+
+#include "ThreadUtils.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chromafiler {
+
+enum ResampleFilter {
+    RESAMPLE_BOX, // area average, fast
+    RESAMPLE_LANCZOS3, // sharper, slower for large reductions
+};
+
+// Resize 32-bit BGRA pixels with a separable filter, using 14-bit fixed point weights and SSE2.
+// Strides may be negative for bottom-up images. Bands of rows are processed using parallel.
+void resamplePixels(const uint8_t *src, int srcWidth, int srcHeight, ptrdiff_t srcStride,
+    uint8_t *dest, int destWidth, int destHeight, ptrdiff_t destStride,
+    ResampleFilter filter, ParallelForFunc parallel);
+
+// Reduces an image with an area average as its rows arrive (in any order), so a large image can
+// be scaled down while it's decoded without holding all of it in memory. Uses 16 bytes per
+// destination pixel. Pixels should have premultiplied alpha.
+class BoxDownscaler {
+public:
+    // destination must not be larger than the source. it may be enlarged so each destination
+    // pixel covers at most 4096 x 4096 source pixels
+    BoxDownscaler(int srcWidth, int srcHeight, int destWidth, int destHeight);
+    int width() const;
+    int height() const;
+    void addRow(int y, const uint8_t *pixels);
+    // write the averaged pixels. areas where no rows were added are transparent
+    void finish(uint8_t *dest, ptrdiff_t destStride) const;
+
+private:
+    int srcWidth, srcHeight, destWidth, destHeight;
+    std::vector<int> columnMap; // destination column of each source column
+    std::vector<uint32_t> columnCounts; // source columns per destination column
+    std::vector<uint32_t> rowCounts; // source rows added per destination row
+    std::vector<uint32_t> sums; // 4 channels per destination pixel
+};
+
+} // namespace
@@ -15,6 +15,7 @@ const wchar_t KEY_SETTINGS_TEST[]       = L"Software\\ChromaFiler\\Test";
     #define KEY_SETTINGS KEY_SETTINGS_NORMAL
 #endif
 
+const wchar_t KEY_HANDLER_USAGE[]       = L"HandlerUsage"; // subkey of settings
 const wchar_t KEY_STARTUP[]             = L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Run";
 const wchar_t VAL_STARTUP[]             = L"ChromaFiler";
 const wchar_t KEY_DIRECTORY_VERB[]      = L"Directory\\shell\\chromafiler";
@@ -149,6 +150,58 @@ SETTINGS_BOOL_VALUE(StatusTextEnabled, L"StatusTextEnabled", DEFAULT_STATUS_TEXT
 SETTINGS_BOOL_VALUE(ToolbarEnabled, L"ToolbarEnabled", DEFAULT_TOOLBAR_ENABLED)
 
 SETTINGS_BOOL_VALUE(PreviewsEnabled, L"PreviewsEnabled", DEFAULT_PREVIEWS_ENABLED)
+SETTINGS_DWORD_VALUE(ThumbnailCacheSize, DWORD, L"ThumbnailCacheSize",
+    DEFAULT_THUMBNAIL_CACHE_SIZE)
+SETTINGS_BOOL_VALUE(ImageStatsEnabled, L"ImageStatsEnabled", DEFAULT_IMAGE_STATS_ENABLED)
+SETTINGS_DWORD_VALUE(HandlerCacheSize, DWORD, L"HandlerCacheSize", DEFAULT_HANDLER_CACHE_SIZE)
+SETTINGS_DWORD_VALUE(HandlerWarmUp, DWORD, L"HandlerWarmUp", DEFAULT_HANDLER_WARM_UP)
+
+void addHandlerUse(CLSID clsid) {
+    wchar_t name[64];
+    if (!StringFromGUID2(clsid, name, _countof(name)))
+        return;
+    local_wstr_ptr key = format(L"%1\\%2", KEY_SETTINGS, KEY_HANDLER_USAGE);
+    DWORD count = 0, size = sizeof(count);
+    RegGetValue(HKEY_CURRENT_USER, key.get(), name, RRF_RT_DWORD, nullptr, &count, &size);
+    if (count != MAXDWORD)
+        count++;
+    RegSetKeyValue(HKEY_CURRENT_USER, key.get(), name, REG_DWORD, &count, sizeof(count));
+}
+
+int getMostUsedHandlers(CLSID *clsids, int maxCount) {
+    local_wstr_ptr keyPath = format(L"%1\\%2", KEY_SETTINGS, KEY_HANDLER_USAGE);
+    HKEY key;
+    if (maxCount <= 0 || RegOpenKeyEx(HKEY_CURRENT_USER, keyPath.get(), 0, KEY_QUERY_VALUE, &key))
+        return 0;
+    std::unique_ptr<DWORD[]> counts(new DWORD[maxCount]);
+    int found = 0;
+    for (DWORD i = 0; ; i++) {
+        wchar_t name[64];
+        DWORD nameLen = _countof(name), type, count, size = sizeof(count);
+        LSTATUS status = RegEnumValue(key, i, name, &nameLen, nullptr, &type, (BYTE *)&count,
+            &size);
+        if (status == ERROR_NO_MORE_ITEMS)
+            break;
+        CLSID clsid;
+        if (status || type != REG_DWORD || FAILED(CLSIDFromString(name, &clsid)))
+            continue;
+        // insertion sort, keeping only the top entries
+        int pos = found;
+        while (pos > 0 && counts[pos - 1] < count)
+            pos--;
+        if (pos >= maxCount)
+            continue;
+        for (int j = min(found, maxCount - 1); j > pos; j--) {
+            clsids[j] = clsids[j - 1];
+            counts[j] = counts[j - 1];
+        }
+        clsids[pos] = clsid;
+        counts[pos] = count;
+        found = min(found + 1, maxCount);
+    }
+    RegCloseKey(key);
+    return found;
+}
 
 SETTINGS_DWORD_VALUE(OpenSelectionTime, UINT, L"OpenSelectionTime", DEFAULT_OPEN_SELECTION_TIME)
 SETTINGS_BOOL_VALUE(DeselectOnOpen, L"DeselectOnOpen", DEFAULT_DESELECT_ON_OPEN)
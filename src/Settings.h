@@ -29,6 +29,10 @@ const SIZE      DEFAULT_FOLDER_WINDOW_SIZE  = {210, 435};
 const bool      DEFAULT_STATUS_TEXT_ENABLED = true;
 const bool      DEFAULT_TOOLBAR_ENABLED     = true;
 const bool      DEFAULT_PREVIEWS_ENABLED    = true;
+const DWORD     DEFAULT_THUMBNAIL_CACHE_SIZE= 64; // megabytes
+const bool      DEFAULT_IMAGE_STATS_ENABLED = false;
+const DWORD     DEFAULT_HANDLER_CACHE_SIZE  = 6; // preview handler class factories
+const DWORD     DEFAULT_HANDLER_WARM_UP     = 0; // disabled
 const UINT      DEFAULT_OPEN_SELECTION_TIME = 100; // slower than key repeat 10 and above
 const bool      DEFAULT_DESELECT_ON_OPEN    = true;
 const bool      DEFAULT_TEXT_EDITOR_ENABLED = true;
@@ -82,6 +86,18 @@ void setToolbarEnabled(bool value);
 
 bool getPreviewsEnabled();
 void setPreviewsEnabled(bool value);
+DWORD getThumbnailCacheSize(); // megabytes
+void setThumbnailCacheSize(DWORD value); // TODO: add to Settings
+bool getImageStatsEnabled();
+void setImageStatsEnabled(bool value);
+DWORD getHandlerCacheSize(); // number of preview handler class factories kept loaded
+void setHandlerCacheSize(DWORD value); // TODO: add to Settings
+// number of the most used preview handlers to load in the background at startup
+DWORD getHandlerWarmUp();
+void setHandlerWarmUp(DWORD value); // TODO: add to Settings
+void addHandlerUse(CLSID clsid); // count a preview opened with this handler
+// get the most used preview handlers, most used first. returns the number found
+int getMostUsedHandlers(CLSID *clsids, int maxCount);
 
 UINT getOpenSelectionTime(); // milliseconds
 void setOpenSelectionTime(UINT value); // TODO: add to Settings
@@ -1,7 +1,15 @@
 #include "ShellUtils.h"
+#include <propkey.h>
 
 namespace chromafiler {
 
+bool isImageItem(IShellItem *const item) {
+    CComQIPtr<IShellItem2> item2(item);
+    int perceivedType;
+    return item2 && SUCCEEDED(item2->GetInt32(PKEY_PerceivedType, &perceivedType))
+        && perceivedType == PERCEIVED_TYPE_IMAGE;
+}
+
 STDMETHODIMP NewItemSink::StartOperations() {return S_OK;}
 STDMETHODIMP NewItemSink::FinishOperations(HRESULT) {return S_OK;}
 STDMETHODIMP NewItemSink::PreRenameItem(DWORD, IShellItem *, LPCWSTR) {return S_OK;}
@@ -6,6 +6,8 @@
 
 namespace chromafiler {
 
+bool isImageItem(IShellItem *item); // perceived type is image
+
 // not reference counted! allocate on stack!
 class NewItemSink : public IFileOperationProgressSink {
 public:
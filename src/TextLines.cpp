@@ -0,0 +1,482 @@
+#include "TextLines.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cwctype>
+#include <unordered_set>
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace chromafiler {
+
+const size_t MAX_REGEX_STEPS = 1 << 20; // per line
+
+TextLines::TextLines(const wchar_t *text, size_t length) : text(text), length(length) {
+    starts.reserve(length / 32 + 2);
+    starts.push_back(0);
+    size_t i = 0;
+    while (i < length) {
+#if defined(_M_IX86) || defined(_M_X64)
+        // skip ahead 8 characters at a time until a CR or LF
+        const __m128i cr = _mm_set1_epi16(L'\r'), lf = _mm_set1_epi16(L'\n');
+        while (i + 8 <= length) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+            int mask = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi16(v, cr), _mm_cmpeq_epi16(v, lf)));
+            if (mask) {
+                unsigned long bit;
+                _BitScanForward(&bit, mask);
+                i += bit / 2;
+                break;
+            }
+            i += 8;
+        }
+#endif
+        while (i < length && text[i] != L'\r' && text[i] != L'\n')
+            i++;
+        if (i == length)
+            break;
+        if (text[i] == L'\r' && i + 1 < length && text[i + 1] == L'\n')
+            i++;
+        i++;
+        starts.push_back((uint32_t)i);
+    }
+    starts.push_back((uint32_t)length);
+}
+
+size_t TextLines::count() const {
+    return starts.size() - 1;
+}
+
+size_t TextLines::lineStart(size_t i) const {
+    return starts[i];
+}
+
+size_t TextLines::lineAt(size_t offset) const {
+    auto it = std::upper_bound(starts.begin(), starts.end() - 1, (uint32_t)offset);
+    return (it - starts.begin()) - 1;
+}
+
+const wchar_t * TextLines::line(size_t i, size_t *lineLength) const {
+    size_t start = starts[i], end = starts[i + 1];
+    if (i + 1 < count()) { // exclude separator
+        if (end > start && text[end - 1] == L'\n')
+            end--;
+        if (end > start && text[end - 1] == L'\r')
+            end--;
+    }
+    *lineLength = end - start;
+    return text + start;
+}
+
+const size_t SORT_CHUNK_LINES = 32768;
+const size_t MAX_SORT_CHUNKS = 64;
+
+static int compareLines(const TextLines &lines, uint32_t a, uint32_t b) {
+    size_t lenA, lenB;
+    const wchar_t *textA = lines.line(a, &lenA), *textB = lines.line(b, &lenB);
+    size_t len = lenA < lenB ? lenA : lenB;
+    for (size_t i = 0; i < len; i++) {
+        if (textA[i] != textB[i])
+            return textA[i] < textB[i] ? -1 : 1;
+    }
+    return lenA < lenB ? -1 : (lenA > lenB ? 1 : 0);
+}
+
+static double leadingNumber(const wchar_t *text, size_t length) {
+    size_t i = 0;
+    while (i < length && (text[i] == L' ' || text[i] == L'\t'))
+        i++;
+    bool negative = false;
+    if (i < length && (text[i] == L'-' || text[i] == L'+'))
+        negative = text[i++] == L'-';
+    bool anyDigits = false;
+    double value = 0;
+    for (; i < length && text[i] >= L'0' && text[i] <= L'9'; i++, anyDigits = true)
+        value = value * 10 + (text[i] - L'0');
+    if (i < length && text[i] == L'.') {
+        double scale = 0.1;
+        for (i++; i < length && text[i] >= L'0' && text[i] <= L'9'; i++, anyDigits = true) {
+            value += (text[i] - L'0') * scale;
+            scale *= 0.1;
+        }
+    }
+    if (!anyDigits)
+        return -HUGE_VAL;
+    return negative ? -value : value;
+}
+
+// maps a double to an integer with the same ordering
+static uint64_t orderedBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & (1ULL << 63)) ? ~bits : (bits | (1ULL << 63));
+}
+
+void sortLines(const TextLines &lines, size_t first, size_t last, bool numeric,
+        ParallelForFunc parallel, std::vector<uint32_t> *order) {
+    // Sort compact (key, index) entries so most comparisons don't need to touch the text. The keys
+    // are the first 8 characters of the line, or the leading number followed by the first 4
+    // characters. Equal keys fall back to comparing the full line and then the index (which makes
+    // the sort stable).
+    struct SortEntry {
+        uint64_t key, key2;
+        uint32_t index;
+    };
+    size_t count = last - first;
+    std::vector<SortEntry> entries(count);
+    size_t numChunks = count / SORT_CHUNK_LINES + 1;
+    if (numChunks > MAX_SORT_CHUNKS)
+        numChunks = MAX_SORT_CHUNKS;
+    std::vector<size_t> bounds(numChunks + 1);
+    for (size_t i = 0; i <= numChunks; i++)
+        bounds[i] = count * i / numChunks;
+
+    auto less = [&](const SortEntry &a, const SortEntry &b) {
+        if (a.key != b.key)
+            return a.key < b.key;
+        if (a.key2 != b.key2)
+            return a.key2 < b.key2;
+        int cmp = compareLines(lines, a.index, b.index);
+        return cmp != 0 ? cmp < 0 : a.index < b.index;
+    };
+    SortEntry *src = entries.data();
+    parallel(numChunks, [&](size_t chunk) {
+        for (size_t i = bounds[chunk]; i < bounds[chunk + 1]; i++) {
+            size_t length;
+            const wchar_t *text = lines.line(first + i, &length);
+            uint64_t prefix[2] = {};
+            for (size_t c = 0; c < 8; c++)
+                prefix[c / 4] = (prefix[c / 4] << 16) | (c < length ? (uint16_t)text[c] : 0);
+            uint32_t index = (uint32_t)(first + i);
+            if (numeric)
+                src[i] = {orderedBits(leadingNumber(text, length)), prefix[0], index};
+            else
+                src[i] = {prefix[0], prefix[1], index};
+        }
+        std::sort(src + bounds[chunk], src + bounds[chunk + 1], less);
+    });
+
+    // merge pairs of sorted runs until one remains
+    std::vector<SortEntry> temp(numChunks > 1 ? count : 0);
+    SortEntry *dst = temp.data();
+    while (bounds.size() > 2) {
+        size_t numRuns = bounds.size() - 1;
+        parallel((numRuns + 1) / 2, [&](size_t pair) {
+            size_t lo = bounds[pair * 2];
+            size_t mid = bounds[std::min(pair * 2 + 1, numRuns)];
+            size_t hi = bounds[std::min(pair * 2 + 2, numRuns)];
+            std::merge(src + lo, src + mid, src + mid, src + hi, dst + lo, less);
+        });
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < numRuns; i += 2)
+            merged.push_back(bounds[i]);
+        merged.push_back(count);
+        bounds.swap(merged);
+        std::swap(src, dst);
+    }
+
+    order->resize(count);
+    for (size_t i = 0; i < count; i++)
+        (*order)[i] = src[i].index;
+}
+
+void uniqueLines(const TextLines &lines, size_t first, size_t last, std::vector<uint32_t> *order) {
+    auto hash = [&](uint32_t i) {
+        size_t length;
+        const wchar_t *text = lines.line(i, &length);
+        uint32_t h = 2166136261u; // FNV-1a
+        for (size_t c = 0; c < length; c++)
+            h = (h ^ text[c]) * 16777619u;
+        return (size_t)h;
+    };
+    auto equal = [&](uint32_t a, uint32_t b) {
+        return compareLines(lines, a, b) == 0;
+    };
+    std::unordered_set<uint32_t, decltype(hash), decltype(equal)> seen(
+        (last - first) * 2, hash, equal);
+    order->clear();
+    for (size_t i = first; i < last; i++) {
+        if (seen.insert((uint32_t)i).second)
+            order->push_back((uint32_t)i);
+    }
+}
+
+static inline wchar_t foldCase(wchar_t c) {
+    if (c < 0x80)
+        return (c >= L'A' && c <= L'Z') ? (wchar_t)(c + (L'a' - L'A')) : c;
+    return (wchar_t)towlower(c);
+}
+
+static inline bool isWordChar(wchar_t c) {
+    return (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9')
+        || c == L'_';
+}
+
+struct LogLevel {
+    const wchar_t *name;
+    int level;
+};
+static const LogLevel LOG_LEVELS[] = {
+    {L"trace", 1}, {L"verbose", 1},
+    {L"debug", 2},
+    {L"info", 3}, {L"information", 3}, {L"notice", 3},
+    {L"warn", 4}, {L"warning", 4},
+    {L"error", 5}, {L"err", 5},
+    {L"fatal", 6}, {L"critical", 6}, {L"crit", 6},
+};
+
+// returns 0 if the word is not a level name
+static int findLogLevel(const wchar_t *word, size_t length) {
+    for (auto &level : LOG_LEVELS) {
+        size_t i = 0;
+        for (; i < length && level.name[i]; i++) {
+            if (foldCase(word[i]) != level.name[i])
+                break;
+        }
+        if (i == length && !level.name[i])
+            return level.level;
+    }
+    return 0;
+}
+
+static bool startsWith(const wchar_t *str, const wchar_t *prefix) {
+    for (; *prefix; str++, prefix++) {
+        if (*str != *prefix)
+            return false;
+    }
+    return true;
+}
+
+bool LineFilter::parse(const wchar_t *pattern) {
+    literal.clear();
+    alternatives.clear();
+    minLevel = 0;
+    if (startsWith(pattern, L"re:")) {
+        mode = FILTER_REGEX;
+        return parseRegex(pattern + 3);
+    } else if (startsWith(pattern, L"level:")) {
+        mode = FILTER_LEVEL;
+        const wchar_t *name = pattern + 6;
+        size_t nameLen = 0;
+        while (name[nameLen])
+            nameLen++;
+        minLevel = findLogLevel(name, nameLen);
+        return minLevel != 0;
+    } else {
+        mode = FILTER_LITERAL;
+        for (const wchar_t *c = pattern; *c; c++)
+            literal.push_back(foldCase(*c));
+        return true;
+    }
+}
+
+bool LineFilter::isEmpty() const {
+    return mode == FILTER_LITERAL && literal.empty();
+}
+
+bool LineFilter::parseRegex(const wchar_t *pattern) {
+    alternatives.emplace_back();
+    for (const wchar_t *p = pattern; *p; p++) {
+        Regex &regex = alternatives.back();
+        RegexNode node = {NODE_CHAR, REPEAT_ONE, 0, false, {}};
+        switch (*p) {
+            case L'|':
+                alternatives.emplace_back();
+                continue;
+            case L'*': case L'+': case L'?':
+                if (regex.empty() || regex.back().repeat != REPEAT_ONE
+                        || regex.back().type == NODE_LINE_START
+                        || regex.back().type == NODE_LINE_END)
+                    return false;
+                regex.back().repeat = *p == L'*' ? REPEAT_STAR
+                    : (*p == L'+' ? REPEAT_PLUS : REPEAT_OPTIONAL);
+                continue;
+            case L'.':
+                node.type = NODE_ANY;
+                break;
+            case L'^':
+                node.type = NODE_LINE_START;
+                break;
+            case L'$':
+                node.type = NODE_LINE_END;
+                break;
+            case L'\\':
+                p++;
+                node.type = NODE_CLASS;
+                switch (*p) {
+                    case 0:
+                        return false;
+                    case L'D': node.negate = true; // fall through
+                    case L'd': node.ranges = {L'0', L'9'}; break;
+                    case L'W': node.negate = true; // fall through
+                    case L'w': node.ranges = {L'a', L'z', L'A', L'Z', L'0', L'9', L'_', L'_'};
+                        break;
+                    case L'S': node.negate = true; // fall through
+                    case L's': node.ranges = {L' ', L' ', L'\t', L'\t', L'\r', L'\r', L'\n', L'\n'};
+                        break;
+                    default:
+                        node.type = NODE_CHAR;
+                        node.c = *p;
+                }
+                break;
+            case L'[':
+                node.type = NODE_CLASS;
+                p++;
+                if (*p == L'^') {
+                    node.negate = true;
+                    p++;
+                }
+                // a leading ] is a literal
+                for (bool first = true; *p && (first || *p != L']'); p++, first = false) {
+                    wchar_t lo = *p;
+                    if (lo == L'\\' && p[1])
+                        lo = *++p;
+                    wchar_t hi = lo;
+                    if (p[1] == L'-' && p[2] && p[2] != L']') {
+                        p += 2;
+                        hi = *p;
+                        if (hi == L'\\' && p[1])
+                            hi = *++p;
+                        if (hi < lo)
+                            return false;
+                    }
+                    node.ranges.push_back(lo);
+                    node.ranges.push_back(hi);
+                }
+                if (!*p)
+                    return false;
+                break;
+            default:
+                node.c = *p;
+        }
+        regex.push_back(std::move(node));
+    }
+    return true;
+}
+
+bool LineFilter::matchNode(const RegexNode &node, const wchar_t *line, size_t length,
+        size_t pos) {
+    if (pos >= length)
+        return false;
+    wchar_t c = line[pos];
+    switch (node.type) {
+        case NODE_CHAR:
+            return c == node.c;
+        case NODE_ANY:
+            return true;
+        case NODE_CLASS:
+            for (size_t i = 0; i < node.ranges.size(); i += 2) {
+                if (c >= node.ranges[i] && c <= node.ranges[i + 1])
+                    return !node.negate;
+            }
+            return node.negate;
+        default:
+            return false;
+    }
+}
+
+bool LineFilter::matchHere(const Regex &regex, size_t n, const wchar_t *line, size_t length,
+        size_t pos, size_t *budget) {
+    // backtracking matcher in the style of Kernighan & Pike
+    for (; n < regex.size(); n++) {
+        if (*budget == 0)
+            return false;
+        (*budget)--;
+        const RegexNode &node = regex[n];
+        if (node.type == NODE_LINE_START) {
+            if (pos != 0)
+                return false;
+            continue;
+        } else if (node.type == NODE_LINE_END) {
+            if (pos != length)
+                return false;
+            continue;
+        }
+        if (node.repeat == REPEAT_ONE) {
+            if (!matchNode(node, line, length, pos))
+                return false;
+            pos++;
+            continue;
+        }
+        // greedy: consume as many as possible, then back off
+        size_t minCount = node.repeat == REPEAT_PLUS ? 1 : 0;
+        size_t maxCount = node.repeat == REPEAT_OPTIONAL ? 1 : length - pos;
+        size_t count = 0;
+        while (count < maxCount && matchNode(node, line, length, pos + count))
+            count++;
+        if (count < minCount)
+            return false;
+        while (true) {
+            if (matchHere(regex, n + 1, line, length, pos + count, budget))
+                return true;
+            if (count == minCount || *budget == 0)
+                return false;
+            count--;
+        }
+    }
+    return true;
+}
+
+bool LineFilter::matchesLiteral(const wchar_t *line, size_t length) const {
+    size_t litLen = literal.size();
+    if (litLen == 0)
+        return true;
+    if (litLen > length)
+        return false;
+    wchar_t first = literal[0];
+    for (size_t i = 0; i <= length - litLen; i++) {
+        if (foldCase(line[i]) != first)
+            continue;
+        size_t j = 1;
+        while (j < litLen && foldCase(line[i + j]) == literal[j])
+            j++;
+        if (j == litLen)
+            return true;
+    }
+    return false;
+}
+
+bool LineFilter::matchesLevel(const wchar_t *line, size_t length) const {
+    // the first word that names a level determines the level of the line
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && !isWordChar(line[i]))
+            i++;
+        size_t start = i;
+        while (i < length && isWordChar(line[i]))
+            i++;
+        if (i > start) {
+            int level = findLogLevel(line + start, i - start);
+            if (level)
+                return level >= minLevel;
+        }
+    }
+    return false;
+}
+
+bool LineFilter::matches(const wchar_t *line, size_t length) const {
+    switch (mode) {
+        case FILTER_REGEX: {
+            // patterns like a*a*a*a*b can take exponential time, so give up on pathological lines
+            size_t budget = MAX_REGEX_STEPS;
+            for (auto &regex : alternatives) {
+                bool anchored = !regex.empty() && regex[0].type == NODE_LINE_START;
+                for (size_t pos = 0; pos <= length && budget > 0; pos++) {
+                    if (matchHere(regex, 0, line, length, pos, &budget))
+                        return true;
+                    if (anchored)
+                        break;
+                }
+            }
+            return false;
+        }
+        case FILTER_LEVEL:
+            return matchesLevel(line, length);
+        default:
+            return matchesLiteral(line, length);
+    }
+}
+
+} // namespace
@@ -0,0 +1,76 @@
+#pragma once
+#include <common.h>
+
+#include "ThreadUtils.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chromafiler {
+
+// Index of line start offsets in a UTF-16 buffer. Lines may be separated by CR, LF or CRLF.
+// Does not copy the text, which must outlive the index.
+class TextLines {
+public:
+    TextLines(const wchar_t *text, size_t length);
+
+    size_t count() const;
+    size_t lineStart(size_t i) const;
+    size_t lineAt(size_t offset) const; // index of the line containing offset
+    // returns pointer to start of line, length excludes the line separator
+    const wchar_t * line(size_t i, size_t *length) const;
+
+private:
+    const wchar_t *text;
+    size_t length;
+    std::vector<uint32_t> starts; // one extra entry for the end of the text
+};
+
+// Fill order with the indices of lines [first, last) sorted by ordinal comparison, or by the
+// leading decimal number of each line if numeric is set (lines without a number come first).
+// Chunks are sorted and merged in parallel. The sort is stable.
+void sortLines(const TextLines &lines, size_t first, size_t last, bool numeric,
+    ParallelForFunc parallel, std::vector<uint32_t> *order);
+// Fill order with the indices of lines [first, last), skipping repeats of earlier lines.
+void uniqueLines(const TextLines &lines, size_t first, size_t last, std::vector<uint32_t> *order);
+
+// Matches lines against a filter pattern:
+//  - "re:<regex>" - regular expression (subset: . [] [^] * + ? ^ $ | and \d \w \s escapes).
+//    backtracking is limited per line, lines that take too long to match are treated as not
+//    matching
+//  - "level:<name>" - log lines at or above a severity (trace, debug, info, warn, error, fatal)
+//  - anything else - case-insensitive substring
+class LineFilter {
+public:
+    bool parse(const wchar_t *pattern); // returns false if pattern is invalid
+    bool isEmpty() const;
+    bool matches(const wchar_t *line, size_t length) const;
+
+private:
+    enum FilterMode { FILTER_LITERAL, FILTER_REGEX, FILTER_LEVEL };
+    enum NodeType { NODE_CHAR, NODE_ANY, NODE_CLASS, NODE_LINE_START, NODE_LINE_END };
+    enum Repeat { REPEAT_ONE, REPEAT_STAR, REPEAT_PLUS, REPEAT_OPTIONAL };
+    struct RegexNode {
+        NodeType type;
+        Repeat repeat;
+        wchar_t c;
+        bool negate;
+        std::vector<wchar_t> ranges; // pairs of inclusive bounds for NODE_CLASS
+    };
+    using Regex = std::vector<RegexNode>;
+
+    bool parseRegex(const wchar_t *pattern);
+    bool matchesLiteral(const wchar_t *line, size_t length) const;
+    bool matchesLevel(const wchar_t *line, size_t length) const;
+    static bool matchNode(const RegexNode &node, const wchar_t *line, size_t length, size_t pos);
+    // budget is decremented for each step and matching fails when it runs out
+    static bool matchHere(const Regex &regex, size_t n, const wchar_t *line, size_t length,
+        size_t pos, size_t *budget);
+
+    FilterMode mode = FILTER_LITERAL;
+    std::vector<wchar_t> literal; // case folded
+    std::vector<Regex> alternatives;
+    int minLevel = 0;
+};
+
+} // namespace
@@ -0,0 +1,337 @@
+#include "TextPreview.h"
+#include "DPI.h"
+#include "Settings.h"
+#include "TextWindow.h"
+#include "UIStrings.h"
+#include "WinUtils.h"
+#include "resource.h"
+#include <climits>
+#include <windowsx.h>
+#include <shlobj.h>
+
+namespace chromafiler {
+
+const wchar_t TEXT_PREVIEW_CLASS[] = L"ChromaFiler Text Preview";
+
+const ULONG PREVIEW_MAX_SIZE = 256 * 1024; // bytes read from the start of the file
+const int MAX_LINE_COLUMNS = 4096; // longer lines are cut off
+const int TEXT_MARGIN = 4; // dp
+
+static ClassFactoryImpl<TextPreview, false> factory;
+static DWORD regCookie = 0;
+static CComPtr<WorkerPool> textPool;
+
+void TextPreview::init() {
+    WNDCLASS textClass = {};
+    textClass.lpfnWndProc = windowProc;
+    textClass.hInstance = GetModuleHandle(nullptr);
+    textClass.lpszClassName = TEXT_PREVIEW_CLASS;
+    textClass.hCursor = LoadCursor(nullptr, IDC_ARROW);
+    RegisterClass(&textClass);
+
+    // reading is mostly disk time, and only one task runs per window
+    textPool.Attach(new WorkerPool(2));
+    textPool->start();
+
+    checkHR(CoRegisterClassObject(CLSID_TextPreview, &factory,
+        CLSCTX_LOCAL_SERVER, REGCLS_MULTIPLEUSE, &regCookie));
+}
+
+void TextPreview::uninit() {
+    checkHR(CoRevokeClassObject(regCookie));
+    textPool->shutdown();
+}
+
+TextPreview::~TextPreview() {
+    if (font)
+        DeleteFont(font);
+}
+
+const wchar_t * TextPreview::className() const {
+    return TEXT_PREVIEW_CLASS;
+}
+
+DWORD TextPreview::windowStyle() const {
+    return PreviewHandlerImpl::windowStyle() | WS_VSCROLL | WS_HSCROLL;
+}
+
+// convert wheel movement to lines, keeping the remainder for high resolution wheels
+static int wheelLines(int *accum, int delta) {
+    UINT linesPerClick = 3;
+    checkLE(SystemParametersInfo(SPI_GETWHEELSCROLLLINES, 0, &linesPerClick, 0));
+    if (linesPerClick == WHEEL_PAGESCROLL)
+        linesPerClick = 3;
+    *accum += delta;
+    int lines = *accum * (int)linesPerClick / WHEEL_DELTA;
+    *accum -= lines * WHEEL_DELTA / max((int)linesPerClick, 1);
+    return lines;
+}
+
+LRESULT TextPreview::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
+    switch (message) {
+        case WM_CREATE: {
+            LOGFONT logFont = settings::getTextFont();
+            logFont.lfHeight = -pointsToPixels(logFont.lfHeight);
+            font = CreateFontIndirect(&logFont);
+            tabWidth = max(1, settings::getTextTabWidth());
+            margin = scaleDPI(TEXT_MARGIN);
+
+            HDC hdc = GetDC(hwnd);
+            HFONT oldFont = SelectFont(hdc, font);
+            TEXTMETRIC metrics;
+            GetTextMetrics(hdc, &metrics);
+            SelectFont(hdc, oldFont);
+            ReleaseDC(hwnd, hdc);
+            lineHeight = max(1, (int)metrics.tmHeight);
+            charWidth = max(1, (int)metrics.tmAveCharWidth);
+
+            loadTask.Attach(new LoadTask(item, this, tabWidth));
+            textPool->submit(loadTask, 0);
+            updateLayout();
+            return 0;
+        }
+        case WM_DESTROY:
+            textPool->cancel(loadTask);
+            loadTask->stop();
+            return 0;
+        case WM_SIZE:
+            updateLayout();
+            return 0;
+        case WM_ERASEBKGND:
+            return 1; // painted with double buffering
+        case WM_PAINT:
+            PAINTSTRUCT paint;
+            BeginPaint(hwnd, &paint);
+            onPaint(paint);
+            EndPaint(hwnd, &paint);
+            return 0;
+        case WM_VSCROLL:
+        case WM_HSCROLL: {
+            bool vert = message == WM_VSCROLL;
+            SIZE size = clientSize(hwnd);
+            LONG pos = vert ? scrollPos.y : scrollPos.x;
+            int line = vert ? lineHeight : charWidth;
+            int page = vert ? size.cy : size.cx;
+            switch (LOWORD(wParam)) {
+                case SB_LINEUP: pos -= line; break;
+                case SB_LINEDOWN: pos += line; break;
+                case SB_PAGEUP: pos -= page; break;
+                case SB_PAGEDOWN: pos += page; break;
+                case SB_TOP: pos = 0; break;
+                case SB_BOTTOM: pos = LONG_MAX; break;
+                case SB_THUMBTRACK: {
+                    SCROLLINFO info = {sizeof(info), SIF_TRACKPOS};
+                    GetScrollInfo(hwnd, vert ? SB_VERT : SB_HORZ, &info);
+                    pos = info.nTrackPos;
+                    break;
+                }
+            }
+            setScroll(vert ? POINT{scrollPos.x, pos} : POINT{pos, scrollPos.y});
+            return 0;
+        }
+        case WM_MOUSEWHEEL: {
+            int lines = wheelLines(&wheelAccum, GET_WHEEL_DELTA_WPARAM(wParam));
+            setScroll({scrollPos.x, scrollPos.y - lines * lineHeight});
+            return 0;
+        }
+        case WM_MOUSEHWHEEL: {
+            int lines = wheelLines(&hWheelAccum, GET_WHEEL_DELTA_WPARAM(wParam));
+            setScroll({scrollPos.x + lines * charWidth, scrollPos.y});
+            return TRUE;
+        }
+        case WM_KEYDOWN: {
+            SIZE size = clientSize(hwnd);
+            switch (wParam) {
+                case VK_PRIOR: setScroll({scrollPos.x, scrollPos.y - size.cy}); return 0;
+                case VK_NEXT: setScroll({scrollPos.x, scrollPos.y + size.cy}); return 0;
+                case VK_UP: setScroll({scrollPos.x, scrollPos.y - lineHeight}); return 0;
+                case VK_DOWN: setScroll({scrollPos.x, scrollPos.y + lineHeight}); return 0;
+                case VK_LEFT: setScroll({scrollPos.x - charWidth, scrollPos.y}); return 0;
+                case VK_RIGHT: setScroll({scrollPos.x + charWidth, scrollPos.y}); return 0;
+                case VK_HOME: setScroll({0, 0}); return 0;
+                case VK_END: setScroll({0, LONG_MAX}); return 0;
+            }
+            break;
+        }
+        case WM_LBUTTONDOWN:
+            SetFocus(hwnd);
+            return 0;
+        case MSG_LOAD_COMPLETE:
+            if (!checkHR((HRESULT)wParam))
+                return 0;
+            AcquireSRWLockExclusive(&loadedContentLock);
+            content = std::move(loadedContent);
+            ReleaseSRWLockExclusive(&loadedContentLock);
+            updateLayout();
+            InvalidateRect(hwnd, nullptr, FALSE);
+            return 0;
+    }
+    return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+int TextPreview::lineCount() {
+    if (!content)
+        return 0;
+    return (int)content->lines->count() + (content->truncated ? 1 : 0);
+}
+
+void TextPreview::updateLayout() {
+    SIZE size = clientSize(hwnd);
+    int columns = content ? content->columns : 0;
+
+    SCROLLINFO info = {sizeof(info), SIF_RANGE | SIF_PAGE};
+    info.nMin = 0;
+    info.nMax = max(0, lineCount() * lineHeight + margin * 2 - 1);
+    info.nPage = (UINT)max(0, (int)size.cy);
+    SetScrollInfo(hwnd, SB_VERT, &info, TRUE);
+    info.nMax = max(0, columns * charWidth + margin * 2 - 1);
+    info.nPage = (UINT)max(0, (int)size.cx);
+    SetScrollInfo(hwnd, SB_HORZ, &info, TRUE);
+    setScroll(scrollPos);
+}
+
+void TextPreview::setScroll(POINT pos) {
+    SIZE size = clientSize(hwnd);
+    int columns = content ? content->columns : 0;
+    int maxX = max(0, columns * charWidth + margin * 2 - (int)size.cx);
+    int maxY = max(0, lineCount() * lineHeight + margin * 2 - (int)size.cy);
+    pos.x = max(0L, min((LONG)maxX, pos.x));
+    pos.y = max(0L, min((LONG)maxY, pos.y));
+    if (pos.x == scrollPos.x && pos.y == scrollPos.y)
+        return;
+    scrollPos = pos;
+    SCROLLINFO info = {sizeof(info), SIF_POS};
+    info.nPos = pos.y;
+    SetScrollInfo(hwnd, SB_VERT, &info, TRUE);
+    info.nPos = pos.x;
+    SetScrollInfo(hwnd, SB_HORZ, &info, TRUE);
+    InvalidateRect(hwnd, nullptr, FALSE);
+}
+
+void TextPreview::onPaint(PAINTSTRUCT paint) {
+    SIZE size = clientSize(hwnd);
+    HDC hdcBuffer = CreateCompatibleDC(paint.hdc);
+    HBITMAP buffer = CreateCompatibleBitmap(paint.hdc, size.cx, size.cy);
+    HBITMAP oldBitmap = SelectBitmap(hdcBuffer, buffer);
+    FillRect(hdcBuffer, tempPtr(RECT{0, 0, size.cx, size.cy}), (HBRUSH)(COLOR_WINDOW + 1));
+
+    if (content) {
+        HFONT oldFont = SelectFont(hdcBuffer, font);
+        SetBkMode(hdcBuffer, TRANSPARENT);
+        SetTextColor(hdcBuffer, GetSysColor(COLOR_WINDOWTEXT));
+        int left = margin - scrollPos.x;
+        int tabStop = tabWidth * charWidth;
+        // only lines intersecting the update region are laid out
+        int numLines = (int)content->lines->count();
+        int firstLine = max(0, (int)(scrollPos.y + paint.rcPaint.top - margin) / lineHeight);
+        int lastLine = min(numLines - 1,
+            (int)(scrollPos.y + paint.rcPaint.bottom - margin) / lineHeight);
+        for (int i = firstLine; i <= lastLine; i++) {
+            size_t length;
+            const wchar_t *line = content->lines->line(i, &length);
+            int y = margin + i * lineHeight - scrollPos.y;
+            TabbedTextOut(hdcBuffer, left, y, line, (int)min(length, (size_t)MAX_LINE_COLUMNS),
+                1, &tabStop, left);
+        }
+        if (content->truncated) {
+            int y = margin + numLines * lineHeight - scrollPos.y;
+            SetTextColor(hdcBuffer, GetSysColor(COLOR_GRAYTEXT));
+            local_wstr_ptr notice = formatString(IDS_TEXT_PREVIEW_TRUNCATED,
+                (int)(PREVIEW_MAX_SIZE / 1024));
+            if (notice)
+                TextOut(hdcBuffer, left, y, notice.get(), lstrlen(notice.get()));
+        }
+        SelectFont(hdcBuffer, oldFont);
+    }
+
+    BitBlt(paint.hdc, 0, 0, size.cx, size.cy, hdcBuffer, 0, 0, SRCCOPY);
+    SelectBitmap(hdcBuffer, oldBitmap);
+    DeleteBitmap(buffer);
+    DeleteDC(hdcBuffer);
+}
+
+TextPreview::LoadTask::LoadTask(IShellItem *const item, TextPreview *const callbackWindow,
+        int tabWidth)
+        : callbackWindow(callbackWindow), tabWidth(tabWidth) {
+    checkHR(SHGetIDListFromObject(item, &itemIDList));
+}
+
+void TextPreview::LoadTask::stop() {
+    AcquireSRWLockExclusive(&stopLock);
+    stopped = true;
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+// read the start of the file and convert it to UTF-16
+static HRESULT decodeText(IShellItem *item, std::unique_ptr<uint8_t[]> *buffer,
+        const wchar_t **text, size_t *length, bool *truncated) {
+    TextWindow::LoadResult result;
+    HRESULT hr;
+    if (!checkHR(hr = TextWindow::loadText(item, &result, PREVIEW_MAX_SIZE)))
+        return hr;
+    *truncated = result.truncated;
+    if (result.encoding == ENC_UTF16LE || result.encoding == ENC_UTF16BE) {
+        // already converted in place
+        *text = (const wchar_t *)(void *)result.textStart;
+        *length = wcslen(*text);
+        *buffer = std::move(result.buffer);
+        return S_OK;
+    }
+    // null bytes were replaced, so the text ends at the terminator
+    const char *source = (const char *)result.textStart;
+    int sourceLength = lstrlenA(source);
+    int wideLength = 0;
+    if (sourceLength > 0) {
+        wideLength = MultiByteToWideChar(result.setText.codepage, 0, source, sourceLength,
+            nullptr, 0);
+        if (!checkLE(wideLength))
+            return HRESULT_FROM_WIN32(GetLastError());
+    }
+    buffer->reset(new uint8_t[((size_t)wideLength + 1) * sizeof(wchar_t)]);
+    wchar_t *wide = (wchar_t *)(void *)buffer->get();
+    if (wideLength > 0)
+        MultiByteToWideChar(result.setText.codepage, 0, source, sourceLength, wide, wideLength);
+    wide[wideLength] = 0;
+    *text = wide;
+    *length = (size_t)wideLength;
+    return S_OK;
+}
+
+void TextPreview::LoadTask::run() {
+    if (stopped)
+        return;
+    HRESULT hr = E_FAIL;
+    std::unique_ptr<Content> content(new Content);
+    CComPtr<IShellItem> item;
+    if (itemIDList && checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item)))) {
+        hr = decodeText(item, &content->buffer, &content->text, &content->length,
+            &content->truncated);
+    }
+    if (SUCCEEDED(hr)) {
+        content->lines = std::unique_ptr<TextLines>(
+            new TextLines(content->text, content->length));
+        // measure in columns so horizontal scrolling doesn't need every line laid out
+        for (size_t i = 0; i < content->lines->count(); i++) {
+            size_t length;
+            const wchar_t *line = content->lines->line(i, &length);
+            length = min(length, (size_t)MAX_LINE_COLUMNS);
+            int column = 0;
+            for (size_t c = 0; c < length; c++)
+                column = (line[c] == L'\t') ? (column / tabWidth + 1) * tabWidth : column + 1;
+            content->columns = max(content->columns, column);
+        }
+    }
+
+    AcquireSRWLockExclusive(&stopLock);
+    if (!stopped) {
+        if (SUCCEEDED(hr)) {
+            AcquireSRWLockExclusive(&callbackWindow->loadedContentLock);
+            callbackWindow->loadedContent = std::move(content);
+            ReleaseSRWLockExclusive(&callbackWindow->loadedContentLock);
+        }
+        PostMessage(callbackWindow->hwnd, MSG_LOAD_COMPLETE, (WPARAM)hr, 0);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+} // namespace
@@ -0,0 +1,75 @@
+#pragma once
+#include <common.h>
+
+#include "PreviewHandler.h"
+#include "TextLines.h"
+#include "WorkerPool.h"
+#include <memory>
+
+namespace chromafiler {
+
+// {4c4e31a2-dfab-48b5-9282-11e10603f00f}
+const CLSID CLSID_TextPreview =
+    {0x4c4e31a2, 0xdfab, 0x48b5, {0x92, 0x82, 0x11, 0xe1, 0x06, 0x03, 0xf0, 0x0f}};
+// Read-only view of the start of a text file, used in place of the system text previewer when
+// the text editor is disabled. The encoding is detected the same way as TextWindow, but only the
+// first part of the file is read, and only the visible lines are laid out and painted.
+class TextPreview : public PreviewHandlerImpl {
+public:
+    static void init();
+    static void uninit();
+
+    ~TextPreview();
+
+protected:
+    enum UserMessage {
+        // WPARAM: HRESULT, LPARAM: 0
+        MSG_LOAD_COMPLETE = WM_USER,
+        MSG_LAST
+    };
+    const wchar_t * className() const override;
+    DWORD windowStyle() const override;
+    LRESULT handleMessage(UINT message, WPARAM wParam, LPARAM lParam) override;
+
+private:
+    struct Content {
+        std::unique_ptr<uint8_t[]> buffer; // owns text
+        const wchar_t *text = nullptr; // null terminated
+        size_t length = 0;
+        std::unique_ptr<TextLines> lines;
+        int columns = 0; // of the longest line, with tabs expanded
+        bool truncated = false;
+    };
+
+    void onPaint(PAINTSTRUCT paint);
+    void updateLayout();
+    void setScroll(POINT pos); // clamped
+    int lineCount(); // including the truncation notice
+
+    HFONT font = nullptr;
+    int lineHeight = 0, charWidth = 0, margin = 0; // pixels
+    int tabWidth = 4; // characters
+    POINT scrollPos = {};
+    int wheelAccum = 0, hWheelAccum = 0;
+
+    std::unique_ptr<Content> content; // null until loaded
+    SRWLOCK loadedContentLock = SRWLOCK_INIT;
+    std::unique_ptr<Content> loadedContent; // passed from the task
+
+    class LoadTask : public PoolTask {
+    public:
+        LoadTask(IShellItem *item, TextPreview *callbackWindow, int tabWidth);
+        void stop();
+        void run() override;
+    private:
+        CComHeapPtr<ITEMIDLIST> itemIDList;
+        TextPreview *callbackWindow;
+        int tabWidth; // for measuring columns
+        SRWLOCK stopLock = SRWLOCK_INIT; // task will not be stopped while held
+        bool stopped = false;
+    };
+
+    CComPtr<LoadTask> loadTask;
+};
+
+} // namespace
@@ -0,0 +1,111 @@
+#include "TextStats.h"
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace chromafiler {
+
+static inline bool isSpace(wchar_t c) {
+    return c <= 0x20;
+}
+
+static inline bool isNewline(wchar_t c) {
+    return c == L'\r' || c == L'\n';
+}
+
+static inline int popCount8(unsigned int x) {
+    x = x - ((x >> 1) & 0x55);
+    x = (x & 0x33) + ((x >> 2) & 0x33);
+    return (x + (x >> 4)) & 0x0F;
+}
+
+static void countScalar(const wchar_t *text, size_t length, wchar_t prev, TextStats *stats) {
+    for (size_t i = 0; i < length; i++) {
+        wchar_t c = text[i];
+        if (!isSpace(c) && isSpace(prev))
+            stats->words++;
+        prev = c;
+        if (isNewline(c)) {
+            stats->newlines++;
+            continue;
+        }
+        stats->utf16Units++;
+        if ((c & 0xFC00) != 0xDC00) // not a low surrogate
+            stats->codePoints++;
+        if (c < 0x80)
+            stats->utf8Bytes += 1;
+        else if (c < 0x800 || (c & 0xF800) == 0xD800) // surrogate pair is 4 bytes total
+            stats->utf8Bytes += 2;
+        else
+            stats->utf8Bytes += 3;
+    }
+}
+
+void countTextStats(const wchar_t *text, size_t length, wchar_t prev, TextStats *stats) {
+    size_t i = 0;
+#if defined(_M_IX86) || defined(_M_X64)
+    // compute 8-bit masks (one bit per character) for each property, then count bits
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c20 = _mm_set1_epi16(0x20), c7F = _mm_set1_epi16(0x7F),
+        c7FF = _mm_set1_epi16(0x7FF), cr = _mm_set1_epi16(L'\r'), lf = _mm_set1_epi16(L'\n'),
+        surrogateMask = _mm_set1_epi16((short)0xF800), surrogate = _mm_set1_epi16((short)0xD800),
+        lowMask = _mm_set1_epi16((short)0xFC00), low = _mm_set1_epi16((short)0xDC00);
+    unsigned int prevSpace = isSpace(prev) ? 1 : 0;
+    int64_t newlines = 0, words = 0, lowSurrogates = 0, over7F = 0, over7FF = 0, surrogates = 0;
+    for (; i + 8 <= length; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+        // unsigned v <= n is equivalent to saturating v - n == 0
+        __m128i space = _mm_cmpeq_epi16(_mm_subs_epu16(v, c20), zero);
+        __m128i newline = _mm_or_si128(_mm_cmpeq_epi16(v, cr), _mm_cmpeq_epi16(v, lf));
+        __m128i ascii = _mm_cmpeq_epi16(_mm_subs_epu16(v, c7F), zero);
+        __m128i twoByte = _mm_cmpeq_epi16(_mm_subs_epu16(v, c7FF), zero);
+        __m128i isSurrogate = _mm_cmpeq_epi16(_mm_and_si128(v, surrogateMask), surrogate);
+        __m128i isLow = _mm_cmpeq_epi16(_mm_and_si128(v, lowMask), low);
+        unsigned int spaceBits = _mm_movemask_epi8(_mm_packs_epi16(space, zero));
+        unsigned int wordStarts = ~spaceBits & ((spaceBits << 1) | prevSpace) & 0xFF;
+        prevSpace = spaceBits >> 7;
+        words += popCount8(wordStarts);
+        newlines += popCount8(_mm_movemask_epi8(_mm_packs_epi16(newline, zero)));
+        lowSurrogates += popCount8(_mm_movemask_epi8(_mm_packs_epi16(isLow, zero)));
+        over7F += 8 - popCount8(_mm_movemask_epi8(_mm_packs_epi16(ascii, zero)));
+        over7FF += 8 - popCount8(_mm_movemask_epi8(_mm_packs_epi16(twoByte, zero)));
+        surrogates += popCount8(_mm_movemask_epi8(_mm_packs_epi16(isSurrogate, zero)));
+    }
+    int64_t units = (int64_t)i - newlines; // newlines are ascii so they don't affect other counts
+    stats->newlines += newlines;
+    stats->words += words;
+    stats->utf16Units += units;
+    stats->codePoints += units - lowSurrogates;
+    stats->utf8Bytes += units + over7F + over7FF - surrogates;
+    if (i > 0)
+        prev = text[i - 1];
+#endif
+    countScalar(text + i, length - i, prev, stats);
+}
+
+static void subtractStats(TextStats *stats, const TextStats &delta) {
+    stats->newlines -= delta.newlines;
+    stats->words -= delta.words;
+    stats->codePoints -= delta.codePoints;
+    stats->utf16Units -= delta.utf16Units;
+    stats->utf8Bytes -= delta.utf8Bytes;
+}
+
+void replaceTextStats(const wchar_t *removed, size_t removedLength,
+        const wchar_t *inserted, size_t insertedLength, wchar_t before, wchar_t after,
+        TextStats *stats) {
+    // the character after the range may start (or stop starting) a word
+    TextStats old = {};
+    countTextStats(removed, removedLength, before, &old);
+    wchar_t oldLast = removedLength ? removed[removedLength - 1] : before;
+    if (!isSpace(after) && isSpace(oldLast))
+        old.words++;
+    subtractStats(stats, old);
+
+    countTextStats(inserted, insertedLength, before, stats);
+    wchar_t newLast = insertedLength ? inserted[insertedLength - 1] : before;
+    if (!isSpace(after) && isSpace(newLast))
+        stats->words++;
+}
+
+} // namespace
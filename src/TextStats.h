@@ -0,0 +1,29 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chromafiler {
+
+// Document statistics which can be maintained incrementally as text is replaced. Whitespace is
+// any character <= U+0020, and a word is a run of non-whitespace characters.
+struct TextStats {
+    int64_t newlines;   // CR or LF characters
+    int64_t words;
+    int64_t codePoints; // excluding newlines
+    int64_t utf16Units; // excluding newlines
+    int64_t utf8Bytes;  // excluding newlines
+};
+
+// Add the statistics of text to stats. prev is the character before the text (0 if none), which
+// decides whether the first character starts a word.
+void countTextStats(const wchar_t *text, size_t length, wchar_t prev, TextStats *stats);
+
+// Update stats for replacing removed with inserted. before and after are the characters adjacent
+// to the replaced range (0 at the start/end of the document), needed to keep word counts exact.
+void replaceTextStats(const wchar_t *removed, size_t removedLength,
+    const wchar_t *inserted, size_t insertedLength, wchar_t before, wchar_t after,
+    TextStats *stats);
+
+} // namespace
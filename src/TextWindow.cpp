@@ -4,8 +4,13 @@
 #include "Settings.h"
 #include "DPI.h"
 #include "UIStrings.h"
+#include "JSONFormat.h"
+#include "ThreadUtils.h"
+#include "TextStats.h"
 #include <cstdint>
 #include <windowsx.h>
+#include <commctrl.h>
+#include <strsafe.h>
 #include <shlobj.h>
 #include <propkey.h>
 #include <propvarutil.h>
@@ -18,6 +23,16 @@ const ULONG MAX_FILE_SIZE = 50'000'000;
 
 const UINT CP_UTF16LE = 1200;
 
+const UINT RECOUNT_STATS_DELAY = 500;
+const LONG EDIT_CAPTURE_CONTEXT = 256;
+
+const LONG MAX_COMPLETE_PREFIX = 64;
+const size_t MAX_COMPLETIONS = 12;
+
+const size_t FILTER_CHUNK_LINES = 16384;
+const int FILTER_NUMBER_WIDTH = 56;
+const int FILTER_TEXT_WIDTH = 4096;
+
 const uint8_t BOM_UTF8BOM[] = {0xEF, 0xBB, 0xBF};
 const uint8_t BOM_UTF16LE[] = {0xFF, 0xFE};
 const uint8_t BOM_UTF16BE[] = {0xFE, 0xFF};
@@ -174,6 +189,11 @@ void TextWindow::updateFont() {
     scaledLogFont.lfHeight = -pointsToPixels(logFont.lfHeight);
     font = CreateFontIndirect(&scaledLogFont);
     applyEditFont(edit, font);
+    if (filterEdit) {
+        SendMessage(filterEdit, WM_SETFONT, (WPARAM)font, TRUE);
+        SendMessage(filterList, WM_SETFONT, (WPARAM)font, TRUE);
+        updateEditSize();
+    }
 }
 
 bool TextWindow::onCloseRequest() {
@@ -192,6 +212,10 @@ void TextWindow::onDestroy() {
         DeleteFont(font);
     if (loadThread)
         loadThread->stop();
+    if (filterThread)
+        filterThread->stop();
+    if (wordIndexThread)
+        wordIndexThread->stop();
 }
 
 void TextWindow::addToolbarButtons(HWND tb) {
@@ -214,7 +238,7 @@ int TextWindow::getToolbarTooltip(WORD command) {
 }
 
 void TextWindow::trackContextMenu(POINT pos) {
-    if (!isEditable()) {
+    if (!isEditable() || filterEdit) {
         ItemWindow::trackContextMenu(pos);
         return;
     }
@@ -226,7 +250,7 @@ void TextWindow::trackContextMenu(POINT pos) {
 void TextWindow::onActivate(WORD state, HWND prevWindow) {
     ItemWindow::onActivate(state, prevWindow);
     if (state != WA_INACTIVE) {
-        SetFocus(edit);
+        SetFocus(filterEdit ? filterEdit : edit);
     }
 }
 
@@ -237,6 +261,11 @@ void TextWindow::onSize(SIZE size) {
 
 void TextWindow::updateEditSize() {
     RECT body = windowBody();
+    if (filterEdit) {
+        MoveWindow(filterEdit, body.left, body.top, rectWidth(body), filterBarHeight, TRUE);
+        body.top += filterBarHeight;
+        MoveWindow(filterList, body.left, body.top, rectWidth(body), rectHeight(body), TRUE);
+    }
     MoveWindow(edit, body.left, body.top, rectWidth(body), rectHeight(body), TRUE);
 }
 
@@ -244,6 +273,18 @@ bool TextWindow::handleTopLevelMessage(MSG *msg) {
     // TODO: this will only be handled if the text window is active
     if (findReplaceDialog && IsDialogMessage(findReplaceDialog, msg))
         return true;
+    if (filterEdit && msg->hwnd == filterEdit && msg->message == WM_KEYDOWN) {
+        if (msg->wParam == VK_ESCAPE) {
+            closeFilter();
+            return true;
+        } else if ((msg->wParam == VK_DOWN || msg->wParam == VK_RETURN) && !filterLines.empty()) {
+            SetFocus(filterList);
+            if (ListView_GetNextItem(filterList, -1, LVNI_FOCUSED) == -1)
+                ListView_SetItemState(filterList, 0, LVIS_FOCUSED | LVIS_SELECTED,
+                    LVIS_FOCUSED | LVIS_SELECTED);
+            return true;
+        }
+    }
     if (msg->message == WM_KEYDOWN && msg->wParam == VK_TAB
             && GetKeyState(VK_CONTROL) >= 0 && GetKeyState(VK_MENU) >= 0)
         return false; // allow rich edit subclass to handle these
@@ -276,7 +317,7 @@ LRESULT TextWindow::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
                 detectNewlines = result.newlines;
                 debugPrintf(L"Detected encoding %d\n", detectEncoding);
                 debugPrintf(L"Detected newlines %d\n", detectNewlines);
-                updateStatus();
+                recountStats();
             }
             return 0;
         }
@@ -284,6 +325,55 @@ LRESULT TextWindow::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
             if (hasStatusText())
                 setStatusText(getErrorMessage((HRESULT)wParam).get());
             return 0;
+        case MSG_FILTER_COMPLETE: {
+            AcquireSRWLockExclusive(&asyncFilterResultLock);
+            std::unique_ptr<std::vector<uint32_t>> result = std::move(asyncFilterResult);
+            ReleaseSRWLockExclusive(&asyncFilterResultLock);
+            if (result && filterList) {
+                filterLines = std::move(*result);
+                ListView_SetItemCountEx(filterList, (int)filterLines.size(), 0);
+                if (hasStatusText()) {
+                    setStatusText(formatString(IDS_TEXT_FILTER_STATUS,
+                        (int)filterLines.size(), (int)filterSnapshot->lines.count()).get());
+                }
+            }
+            return 0;
+        }
+        case MSG_CLOSE_FILTER: {
+            int index = (int)wParam;
+            LONG offset = -1;
+            if (filterEdit && index >= 0 && index < (int)filterLines.size())
+                offset = (LONG)filterSnapshot->lines.lineStart(filterLines[index]);
+            closeFilter();
+            if (offset >= 0) {
+                CHARRANGE sel = {offset, offset};
+                SendMessage(edit, EM_EXSETSEL, 0, (LPARAM)&sel);
+                SendMessage(edit, EM_SCROLLCARET, 0, 0);
+            }
+            return 0;
+        }
+        case MSG_WORD_INDEX_COMPLETE: {
+            AcquireSRWLockExclusive(&asyncWordIndexLock);
+            std::unique_ptr<WordIndex> result = std::move(asyncWordIndex);
+            ReleaseSRWLockExclusive(&asyncWordIndexLock);
+            if (result) {
+                wordIndexThread = nullptr;
+                wordIndex = std::move(result);
+                // catch up with edits made since the text was copied
+                for (auto &wordEdit : pendingWordEdits) {
+                    wordIndex->update(wordEdit.removed.data(), wordEdit.removed.size(), -1);
+                    wordIndex->update(wordEdit.inserted.data(), wordEdit.inserted.size(), 1);
+                }
+                pendingWordEdits.clear();
+            }
+            return 0;
+        }
+        case WM_TIMER:
+            if (wParam == TIMER_RECOUNT_STATS) {
+                recountStats();
+                return 0;
+            }
+            break;
         case WM_QUERYENDSESSION:
             if (isEditable() && Edit_GetModify(edit)) {
                 userSave();
@@ -345,6 +435,10 @@ LRESULT TextWindow::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
 bool TextWindow::onCommand(WORD command) {
     if (!isEditable())
         return ItemWindow::onCommand(command);
+    // text commands (after IDM_SAVE) operate on the editor, so leave filter mode first
+    if (filterEdit && command > IDM_SAVE && command < IDM_SHELL_FIRST
+            && command != IDM_FILTER_LINES)
+        closeFilter();
     switch (command) {
         case IDM_SAVE:
             userSave();
@@ -394,9 +488,30 @@ bool TextWindow::onCommand(WORD command) {
             SendMessage(edit, EM_EXSETSEL, 0, (LPARAM)&sel);
             return true;
         }
+        case IDM_FILTER_LINES:
+            if (filterEdit)
+                closeFilter();
+            else
+                openFilter();
+            return true;
         case IDM_LINE_SELECT:
             lineSelect();
             return true;
+        case IDM_COMPLETE_WORD:
+            completeWord();
+            return true;
+        case IDM_SORT_LINES:
+        case IDM_SORT_LINES_NUMERIC:
+        case IDM_UNIQUE_LINES:
+        case IDM_REVERSE_LINES:
+            reorderLines(command);
+            return true;
+        case IDM_VALIDATE_JSON:
+            checkJSON(false);
+            return true;
+        case IDM_FORMAT_JSON:
+            checkJSON(true);
+            return true;
         case IDM_WORD_WRAP: {
             bool wordWrap = !isWordWrap();
             setWordWrap(wordWrap);
@@ -423,6 +538,12 @@ bool TextWindow::onControlCommand(HWND controlHwnd, WORD notif) {
     if (controlHwnd == edit && notif == EN_CHANGE) {
         if (Edit_GetModify(edit))
             setToolbarButtonState(IDM_SAVE, TBSTATE_ENABLED);
+        // change could be anywhere (undo, drag-and-drop, TOM edits), count everything later
+        if (!trackingEdit && isEditable())
+            checkLE(SetTimer(hwnd, TIMER_RECOUNT_STATS, RECOUNT_STATS_DELAY, nullptr));
+    } else if (filterEdit && controlHwnd == filterEdit && notif == EN_CHANGE) {
+        updateFilter();
+        return true;
     }
     return ItemWindow::onControlCommand(controlHwnd, notif);
 }
@@ -431,6 +552,30 @@ LRESULT TextWindow::onNotify(NMHDR *nmHdr) {
     if (nmHdr->hwndFrom == edit && nmHdr->code == EN_SELCHANGE) {
         updateStatus();
         return 0;
+    } else if (filterList && nmHdr->hwndFrom == filterList) {
+        switch (nmHdr->code) {
+            case LVN_GETDISPINFO: {
+                LVITEM &lvItem = ((NMLVDISPINFO *)nmHdr)->item;
+                if ((lvItem.mask & LVIF_TEXT) && lvItem.iItem < (int)filterLines.size()) {
+                    uint32_t line = filterLines[lvItem.iItem];
+                    if (lvItem.iSubItem == 0) {
+                        StringCchPrintf(lvItem.pszText, lvItem.cchTextMax, L"%u", line + 1);
+                    } else {
+                        size_t length;
+                        const wchar_t *text = filterSnapshot->lines.line(line, &length);
+                        StringCchCopyN(lvItem.pszText, lvItem.cchTextMax, text, length);
+                    }
+                }
+                return 0;
+            }
+            case LVN_ITEMACTIVATE: // can't destroy the list during its own notification
+                PostMessage(hwnd, MSG_CLOSE_FILTER, ((NMITEMACTIVATE *)nmHdr)->iItem, 0);
+                return 0;
+            case LVN_KEYDOWN:
+                if (((NMLVKEYDOWN *)nmHdr)->wVKey == VK_ESCAPE)
+                    PostMessage(hwnd, MSG_CLOSE_FILTER, (WPARAM)-1, 0);
+                return 0;
+        }
     }
     return ItemWindow::onNotify(nmHdr);
 }
@@ -447,15 +592,119 @@ void TextWindow::updateStatus() {
     checkHR(range->GetEnd(&end));
     checkHR(range->GetIndex(tomParagraph, &line));
     checkHR(range->StartOf(tomParagraph, tomMove, &toStart));
+    int numLines = (int)docStats.newlines + 1, numWords = (int)docStats.words;
+    int numChars = (int)docStats.codePoints;
+    // exact except for multi-byte ANSI code pages
+    int64_t newlineUnits = docStats.newlines * (currentNewlines() == NL_CRLF ? 2 : 1);
+    int64_t numBytes;
+    switch (currentEncoding()) {
+        case ENC_UTF16LE:
+        case ENC_UTF16BE:
+            numBytes = sizeof(BOM_UTF16LE) + (docStats.utf16Units + newlineUnits) * 2;
+            break;
+        case ENC_UTF8BOM:
+            numBytes = sizeof(BOM_UTF8BOM) + docStats.utf8Bytes + newlineUnits;
+            break;
+        case ENC_ANSI:
+            numBytes = docStats.codePoints + newlineUnits;
+            break;
+        default:
+            numBytes = docStats.utf8Bytes + newlineUnits;
+    }
     local_wstr_ptr status;
     if (start == end) {
-        status = formatString(IDS_TEXT_STATUS, line, 1 - toStart);
+        status = formatString(IDS_TEXT_STATUS, line, 1 - toStart,
+            numLines, numWords, numChars, (int)numBytes);
     } else {
-        status = formatString(IDS_TEXT_STATUS_SEL, line, 1 - toStart, end - start);
+        status = formatString(IDS_TEXT_STATUS_SEL, line, 1 - toStart, end - start,
+            numLines, numWords, numChars, (int)numBytes);
     }
     setStatusText(status.get());
 }
 
+void TextWindow::recountStats() {
+    KillTimer(hwnd, TIMER_RECOUNT_STATS);
+    LONG textLength;
+    wstr_ptr text = getText(&textLength);
+    docStats = {};
+    countTextStats(text.get(), textLength, 0, &docStats);
+    updateStatus();
+
+    // rebuild the word index in the background from the same copy of the text
+    if (wordIndexThread) {
+        wordIndexThread->stop();
+        // discard a result that was already posted
+        AcquireSRWLockExclusive(&asyncWordIndexLock);
+        asyncWordIndex = nullptr;
+        ReleaseSRWLockExclusive(&asyncWordIndexLock);
+    }
+    pendingWordEdits.clear();
+    wordIndexThread.Attach(new WordIndexThread(std::move(text), textLength, this));
+    wordIndexThread->start();
+}
+
+void TextWindow::captureEdit(EditCapture *capture) {
+    CHARRANGE sel;
+    SendMessage(edit, EM_EXGETSEL, 0, (LPARAM)&sel);
+    capture->docLength = getTextLength();
+    capture->start = max(0, sel.cpMin - EDIT_CAPTURE_CONTEXT);
+    LONG end = min(capture->docLength, sel.cpMax + EDIT_CAPTURE_CONTEXT);
+    capture->text = getTextRange(capture->start, end, &capture->length);
+}
+
+void TextWindow::countEdit(const EditCapture &before) {
+    // the same range of text, adjusted for the change in length
+    LONG docLength = getTextLength();
+    LONG end = before.start + before.length + (docLength - before.docLength);
+    if (end < before.start) {
+        recountStats();
+        return;
+    }
+    LONG length;
+    wstr_ptr after = getTextRange(before.start, end, &length);
+
+    // find the changed part by trimming the common prefix and suffix
+    LONG maxCommon = min(length, before.length);
+    LONG prefix = 0, suffix = 0;
+    while (prefix < maxCommon && after[prefix] == before.text[prefix])
+        prefix++;
+    while (suffix < maxCommon - prefix
+            && after[length - 1 - suffix] == before.text[before.length - 1 - suffix])
+        suffix++;
+    if (prefix == length && length == before.length)
+        return; // no change
+    // if the change reaches the edge of the captured text it may extend beyond it
+    if ((prefix == 0 && before.start != 0)
+            || (suffix == 0 && before.start + before.length != before.docLength)) {
+        recountStats();
+        return;
+    }
+    wchar_t prevChar = prefix > 0 ? after[prefix - 1] : 0;
+    wchar_t nextChar = suffix > 0 ? after[length - suffix] : 0;
+    replaceTextStats(before.text.get() + prefix, before.length - prefix - suffix,
+        after.get() + prefix, length - prefix - suffix, prevChar, nextChar, &docStats);
+    updateStatus();
+
+    // extend the changed range to whole words, which are the same before and after the change
+    while (prefix > 0 && WordIndex::isWordChar(after[prefix - 1]))
+        prefix--;
+    while (suffix > 0 && WordIndex::isWordChar(after[length - suffix]))
+        suffix--;
+    updateWordIndex(before.text.get() + prefix, before.length - prefix - suffix,
+        after.get() + prefix, length - prefix - suffix);
+}
+
+void TextWindow::updateWordIndex(const wchar_t *removed, size_t removedLength,
+        const wchar_t *inserted, size_t insertedLength) {
+    if (wordIndexThread) {
+        pendingWordEdits.push_back({std::vector<wchar_t>(removed, removed + removedLength),
+            std::vector<wchar_t>(inserted, inserted + insertedLength)});
+    } else if (wordIndex) {
+        wordIndex->update(removed, removedLength, -1);
+        wordIndex->update(inserted, insertedLength, 1);
+    }
+}
+
 void TextWindow::userSave() {
     HRESULT hr;
     if (checkHR(hr = saveText())) {
@@ -500,6 +749,41 @@ void TextWindow::changeFontSize(int amount) {
     settings::setTextFont(logFont);
 }
 
+LONG TextWindow::getTextLength() {
+    // can't use WM_GETTEXTLENGTH because it counts CRLFs instead of LFs
+    GETTEXTLENGTHEX getLength = {GTL_NUMCHARS | GTL_PRECISE, CP_UTF16LE};
+    return (LONG)SendMessage(edit, EM_GETTEXTLENGTHEX, (WPARAM)&getLength, 0);
+}
+
+wstr_ptr TextWindow::getText(LONG *length) {
+    LONG textLength = getTextLength();
+    wstr_ptr buffer(new wchar_t[textLength + 1]);
+    GETTEXTEX getTextEx = {};
+    getTextEx.cb = (textLength + 1) * sizeof(wchar_t);
+    getTextEx.codepage = CP_UTF16LE;
+    *length = (LONG)SendMessage(edit, EM_GETTEXTEX, (WPARAM)&getTextEx, (LPARAM)buffer.get());
+    return buffer;
+}
+
+wstr_ptr TextWindow::getTextRange(LONG start, LONG end, LONG *length) {
+    wstr_ptr buffer(new wchar_t[end - start + 1]);
+    TEXTRANGE range = {{start, end}, buffer.get()};
+    *length = (LONG)SendMessage(edit, EM_GETTEXTRANGE, 0, (LPARAM)&range);
+    return buffer;
+}
+
+TextEncoding TextWindow::currentEncoding() {
+    if (detectEncoding == ENC_UNK || !settings::getTextAutoEncoding())
+        return settings::getTextDefaultEncoding();
+    return detectEncoding;
+}
+
+TextNewlines TextWindow::currentNewlines() {
+    if (detectNewlines == NL_UNK || !settings::getTextAutoNewlines())
+        return settings::getTextDefaultNewlines();
+    return detectNewlines;
+}
+
 bool TextWindow::isWordWrap() {
     return !(GetWindowLongPtr(edit, GWL_STYLE) & ES_AUTOHSCROLL);
 }
@@ -507,14 +791,8 @@ bool TextWindow::isWordWrap() {
 void TextWindow::setWordWrap(bool wordWrap) {
     if (!isEditable())
         return;
-    // can't use WM_GETTEXTLENGTH because it counts CRLFs instead of LFs
-    GETTEXTLENGTHEX getLength = {GTL_NUMCHARS | GTL_PRECISE, CP_UTF16LE};
-    LONG textLength = (LONG)SendMessage(edit, EM_GETTEXTLENGTHEX, (WPARAM)&getLength, 0);
-    wstr_ptr buffer(new wchar_t[textLength + 1]);
-    GETTEXTEX getText = {};
-    getText.cb = (textLength + 1) * sizeof(wchar_t);
-    getText.codepage = CP_UTF16LE;
-    SendMessage(edit, EM_GETTEXTEX, (WPARAM)&getText, (LPARAM)buffer.get());
+    LONG textLength;
+    wstr_ptr buffer = getText(&textLength);
 
     // other state
     BOOL modify = Edit_GetModify(edit);
@@ -526,7 +804,9 @@ void TextWindow::setWordWrap(bool wordWrap) {
     updateEditSize();
 
     SETTEXTEX setText = {ST_UNICODE, CP_UTF16LE};
+    trackingEdit = true; // same text
     SendMessage(edit, EM_SETTEXTEX, (WPARAM)&setText, (LPARAM)buffer.get());
+    trackingEdit = false;
     Edit_SetModify(edit, modify);
     SendMessage(edit, EM_EXSETSEL, 0, (LPARAM)&sel);
 
@@ -594,6 +874,66 @@ void TextWindow::lineSelect() {
     checkHR(sel->Expand(tomParagraph, nullptr));
 }
 
+void TextWindow::completeWord() {
+    CHARRANGE sel;
+    SendMessage(edit, EM_EXGETSEL, 0, (LPARAM)&sel);
+    if (!wordIndex || sel.cpMin != sel.cpMax) {
+        MessageBeep(MB_OK);
+        return;
+    }
+    LONG caret = sel.cpMax, textLength;
+    wstr_ptr text = getTextRange(max(0, caret - MAX_COMPLETE_PREFIX), caret, &textLength);
+    LONG prefixLength = 0;
+    while (prefixLength < textLength && WordIndex::isWordChar(text[textLength - 1 - prefixLength]))
+        prefixLength++;
+    const wchar_t *prefix = text.get() + textLength - prefixLength;
+
+    std::vector<WordIndex::Match> matches;
+    if (prefixLength != 0)
+        wordIndex->complete(prefix, prefixLength, MAX_COMPLETIONS + 1, &matches);
+    // copy words out of the index, which will change when one is inserted
+    std::vector<wstr_ptr> words;
+    for (auto &match : matches) {
+        if (words.size() == MAX_COMPLETIONS)
+            break;
+        // the word being typed is usually in the index itself
+        if (match.length == (size_t)prefixLength && wmemcmp(match.text, prefix, prefixLength) == 0)
+            continue;
+        wstr_ptr word(new wchar_t[match.length + 1]);
+        wmemcpy(word.get(), match.text, match.length);
+        word[match.length] = 0;
+        words.push_back(std::move(word));
+    }
+    if (words.empty()) {
+        MessageBeep(MB_OK);
+        return;
+    }
+    HMENU menu = CreatePopupMenu();
+    for (size_t i = 0; i < words.size(); i++)
+        AppendMenu(menu, MF_STRING, i + 1, words[i].get());
+
+    POINTL caretPos = {};
+    SendMessage(edit, EM_POSFROMCHAR, (WPARAM)&caretPos, caret);
+    TEXTMETRIC metrics;
+    HDC hdc = GetDC(edit);
+    HFONT oldFont = SelectFont(hdc, font);
+    GetTextMetrics(hdc, &metrics);
+    SelectFont(hdc, oldFont);
+    ReleaseDC(edit, hdc);
+    POINT menuPos = {caretPos.x, caretPos.y + metrics.tmHeight};
+    ClientToScreen(edit, &menuPos);
+    int cmd = TrackPopupMenuEx(menu, TPM_RETURNCMD | TPM_LEFTALIGN | TPM_TOPALIGN,
+        menuPos.x, menuPos.y, hwnd, nullptr);
+    DestroyMenu(menu);
+    if (cmd <= 0)
+        return;
+
+    // replace the whole prefix, in case the chosen word differs in case
+    sel = {caret - prefixLength, caret};
+    SendMessage(edit, EM_EXSETSEL, 0, (LPARAM)&sel);
+    SendMessage(edit, EM_REPLACESEL, TRUE, (LPARAM)words[cmd - 1].get());
+}
+
 void TextWindow::openFindDialog(bool replace) {
     if (findReplaceDialog)
         DestroyWindow(findReplaceDialog);
@@ -698,6 +1038,190 @@ int TextWindow::replaceAll(FINDREPLACE *input) {
     return numOccurrences;
 }
 
+void TextWindow::reorderLines(WORD command) {
+    CComPtr<ITextDocument> doc = getTOMDocument();
+    if (!doc) return;
+    CHARRANGE sel;
+    SendMessage(edit, EM_EXGETSEL, 0, (LPARAM)&sel);
+    LONG textLength;
+    wstr_ptr text = getText(&textLength);
+    TextLines lines(text.get(), textLength); // line slices refer to the snapshot, not copied
+
+    // selected lines, or the whole document if less than two lines are selected
+    size_t first = 0, last = lines.count();
+    if (sel.cpMax > sel.cpMin) {
+        first = lines.lineAt(sel.cpMin);
+        last = lines.lineAt(sel.cpMax - 1) + 1; // exclude line if selection ends at its start
+        if (last - first < 2) {
+            first = 0;
+            last = lines.count();
+        }
+    }
+    size_t lastLength;
+    lines.line(last - 1, &lastLength);
+    if (last == lines.count() && last - first > 1 && lastLength == 0) {
+        last--; // keep trailing newline at the end
+        lines.line(last - 1, &lastLength);
+    }
+
+    std::vector<uint32_t> order;
+    switch (command) {
+        case IDM_SORT_LINES:
+        case IDM_SORT_LINES_NUMERIC:
+            sortLines(lines, first, last, command == IDM_SORT_LINES_NUMERIC, parallelFor, &order);
+            break;
+        case IDM_UNIQUE_LINES:
+            uniqueLines(lines, first, last, &order);
+            break;
+        case IDM_REVERSE_LINES:
+            for (size_t i = last; i-- > first;)
+                order.push_back((uint32_t)i);
+            break;
+    }
+
+    ChunkedTextBuffer output;
+    for (size_t i = 0; i < order.size(); i++) {
+        if (i != 0)
+            output.append(L'\r');
+        size_t length;
+        const wchar_t *line = lines.line(order[i], &length);
+        output.append(line, length);
+    }
+    CComPtr<ITextRange> range;
+    LONG start = (LONG)lines.lineStart(first);
+    LONG end = (LONG)(lines.lineStart(last - 1) + lastLength);
+    if (!checkHR(doc->Range(start, end, &range))) return;
+    CComBSTR result((int)output.size());
+    if (!result) return;
+    output.copyTo(result);
+    checkHR(range->SetText(result)); // single edit so it can be undone in one step
+    checkHR(range->Select());
+
+    if (command == IDM_UNIQUE_LINES && hasStatusText()) {
+        int numRemoved = (int)(last - first - order.size());
+        setStatusText(formatString(IDS_TEXT_STATUS_DUPLICATES, numRemoved).get());
+    }
+}
+
+TextWindow::FilterSnapshot::FilterSnapshot(wstr_ptr textBuffer, size_t length)
+    : text(std::move(textBuffer)), lines(text.get(), length) {}
+
+void TextWindow::openFilter() {
+    LONG textLength;
+    wstr_ptr text = getText(&textLength);
+    filterSnapshot = std::make_shared<FilterSnapshot>(std::move(text), textLength);
+
+    HINSTANCE instance = GetWindowInstance(hwnd);
+    filterEdit = checkLE(CreateWindowEx(WS_EX_CLIENTEDGE, L"EDIT", nullptr,
+        WS_CHILD | WS_VISIBLE | ES_AUTOHSCROLL, 0, 0, 0, 0, hwnd, nullptr, instance, nullptr));
+    SendMessage(filterEdit, WM_SETFONT, (WPARAM)font, FALSE);
+    Edit_SetCueBannerText(filterEdit, getString(IDS_TEXT_FILTER_CUE));
+    HDC hdc = GetDC(filterEdit);
+    HFONT oldFont = SelectFont(hdc, font);
+    TEXTMETRIC metrics;
+    GetTextMetrics(hdc, &metrics);
+    SelectFont(hdc, oldFont);
+    ReleaseDC(filterEdit, hdc);
+    filterBarHeight = metrics.tmHeight + 2 * GetSystemMetrics(SM_CYEDGE) + scaleDPI(4);
+
+    // virtual list, text is fetched from the snapshot on demand
+    filterList = checkLE(CreateWindow(WC_LISTVIEW, nullptr,
+        WS_CHILD | WS_VISIBLE | LVS_REPORT | LVS_OWNERDATA | LVS_NOCOLUMNHEADER
+            | LVS_SINGLESEL | LVS_SHOWSELALWAYS,
+        0, 0, 0, 0, hwnd, nullptr, instance, nullptr));
+    ListView_SetExtendedListViewStyle(filterList, LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER);
+    SendMessage(filterList, WM_SETFONT, (WPARAM)font, FALSE);
+    LVCOLUMN column = {LVCF_WIDTH | LVCF_SUBITEM};
+    column.cx = scaleDPI(FILTER_NUMBER_WIDTH);
+    column.iSubItem = 0;
+    ListView_InsertColumn(filterList, 0, &column);
+    column.cx = scaleDPI(FILTER_TEXT_WIDTH);
+    column.iSubItem = 1;
+    ListView_InsertColumn(filterList, 1, &column);
+
+    ShowWindow(edit, SW_HIDE);
+    updateEditSize();
+    updateFilter();
+    SetFocus(filterEdit);
+}
+
+void TextWindow::closeFilter() {
+    if (filterThread) {
+        filterThread->stop();
+        filterThread = nullptr;
+    }
+    DestroyWindow(filterEdit);
+    DestroyWindow(filterList);
+    filterEdit = filterList = nullptr;
+    filterSnapshot = nullptr;
+    std::vector<uint32_t>().swap(filterLines);
+
+    ShowWindow(edit, SW_SHOW);
+    updateEditSize();
+    SetFocus(edit);
+    updateStatus();
+}
+
+void TextWindow::updateFilter() {
+    if (filterThread) {
+        filterThread->stop();
+        filterThread = nullptr;
+    }
+    int length = GetWindowTextLength(filterEdit);
+    wstr_ptr pattern(new wchar_t[length + 1]);
+    GetWindowText(filterEdit, pattern.get(), length + 1);
+    LineFilter filter;
+    if (!filter.parse(pattern.get())) {
+        // don't leave the results of the previous pattern on screen
+        std::vector<uint32_t>().swap(filterLines);
+        ListView_SetItemCountEx(filterList, 0, 0);
+        if (hasStatusText())
+            setStatusText(getString(IDS_TEXT_FILTER_INVALID));
+        else
+            Edit_ShowBalloonTip(filterEdit, tempPtr(EDITBALLOONTIP{sizeof(EDITBALLOONTIP),
+                nullptr, getString(IDS_TEXT_FILTER_INVALID), TTI_NONE}));
+        return;
+    }
+    Edit_HideBalloonTip(filterEdit);
+    filterThread.Attach(new FilterThread(filterSnapshot, filter, this));
+    filterThread->start();
+}
+
+void TextWindow::checkJSON(bool format) {
+    LONG textLength;
+    wstr_ptr text = getText(&textLength);
+    ChunkedTextBuffer output;
+    JSONResult result = processJSON(text.get(), textLength, format ? &output : nullptr, L'\r');
+    text.reset();
+
+    if (result.status != JSON_OK) {
+        CHARRANGE sel = {(LONG)result.errorOffset, (LONG)result.errorOffset};
+        SendMessage(edit, EM_EXSETSEL, 0, (LPARAM)&sel);
+        SendMessage(edit, EM_SCROLLCARET, 0, 0);
+        if (hasStatusText()) {
+            setStatusText(formatString(IDS_JSON_ERROR, result.errorLine, result.errorColumn,
+                getString(IDS_JSON_STATUS_OK + result.status)).get());
+        }
+        MessageBeep(MB_OK);
+        return;
+    }
+
+    if (format) {
+        CComPtr<ITextDocument> doc = getTOMDocument();
+        CComPtr<ITextRange> range;
+        if (!doc || !checkHR(doc->Range(0, textLength, &range))) return;
+        CComBSTR formatted((int)output.size());
+        if (!formatted) return;
+        output.copyTo(formatted);
+        // single edit so it can be undone in one step
+        checkHR(range->SetText(formatted));
+        checkHR(range->Collapse(tomStart));
+        checkHR(range->Select());
+    }
+    if (hasStatusText())
+        setStatusText(getString(IDS_JSON_STATUS_OK));
+}
+
 template<typename T>
 TextNewlines detectNewlineType(T *start, T*end) {
     for (T *c = start; c < end; c++) {
@@ -713,9 +1237,10 @@ TextNewlines detectNewlineType(T *start, T*end) {
     return NL_UNK;
 }
 
-HRESULT TextWindow::loadText(IShellItem *const item, LoadResult *result) {
+HRESULT TextWindow::loadText(IShellItem *const item, LoadResult *result, ULONG maxSize) {
     HRESULT hr;
     ULONG size;
+    result->truncated = false;
     {
         CComPtr<IBindCtx> context;
         if (checkHR(CreateBindCtx(0, &context))) {
@@ -728,8 +1253,12 @@ HRESULT TextWindow::loadText(IShellItem *const item, LoadResult *result) {
         ULARGE_INTEGER largeSize;
         if (!checkHR(hr = IStream_Size(stream, &largeSize)))
             return hr;
-        if (largeSize.QuadPart > (ULONGLONG)MAX_FILE_SIZE)
+        if (maxSize && largeSize.QuadPart > (ULONGLONG)maxSize) {
+            largeSize.QuadPart = maxSize;
+            result->truncated = true;
+        } else if (largeSize.QuadPart > (ULONGLONG)MAX_FILE_SIZE) {
             return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        }
         size = (ULONG)largeSize.QuadPart;
         result->buffer = std::unique_ptr<uint8_t[]>(new uint8_t[size + 2]); // 2 null bytes
         if (!checkHR(hr = IStream_Read(stream, result->buffer.get(), (ULONG)size)))
@@ -750,6 +1279,24 @@ HRESULT TextWindow::loadText(IShellItem *const item, LoadResult *result) {
         result->encoding = ENC_UNK;
     }
 
+    if (result->truncated) {
+        // don't let a code point cut off at the end make the text look like ANSI
+        if (result->encoding == ENC_UTF16BE || result->encoding == ENC_UTF16LE) {
+            size &= ~1;
+        } else {
+            ULONG end = size;
+            while (end > 0 && size - end < 3 && (result->buffer[end - 1] & 0xC0) == 0x80)
+                end--;
+            if (end > 0 && (result->buffer[end - 1] & 0xC0) == 0xC0) {
+                uint8_t lead = result->buffer[end - 1];
+                ULONG length = (lead & 0xF0) == 0xF0 ? 4 : (lead & 0xE0) == 0xE0 ? 3 : 2;
+                if (length > size - end + 1) // sequence continues past the end
+                    size = end - 1;
+            }
+        }
+        result->buffer[size] = result->buffer[size + 1] = 0;
+    }
+
     if (result->encoding == ENC_UTF16BE || result->encoding == ENC_UTF16LE) {
         wchar_t *wcString = ((wchar_t *)(void *)result->buffer.get()) + 1; // skip BOM
         wchar_t *wcEnd = (wchar_t *)(void *)(result->buffer.get() + size);
@@ -759,6 +1306,8 @@ HRESULT TextWindow::loadText(IShellItem *const item, LoadResult *result) {
             else if (result->encoding == ENC_UTF16BE)
                 *c = _byteswap_ushort(*c);
         }
+        if (result->truncated && wcEnd > wcString && IS_HIGH_SURROGATE(wcEnd[-1]))
+            *(--wcEnd) = 0;
         result->newlines = detectNewlineType(wcString, wcEnd);
         result->textStart = (uint8_t *)wcString;
         result->setText = {ST_UNICODE, CP_UTF16LE};
@@ -809,13 +1358,9 @@ HRESULT TextWindow::loadText(IShellItem *const item, LoadResult *result) {
 HRESULT TextWindow::saveText() {
     debugPrintf(L"Saving!\n");
 
-    TextEncoding saveEncoding = detectEncoding;
-    if (saveEncoding == ENC_UNK || !settings::getTextAutoEncoding())
-        saveEncoding = settings::getTextDefaultEncoding();
+    TextEncoding saveEncoding = currentEncoding();
     bool isUtf16 = saveEncoding == ENC_UTF16LE || saveEncoding == ENC_UTF16BE;
-    TextNewlines saveNewlines = detectNewlines;
-    if (saveNewlines == NL_UNK || !settings::getTextAutoNewlines())
-        saveNewlines = settings::getTextDefaultNewlines();
+    TextNewlines saveNewlines = currentNewlines();
 
     GETTEXTLENGTHEX getLength = {};
     getLength.flags = (isUtf16 ? GTL_NUMCHARS : GTL_NUMBYTES) | GTL_CLOSE;
@@ -891,6 +1436,68 @@ TextWindow::LoadThread::LoadThread(IShellItem *const item, TextWindow *const cal
     checkHR(SHGetIDListFromObject(item, &itemIDList));
 }
 
+TextWindow::WordIndexThread::WordIndexThread(wstr_ptr text, size_t length,
+        TextWindow *const callbackWindow)
+        : text(std::move(text)), length(length), callbackWindow(callbackWindow) {}
+
+void TextWindow::WordIndexThread::run() {
+    std::unique_ptr<WordIndex> index(new WordIndex());
+    index->build(text.get(), length);
+    text = nullptr;
+
+    AcquireSRWLockExclusive(&stopLock);
+    if (!isStopped()) {
+        AcquireSRWLockExclusive(&callbackWindow->asyncWordIndexLock);
+        callbackWindow->asyncWordIndex = std::move(index);
+        ReleaseSRWLockExclusive(&callbackWindow->asyncWordIndexLock);
+        PostMessage(callbackWindow->hwnd, MSG_WORD_INDEX_COMPLETE, 0, 0);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+TextWindow::FilterThread::FilterThread(std::shared_ptr<FilterSnapshot> snapshot,
+        const LineFilter &filter, TextWindow *const callbackWindow)
+        : snapshot(snapshot), filter(filter), callbackWindow(callbackWindow) {}
+
+void TextWindow::FilterThread::run() {
+    const TextLines &lines = snapshot->lines;
+    size_t numLines = lines.count();
+    std::unique_ptr<std::vector<uint32_t>> result(new std::vector<uint32_t>());
+    if (filter.isEmpty()) {
+        result->resize(numLines);
+        for (size_t i = 0; i < numLines; i++)
+            (*result)[i] = (uint32_t)i;
+    } else {
+        // each chunk collects its own matches, which are concatenated in order
+        size_t numChunks = (numLines + FILTER_CHUNK_LINES - 1) / FILTER_CHUNK_LINES;
+        std::vector<std::vector<uint32_t>> chunkMatches(numChunks);
+        parallelFor(numChunks, [&](size_t chunk) {
+            if (isStopped())
+                return;
+            size_t end = min((chunk + 1) * FILTER_CHUNK_LINES, numLines);
+            for (size_t i = chunk * FILTER_CHUNK_LINES; i < end; i++) {
+                size_t length;
+                const wchar_t *line = lines.line(i, &length);
+                if (filter.matches(line, length))
+                    chunkMatches[chunk].push_back((uint32_t)i);
+            }
+        });
+        if (isStopped())
+            return;
+        for (auto &matches : chunkMatches)
+            result->insert(result->end(), matches.begin(), matches.end());
+    }
+
+    AcquireSRWLockExclusive(&stopLock);
+    if (!isStopped()) {
+        AcquireSRWLockExclusive(&callbackWindow->asyncFilterResultLock);
+        callbackWindow->asyncFilterResult = std::move(result);
+        ReleaseSRWLockExclusive(&callbackWindow->asyncFilterResultLock);
+        PostMessage(callbackWindow->hwnd, MSG_FILTER_COMPLETE, 0, 0);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
 void TextWindow::LoadThread::run() {
     CComPtr<IShellItem> localItem;
     if (!itemIDList || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&localItem))))
@@ -923,11 +1530,42 @@ static int scrollAccumLines(int *scrollAccum) {
     return lines;
 }
 
+// messages that only change text near the selection
+static bool isLocalEditMessage(UINT message, WPARAM wParam) {
+    switch (message) {
+        case WM_CHAR:
+            return wParam >= 0x20 || wParam == VK_BACK || wParam == VK_TAB || wParam == VK_RETURN;
+        case WM_KEYDOWN: // not undo/redo
+            return wParam == VK_DELETE || wParam == VK_BACK || wParam == VK_RETURN
+                || wParam == VK_INSERT
+                || (GetKeyState(VK_CONTROL) < 0 && (wParam == 'V' || wParam == 'X'));
+        case WM_UNICHAR:
+        case WM_IME_CHAR:
+        case WM_IME_COMPOSITION:
+        case WM_PASTE:
+        case WM_CUT:
+        case WM_CLEAR:
+        case EM_REPLACESEL:
+            return true;
+    }
+    return false;
+}
+
 LRESULT CALLBACK TextWindow::richEditProc(HWND hwnd, UINT message,
-        WPARAM wParam, LPARAM lParam, UINT_PTR, DWORD_PTR refData) {
+        WPARAM wParam, LPARAM lParam, UINT_PTR subclassID, DWORD_PTR refData) {
+    TextWindow *window = (TextWindow *)refData;
+    if (!window->trackingEdit && isLocalEditMessage(message, wParam) && window->isEditable()) {
+        // update statistics from the difference in text around the selection
+        EditCapture before;
+        window->captureEdit(&before);
+        window->trackingEdit = true;
+        LRESULT result = richEditProc(hwnd, message, wParam, lParam, subclassID, refData);
+        window->trackingEdit = false;
+        window->countEdit(before);
+        return result;
+    }
     if (message == WM_MOUSEWHEEL) {
         // override smooth scrolling
-        TextWindow *window = (TextWindow *)refData;
         window->vScrollAccum += GET_WHEEL_DELTA_WPARAM(wParam);
         int lines = scrollAccumLines(&window->vScrollAccum);
         if (GetKeyState(VK_CONTROL) < 0) {
@@ -937,7 +1575,6 @@ LRESULT CALLBACK TextWindow::richEditProc(HWND hwnd, UINT message,
         }
         return 0;
     } else if (message == WM_MOUSEHWHEEL) {
-        TextWindow *window = (TextWindow *)refData;
         window->hScrollAccum += GET_WHEEL_DELTA_WPARAM(wParam);
         int lines = scrollAccumLines(&window->hScrollAccum);
         while (lines > 0) {
@@ -950,10 +1587,10 @@ LRESULT CALLBACK TextWindow::richEditProc(HWND hwnd, UINT message,
         }
         return 0;
     } else if (message == WM_KEYDOWN && wParam == VK_RETURN && settings::getTextAutoIndent()) {
-        ((TextWindow *)refData)->newLine();
+        window->newLine();
         return 0;
     } else if (message == WM_CHAR && wParam == VK_TAB) {
-        ((TextWindow *)refData)->indentSelection((GetKeyState(VK_SHIFT) < 0) ? -1 : 1);
+        window->indentSelection((GetKeyState(VK_SHIFT) < 0) ? -1 : 1);
         return 0;
     } else if (message == WM_CONTEXTMENU) {
         POINT pos = pointFromLParam(lParam);
@@ -963,7 +1600,7 @@ LRESULT CALLBACK TextWindow::richEditProc(HWND hwnd, UINT message,
             SendMessage(hwnd, EM_POSFROMCHAR, (WPARAM)&pos, sel.cpMin);
             pos = clientToScreen(hwnd, pos);
         }
-        ((TextWindow *)refData)->trackContextMenu(pos);
+        window->trackContextMenu(pos);
         return 0;
     }
     return DefSubclassProc(hwnd, message, wParam, lParam);
@@ -3,6 +3,11 @@
 
 #include "ItemWindow.h"
 #include "Settings.h"
+#include "TextLines.h"
+#include "TextStats.h"
+#include "WordIndex.h"
+#include <memory>
+#include <vector>
 #include <Richedit.h>
 #include <commdlg.h>
 #include <TOM.h>
@@ -17,6 +22,18 @@ public:
 
     static void updateAllSettings();
 
+    struct LoadResult {
+        std::unique_ptr<uint8_t[]> buffer; // null terminated!
+        uint8_t *textStart;
+        SETTEXTEX setText;
+        TextEncoding encoding;
+        TextNewlines newlines;
+        bool truncated; // only the first maxSize bytes were read
+    };
+    // read a file and detect its encoding. if maxSize is nonzero, larger files are cut off
+    // (at a code point boundary) instead of failing
+    static HRESULT loadText(IShellItem *item, LoadResult *result, ULONG maxSize = 0);
+
     bool handleTopLevelMessage(MSG *msg) override;
 
 protected:
@@ -29,8 +46,18 @@ protected:
         MSG_LOAD_COMPLETE = ItemWindow::MSG_LAST,
         // WPARAM: HRESULT, LPARAM: 0
         MSG_LOAD_FAIL,
+        // WPARAM: 0, LPARAM: 0
+        MSG_FILTER_COMPLETE,
+        // WPARAM: index of filter list item to jump to, or -1, LPARAM: 0
+        MSG_CLOSE_FILTER,
+        // WPARAM: 0, LPARAM: 0
+        MSG_WORD_INDEX_COMPLETE,
         MSG_LAST
     };
+    enum TimerID {
+        TIMER_RECOUNT_STATS = 1,
+        TIMER_LAST
+    };
     LRESULT handleMessage(UINT message, WPARAM wParam, LPARAM lParam) override;
 
     const wchar_t * appUserModelID() const override;
@@ -61,9 +88,15 @@ private:
     HWND createRichEdit(bool readOnly, bool wordWrap);
     bool isEditable();
     CComPtr<ITextDocument> getTOMDocument();
+    LONG getTextLength();
+    wstr_ptr getText(LONG *length);
+    wstr_ptr getTextRange(LONG start, LONG end, LONG *length);
+    TextEncoding currentEncoding();
+    TextNewlines currentNewlines();
     void updateFont();
     void updateEditSize();
     void updateStatus();
+    void recountStats();
     void userSave();
     bool confirmSave(bool willDelete);
 
@@ -78,18 +111,25 @@ private:
     void findNext(FINDREPLACE *input);
     void replace(FINDREPLACE *input);
     int replaceAll(FINDREPLACE *input);
+    void checkJSON(bool format);
+    void reorderLines(WORD command);
+    void openFilter();
+    void closeFilter();
+    void updateFilter();
+    void completeWord();
 
-    struct LoadResult {
-        std::unique_ptr<uint8_t[]> buffer; // null terminated!
-        uint8_t *textStart;
-        SETTEXTEX setText;
-        TextEncoding encoding;
-        TextNewlines newlines;
-    };
-
-    static HRESULT loadText(IShellItem *item, LoadResult *result);
     HRESULT saveText();
 
+    struct EditCapture {
+        LONG docLength;
+        LONG start, length; // of text
+        wstr_ptr text;
+    };
+    void captureEdit(EditCapture *capture);
+    void countEdit(const EditCapture &before);
+    void updateWordIndex(const wchar_t *removed, size_t removedLength,
+        const wchar_t *inserted, size_t insertedLength);
+
     static LRESULT CALLBACK richEditProc(HWND hwnd, UINT message,
         WPARAM wParam, LPARAM lParam, UINT_PTR subclassID, DWORD_PTR refData);
 
@@ -99,6 +139,8 @@ private:
     TextEncoding detectEncoding = ENC_UNK;
     TextNewlines detectNewlines = NL_UNK;
     int vScrollAccum = 0, hScrollAccum = 0; // for high resolution scrolling
+    TextStats docStats = {};
+    bool trackingEdit = false; // text changes are counted by the caller, don't recount
 
     HWND findReplaceDialog = nullptr;
     FINDREPLACE findReplace;
@@ -107,6 +149,28 @@ private:
     SRWLOCK asyncLoadResultLock = SRWLOCK_INIT;
     LoadResult asyncLoadResult;
 
+    struct FilterSnapshot {
+        FilterSnapshot(wstr_ptr textBuffer, size_t length);
+        wstr_ptr text;
+        TextLines lines;
+    };
+    HWND filterEdit = nullptr, filterList = nullptr;
+    int filterBarHeight = 0;
+    std::shared_ptr<FilterSnapshot> filterSnapshot;
+    std::vector<uint32_t> filterLines; // indices of matching lines in filterSnapshot
+
+    SRWLOCK asyncFilterResultLock = SRWLOCK_INIT;
+    std::unique_ptr<std::vector<uint32_t>> asyncFilterResult;
+
+    struct WordEdit {
+        std::vector<wchar_t> removed, inserted;
+    };
+    std::unique_ptr<WordIndex> wordIndex;
+    std::vector<WordEdit> pendingWordEdits; // made while the index is being rebuilt
+
+    SRWLOCK asyncWordIndexLock = SRWLOCK_INIT;
+    std::unique_ptr<WordIndex> asyncWordIndex;
+
     class LoadThread : public StoppableThread {
     public:
         LoadThread(IShellItem *item, TextWindow *callbackWindow);
@@ -117,6 +181,31 @@ private:
         TextWindow *callbackWindow;
     };
     CComPtr<LoadThread> loadThread;
+
+    class FilterThread : public StoppableThread {
+    public:
+        FilterThread(std::shared_ptr<FilterSnapshot> snapshot, const LineFilter &filter,
+            TextWindow *callbackWindow);
+    protected:
+        void run() override;
+    private:
+        std::shared_ptr<FilterSnapshot> snapshot;
+        LineFilter filter;
+        TextWindow *callbackWindow;
+    };
+    CComPtr<FilterThread> filterThread;
+
+    class WordIndexThread : public StoppableThread {
+    public:
+        WordIndexThread(wstr_ptr text, size_t length, TextWindow *callbackWindow);
+    protected:
+        void run() override;
+    private:
+        wstr_ptr text;
+        size_t length;
+        TextWindow *callbackWindow;
+    };
+    CComPtr<WordIndexThread> wordIndexThread;
 };
 
 } // namespace
@@ -0,0 +1,47 @@
+#include "ThreadUtils.h"
+#include <windows.h>
+
+namespace chromafiler {
+
+struct ParallelForContext {
+    const std::function<void(size_t)> *func;
+    size_t count;
+    volatile LONG next;
+};
+
+static void runParallelFor(ParallelForContext *context) {
+    while (true) {
+        size_t i = (size_t)(InterlockedIncrement(&context->next) - 1);
+        if (i >= context->count)
+            return;
+        (*context->func)(i);
+    }
+}
+
+static void CALLBACK parallelForCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_WORK) {
+    runParallelFor((ParallelForContext *)context);
+}
+
+void parallelFor(size_t count, const std::function<void(size_t)> &func) {
+    if (count == 0)
+        return;
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    size_t helpers = min(count, (size_t)systemInfo.dwNumberOfProcessors) - 1;
+
+    ParallelForContext context = {&func, count, 0};
+    PTP_WORK work = nullptr;
+    if (helpers > 0)
+        work = checkLE(CreateThreadpoolWork(parallelForCallback, &context, nullptr));
+    if (work) {
+        for (size_t i = 0; i < helpers; i++)
+            SubmitThreadpoolWork(work);
+    }
+    runParallelFor(&context);
+    if (work) {
+        WaitForThreadpoolWorkCallbacks(work, FALSE);
+        CloseThreadpoolWork(work);
+    }
+}
+
+} // namespace
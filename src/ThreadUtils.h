@@ -0,0 +1,16 @@
+#pragma once
+#include <common.h>
+
+#include <functional>
+
+namespace chromafiler {
+
+// Call func(i) for every i in [0, count), spread across the system thread pool. The calling
+// thread participates and blocks until every call has returned. func must be thread-safe.
+void parallelFor(size_t count, const std::function<void(size_t)> &func);
+
+// Runs func(i) for every i in [0, count), possibly in parallel (eg. chromafiler::parallelFor).
+// Lets portable code be parallelized by the caller.
+typedef void (*ParallelForFunc)(size_t count, const std::function<void(size_t)> &func);
+
+} // namespace
@@ -0,0 +1,297 @@
+#include "ThumbnailCache.h"
+#include "ThumbnailPack.h"
+#include <list>
+#include <unordered_map>
+#include <windowsx.h>
+#include <propkey.h>
+#include <shlobj.h>
+#include <Shlwapi.h>
+
+namespace chromafiler {
+
+const int MIN_SIZE_BUCKET = 32;
+const wchar_t THUMBNAIL_PACK_FOLDER[] = L"ChromaFiler";
+const wchar_t THUMBNAIL_PACK_FILE[] = L"thumbnails.pack";
+const size_t THUMBNAIL_PACK_MAX_SIZE = 256 << 20;
+
+// PackStorage backed by a memory-mapped file
+class MappedFileStorage : public PackStorage {
+public:
+    ~MappedFileStorage();
+    bool open(const wchar_t *path);
+    uint8_t * data() override;
+    size_t size() override;
+    bool resize(size_t size) override;
+
+private:
+    void unmap();
+
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+    uint8_t *view = nullptr;
+    size_t viewSize = 0;
+};
+
+struct ThumbnailKeyHash {
+    size_t operator()(const ThumbnailKey &key) const {
+        return std::hash<std::wstring>()(key.path)
+            ^ std::hash<uint64_t>()((key.modified * 31 + key.sizeBucket) * 31 + key.background);
+    }
+};
+
+struct CacheEntry {
+    ThumbnailKey key;
+    std::shared_ptr<ThumbnailBitmap> thumbnail;
+};
+
+static SRWLOCK cacheLock = SRWLOCK_INIT;
+static std::list<CacheEntry> lruList; // most recently used first
+static std::unordered_map<ThumbnailKey, std::list<CacheEntry>::iterator, ThumbnailKeyHash>
+    cacheMap;
+static size_t cacheBudget = 0;
+static ThumbnailCacheStats cacheStats = {};
+
+static SRWLOCK packLock = SRWLOCK_INIT;
+static std::unique_ptr<MappedFileStorage> packStorage;
+static std::unique_ptr<ThumbnailPack> pack;
+
+MappedFileStorage::~MappedFileStorage() {
+    unmap();
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+}
+
+bool MappedFileStorage::open(const wchar_t *path) {
+    // not shared, another process would have its own pack
+    file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!checkLE(GetFileSizeEx(file, &fileSize)) || fileSize.QuadPart > (LONGLONG)THUMBNAIL_PACK_MAX_SIZE)
+        return false;
+    return fileSize.QuadPart == 0 || resize((size_t)fileSize.QuadPart);
+}
+
+uint8_t * MappedFileStorage::data() {
+    return view;
+}
+
+size_t MappedFileStorage::size() {
+    return viewSize;
+}
+
+bool MappedFileStorage::resize(size_t size) {
+    unmap();
+    // file is extended if necessary
+    uint64_t size64 = size;
+    mapping = checkLE(CreateFileMapping(file, nullptr, PAGE_READWRITE,
+        (DWORD)(size64 >> 32), (DWORD)size64, nullptr));
+    if (!mapping)
+        return false;
+    view = (uint8_t *)checkLE(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (!view) {
+        unmap();
+        return false;
+    }
+    viewSize = size;
+    return true;
+}
+
+void MappedFileStorage::unmap() {
+    if (view)
+        UnmapViewOfFile(view);
+    if (mapping)
+        CloseHandle(mapping);
+    view = nullptr;
+    mapping = nullptr;
+    viewSize = 0;
+}
+
+ThumbnailBitmap::ThumbnailBitmap(HBITMAP bitmap) : bitmap(bitmap) {
+    BITMAP info = {};
+    GetObject(bitmap, sizeof(info), &info);
+    size = {info.bmWidth, info.bmHeight};
+    bytes = (size_t)info.bmWidthBytes * info.bmHeight;
+}
+
+ThumbnailBitmap::~ThumbnailBitmap() {
+    DeleteBitmap(bitmap);
+}
+
+bool ThumbnailKey::operator==(const ThumbnailKey &other) const {
+    return modified == other.modified && sizeBucket == other.sizeBucket
+        && background == other.background && path == other.path;
+}
+
+int thumbnailSizeBucket(SIZE size) {
+    int bucket = MIN_SIZE_BUCKET;
+    while (bucket < size.cx || bucket < size.cy)
+        bucket = (bucket * 5 + 3) / 4;
+    return bucket;
+}
+
+bool getThumbnailKey(IShellItem *item, int sizeBucket, ThumbnailKey *key) {
+    // set even if the item isn't cacheable, since it's used for compositing
+    key->background = GetSysColor(COLOR_WINDOW);
+    CComHeapPtr<wchar_t> path;
+    if (!checkHR(item->GetDisplayName(SIGDN_DESKTOPABSOLUTEPARSING, &path)))
+        return false;
+    key->path = path;
+    key->modified = 0;
+    key->sizeBucket = sizeBucket;
+    CComQIPtr<IShellItem2> item2(item);
+    FILETIME modified;
+    if (item2 && SUCCEEDED(item2->GetFileTime(PKEY_DateModified, &modified)))
+        key->modified = ((uint64_t)modified.dwHighDateTime << 32) | modified.dwLowDateTime;
+    return true;
+}
+
+static void evictThumbnails() {
+    while (cacheStats.bytes > cacheBudget && !lruList.empty()) {
+        CacheEntry &entry = lruList.back();
+        cacheStats.bytes -= entry.thumbnail->bytes;
+        cacheStats.evictions++;
+        cacheMap.erase(entry.key);
+        lruList.pop_back(); // bitmap is deleted once no views are using it
+    }
+    cacheStats.count = lruList.size();
+}
+
+void openThumbnailPack() {
+    CComHeapPtr<wchar_t> appData;
+    if (!checkHR(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_CREATE, nullptr, &appData)))
+        return;
+    wchar_t path[MAX_PATH];
+    PathCombine(path, appData, THUMBNAIL_PACK_FOLDER);
+    CreateDirectory(path, nullptr);
+    PathAppend(path, THUMBNAIL_PACK_FILE);
+
+    std::unique_ptr<MappedFileStorage> storage(new MappedFileStorage());
+    if (!storage->open(path)) {
+        debugPrintf(L"Couldn't open thumbnail pack\n");
+        return;
+    }
+    std::unique_ptr<ThumbnailPack> newPack(new ThumbnailPack(storage.get(),
+        THUMBNAIL_PACK_MAX_SIZE));
+    if (!newPack->open())
+        return;
+    debugPrintf(L"Opened thumbnail pack with %d thumbnails\n", newPack->count());
+    AcquireSRWLockExclusive(&packLock);
+    packStorage = std::move(storage);
+    pack = std::move(newPack);
+    ReleaseSRWLockExclusive(&packLock);
+}
+
+void closeThumbnailPack() {
+    AcquireSRWLockExclusive(&packLock);
+    pack = nullptr;
+    packStorage = nullptr;
+    ReleaseSRWLockExclusive(&packLock);
+}
+
+static std::shared_ptr<ThumbnailBitmap> loadPackedThumbnail(const ThumbnailKey &key) {
+    std::shared_ptr<ThumbnailBitmap> thumbnail;
+    AcquireSRWLockExclusive(&packLock);
+    PackImage image;
+    if (pack && pack->find({key.path.c_str(), key.path.size(), key.modified,
+            (uint32_t)key.sizeBucket, key.background}, &image)) {
+        BITMAPINFO bitmapInfo = {{sizeof(BITMAPINFOHEADER), image.width, -image.height,
+            1, 32, BI_RGB}};
+        uint8_t *pixels;
+        HBITMAP bitmap = checkLE(CreateDIBSection(nullptr, &bitmapInfo, DIB_RGB_COLORS,
+                                                  (void **)&pixels, nullptr, 0));
+        if (bitmap) {
+            memcpy(pixels, image.pixels, (size_t)image.width * image.height * 4);
+            thumbnail = std::make_shared<ThumbnailBitmap>(bitmap);
+        }
+    }
+    ReleaseSRWLockExclusive(&packLock);
+    return thumbnail;
+}
+
+static void packThumbnail(const ThumbnailKey &key, const ThumbnailBitmap &thumbnail) {
+    if (key.modified == 0)
+        return; // can't tell if it's stale in a later session
+    DIBSECTION dib;
+    if (!GetObject(thumbnail.bitmap, sizeof(dib), &dib) || !dib.dsBm.bmBits
+            || dib.dsBm.bmBitsPixel != 32)
+        return;
+    const uint8_t *pixels = (const uint8_t *)dib.dsBm.bmBits;
+    ptrdiff_t stride = dib.dsBm.bmWidthBytes;
+    if (dib.dsBmih.biHeight > 0) { // bottom-up
+        pixels += stride * (dib.dsBm.bmHeight - 1);
+        stride = -stride;
+    }
+    AcquireSRWLockExclusive(&packLock);
+    if (pack) {
+        pack->insert({key.path.c_str(), key.path.size(), key.modified, (uint32_t)key.sizeBucket,
+            key.background}, dib.dsBm.bmWidth, dib.dsBm.bmHeight, pixels, stride);
+    }
+    ReleaseSRWLockExclusive(&packLock);
+}
+
+static void insertThumbnail(const ThumbnailKey &key, std::shared_ptr<ThumbnailBitmap> thumbnail) {
+    // assumes cacheLock is held
+    auto it = cacheMap.find(key);
+    if (it != cacheMap.end()) {
+        cacheStats.bytes -= it->second->thumbnail->bytes;
+        lruList.erase(it->second);
+        cacheMap.erase(it);
+    }
+    if (thumbnail->bytes <= cacheBudget) {
+        lruList.push_front({key, thumbnail});
+        cacheMap[key] = lruList.begin();
+        cacheStats.bytes += thumbnail->bytes;
+    }
+    evictThumbnails();
+}
+
+void setThumbnailCacheBudget(size_t bytes) {
+    AcquireSRWLockExclusive(&cacheLock);
+    cacheBudget = bytes;
+    evictThumbnails();
+    ReleaseSRWLockExclusive(&cacheLock);
+}
+
+std::shared_ptr<ThumbnailBitmap> lookupThumbnail(const ThumbnailKey &key) {
+    std::shared_ptr<ThumbnailBitmap> thumbnail;
+    AcquireSRWLockExclusive(&cacheLock);
+    auto it = cacheMap.find(key);
+    if (it != cacheMap.end()) {
+        lruList.splice(lruList.begin(), lruList, it->second);
+        thumbnail = it->second->thumbnail;
+        cacheStats.hits++;
+    }
+    ReleaseSRWLockExclusive(&cacheLock);
+    if (thumbnail)
+        return thumbnail;
+
+    thumbnail = loadPackedThumbnail(key);
+    AcquireSRWLockExclusive(&cacheLock);
+    if (thumbnail) {
+        insertThumbnail(key, thumbnail);
+        cacheStats.packHits++;
+    } else {
+        cacheStats.misses++;
+    }
+    debugPrintf(L"Thumbnail cache: %llu hits, %llu pack hits, %llu misses\n",
+        cacheStats.hits, cacheStats.packHits, cacheStats.misses);
+    ReleaseSRWLockExclusive(&cacheLock);
+    return thumbnail;
+}
+
+void storeThumbnail(const ThumbnailKey &key, std::shared_ptr<ThumbnailBitmap> thumbnail) {
+    AcquireSRWLockExclusive(&cacheLock);
+    insertThumbnail(key, thumbnail);
+    ReleaseSRWLockExclusive(&cacheLock);
+    packThumbnail(key, *thumbnail);
+}
+
+ThumbnailCacheStats getThumbnailCacheStats() {
+    AcquireSRWLockShared(&cacheLock);
+    ThumbnailCacheStats stats = cacheStats;
+    ReleaseSRWLockShared(&cacheLock);
+    return stats;
+}
+
+} // namespace
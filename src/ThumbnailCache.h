@@ -0,0 +1,54 @@
+#pragma once
+#include <common.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <atlbase.h>
+#include <ShObjIdl.h>
+
+namespace chromafiler {
+
+// A thumbnail as a 32bpp DIB section, shared by the cache and the views displaying it
+class ThumbnailBitmap {
+public:
+    explicit ThumbnailBitmap(HBITMAP bitmap);
+    ~ThumbnailBitmap();
+    ThumbnailBitmap(const ThumbnailBitmap &) = delete;
+    ThumbnailBitmap & operator=(const ThumbnailBitmap &) = delete;
+
+    HBITMAP bitmap;
+    SIZE size;
+    size_t bytes;
+};
+
+struct ThumbnailKey {
+    std::wstring path; // desktop absolute parsing name
+    uint64_t modified; // FILETIME, or 0 if unknown
+    int sizeBucket;
+    COLORREF background; // composited under transparent pixels
+
+    bool operator==(const ThumbnailKey &other) const;
+};
+
+struct ThumbnailCacheStats {
+    uint64_t hits, packHits, misses, evictions;
+    size_t count, bytes;
+};
+
+// Round the larger dimension of size up to one of a fixed set of sizes (steps of 1.25x), so
+// nearby sizes share cache entries.
+int thumbnailSizeBucket(SIZE size);
+// background is the current window color, which thumbnails must be composited onto
+bool getThumbnailKey(IShellItem *item, int sizeBucket, ThumbnailKey *key);
+
+// Process-wide LRU cache of thumbnails, shared by all ThumbnailViews. Thread-safe.
+// Thumbnails are also persisted to a pack file (see ThumbnailPack) while it's open.
+void setThumbnailCacheBudget(size_t bytes);
+void openThumbnailPack(); // in local app data
+void closeThumbnailPack();
+std::shared_ptr<ThumbnailBitmap> lookupThumbnail(const ThumbnailKey &key); // null if missing
+void storeThumbnail(const ThumbnailKey &key, std::shared_ptr<ThumbnailBitmap> thumbnail);
+ThumbnailCacheStats getThumbnailCacheStats();
+
+} // namespace
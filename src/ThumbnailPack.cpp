@@ -0,0 +1,292 @@
+#include "ThumbnailPack.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace chromafiler {
+
+const uint32_t PACK_MAGIC = 0x50544643; // "CFTP"
+const uint32_t PACK_VERSION = 2;
+const uint32_t RECORD_MAGIC = 0x44524352; // "RCRD"
+const size_t INITIAL_BLOB_SIZE = 1 << 20;
+
+struct ThumbnailPack::Header {
+    uint32_t magic, version;
+    uint32_t slotCount, count;
+    uint64_t blobStart, blobEnd;
+    uint64_t checksum;
+};
+
+struct ThumbnailPack::Slot {
+    uint64_t keyHash; // 0 if empty
+    uint64_t offset, length; // of record
+    uint64_t checksum;
+};
+
+// followed by path (UTF-16, padded to 8 bytes) and pixels
+struct ThumbnailPack::Record {
+    uint32_t magic, pathLength;
+    uint64_t modified;
+    uint32_t sizeBucket, width, height, background;
+    uint64_t checksum; // of the entire record with this field set to 0
+};
+
+static inline size_t align8(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+static uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+    const uint64_t PRIME = 0x100000001b3ULL;
+    const uint8_t *bytes = (const uint8_t *)data;
+    // a word at a time, it's run over every pixel of every record read
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 29;
+    }
+    for (; size > 0; bytes++, size--)
+        hash = (hash ^ *bytes) * PRIME;
+    return hash;
+}
+
+uint64_t ThumbnailPack::slotChecksum(uint64_t keyHash, uint64_t offset, uint64_t length) {
+    uint64_t fields[] = {keyHash, offset, length};
+    return hashBytes(fields, sizeof(fields));
+}
+
+uint64_t ThumbnailPack::recordChecksum(const uint8_t *record, size_t length) {
+    uint64_t hash = hashBytes(record, offsetof(Record, checksum));
+    size_t end = offsetof(Record, checksum) + sizeof(uint64_t);
+    return hashBytes(record + end, length - end, hash);
+}
+
+ThumbnailPack::ThumbnailPack(PackStorage *storage, size_t maxSize, uint32_t slotCount)
+    : storage(storage), maxSize(maxSize), slotCount(slotCount) {}
+
+ThumbnailPack::Header * ThumbnailPack::header() {
+    return (Header *)storage->data();
+}
+
+ThumbnailPack::Slot * ThumbnailPack::slots() {
+    return (Slot *)(storage->data() + sizeof(Header));
+}
+
+size_t ThumbnailPack::dataStart() const {
+    return sizeof(Header) + (size_t)slotCount * sizeof(Slot);
+}
+
+void ThumbnailPack::writeHeader(uint64_t blobEnd, uint32_t count) {
+    Header *h = header();
+    h->magic = PACK_MAGIC;
+    h->version = PACK_VERSION;
+    h->slotCount = slotCount;
+    h->count = count;
+    h->blobStart = dataStart();
+    h->blobEnd = blobEnd;
+    h->checksum = hashBytes(h, offsetof(Header, checksum));
+}
+
+bool ThumbnailPack::open() {
+    if (storage->size() >= sizeof(Header)) {
+        Header *h = header();
+        if (h->magic == PACK_MAGIC && h->version == PACK_VERSION && h->slotCount == slotCount
+                && h->checksum == hashBytes(h, offsetof(Header, checksum))
+                && h->blobStart == dataStart() && h->blobEnd >= h->blobStart
+                && h->blobEnd <= storage->size())
+            return true;
+    }
+    // format
+    if (!storage->resize(std::min(dataStart() + INITIAL_BLOB_SIZE, maxSize)))
+        return false;
+    memset(storage->data(), 0, dataStart());
+    writeHeader(dataStart(), 0);
+    return true;
+}
+
+uint32_t ThumbnailPack::count() {
+    return header()->count;
+}
+
+uint64_t ThumbnailPack::hashKey(const PackKey &key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key.pathLength; i++) {
+        uint16_t c = (uint16_t)key.path[i];
+        hash = hashBytes(&c, sizeof(c), hash);
+    }
+    uint64_t fields[] = {key.modified, key.sizeBucket, key.background};
+    hash = hashBytes(fields, sizeof(fields), hash);
+    return hash ? hash : 1;
+}
+
+const ThumbnailPack::Record * ThumbnailPack::validRecord(const Slot &slot, bool checkPixels) {
+    if (slot.checksum != slotChecksum(slot.keyHash, slot.offset, slot.length))
+        return nullptr;
+    const Header *h = header();
+    if (slot.offset < h->blobStart || slot.offset > h->blobEnd || slot.offset % 8 != 0
+            || slot.length > h->blobEnd - slot.offset || slot.length < sizeof(Record))
+        return nullptr;
+    const Record *record = (const Record *)(storage->data() + slot.offset);
+    if (record->magic != RECORD_MAGIC)
+        return nullptr;
+    uint64_t pixelsLength = (uint64_t)record->width * record->height * 4;
+    if (align8(align8(sizeof(Record) + (size_t)record->pathLength * 2) + pixelsLength)
+            != slot.length)
+        return nullptr;
+    if (checkPixels
+            && recordChecksum((const uint8_t *)record, (size_t)slot.length) != record->checksum)
+        return nullptr;
+    return record;
+}
+
+bool ThumbnailPack::recordMatches(const Record *record, const PackKey &key) {
+    if (record->modified != key.modified || record->sizeBucket != key.sizeBucket
+            || record->background != key.background || record->pathLength != key.pathLength)
+        return false;
+    const uint8_t *path = (const uint8_t *)(record + 1);
+    for (size_t i = 0; i < key.pathLength; i++) {
+        uint16_t c;
+        memcpy(&c, path + i * 2, 2);
+        if (c != (uint16_t)key.path[i])
+            return false;
+    }
+    return true;
+}
+
+ThumbnailPack::Slot * ThumbnailPack::findSlot(uint64_t keyHash, const PackKey *key) {
+    Slot *table = slots();
+    uint32_t mask = slotCount - 1;
+    for (uint32_t i = 0, index = (uint32_t)keyHash & mask; i < slotCount;
+            i++, index = (index + 1) & mask) {
+        Slot &slot = table[index];
+        if (slot.keyHash == 0)
+            return &slot;
+        if (slot.keyHash == keyHash && key) {
+            const Record *record = validRecord(slot, false);
+            if (record && recordMatches(record, *key))
+                return &slot;
+        }
+        // otherwise a different key, or an invalid slot which is left alone
+    }
+    return nullptr;
+}
+
+void ThumbnailPack::setSlot(Slot *slot, uint64_t keyHash, uint64_t offset, uint64_t length) {
+    slot->offset = offset;
+    slot->length = length;
+    slot->checksum = slotChecksum(keyHash, offset, length);
+    slot->keyHash = keyHash;
+}
+
+bool ThumbnailPack::find(const PackKey &key, PackImage *image) {
+    uint64_t keyHash = hashKey(key);
+    Slot *slot = findSlot(keyHash, &key);
+    if (!slot || slot->keyHash == 0)
+        return false;
+    const Record *record = validRecord(*slot, true);
+    if (!record)
+        return false;
+    image->width = (int)record->width;
+    image->height = (int)record->height;
+    image->pixels = (const uint8_t *)record + align8(sizeof(Record) + record->pathLength * 2);
+    return true;
+}
+
+bool ThumbnailPack::insert(const PackKey &key, int width, int height, const uint8_t *pixels,
+        ptrdiff_t stride) {
+    if (width <= 0 || height <= 0)
+        return false;
+    size_t pathSize = align8(sizeof(Record) + key.pathLength * 2);
+    size_t length = align8(pathSize + (size_t)width * height * 4);
+    if (length > (maxSize - dataStart()) / 4)
+        return false; // would churn the whole pack
+
+    uint64_t keyHash = hashKey(key);
+    Slot *slot = findSlot(keyHash, &key);
+    bool replace = slot && slot->keyHash != 0;
+    if (!replace && (!slot || header()->count + 1 > slotCount / 4 * 3)) {
+        compact();
+        slot = findSlot(keyHash, &key);
+    }
+    uint64_t offset = header()->blobEnd;
+    if (offset + length > maxSize) {
+        compact();
+        slot = findSlot(keyHash, &key);
+        replace = slot && slot->keyHash != 0;
+        offset = header()->blobEnd;
+    }
+    if (!slot || offset + length > maxSize)
+        return false;
+    if (offset + length > storage->size()) {
+        size_t slotIndex = slot - slots();
+        size_t newSize = std::max((size_t)(offset + length), storage->size() / 2 * 3);
+        if (!storage->resize(std::min(newSize, maxSize)))
+            return false;
+        slot = slots() + slotIndex;
+    }
+
+    // record first, then the header and slot that make it reachable
+    uint8_t *data = storage->data() + offset;
+    Record *record = (Record *)data;
+    record->magic = RECORD_MAGIC;
+    record->pathLength = (uint32_t)key.pathLength;
+    record->modified = key.modified;
+    record->sizeBucket = key.sizeBucket;
+    record->width = (uint32_t)width;
+    record->height = (uint32_t)height;
+    record->background = key.background;
+    uint8_t *path = data + sizeof(Record);
+    for (size_t i = 0; i < key.pathLength; i++) {
+        uint16_t c = (uint16_t)key.path[i];
+        memcpy(path + i * 2, &c, 2);
+    }
+    memset(path + key.pathLength * 2, 0, pathSize - sizeof(Record) - key.pathLength * 2);
+    for (int y = 0; y < height; y++)
+        memcpy(data + pathSize + (size_t)y * width * 4, pixels + y * stride, (size_t)width * 4);
+    size_t pixelsEnd = pathSize + (size_t)width * height * 4;
+    memset(data + pixelsEnd, 0, length - pixelsEnd);
+    record->checksum = recordChecksum(data, length);
+
+    writeHeader(offset + length, header()->count + (replace ? 0 : 1));
+    setSlot(slot, keyHash, offset, length);
+    return true;
+}
+
+void ThumbnailPack::compact() {
+    struct LiveRecord {
+        uint64_t keyHash, offset, length;
+    };
+    std::vector<LiveRecord> live;
+    Slot *table = slots();
+    for (uint32_t i = 0; i < slotCount; i++) {
+        if (table[i].keyHash && validRecord(table[i], true))
+            live.push_back({table[i].keyHash, table[i].offset, table[i].length});
+    }
+    // keep the newest (last appended) records
+    std::sort(live.begin(), live.end(), [](const LiveRecord &a, const LiveRecord &b) {
+        return a.offset > b.offset;
+    });
+    size_t keepBytes = 0, keepCount = 0;
+    size_t maxBytes = (maxSize - dataStart()) / 2;
+    while (keepCount < live.size() && keepCount < slotCount / 2
+            && keepBytes + live[keepCount].length <= maxBytes)
+        keepBytes += (size_t)live[keepCount++].length;
+    live.resize(keepCount);
+    std::reverse(live.begin(), live.end());
+
+    // mark the pack empty while records are moved, in case of a crash
+    writeHeader(dataStart(), 0);
+    memset(table, 0, (size_t)slotCount * sizeof(Slot));
+    uint64_t offset = dataStart();
+    for (auto &rec : live) {
+        uint8_t *data = storage->data();
+        memmove(data + offset, data + rec.offset, (size_t)rec.length);
+        Slot *slot = findSlot(rec.keyHash, nullptr);
+        setSlot(slot, rec.keyHash, offset, rec.length);
+        offset += rec.length;
+    }
+    writeHeader(offset, (uint32_t)live.size());
+}
+
+} // namespace
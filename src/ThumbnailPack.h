@@ -0,0 +1,72 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chromafiler {
+
+// Backing memory for a ThumbnailPack, eg. a memory-mapped file
+class PackStorage {
+public:
+    virtual uint8_t * data() = 0;
+    virtual size_t size() = 0;
+    virtual bool resize(size_t size) = 0; // may move data
+};
+
+struct PackKey {
+    const wchar_t *path;
+    size_t pathLength;
+    uint64_t modified;
+    uint32_t sizeBucket;
+    uint32_t background; // COLORREF composited into the pixels
+};
+
+struct PackImage {
+    int width, height;
+    const uint8_t *pixels; // 32bpp, top-down, stride = width * 4. Valid until the pack changes
+};
+
+// Persistent thumbnail store in a single block of storage:
+//  - a header, a fixed-size open-addressed hash index, then an append-only region of records
+//  - every index slot and record has a checksum, so anything torn by a crash is detected and
+//    treated as missing rather than returned as bad data
+//  - when full, compaction keeps the most recently added records, so entries for an old
+//    background color age out once they stop matching
+// Not thread-safe.
+class ThumbnailPack {
+public:
+    static const uint32_t DEFAULT_SLOT_COUNT = 1 << 16;
+
+    ThumbnailPack(PackStorage *storage, size_t maxSize, uint32_t slotCount = DEFAULT_SLOT_COUNT);
+
+    bool open(); // validates the header, or formats the storage if it's invalid
+    bool find(const PackKey &key, PackImage *image);
+    bool insert(const PackKey &key, int width, int height, const uint8_t *pixels,
+        ptrdiff_t stride);
+    void compact(); // keep newer records, up to half of the size and slot limits
+    uint32_t count();
+
+private:
+    struct Header;
+    struct Slot;
+    struct Record;
+
+    Header * header();
+    Slot * slots();
+    void writeHeader(uint64_t blobEnd, uint32_t count);
+    size_t dataStart() const;
+    static uint64_t hashKey(const PackKey &key);
+    static uint64_t slotChecksum(uint64_t keyHash, uint64_t offset, uint64_t length);
+    static uint64_t recordChecksum(const uint8_t *record, size_t length);
+    const Record * validRecord(const Slot &slot, bool checkPixels);
+    bool recordMatches(const Record *record, const PackKey &key);
+    Slot * findSlot(uint64_t keyHash, const PackKey *key); // matching or empty slot
+    void setSlot(Slot *slot, uint64_t keyHash, uint64_t offset, uint64_t length);
+
+    PackStorage *storage;
+    size_t maxSize;
+    uint32_t slotCount;
+};
+
+} // namespace
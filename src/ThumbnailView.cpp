@@ -1,15 +1,57 @@
 #include "ThumbnailView.h"
 #include "GeomUtils.h"
+#include "DPI.h"
 #include "GDIUtils.h"
 #include "WinUtils.h"
+#include "ShellUtils.h"
+#include "UIStrings.h"
+#include "Settings.h"
+#include "ThumbnailCache.h"
+#include "CreateItemWindow.h"
+#include "PreviewWindow.h"
+#include "ImageView.h"
+#include "RasterDecoder.h"
+#include "Resample.h"
 #include <windowsx.h>
+#include <propkey.h>
+#include <dwmapi.h>
+#include <shlwapi.h>
+#include <climits>
+#include <cstring>
 
 namespace chromafiler {
 
 const wchar_t THUMBNAIL_CLASS[] = L"ChromaFiler Thumbnail";
 
+const UINT RESIZE_REQUEST_DELAY = 100; // wait for resizing to pause
+const int PREVIEW_THUMBNAIL_SIZE = 96; // commonly stored in the system thumbnail cache
+
+// requests from windows in the foreground chain are served first
+const int THUMBNAIL_PRIORITY_BACKGROUND = 0;
+const int THUMBNAIL_PRIORITY_FOREGROUND = 1;
+const int THUMBNAIL_PRIORITY_PREFETCH = -1;
+
+// fraction of the thumbnail cache that prefetching may fill, so it can't evict everything
+const int PREFETCH_CACHE_FRACTION = 4;
+
+// decoded frames kept ahead of playback, per window
+const size_t ANIMATION_CACHE_SIZE = 32 * 1024 * 1024;
+const ULONG MAX_ANIMATION_COPY_SIZE = 64 * 1024 * 1024; // files that aren't in the file system
+const int MAX_FRAMES_AHEAD = 8;
+const UINT PAUSED_POLL_INTERVAL = 500; // check if a paused animation has become visible
+
+// histogram overlay, in dp
+const int STATS_MARGIN = 8;
+const int STATS_PADDING = 6;
+const int STATS_GRAPH_WIDTH = 256;
+const int STATS_GRAPH_HEIGHT = 64;
+const int STATS_STRIP_ROWS = 64; // decoded at a time
+
 static ClassFactoryImpl<ThumbnailView, false> factory;
 static DWORD regCookie = 0;
+static CComPtr<WorkerPool> thumbnailPool;
+static volatile LONG lastSizeBucket = 0; // for prefetching
+static HFONT statsFont = nullptr;
 
 void ThumbnailView::init() {
     WNDCLASS thumbClass = {};
@@ -20,16 +62,34 @@ void ThumbnailView::init() {
     thumbClass.hCursor = LoadCursor(nullptr, IDC_ARROW);
     RegisterClass(&thumbClass);
 
+    NONCLIENTMETRICS metrics = {sizeof(metrics)};
+    SystemParametersInfo(SPI_GETNONCLIENTMETRICS, sizeof(metrics), &metrics, 0);
+    statsFont = CreateFontIndirect(&metrics.lfStatusFont);
+
+    setThumbnailCacheBudget((size_t)settings::getThumbnailCacheSize() * 1024 * 1024);
+    openThumbnailPack();
+
+    // extraction is a mix of disk and CPU, a few threads are enough to keep both busy
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    int threadCount = max(2, min(4, (int)systemInfo.dwNumberOfProcessors / 2));
+    thumbnailPool.Attach(new WorkerPool(threadCount));
+    thumbnailPool->start();
+
     checkHR(CoRegisterClassObject(CLSID_ThumbnailView, &factory,
         CLSCTX_LOCAL_SERVER, REGCLS_MULTIPLEUSE, &regCookie));
 }
 
 void ThumbnailView::uninit() {
     checkHR(CoRevokeClassObject(regCookie));
+    thumbnailPool->shutdown();
+    closeThumbnailPack();
+    if (statsFont)
+        DeleteFont(statsFont);
 }
 
 ThumbnailView::~ThumbnailView() {
-    // don't need to acquire lock since thread is stopped
+    // don't need to acquire lock since task is stopped
     if (thumbnailBitmap) {
         DeleteBitmap(thumbnailBitmap);
         CHROMAFILER_MEMLEAK_FREE;
@@ -42,16 +102,62 @@ const wchar_t * ThumbnailView::className() const {
 
 LRESULT ThumbnailView::handleMessage(UINT message, WPARAM wParam, LPARAM lParam) {
     switch (message) {
-        case WM_CREATE:
-            thumbnailThread.Attach(new ThumbnailThread(item, this));
-            thumbnailThread->start();
+        case WM_CREATE: {
+            thumbnailTask.Attach(new ThumbnailTask(item, this));
+            CComQIPtr<IShellItem2> item2(item);
+            CComHeapPtr<wchar_t> type;
+            if (item2 && SUCCEEDED(item2->GetString(PKEY_ItemType, &type))
+                    && (_wcsicmp(type, L".gif") == 0 || _wcsicmp(type, L".png") == 0
+                    || _wcsicmp(type, L".apng") == 0)) {
+                animationTask.Attach(new AnimationTask(item, this));
+                thumbnailPool->submit(animationTask, THUMBNAIL_PRIORITY_BACKGROUND);
+            }
+            if (settings::getImageStatsEnabled() && isImageItem(item))
+                statsTask.Attach(new StatsTask(item, this));
             return 0;
+        }
         case WM_DESTROY:
-            thumbnailThread->stop();
+            thumbnailPool->cancel(thumbnailTask);
+            thumbnailTask->stop();
+            if (animationTask) {
+                thumbnailPool->cancel(animationTask);
+                animationTask->stop();
+            }
+            if (statsTask) {
+                thumbnailPool->cancel(statsTask);
+                statsTask->stop();
+            }
             return 0;
-        case WM_SIZE:
-            thumbnailThread->requestThumbnail(clientSize(hwnd));
+        case WM_SIZE: {
+            if (animating)
+                return 0; // frames are stretched when painted
+
+            AcquireSRWLockShared(&thumbnailBitmapLock);
+            bool hasBitmap = thumbnailBitmap != nullptr;
+            ReleaseSRWLockShared(&thumbnailBitmapLock);
+            if (hasBitmap) {
+                // current bitmap is stretched in the meantime
+                checkLE(SetTimer(hwnd, TIMER_REQUEST_THUMBNAIL, RESIZE_REQUEST_DELAY, nullptr));
+            } else {
+                requestThumbnail();
+            }
             return 0;
+        }
+        case WM_TIMER:
+            if (wParam == TIMER_REQUEST_THUMBNAIL) {
+                KillTimer(hwnd, TIMER_REQUEST_THUMBNAIL);
+                requestThumbnail();
+                return 0;
+            } else if (wParam == TIMER_ANIMATION) {
+                if (isAnimationVisible()) {
+                    advanceAnimation();
+                } else {
+                    // pause, decoding also stops once the buffers are full
+                    SetTimer(hwnd, TIMER_ANIMATION, PAUSED_POLL_INTERVAL, nullptr);
+                }
+                return 0;
+            }
+            break;
         case WM_PAINT:
             PAINTSTRUCT paint;
             BeginPaint(hwnd, &paint);
@@ -61,13 +167,108 @@ LRESULT ThumbnailView::handleMessage(UINT message, WPARAM wParam, LPARAM lParam)
         case WM_NCHITTEST:
             return HTTRANSPARENT; // allow moving window by dragging anywhere
         case MSG_UPDATE_THUMBNAIL_BITMAP:
+            InvalidateRect(hwnd, nullptr, FALSE);
+            if (!wParam)
+                return 0; // preview, final bitmap will follow
+            requestInFlight = false;
+            if (requestPending) {
+                requestPending = false;
+                requestThumbnail();
+            }
+            if (statsTask && !statsRequested) {
+                statsRequested = true;
+                thumbnailPool->submit(statsTask, THUMBNAIL_PRIORITY_BACKGROUND);
+            }
+            return 0;
+        case MSG_ANIMATION_FRAME:
+            onAnimationFrame();
+            return 0;
+        case MSG_UPDATE_STATS:
             InvalidateRect(hwnd, nullptr, FALSE);
             return 0;
     }
     return DefWindowProc(hwnd, message, wParam, lParam);
 }
 
+int ThumbnailView::taskPriority() {
+    HWND foreground = GetForegroundWindow();
+    bool isForeground = foreground
+        && GetAncestor(foreground, GA_ROOTOWNER) == GetAncestor(hwnd, GA_ROOTOWNER);
+    return isForeground ? THUMBNAIL_PRIORITY_FOREGROUND : THUMBNAIL_PRIORITY_BACKGROUND;
+}
+
+void ThumbnailView::requestThumbnail() {
+    if (requestInFlight) {
+        requestPending = true;
+    } else {
+        requestInFlight = true;
+        thumbnailTask->requestThumbnail(clientSize(hwnd));
+        thumbnailPool->submit(thumbnailTask, taskPriority());
+    }
+}
+
+void ThumbnailView::onAnimationFrame() {
+    if (!animating) {
+        // first frame, replaces the thumbnail
+        animating = true;
+        int delay;
+        AcquireSRWLockShared(&animationLock);
+        animationFrames->front(&delay);
+        ReleaseSRWLockShared(&animationLock);
+        InvalidateRect(hwnd, nullptr, FALSE);
+        SetTimer(hwnd, TIMER_ANIMATION, delay, nullptr);
+    } else if (animationWaiting) {
+        animationWaiting = false;
+        advanceAnimation();
+    }
+}
+
+void ThumbnailView::advanceAnimation() {
+    int delay = 0;
+    AcquireSRWLockExclusive(&animationLock);
+    bool ready = animationFrames->count() >= 2;
+    if (ready) {
+        animationFrames->pop();
+        animationFrames->front(&delay);
+    }
+    ReleaseSRWLockExclusive(&animationLock);
+    if (!ready) {
+        // decoding fell behind, keep showing the current frame
+        KillTimer(hwnd, TIMER_ANIMATION);
+        animationWaiting = true;
+        return;
+    }
+    InvalidateRect(hwnd, nullptr, FALSE);
+    SetTimer(hwnd, TIMER_ANIMATION, delay, nullptr);
+    // a buffer is free to decode into
+    thumbnailPool->submit(animationTask, THUMBNAIL_PRIORITY_BACKGROUND);
+}
+
+// playback pauses while the window is minimized, hidden or not in the foreground
+bool ThumbnailView::isAnimationVisible() {
+    HWND root = GetAncestor(hwnd, GA_ROOT);
+    if (!IsWindowVisible(hwnd) || IsIconic(root))
+        return false;
+    BOOL cloaked = FALSE; // eg. on another virtual desktop
+    if (SUCCEEDED(DwmGetWindowAttribute(root, DWMWA_CLOAKED, &cloaked, sizeof(cloaked)))
+            && cloaked)
+        return false;
+    return taskPriority() == THUMBNAIL_PRIORITY_FOREGROUND;
+}
+
+static void fillAround(HDC hdc, RECT dest, SIZE size) {
+    HBRUSH bg = (HBRUSH)(COLOR_WINDOW + 1);
+    FillRect(hdc, tempPtr(RECT{0, 0, size.cx, dest.top}), bg);
+    FillRect(hdc, tempPtr(RECT{0, dest.top, dest.left, dest.bottom}), bg);
+    FillRect(hdc, tempPtr(RECT{dest.right, dest.top, size.cx, dest.bottom}), bg);
+    FillRect(hdc, tempPtr(RECT{0, dest.bottom, size.cx, size.cy}), bg);
+}
+
 void ThumbnailView::onPaint(PAINTSTRUCT paint) {
+    if (animating) {
+        paintAnimation(paint);
+        return;
+    }
     AcquireSRWLockExclusive(&thumbnailBitmapLock);
     if (!thumbnailBitmap) {
         ReleaseSRWLockExclusive(&thumbnailBitmapLock);
@@ -75,107 +276,741 @@ void ThumbnailView::onPaint(PAINTSTRUCT paint) {
     }
     SIZE size = clientSize(hwnd);
 
-    HBRUSH bg = (HBRUSH)(COLOR_WINDOW + 1);
     BITMAP bitmap;
     GetObject(thumbnailBitmap, sizeof(bitmap), &bitmap);
-    int xDest, yDest, wDest, hDest;
-    float wScale = (float)size.cx / bitmap.bmWidth;
-    float hScale = (float)size.cy / bitmap.bmHeight;
-    if (wScale < hScale) {
-        xDest = 0;
-        wDest = size.cx;
-        yDest = (int)((size.cy - wScale*bitmap.bmHeight) / 2);
-        hDest = (int)(wScale*bitmap.bmHeight);
-        FillRect(paint.hdc, tempPtr(RECT{0, 0, size.cx, yDest}), bg);
-        FillRect(paint.hdc, tempPtr(RECT{0, yDest + hDest, size.cx, size.cy}), bg);
-    } else {
-        xDest = (int)((size.cx - hScale*bitmap.bmWidth) / 2);
-        wDest = (int)(hScale*bitmap.bmWidth);
-        yDest = 0;
-        hDest = size.cy;
-        FillRect(paint.hdc, tempPtr(RECT{0, 0, xDest, size.cy}), bg);
-        FillRect(paint.hdc, tempPtr(RECT{xDest + wDest, 0, size.cx, size.cy}), bg);
-    }
+    RECT dest = fitRect({bitmap.bmWidth, bitmap.bmHeight}, size);
+    int wDest = rectWidth(dest), hDest = rectHeight(dest);
+    fillAround(paint.hdc, dest, size);
 
     HDC hdcMem = CreateCompatibleDC(paint.hdc);
     HBITMAP oldBitmap = SelectBitmap(hdcMem, thumbnailBitmap);
-    SetStretchBltMode(paint.hdc, HALFTONE);
-    StretchBlt(paint.hdc, xDest, yDest, wDest, hDest,
-        hdcMem, 0, 0, bitmap.bmWidth, bitmap.bmHeight, SRCCOPY);
+    if (wDest == bitmap.bmWidth && hDest == bitmap.bmHeight) {
+        BitBlt(paint.hdc, dest.left, dest.top, wDest, hDest, hdcMem, 0, 0, SRCCOPY);
+    } else {
+        // window was resized, until the thread resamples the thumbnail for the new size
+        SetStretchBltMode(paint.hdc, HALFTONE);
+        StretchBlt(paint.hdc, dest.left, dest.top, wDest, hDest,
+            hdcMem, 0, 0, bitmap.bmWidth, bitmap.bmHeight, SRCCOPY);
+    }
     SelectBitmap(hdcMem, oldBitmap);
     DeleteDC(hdcMem);
+    if (imageStats)
+        paintStats(paint.hdc, size);
     ReleaseSRWLockExclusive(&thumbnailBitmapLock);
 }
 
-ThumbnailView::ThumbnailThread::ThumbnailThread(
+// histograms and a summary in the bottom-left corner. the vertical scale ignores the extreme
+// values, which often have large spikes from clipping
+void ThumbnailView::paintStats(HDC hdc, SIZE size) {
+    const PixelStats &stats = *imageStats;
+    static const UINT channelStrings[3] = {IDS_IMAGE_STATS_BLUE, IDS_IMAGE_STATS_GREEN,
+        IDS_IMAGE_STATS_RED};
+    static const COLORREF channelColors[3] = {RGB(40, 80, 230), RGB(30, 160, 30),
+        RGB(220, 40, 40)};
+    local_wstr_ptr lines[4];
+    for (int c = 2; c >= 0; c--) { // red first
+        lines[2 - c] = formatString(channelStrings[c], stats.minValue[c], stats.maxValue[c],
+            (int)(stats.mean[c] + 0.5));
+    }
+    lines[3] = formatString(IDS_IMAGE_STATS_CLIPPED, (UINT)stats.clipped, (UINT)stats.pixels);
+
+    HFONT oldFont = SelectFont(hdc, statsFont);
+    TEXTMETRIC textMetrics;
+    GetTextMetrics(hdc, &textMetrics);
+    int lineHeight = textMetrics.tmHeight;
+    int margin = scaleDPI(STATS_MARGIN), padding = scaleDPI(STATS_PADDING);
+    int graphWidth = min(scaleDPI(STATS_GRAPH_WIDTH), size.cx - 2 * (margin + padding));
+    int graphHeight = scaleDPI(STATS_GRAPH_HEIGHT);
+    int panelHeight = graphHeight + lineHeight * (int)_countof(lines) + padding * 3;
+    if (graphWidth <= 0 || panelHeight + 2 * margin > size.cy) {
+        SelectFont(hdc, oldFont);
+        return;
+    }
+    RECT panel = {margin, size.cy - margin - panelHeight,
+        margin + graphWidth + 2 * padding, size.cy - margin};
+    FillRect(hdc, &panel, GetSysColorBrush(COLOR_WINDOW));
+    FrameRect(hdc, &panel, GetSysColorBrush(COLOR_GRAYTEXT));
+
+    uint32_t scale = 1;
+    for (int c = 0; c < 3; c++) {
+        for (int v = 1; v < 255; v++)
+            scale = max(scale, stats.histogram[c][v]);
+    }
+    int graphLeft = panel.left + padding, graphBottom = panel.top + padding + graphHeight;
+    POINT points[256];
+    for (int c = 0; c < 3; c++) {
+        for (int v = 0; v < 256; v++) {
+            uint32_t count = min(stats.histogram[c][v], scale);
+            points[v] = {graphLeft + MulDiv(v, graphWidth - 1, 255),
+                graphBottom - MulDiv((int)count, graphHeight, (int)scale)};
+        }
+        HPEN pen = CreatePen(PS_SOLID, 1, channelColors[c]);
+        HPEN oldPen = SelectPen(hdc, pen);
+        Polyline(hdc, points, 256);
+        SelectPen(hdc, oldPen);
+        DeletePen(pen);
+    }
+
+    SetTextColor(hdc, GetSysColor(COLOR_WINDOWTEXT));
+    SetBkMode(hdc, TRANSPARENT);
+    RECT textRect = {graphLeft, graphBottom + padding, panel.right - padding, 0};
+    for (auto &line : lines) {
+        textRect.bottom = textRect.top + lineHeight;
+        if (line)
+            DrawText(hdc, line.get(), -1, &textRect,
+                DT_SINGLELINE | DT_NOPREFIX | DT_END_ELLIPSIS);
+        textRect.top = textRect.bottom;
+    }
+    SelectFont(hdc, oldFont);
+}
+
+void ThumbnailView::paintAnimation(PAINTSTRUCT paint) {
+    SIZE size = clientSize(hwnd);
+    RECT dest = fitRect(animationSize, size);
+    fillAround(paint.hdc, dest, size);
+    BITMAPINFO bitmapInfo = {{sizeof(BITMAPINFOHEADER), animationSize.cx, -animationSize.cy, 1,
+        32, BI_RGB}};
+    AcquireSRWLockShared(&animationLock);
+    SetStretchBltMode(paint.hdc, HALFTONE);
+    StretchDIBits(paint.hdc, dest.left, dest.top, rectWidth(dest), rectHeight(dest),
+        0, 0, animationSize.cx, animationSize.cy, animationFrames->front(nullptr), &bitmapInfo,
+        DIB_RGB_COLORS, SRCCOPY);
+    ReleaseSRWLockShared(&animationLock);
+}
+
+ThumbnailView::ThumbnailTask::ThumbnailTask(
         IShellItem *const item, ThumbnailView *const callbackWindow)
         : callbackWindow(callbackWindow) {
     checkHR(SHGetIDListFromObject(item, &itemIDList));
-    requestThumbnailEvent = checkLE(CreateEvent(nullptr, TRUE, FALSE, nullptr));
 }
 
-ThumbnailView::ThumbnailThread::~ThumbnailThread() {
-    checkLE(CloseHandle(requestThumbnailEvent));
-}
-
-void ThumbnailView::ThumbnailThread::requestThumbnail(SIZE size) {
+void ThumbnailView::ThumbnailTask::requestThumbnail(SIZE size) {
     AcquireSRWLockExclusive(&requestThumbnailLock);
     requestedSize = size;
-    checkLE(SetEvent(requestThumbnailEvent));
     ReleaseSRWLockExclusive(&requestThumbnailLock);
 }
 
-void ThumbnailView::ThumbnailThread::run() {
-    CComPtr<IShellItemImageFactory> imageFactory;
-    if (!itemIDList || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&imageFactory))))
+void ThumbnailView::ThumbnailTask::stop() {
+    AcquireSRWLockExclusive(&stopLock);
+    stopped = true;
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+// returns a bitmap composited onto background, or null on failure
+static HBITMAP extractThumbnail(IShellItemImageFactory *imageFactory, int sizeBucket,
+        COLORREF background) {
+    HBITMAP hBitmap;
+    SIZE size = {sizeBucket, sizeBucket}; // square (for Windows 7 icons)
+    if (FAILED(imageFactory->GetImage(size,
+            SIIGBF_BIGGERSIZEOK | SIIGBF_THUMBNAILONLY, &hBitmap))) {
+        // no thumbnail, fallback to icon
+        if (!checkHR(imageFactory->GetImage(size,
+                SIIGBF_BIGGERSIZEOK | SIIGBF_ICONONLY, &hBitmap)))
+            return nullptr;
+    }
+    BITMAP bitmap;
+    GetObject(hBitmap, sizeof(bitmap), &bitmap);
+    compositeBackground(bitmap, background);
+    return hBitmap;
+}
+
+// decode simple formats in-process, without a round trip through the shell thumbnail provider.
+// returns a bitmap composited onto background, or null if the format isn't supported
+static HBITMAP decodeThumbnail(IShellItem *item, int sizeBucket, COLORREF background) {
+    CComQIPtr<IShellItem2> item2(item);
+    CComHeapPtr<wchar_t> type;
+    if (!item2 || FAILED(item2->GetString(PKEY_ItemType, &type))
+            || !RasterDecoder::isRasterExtension(type))
+        return nullptr;
+    CComPtr<IStream> stream;
+    if (!checkHR(item->BindToHandler(nullptr, BHID_Stream, IID_PPV_ARGS(&stream))))
+        return nullptr;
+    auto decoder = RasterDecoder::open([&stream](void *buffer, size_t size) {
+        ULONG read = 0;
+        if (FAILED(stream->Read(buffer, (ULONG)size, &read)))
+            return (size_t)0;
+        return (size_t)read;
+    });
+    if (!decoder)
+        return nullptr;
+
+    // reduce while decoding so only one row of the full image is in memory
+    int width = decoder->width(), height = decoder->height();
+    SIZE fit = {width, height};
+    if (width > sizeBucket || height > sizeBucket) {
+        RECT fitted = fitRect(fit, {sizeBucket, sizeBucket});
+        fit = {max(1, rectWidth(fitted)), max(1, rectHeight(fitted))};
+    }
+    BoxDownscaler scaler(width, height, fit.cx, fit.cy);
+    std::unique_ptr<uint8_t[]> row(new uint8_t[(size_t)width * 4]);
+    int rows = 0;
+    for (; rows < height; rows++) {
+        if (!decoder->readRow(row.get()))
+            break; // truncated, show what was decoded
+        scaler.addRow(decoder->bottomUp() ? height - 1 - rows : rows, row.get());
+    }
+    if (rows == 0)
+        return nullptr;
+
+    BITMAPINFO bitmapInfo = {{sizeof(BITMAPINFOHEADER), scaler.width(), -scaler.height(), 1, 32,
+        BI_RGB}};
+    uint8_t *pixels;
+    HBITMAP hBitmap = checkLE(CreateDIBSection(nullptr, &bitmapInfo, DIB_RGB_COLORS,
+        (void **)&pixels, nullptr, 0));
+    if (!hBitmap)
+        return nullptr;
+    GdiFlush();
+    scaler.finish(pixels, scaler.width() * 4);
+    if (decoder->hasAlpha() || rows < height) {
+        unpremultiplyAlpha(pixels, scaler.width(), scaler.height(), scaler.width() * 4);
+        BITMAP bitmap;
+        GetObject(hBitmap, sizeof(bitmap), &bitmap);
+        compositeBackground(bitmap, background);
+    }
+    return hBitmap;
+}
+
+// fast lookup in the system thumbnail cache, returns null if it would need to be extracted
+static HBITMAP cachedSystemThumbnail(IShellItemImageFactory *imageFactory, int sizeBucket,
+        COLORREF background) {
+    HBITMAP hBitmap;
+    // try the full size first, then a smaller size which is more likely to be cached
+    if (FAILED(imageFactory->GetImage({sizeBucket, sizeBucket},
+            SIIGBF_BIGGERSIZEOK | SIIGBF_THUMBNAILONLY | SIIGBF_INCACHEONLY, &hBitmap))) {
+        if (sizeBucket <= PREVIEW_THUMBNAIL_SIZE || FAILED(imageFactory->GetImage(
+                {PREVIEW_THUMBNAIL_SIZE, PREVIEW_THUMBNAIL_SIZE},
+                SIIGBF_BIGGERSIZEOK | SIIGBF_THUMBNAILONLY | SIIGBF_INCACHEONLY, &hBitmap)))
+            return nullptr;
+    }
+    BITMAP bitmap;
+    GetObject(hBitmap, sizeof(bitmap), &bitmap);
+    compositeBackground(bitmap, background);
+    return hBitmap;
+}
+
+static bool rasterImageStats(IStream *stream, const bool &stopped, PixelStats *stats) {
+    auto decoder = RasterDecoder::open([stream](void *buffer, size_t size) {
+        ULONG read = 0;
+        if (FAILED(stream->Read(buffer, (ULONG)size, &read)))
+            return (size_t)0;
+        return (size_t)read;
+    });
+    if (!decoder)
+        return false;
+    int width = decoder->width(), height = decoder->height();
+    std::unique_ptr<uint8_t[]> strip(new uint8_t[(size_t)width * 4 * STATS_STRIP_ROWS]);
+    computePixelStats(nullptr, 0, 0, 0, stats); // start empty
+    bool truncated = false;
+    for (int y = 0; y < height && !truncated; y += STATS_STRIP_ROWS) {
+        if (stopped)
+            return false;
+        int rows = 0;
+        for (; rows < STATS_STRIP_ROWS && y + rows < height; rows++) {
+            if (!decoder->readRow(strip.get() + (size_t)rows * width * 4)) {
+                truncated = true; // use what was decoded
+                break;
+            }
+        }
+        if (decoder->hasAlpha())
+            unpremultiplyAlpha(strip.get(), width, rows, width * 4);
+        addPixelStats(strip.get(), width, rows, width * 4, stats);
+    }
+    return true;
+}
+
+static bool wicImageStats(IStream *stream, const bool &stopped, PixelStats *stats) {
+    CComPtr<IWICImagingFactory> factory;
+    CComPtr<IWICBitmapDecoder> decoder;
+    CComPtr<IWICBitmapFrameDecode> frame;
+    CComPtr<IWICFormatConverter> converter;
+    UINT width, height;
+    if (!checkHR(factory.CoCreateInstance(CLSID_WICImagingFactory))
+            || !checkHR(factory->CreateDecoderFromStream(stream, nullptr,
+                WICDecodeMetadataCacheOnDemand, &decoder))
+            || !checkHR(decoder->GetFrame(0, &frame))
+            || !checkHR(factory->CreateFormatConverter(&converter))
+            || !checkHR(converter->Initialize(frame, GUID_WICPixelFormat32bppBGRA,
+                WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom))
+            || !checkHR(converter->GetSize(&width, &height))
+            || width == 0 || width > INT_MAX / 4 / STATS_STRIP_ROWS)
+        return false;
+    UINT stride = width * 4;
+    std::unique_ptr<uint8_t[]> strip(new uint8_t[(size_t)stride * STATS_STRIP_ROWS]);
+    computePixelStats(nullptr, 0, 0, 0, stats); // start empty
+    for (UINT y = 0; y < height; y += STATS_STRIP_ROWS) {
+        if (stopped)
+            return false;
+        int rows = (int)min(height - y, (UINT)STATS_STRIP_ROWS);
+        WICRect rect = {0, (INT)y, (INT)width, rows};
+        if (!checkHR(converter->CopyPixels(&rect, stride, stride * rows, strip.get())))
+            return false;
+        addPixelStats(strip.get(), (int)width, rows, stride, stats);
+    }
+    return true;
+}
+
+// statistics of the full resolution image with straight alpha, rather than the thumbnail which
+// is scaled and composited. decoded in strips, so memory use doesn't depend on the height.
+// returns false on failure or as soon as stopped is set
+static bool computeImageStats(IShellItem *item, const bool &stopped, PixelStats *stats) {
+    CComQIPtr<IShellItem2> item2(item);
+    CComHeapPtr<wchar_t> type;
+    CComPtr<IStream> stream;
+    if (!item2 || FAILED(item2->GetString(PKEY_ItemType, &type))
+            || !checkHR(item->BindToHandler(nullptr, BHID_Stream, IID_PPV_ARGS(&stream))))
+        return false;
+    if (RasterDecoder::isRasterExtension(type))
+        return rasterImageStats(stream, stopped, stats);
+    return wicImageStats(stream, stopped, stats);
+}
+
+ThumbnailView::StatsTask::StatsTask(
+        IShellItem *const item, ThumbnailView *const callbackWindow)
+        : callbackWindow(callbackWindow) {
+    checkHR(SHGetIDListFromObject(item, &itemIDList));
+}
+
+void ThumbnailView::StatsTask::stop() {
+    AcquireSRWLockExclusive(&stopLock);
+    stopped = true;
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+void ThumbnailView::StatsTask::run() {
+    CComPtr<IShellItem> item;
+    if (stopped || !itemIDList
+            || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item))))
+        return;
+    std::unique_ptr<PixelStats> stats(new PixelStats);
+    if (!computeImageStats(item, stopped, stats.get()))
         return;
-    itemIDList.Free();
-
-    HANDLE waitObjects[] = {requestThumbnailEvent, stopEvent};
-    int event;
-    while ((event = WaitForMultipleObjects(
-            _countof(waitObjects), waitObjects, FALSE, INFINITE)) != WAIT_FAILED) {
-        if (event == WAIT_OBJECT_0) {
-            SIZE size;
-            AcquireSRWLockExclusive(&requestThumbnailLock);
-            size = requestedSize;
-            checkLE(ResetEvent(requestThumbnailEvent));
-            ReleaseSRWLockExclusive(&requestThumbnailLock);
-
-            HBITMAP hBitmap;
-            if (FAILED(imageFactory->GetImage(size,
-                    SIIGBF_BIGGERSIZEOK | SIIGBF_THUMBNAILONLY, &hBitmap))) {
-                // no thumbnail, fallback to icon
-                int minDim = max(1, min(size.cx, size.cy)); // make square (for Windows 7)
-                if (!checkHR(imageFactory->GetImage({minDim, minDim},
-                        SIIGBF_BIGGERSIZEOK | SIIGBF_ICONONLY, &hBitmap)))
-                    return;
+
+    // ensure the window is not closed before the message is posted
+    AcquireSRWLockExclusive(&stopLock);
+    if (!stopped) {
+        AcquireSRWLockExclusive(&callbackWindow->thumbnailBitmapLock);
+        callbackWindow->imageStats = std::move(stats);
+        ReleaseSRWLockExclusive(&callbackWindow->thumbnailBitmapLock);
+        PostMessage(callbackWindow->hwnd, MSG_UPDATE_STATS, 0, 0);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+void ThumbnailView::ThumbnailTask::showThumbnail(HBITMAP source, SIZE sourceSize, SIZE size,
+        bool complete) {
+    // resample to the exact display size here, so painting is a plain blit
+    RECT fit = fitRect(sourceSize, size);
+    HBITMAP hBitmap = nullptr;
+    if (rectWidth(fit) > 0 && rectHeight(fit) > 0)
+        hBitmap = resampleBitmap(source, rectWidth(fit), rectHeight(fit));
+    if (!hBitmap && !complete)
+        return;
+
+    // ensure the window is not closed before the message is posted
+    AcquireSRWLockExclusive(&stopLock);
+    if (stopped) {
+        if (hBitmap)
+            DeleteBitmap(hBitmap);
+    } else {
+        if (hBitmap) {
+            AcquireSRWLockExclusive(&callbackWindow->thumbnailBitmapLock);
+            if (callbackWindow->thumbnailBitmap) {
+                DeleteBitmap(callbackWindow->thumbnailBitmap);
+                CHROMAFILER_MEMLEAK_FREE;
             }
-            BITMAP bitmap;
-            GetObject(hBitmap, sizeof(bitmap), &bitmap);
-            compositeBackground(bitmap); // TODO change color for high contrast themes
-
-            // ensure the window is not closed before the message is posted
-            AcquireSRWLockExclusive(&stopLock);
-            if (isStopped()) {
-                DeleteBitmap(hBitmap);
-            } else {
-                AcquireSRWLockExclusive(&callbackWindow->thumbnailBitmapLock);
-                if (callbackWindow->thumbnailBitmap) {
-                    DeleteBitmap(callbackWindow->thumbnailBitmap);
-                    CHROMAFILER_MEMLEAK_FREE;
+            callbackWindow->thumbnailBitmap = hBitmap;
+            CHROMAFILER_MEMLEAK_ALLOC;
+            ReleaseSRWLockExclusive(&callbackWindow->thumbnailBitmapLock);
+        }
+        // complete message is sent even without a new bitmap, to finish the request
+        PostMessage(callbackWindow->hwnd, MSG_UPDATE_THUMBNAIL_BITMAP, complete, 0);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+void ThumbnailView::ThumbnailTask::run() {
+    SIZE size;
+    AcquireSRWLockExclusive(&requestThumbnailLock);
+    size = requestedSize;
+    ReleaseSRWLockExclusive(&requestThumbnailLock);
+    if (failed || stopped)
+        return;
+
+    int sizeBucket = thumbnailSizeBucket(size);
+    InterlockedExchange(&lastSizeBucket, sizeBucket);
+    if (!thumbnail || sizeBucket != thumbnailBucket) {
+        // pool threads are shared, so COM objects are not kept between tasks
+        CComPtr<IShellItem> item;
+        CComQIPtr<IShellItemImageFactory> imageFactory;
+        if (!itemIDList || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item)))
+                || !(imageFactory = item)) {
+            failed = true;
+            return;
+        }
+        ThumbnailKey key;
+        bool cacheable = getThumbnailKey(item, sizeBucket, &key);
+        bool first = !thumbnail; // nothing is displayed yet
+        thumbnail = cacheable ? lookupThumbnail(key) : nullptr;
+        if (!thumbnail) {
+            HBITMAP decoded = decodeThumbnail(item, sizeBucket, key.background);
+            if (decoded) {
+                thumbnail = std::make_shared<ThumbnailBitmap>(decoded);
+                if (cacheable)
+                    storeThumbnail(key, thumbnail);
+            }
+        }
+        if (!thumbnail && first) {
+            // extraction can take seconds for large files, show a preview meanwhile
+            HBITMAP preview = cachedSystemThumbnail(imageFactory, sizeBucket, key.background);
+            if (preview) {
+                auto cached = std::make_shared<ThumbnailBitmap>(preview);
+                if (max(cached->size.cx, cached->size.cy) >= sizeBucket) {
+                    thumbnail = cached; // already full quality
+                    if (cacheable)
+                        storeThumbnail(key, thumbnail);
+                } else {
+                    showThumbnail(cached->bitmap, cached->size, size, false);
                 }
-                callbackWindow->thumbnailBitmap = hBitmap;
-                PostMessage(callbackWindow->hwnd, MSG_UPDATE_THUMBNAIL_BITMAP, 0, 0);
-                CHROMAFILER_MEMLEAK_ALLOC;
-                ReleaseSRWLockExclusive(&callbackWindow->thumbnailBitmapLock);
             }
-            ReleaseSRWLockExclusive(&stopLock);
-        } else if (event == WAIT_OBJECT_0 + 1) {
-            return; // stop
         }
+        if (!thumbnail) {
+            HBITMAP hBitmap = extractThumbnail(imageFactory, sizeBucket, key.background);
+            if (!hBitmap) {
+                failed = true;
+                return;
+            }
+            thumbnail = std::make_shared<ThumbnailBitmap>(hBitmap);
+            if (cacheable)
+                storeThumbnail(key, thumbnail);
+        }
+        thumbnailBucket = sizeBucket;
     }
-    return;
+    showThumbnail(thumbnail->bitmap, thumbnail->size, size, true);
+}
+
+ThumbnailView::AnimationTask::AnimationTask(
+        IShellItem *const item, ThumbnailView *const callbackWindow)
+        : callbackWindow(callbackWindow) {
+    checkHR(SHGetIDListFromObject(item, &itemIDList));
+}
+
+void ThumbnailView::AnimationTask::stop() {
+    AcquireSRWLockExclusive(&stopLock);
+    stopped = true;
+    ReleaseSRWLockExclusive(&stopLock);
+}
+
+static bool getMetadataUInt(IWICMetadataQueryReader *reader, const wchar_t *name, UINT *value) {
+    PROPVARIANT var;
+    PropVariantInit(&var);
+    if (FAILED(reader->GetMetadataByName(name, &var)))
+        return false;
+    bool found = true;
+    switch (var.vt) {
+        case VT_UI1: *value = var.bVal; break;
+        case VT_UI2: *value = var.uiVal; break;
+        case VT_UI4: *value = var.ulVal; break;
+        default: found = false;
+    }
+    PropVariantClear(&var);
+    return found;
+}
+
+// the GIF decoder and APNG reader keep reading from the stream on whichever pool thread runs
+// the task, but a BHID_Stream from a shell folder may belong to the apartment that created it.
+// so files are opened directly, and anything else is copied into memory
+static bool openAnimationStream(IShellItem *item, IStream **stream) {
+    CComHeapPtr<wchar_t> path;
+    if (SUCCEEDED(item->GetDisplayName(SIGDN_FILESYSPATH, &path)))
+        return checkHR(SHCreateStreamOnFileEx(path, STGM_READ | STGM_SHARE_DENY_NONE,
+            FILE_ATTRIBUTE_NORMAL, FALSE, nullptr, stream));
+    CComPtr<IStream> shellStream;
+    STATSTG stat;
+    if (!checkHR(item->BindToHandler(nullptr, BHID_Stream, IID_PPV_ARGS(&shellStream)))
+            || !checkHR(shellStream->Stat(&stat, STATFLAG_NONAME))
+            || stat.cbSize.QuadPart > MAX_ANIMATION_COPY_SIZE)
+        return false;
+    ULONG size = (ULONG)stat.cbSize.QuadPart, total = 0, read;
+    std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+    while (total < size && SUCCEEDED(shellStream->Read(data.get() + total, size - total, &read))
+            && read)
+        total += read;
+    *stream = SHCreateMemStream(data.get(), total); // makes a copy
+    return *stream != nullptr;
+}
+
+bool ThumbnailView::AnimationTask::open() {
+    CComPtr<IShellItem> item;
+    CComPtr<IStream> stream;
+    if (!itemIDList || !checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item)))
+            || !openAnimationStream(item, &stream)
+            || !checkHR(factory.CoCreateInstance(CLSID_WICImagingFactory)))
+        return false;
+    SIZE size;
+    bool isAPNG = apng.open([stream](uint64_t offset, void *buffer, size_t bufferSize) {
+        LARGE_INTEGER move;
+        move.QuadPart = (LONGLONG)offset;
+        ULONG read = 0;
+        if (FAILED(stream->Seek(move, STREAM_SEEK_SET, nullptr))
+                || FAILED(stream->Read(buffer, (ULONG)bufferSize, &read)))
+            return (size_t)0;
+        return (size_t)read;
+    });
+    if (isAPNG) {
+        size = {apng.width(), apng.height()};
+        frameCount = apng.frameCount();
+    } else if (!openGIF(stream, &size)) {
+        return false; // not animated
+    }
+    // must fit at least two frames, one displayed and one decoding
+    if ((uint64_t)size.cx * size.cy * 4 * 2 > ANIMATION_CACHE_SIZE)
+        return false;
+    size_t frameBytes = (size_t)size.cx * size.cy * 4;
+    compositor = std::make_unique<FrameCompositor>(size.cx, size.cy);
+    compositor->reset();
+
+    AcquireSRWLockExclusive(&stopLock);
+    if (!stopped) {
+        AcquireSRWLockExclusive(&callbackWindow->animationLock);
+        callbackWindow->animationFrames = std::make_unique<FrameRing>(
+            frameBytes, ANIMATION_CACHE_SIZE, MAX_FRAMES_AHEAD);
+        callbackWindow->animationSize = size;
+        ReleaseSRWLockExclusive(&callbackWindow->animationLock);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+    return true;
+}
+
+bool ThumbnailView::AnimationTask::openGIF(IStream *stream, SIZE *size) {
+    // failures are expected here for still images, so they aren't logged
+    GUID format;
+    UINT count, width, height;
+    CComPtr<IWICMetadataQueryReader> metadata;
+    if (FAILED(stream->Seek({}, STREAM_SEEK_SET, nullptr))
+            || FAILED(factory->CreateDecoderFromStream(stream, nullptr,
+                WICDecodeMetadataCacheOnDemand, &gifDecoder))
+            || FAILED(gifDecoder->GetContainerFormat(&format))
+            || format != GUID_ContainerFormatGif
+            || FAILED(gifDecoder->GetFrameCount(&count)) || count < 2
+            || FAILED(gifDecoder->GetMetadataQueryReader(&metadata))
+            || !getMetadataUInt(metadata, L"/logscrdesc/Width", &width)
+            || !getMetadataUInt(metadata, L"/logscrdesc/Height", &height)
+            || width == 0 || height == 0) {
+        gifDecoder = nullptr;
+        return false;
+    }
+    *size = {(LONG)width, (LONG)height};
+    frameCount = (int)count;
+    return true;
+}
+
+bool ThumbnailView::AnimationTask::decodeFrame(int index, FrameInfo *info) {
+    CComPtr<IWICBitmapFrameDecode> frame;
+    if (gifDecoder) {
+        if (!checkHR(gifDecoder->GetFrame(index, &frame)))
+            return false;
+        CComPtr<IWICMetadataQueryReader> metadata;
+        UINT left = 0, top = 0, disposal = 0, delay = 0; // all optional
+        if (SUCCEEDED(frame->GetMetadataQueryReader(&metadata))) {
+            getMetadataUInt(metadata, L"/imgdesc/Left", &left);
+            getMetadataUInt(metadata, L"/imgdesc/Top", &top);
+            getMetadataUInt(metadata, L"/grctlext/Disposal", &disposal);
+            getMetadataUInt(metadata, L"/grctlext/Delay", &delay); // hundredths of a second
+        }
+        info->left = (int)min(left, 0xFFFFu);
+        info->top = (int)min(top, 0xFFFFu);
+        delay = min(delay, 0xFFFFu) * 10;
+        info->delay = (int)delay < MIN_FRAME_DELAY ? DEFAULT_FRAME_DELAY : (int)delay;
+        info->disposal = disposal == 2 ? DISPOSE_BACKGROUND
+            : disposal == 3 ? DISPOSE_PREVIOUS : DISPOSE_NONE;
+        info->blend = true; // transparent pixels leave the canvas unchanged
+    } else {
+        // decode the frame as a standalone PNG
+        CComPtr<IWICStream> frameStream;
+        CComPtr<IWICBitmapDecoder> decoder;
+        if (!apng.readFrame(index, info, &frameData)
+                || !checkHR(factory->CreateStream(&frameStream))
+                || !checkHR(frameStream->InitializeFromMemory(frameData.data(),
+                    (DWORD)frameData.size()))
+                || !checkHR(factory->CreateDecoderFromStream(frameStream, nullptr,
+                    WICDecodeMetadataCacheOnDemand, &decoder))
+                || !checkHR(decoder->GetFrame(0, &frame)))
+            return false;
+    }
+
+    CComPtr<IWICBitmapSource> converted;
+    UINT width, height;
+    if (!checkHR(WICConvertBitmapSource(GUID_WICPixelFormat32bppPBGRA, frame, &converted))
+            || !checkHR(converted->GetSize(&width, &height)) || width == 0 || height == 0
+            || (uint64_t)width * height * 4 > ANIMATION_CACHE_SIZE)
+        return false;
+    info->width = (int)width;
+    info->height = (int)height;
+    framePixels.resize((size_t)width * height * 4);
+    return checkHR(converted->CopyPixels(nullptr, width * 4, (UINT)framePixels.size(),
+        framePixels.data()));
+}
+
+void ThumbnailView::AnimationTask::run() {
+    if (failed || stopped)
+        return;
+    if (!opened) {
+        opened = true;
+        if (!open()) {
+            failed = true; // keep showing the thumbnail
+            return;
+        }
+    }
+    AcquireSRWLockExclusive(&stopLock);
+    bool full = stopped;
+    if (!stopped) {
+        AcquireSRWLockShared(&callbackWindow->animationLock);
+        full = callbackWindow->animationFrames->full();
+        ReleaseSRWLockShared(&callbackWindow->animationLock);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+    if (full)
+        return; // the window resubmits when it advances to the next frame
+
+    FrameInfo info;
+    if (!decodeFrame(nextFrame, &info)) {
+        failed = true; // playback stops at the last decoded frame
+        return;
+    }
+    compositor->compose(info, framePixels.data(), (ptrdiff_t)info.width * 4);
+
+    int width = compositor->width(), height = compositor->height();
+    COLORREF color = GetSysColor(COLOR_WINDOW); // matches onPaint background
+    uint32_t background = (GetRValue(color) << 16) | (GetGValue(color) << 8) | GetBValue(color);
+    // ensure the window is not closed while the buffer is filled
+    AcquireSRWLockExclusive(&stopLock);
+    if (!stopped) {
+        FrameRing *frames = callbackWindow->animationFrames.get();
+        AcquireSRWLockShared(&callbackWindow->animationLock);
+        uint8_t *dest = frames->back();
+        ReleaseSRWLockShared(&callbackWindow->animationLock);
+        // not visible to the window until it's pushed
+        memcpy(dest, compositor->canvas(), (size_t)width * height * 4);
+        unpremultiplyAlpha(dest, width, height, width * 4);
+        compositeOnColor(dest, width, height, width * 4, background);
+        AcquireSRWLockExclusive(&callbackWindow->animationLock);
+        frames->push(info.delay);
+        full = frames->full();
+        ReleaseSRWLockExclusive(&callbackWindow->animationLock);
+        PostMessage(callbackWindow->hwnd, MSG_ANIMATION_FRAME, 0, 0);
+    }
+    ReleaseSRWLockExclusive(&stopLock);
+
+    if (++nextFrame == frameCount) {
+        nextFrame = 0; // loop forever
+        compositor->reset();
+    }
+    if (!full)
+        thumbnailPool->submit(this, THUMBNAIL_PRIORITY_BACKGROUND);
+}
+
+bool ThumbnailView::isAnimationExtension(const wchar_t *extension) {
+    // frame count is checked when the animation is opened
+    return _wcsicmp(extension, L".gif") == 0 || _wcsicmp(extension, L".apng") == 0;
+}
+
+// decode or extract a thumbnail without checking the cache, returns null on failure
+static HBITMAP createThumbnail(IShellItem *item, int sizeBucket, COLORREF background) {
+    HBITMAP hBitmap = decodeThumbnail(item, sizeBucket, background);
+    if (!hBitmap) {
+        CComQIPtr<IShellItemImageFactory> imageFactory(item);
+        if (!imageFactory || !(hBitmap = extractThumbnail(imageFactory, sizeBucket, background)))
+            return nullptr;
+    }
+    return hBitmap;
+}
+
+size_t ThumbnailView::prefetchThumbnail(IShellItem *const item) {
+    int sizeBucket = lastSizeBucket;
+    if (!sizeBucket) // no thumbnails displayed yet
+        sizeBucket = thumbnailSizeBucket(settings::getItemWindowSize());
+    ThumbnailKey key;
+    if (!getThumbnailKey(item, sizeBucket, &key) || lookupThumbnail(key))
+        return 0;
+    HBITMAP hBitmap = createThumbnail(item, sizeBucket, key.background);
+    if (!hBitmap)
+        return 0;
+    auto thumbnail = std::make_shared<ThumbnailBitmap>(hBitmap);
+    storeThumbnail(key, thumbnail);
+    return thumbnail->bytes;
+}
+
+std::shared_ptr<ThumbnailBitmap> ThumbnailView::loadThumbnail(IShellItem *const item,
+        int sizeBucket) {
+    ThumbnailKey key;
+    bool cacheable = getThumbnailKey(item, sizeBucket, &key);
+    if (cacheable) {
+        auto cached = lookupThumbnail(key);
+        if (cached)
+            return cached;
+    }
+    HBITMAP hBitmap = createThumbnail(item, sizeBucket, key.background);
+    if (!hBitmap)
+        return nullptr;
+    auto thumbnail = std::make_shared<ThumbnailBitmap>(hBitmap);
+    if (cacheable)
+        storeThumbnail(key, thumbnail);
+    return thumbnail;
+}
+
+void ItemPrefetch::prefetch(std::unique_ptr<CComHeapPtr<ITEMIDLIST>[]> newItems,
+        int newNumItems) {
+    AcquireSRWLockExclusive(&lock);
+    items = std::move(newItems);
+    numItems = newNumItems;
+    nextItem = 0;
+    cachedBytes = 0;
+    ReleaseSRWLockExclusive(&lock);
+    if (newNumItems)
+        thumbnailPool->submit(this, THUMBNAIL_PRIORITY_PREFETCH);
+}
+
+void ItemPrefetch::cancel() {
+    thumbnailPool->cancel(this);
+    AcquireSRWLockExclusive(&lock);
+    items = nullptr;
+    numItems = nextItem = 0;
+    ReleaseSRWLockExclusive(&lock);
+}
+
+void ItemPrefetch::run() {
+    size_t budget = (size_t)settings::getThumbnailCacheSize() * 1024 * 1024
+        / PREFETCH_CACHE_FRACTION;
+    CComHeapPtr<ITEMIDLIST> itemIDList;
+    AcquireSRWLockExclusive(&lock);
+    if (nextItem < numItems && cachedBytes < budget)
+        itemIDList.Attach(items[nextItem++].Detach());
+    ReleaseSRWLockExclusive(&lock);
+    if (!itemIDList)
+        return;
+
+    CComPtr<IShellItem> item;
+    CLSID previewID;
+    if (checkHR(SHCreateItemFromIDList(itemIDList, IID_PPV_ARGS(&item)))
+            && itemWindowType(item, &previewID) == ITEM_WINDOW_PREVIEW) {
+        size_t bytes = 0;
+        if (previewID == CLSID_ThumbnailView)
+            bytes = ThumbnailView::prefetchThumbnail(item);
+        else if (previewID == CLSID_ImageView)
+            bytes = ImageView::prefetchImage(item);
+        else if (!isBuiltInPreview(previewID))
+            PreviewWindow::prefetchFactory(previewID);
+        AcquireSRWLockExclusive(&lock);
+        cachedBytes += bytes;
+        ReleaseSRWLockExclusive(&lock);
+    }
+
+    // queue the next item after any other waiting requests
+    AcquireSRWLockExclusive(&lock);
+    bool remaining = nextItem < numItems;
+    ReleaseSRWLockExclusive(&lock);
+    if (remaining)
+        thumbnailPool->submit(this, THUMBNAIL_PRIORITY_PREFETCH);
 }
 
 } // namespace
@@ -2,9 +2,17 @@
 #include <common.h>
 
 #include "PreviewHandler.h"
+#include "WorkerPool.h"
+#include "Animation.h"
+#include "PixelOps.h"
+#include <memory>
+#include <vector>
+#include <wincodec.h>
 
 namespace chromafiler {
 
+class ThumbnailBitmap;
+
 // {80f502d3-92c4-4773-9333-1edd9e48d7d3}
 const CLSID CLSID_ThumbnailView =
     {0x80f502d3, 0x92c4, 0x4773, {0x93, 0x33, 0x1e, 0xdd, 0x9e, 0x48, 0xd7, 0xd3}};
@@ -12,40 +20,150 @@ class ThumbnailView : public PreviewHandlerImpl {
 public:
     static void init();
     static void uninit();
+    // extract a thumbnail into the cache at the most recently displayed size.
+    // returns the number of bytes added to the cache (0 if it was already cached)
+    static size_t prefetchThumbnail(IShellItem *item);
+    // get a thumbnail from the cache, or decode or extract it and add it to the cache.
+    // returns null on failure. called on a worker thread
+    static std::shared_ptr<ThumbnailBitmap> loadThumbnail(IShellItem *item, int sizeBucket);
+    // eg. L".gif", usually animated so always shown by ThumbnailView. PNGs are only checked for
+    // animation once they're opened (see ImageView)
+    static bool isAnimationExtension(const wchar_t *extension);
 
     ~ThumbnailView();
 
 protected:
     enum UserMessage {
-        // WPARAM: 0, LPARAM: 0
+        // WPARAM: TRUE if the request is complete, FALSE for a preview, LPARAM: 0
         MSG_UPDATE_THUMBNAIL_BITMAP = WM_USER,
+        // WPARAM: 0, LPARAM: 0
+        MSG_ANIMATION_FRAME,
+        // WPARAM: 0, LPARAM: 0
+        MSG_UPDATE_STATS,
         MSG_LAST
     };
+    enum TimerID {
+        TIMER_REQUEST_THUMBNAIL = 1,
+        TIMER_ANIMATION,
+        TIMER_LAST
+    };
     const wchar_t * className() const override;
     LRESULT handleMessage(UINT message, WPARAM wParam, LPARAM lParam) override;
 
 private:
     void onPaint(PAINTSTRUCT paint);
+    void paintAnimation(PAINTSTRUCT paint);
+    void paintStats(HDC hdc, SIZE size); // thumbnailBitmapLock must be held
+    int taskPriority();
+    void requestThumbnail();
+    void onAnimationFrame();
+    void advanceAnimation();
+    bool isAnimationVisible();
+
+    // only one request at a time, others are combined and sent when it's complete
+    bool requestInFlight = false, requestPending = false;
 
     SRWLOCK thumbnailBitmapLock = SRWLOCK_INIT;
     HBITMAP thumbnailBitmap = nullptr;
+    std::unique_ptr<PixelStats> imageStats; // of the full image, shown over it if set
 
-    class ThumbnailThread : public StoppableThread {
+    // runs on the shared thumbnail worker pool
+    class ThumbnailTask : public PoolTask {
     public:
-        ThumbnailThread(IShellItem *item, ThumbnailView *callbackWindow);
-        ~ThumbnailThread();
-        void requestThumbnail(SIZE size);
-    protected:
+        ThumbnailTask(IShellItem *item, ThumbnailView *callbackWindow);
+        void requestThumbnail(SIZE size); // call submit() after
+        void stop();
         void run() override;
     private:
+        // resample source to fit size and send it to the window
+        void showThumbnail(HBITMAP source, SIZE sourceSize, SIZE size, bool complete);
+
         CComHeapPtr<ITEMIDLIST> itemIDList;
         ThumbnailView *callbackWindow;
-        HANDLE requestThumbnailEvent;
         SRWLOCK requestThumbnailLock = SRWLOCK_INIT;
-        SIZE requestedSize;
+        SIZE requestedSize = {};
+        SRWLOCK stopLock = SRWLOCK_INIT; // task will not be stopped while held
+        bool stopped = false;
+
+        // tasks for one window never run concurrently, so these are only used by run()
+        std::shared_ptr<ThumbnailBitmap> thumbnail; // at the last requested size bucket
+        int thumbnailBucket = 0;
+        bool failed = false;
+    };
+
+    CComPtr<ThumbnailTask> thumbnailTask;
+
+    // frames are decoded ahead of playback into a fixed number of buffers, so memory use doesn't
+    // depend on the length of the animation. the front frame is the one displayed
+    SRWLOCK animationLock = SRWLOCK_INIT;
+    std::unique_ptr<FrameRing> animationFrames; // composited on the window background
+    SIZE animationSize = {};
+    bool animating = false; // replaces the thumbnail once the first frame is decoded
+    bool animationWaiting = false; // timer stopped until the next frame is decoded
+
+    // decodes animated GIF and PNG frames on the thumbnail worker pool, one frame per run
+    class AnimationTask : public PoolTask {
+    public:
+        AnimationTask(IShellItem *item, ThumbnailView *callbackWindow);
+        void stop();
+        void run() override;
+    private:
+        bool open();
+        bool openGIF(IStream *stream, SIZE *size);
+        bool decodeFrame(int index, FrameInfo *info); // into framePixels
+
+        CComHeapPtr<ITEMIDLIST> itemIDList;
+        ThumbnailView *callbackWindow;
+        SRWLOCK stopLock = SRWLOCK_INIT; // task will not be stopped while held
+        bool stopped = false;
+
+        // only used by run(). tasks may run on a different pool thread each time, so the decoder
+        // and reader only use a file or memory stream, never a shell stream (see open())
+        bool opened = false, failed = false;
+        CComPtr<IWICImagingFactory> factory;
+        CComPtr<IWICBitmapDecoder> gifDecoder; // null for APNG
+        APNGReader apng;
+        std::unique_ptr<FrameCompositor> compositor;
+        std::vector<uint8_t> framePixels; // premultiplied BGRA, before compositing
+        std::vector<uint8_t> frameData; // APNG frame as a standalone PNG
+        int frameCount = 0, nextFrame = 0;
+    };
+
+    CComPtr<AnimationTask> animationTask; // null if the item can't be animated
+
+    // decodes the full image to compute imageStats on the thumbnail worker pool. submitted once
+    // the thumbnail is displayed, since it can take much longer
+    class StatsTask : public PoolTask {
+    public:
+        StatsTask(IShellItem *item, ThumbnailView *callbackWindow);
+        void stop();
+        void run() override;
+    private:
+        CComHeapPtr<ITEMIDLIST> itemIDList;
+        ThumbnailView *callbackWindow;
+        SRWLOCK stopLock = SRWLOCK_INIT; // task will not be stopped while held
+        bool stopped = false;
     };
 
-    CComPtr<ThumbnailThread> thumbnailThread;
+    CComPtr<StatsTask> statsTask; // null if stats are disabled or the item isn't an image
+    bool statsRequested = false;
+};
+
+// Warms the thumbnail, image tile and preview handler caches for items likely to be opened next
+// (eg. neighbors of the selection in a folder). Runs at low priority on the thumbnail worker
+// pool, one item at a time so requests from open windows don't have to wait long.
+class ItemPrefetch : public PoolTask {
+public:
+    // replaces any items that haven't been prefetched yet
+    void prefetch(std::unique_ptr<CComHeapPtr<ITEMIDLIST>[]> items, int numItems);
+    void cancel();
+    void run() override;
+
+private:
+    SRWLOCK lock = SRWLOCK_INIT;
+    std::unique_ptr<CComHeapPtr<ITEMIDLIST>[]> items;
+    int numItems = 0, nextItem = 0;
+    size_t cachedBytes = 0; // since prefetch() was called
 };
 
 } // namespace
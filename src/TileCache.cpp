@@ -0,0 +1,145 @@
+#include "TileCache.h"
+#include <algorithm>
+#include <cmath>
+
+namespace chromafiler {
+
+bool TileKey::operator==(const TileKey &other) const {
+    return image == other.image && level == other.level && x == other.x && y == other.y;
+}
+
+TilePyramid::TilePyramid(int width, int height, int tileSize)
+        : width(width), height(height), size(tileSize), levels(1) {
+    while (levelWidth(levels - 1) > size || levelHeight(levels - 1) > size)
+        levels++;
+}
+
+int TilePyramid::levelCount() const {
+    return levels;
+}
+
+int TilePyramid::levelWidth(int level) const {
+    return (int)(((int64_t)width + ((int64_t)1 << level) - 1) >> level);
+}
+
+int TilePyramid::levelHeight(int level) const {
+    return (int)(((int64_t)height + ((int64_t)1 << level) - 1) >> level);
+}
+
+int TilePyramid::tileSize() const {
+    return size;
+}
+
+int TilePyramid::tilesAcross(int level) const {
+    return (levelWidth(level) + size - 1) / size;
+}
+
+int TilePyramid::tilesDown(int level) const {
+    return (levelHeight(level) + size - 1) / size;
+}
+
+TileRect TilePyramid::tileRect(int level, int x, int y) const {
+    return {x * size, y * size,
+        std::min((x + 1) * size, levelWidth(level)), std::min((y + 1) * size, levelHeight(level))};
+}
+
+int TilePyramid::levelForScale(double scale) const {
+    if (!(scale > 0))
+        return levels - 1;
+    // level n has scale 1/2^n, use the smallest one that is still at least as large
+    int level = (int)std::floor(std::log2(1 / scale) + 1e-9);
+    return std::max(0, std::min(level, levels - 1));
+}
+
+void TilePyramid::visibleTiles(int level, TileRect imageRect, uint32_t image,
+        std::vector<TileKey> *tiles) const {
+    tiles->clear();
+    if (imageRect.right <= 0 || imageRect.bottom <= 0)
+        return;
+    int64_t span = (int64_t)size << level; // tile size in full resolution pixels
+    int left = (int)(std::max(0, imageRect.left) / span);
+    int top = (int)(std::max(0, imageRect.top) / span);
+    int right = (int)std::min((int64_t)tilesAcross(level), (imageRect.right + span - 1) / span);
+    int bottom = (int)std::min((int64_t)tilesDown(level), (imageRect.bottom + span - 1) / span);
+    for (int y = top; y < bottom; y++) {
+        for (int x = left; x < right; x++)
+            tiles->push_back({image, level, x, y});
+    }
+    // nearest to the center are loaded first
+    double cx = (left + right - 1) / 2.0, cy = (top + bottom - 1) / 2.0;
+    std::stable_sort(tiles->begin(), tiles->end(), [=](const TileKey &a, const TileKey &b) {
+        return (a.x - cx) * (a.x - cx) + (a.y - cy) * (a.y - cy)
+            < (b.x - cx) * (b.x - cx) + (b.y - cy) * (b.y - cy);
+    });
+}
+
+size_t Tile::bytes() const {
+    return (size_t)width * height * 4;
+}
+
+size_t TileCache::KeyHash::operator()(const TileKey &key) const {
+    uint64_t h = key.image;
+    h = h * 0x9E3779B97F4A7C15ull + (uint32_t)key.level;
+    h = h * 0x9E3779B97F4A7C15ull + (uint32_t)key.x;
+    h = h * 0x9E3779B97F4A7C15ull + (uint32_t)key.y;
+    return (size_t)(h ^ (h >> 32));
+}
+
+TileCache::TileCache(size_t budget) : budget(budget) {}
+
+std::shared_ptr<const Tile> TileCache::find(const TileKey &key) {
+    auto it = entries.find(key);
+    if (it == entries.end())
+        return nullptr;
+    lruList.splice(lruList.begin(), lruList, it->second);
+    return it->second->tile;
+}
+
+bool TileCache::contains(const TileKey &key) const {
+    return entries.count(key) != 0;
+}
+
+void TileCache::insert(const TileKey &key, std::shared_ptr<const Tile> tile) {
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        totalBytes -= it->second->tile->bytes();
+        lruList.erase(it->second);
+        entries.erase(it);
+    }
+    totalBytes += tile->bytes();
+    lruList.push_front({key, std::move(tile)});
+    entries[key] = lruList.begin();
+    evict();
+}
+
+void TileCache::removeImage(uint32_t image) {
+    for (auto it = lruList.begin(); it != lruList.end();) {
+        if (it->key.image == image) {
+            totalBytes -= it->tile->bytes();
+            entries.erase(it->key);
+            it = lruList.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+size_t TileCache::bytes() const {
+    return totalBytes;
+}
+
+size_t TileCache::count() const {
+    return entries.size();
+}
+
+void TileCache::evict() {
+    // always keep the most recent tile, even if it's larger than the budget
+    while (totalBytes > budget && lruList.size() > 1) {
+        Entry &last = lruList.back();
+        totalBytes -= last.tile->bytes();
+        entries.erase(last.key);
+        lruList.pop_back();
+    }
+}
+
+} // namespace
@@ -0,0 +1,87 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace chromafiler {
+
+struct TileKey {
+    uint32_t image; // identifies the image, eg. one per open view
+    int level; // 0 is full resolution, each level is half the size of the previous
+    int x, y; // in tiles
+
+    bool operator==(const TileKey &other) const;
+};
+
+struct TileRect {
+    int left, top, right, bottom;
+};
+
+// Geometry of a mipmap pyramid of square tiles over an image. Level sizes are rounded up, so
+// the last row and column of tiles in a level may be partial.
+class TilePyramid {
+public:
+    TilePyramid(int width, int height, int tileSize);
+
+    int levelCount() const; // the last level fits in a single tile
+    int levelWidth(int level) const;
+    int levelHeight(int level) const;
+    int tileSize() const;
+    int tilesAcross(int level) const;
+    int tilesDown(int level) const;
+    // in pixels of the tile's level, clipped to the level size
+    TileRect tileRect(int level, int x, int y) const;
+
+    // the level to draw at the given scale (display pixels per full resolution pixel), which
+    // has at least as much detail as needed
+    int levelForScale(double scale) const;
+    // tiles in level overlapping a rect of the full resolution image, from the center out
+    void visibleTiles(int level, TileRect imageRect, uint32_t image,
+        std::vector<TileKey> *tiles) const;
+
+private:
+    int width, height, size, levels;
+};
+
+// 32bpp pixels of one tile, top-down, stride = width * 4
+struct Tile {
+    int width, height;
+    std::unique_ptr<uint32_t[]> pixels;
+
+    size_t bytes() const;
+};
+
+// LRU cache of tiles from any number of images, limited to a total size in bytes.
+// Not thread-safe.
+class TileCache {
+public:
+    explicit TileCache(size_t budget);
+
+    std::shared_ptr<const Tile> find(const TileKey &key); // marks as recently used
+    bool contains(const TileKey &key) const;
+    void insert(const TileKey &key, std::shared_ptr<const Tile> tile);
+    void removeImage(uint32_t image);
+    size_t bytes() const;
+    size_t count() const;
+
+private:
+    struct KeyHash {
+        size_t operator()(const TileKey &key) const;
+    };
+    struct Entry {
+        TileKey key;
+        std::shared_ptr<const Tile> tile;
+    };
+    void evict();
+
+    size_t budget, totalBytes = 0;
+    std::list<Entry> lruList; // most recently used first
+    std::unordered_map<TileKey, std::list<Entry>::iterator, KeyHash> entries;
+};
+
+} // namespace
@@ -0,0 +1,159 @@
+#include "WordIndex.h"
+#include <algorithm>
+#include <cwctype>
+
+namespace chromafiler {
+
+const size_t MIN_WORD_LENGTH = 2;
+const size_t MAX_WORD_LENGTH = 64;
+
+static inline wchar_t foldCase(wchar_t c) {
+    if (c < 0x80)
+        return (c >= L'A' && c <= L'Z') ? (wchar_t)(c + (L'a' - L'A')) : c;
+    return (wchar_t)towlower(c);
+}
+
+bool WordIndex::isWordChar(wchar_t c) {
+    if (c < 0x80)
+        return (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9')
+            || c == L'_';
+    return iswalnum(c) != 0;
+}
+
+template <typename Func>
+void WordIndex::forEachWord(const wchar_t *text, size_t length, Func func) {
+    size_t i = 0;
+    while (i < length) {
+        while (i < length && !isWordChar(text[i]))
+            i++;
+        size_t start = i;
+        while (i < length && isWordChar(text[i]))
+            i++;
+        size_t wordLen = i - start;
+        if (wordLen >= MIN_WORD_LENGTH && wordLen <= MAX_WORD_LENGTH)
+            func(text + start, wordLen);
+    }
+}
+
+int WordIndex::compareFolded(const wchar_t *a, size_t lenA, const wchar_t *b, size_t lenB) {
+    size_t len = std::min(lenA, lenB);
+    for (size_t i = 0; i < len; i++) {
+        wchar_t foldA = foldCase(a[i]), foldB = foldCase(b[i]);
+        if (foldA != foldB)
+            return foldA < foldB ? -1 : 1;
+    }
+    if (lenA != lenB)
+        return lenA < lenB ? -1 : 1;
+    return 0;
+}
+
+// case-insensitive order, ties broken by ordinal order so distinct words never compare equal
+int WordIndex::compareWords(const wchar_t *a, size_t lenA, const wchar_t *b, size_t lenB) {
+    int folded = compareFolded(a, lenA, b, lenB);
+    if (folded != 0)
+        return folded;
+    for (size_t i = 0; i < lenA; i++) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+size_t WordIndex::lowerBound(const wchar_t *word, size_t length) const {
+    size_t lo = 0, hi = entries.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const Entry &entry = entries[mid];
+        if (compareWords(pool.data() + entry.offset, entry.length, word, length) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+size_t WordIndex::lowerBoundFolded(const wchar_t *prefix, size_t length) const {
+    // the ordinal tie-break must not apply here, or words that differ from the prefix only in
+    // case could sort before it and be skipped
+    size_t lo = 0, hi = entries.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const Entry &entry = entries[mid];
+        if (compareFolded(pool.data() + entry.offset, entry.length, prefix, length) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void WordIndex::build(const wchar_t *text, size_t length) {
+    struct Occurrence {
+        const wchar_t *text;
+        uint32_t length;
+    };
+    std::vector<Occurrence> words;
+    forEachWord(text, length, [&](const wchar_t *word, size_t wordLen) {
+        words.push_back({word, (uint32_t)wordLen});
+    });
+    std::sort(words.begin(), words.end(), [](const Occurrence &a, const Occurrence &b) {
+        return compareWords(a.text, a.length, b.text, b.length) < 0;
+    });
+
+    pool.clear();
+    entries.clear();
+    for (size_t i = 0; i < words.size();) {
+        size_t j = i + 1;
+        while (j < words.size()
+                && compareWords(words[i].text, words[i].length, words[j].text, words[j].length) == 0)
+            j++;
+        entries.push_back({(uint32_t)pool.size(), words[i].length, (uint32_t)(j - i)});
+        pool.insert(pool.end(), words[i].text, words[i].text + words[i].length);
+        i = j;
+    }
+}
+
+void WordIndex::update(const wchar_t *text, size_t length, int delta) {
+    forEachWord(text, length, [&](const wchar_t *word, size_t wordLen) {
+        size_t i = lowerBound(word, wordLen);
+        if (i < entries.size() && compareWords(pool.data() + entries[i].offset, entries[i].length,
+                word, wordLen) == 0) {
+            if (delta > 0 || entries[i].count > 0)
+                entries[i].count += delta;
+        } else if (delta > 0) {
+            Entry entry = {(uint32_t)pool.size(), (uint32_t)wordLen, (uint32_t)delta};
+            pool.insert(pool.end(), word, word + wordLen);
+            entries.insert(entries.begin() + i, entry);
+        }
+    });
+}
+
+void WordIndex::complete(const wchar_t *prefix, size_t length, size_t maxResults,
+        std::vector<Match> *results) const {
+    results->clear();
+    for (size_t i = lowerBoundFolded(prefix, length); i < entries.size(); i++) {
+        const Entry &entry = entries[i];
+        const wchar_t *word = pool.data() + entry.offset;
+        if (entry.length < length)
+            break;
+        size_t c = 0;
+        while (c < length && foldCase(word[c]) == foldCase(prefix[c]))
+            c++;
+        if (c < length)
+            break; // past the range of words with this prefix
+        if (entry.count > 0)
+            results->push_back({word, entry.length, entry.count});
+    }
+    auto moreFrequent = [](const Match &a, const Match &b) {
+        return a.count != b.count ? a.count > b.count : a.length < b.length;
+    };
+    if (results->size() > maxResults) {
+        std::partial_sort(results->begin(), results->begin() + maxResults, results->end(),
+            moreFrequent);
+        results->resize(maxResults);
+    } else {
+        std::sort(results->begin(), results->end(), moreFrequent);
+    }
+}
+
+} // namespace
@@ -0,0 +1,48 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chromafiler {
+
+// Sorted array of interned words with occurrence counts, for word completion. Words are sorted
+// case-insensitively so a prefix query is a binary search followed by a short scan.
+class WordIndex {
+public:
+    struct Match {
+        const wchar_t *text; // not null terminated, valid until the index is modified
+        size_t length;
+        uint32_t count;
+    };
+
+    static bool isWordChar(wchar_t c);
+
+    void build(const wchar_t *text, size_t length); // replaces contents
+    // add (delta = 1) or remove (delta = -1) one occurrence of every word in text
+    void update(const wchar_t *text, size_t length, int delta);
+    // up to maxResults words starting with prefix (ignoring case), most frequent first
+    void complete(const wchar_t *prefix, size_t length, size_t maxResults,
+        std::vector<Match> *results) const;
+
+private:
+    struct Entry {
+        uint32_t offset, length; // in pool
+        uint32_t count; // may be zero, entries are not removed until the next build
+    };
+
+    template <typename Func>
+    static void forEachWord(const wchar_t *text, size_t length, Func func);
+    // case-insensitive order only, words that differ only in case compare equal
+    static int compareFolded(const wchar_t *a, size_t lenA, const wchar_t *b, size_t lenB);
+    static int compareWords(const wchar_t *a, size_t lenA, const wchar_t *b, size_t lenB);
+    size_t lowerBound(const wchar_t *word, size_t length) const;
+    // first entry not less than prefix ignoring case, ie. the start of the completions
+    size_t lowerBoundFolded(const wchar_t *prefix, size_t length) const;
+
+    std::vector<wchar_t> pool;
+    std::vector<Entry> entries;
+};
+
+} // namespace
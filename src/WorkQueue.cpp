@@ -0,0 +1,86 @@
+#include "WorkQueue.h"
+
+namespace chromafiler {
+
+bool WorkQueue::TaskOrder::operator()(const Task &a, const Task &b) const {
+    if (a.priority != b.priority)
+        return a.priority > b.priority;
+    return a.sequence < b.sequence;
+}
+
+bool WorkQueue::push(const void *owner, int priority) {
+    auto it = owners.find(owner);
+    if (it != owners.end() && it->second.queued) {
+        setPriority(owner, priority);
+        return false;
+    }
+    if (it == owners.end())
+        it = owners.emplace(owner, OwnerState{false, false, {}}).first;
+    OwnerState &state = it->second;
+    state.queued = true;
+    state.task = {priority, nextSequence++, owner};
+    if (!state.running)
+        ready.insert(state.task);
+    return true;
+}
+
+bool WorkQueue::pop(const void **owner) {
+    if (ready.empty())
+        return false;
+    Task task = *ready.begin();
+    ready.erase(ready.begin());
+    OwnerState &state = owners[task.owner];
+    state.queued = false;
+    state.running = true;
+    *owner = task.owner;
+    return true;
+}
+
+bool WorkQueue::finish(const void *owner) {
+    auto it = owners.find(owner);
+    if (it == owners.end())
+        return false;
+    OwnerState &state = it->second;
+    state.running = false;
+    if (state.queued) {
+        ready.insert(state.task);
+        return true;
+    }
+    owners.erase(it);
+    return false;
+}
+
+bool WorkQueue::cancel(const void *owner) {
+    auto it = owners.find(owner);
+    if (it == owners.end() || !it->second.queued)
+        return false;
+    OwnerState &state = it->second;
+    state.queued = false;
+    if (state.running)
+        return true; // erased in finish()
+    ready.erase(state.task);
+    owners.erase(it);
+    return true;
+}
+
+bool WorkQueue::setPriority(const void *owner, int priority) {
+    auto it = owners.find(owner);
+    if (it == owners.end() || !it->second.queued)
+        return false;
+    OwnerState &state = it->second;
+    if (state.task.priority != priority) {
+        // keep the original sequence so the task doesn't lose its place among equals
+        if (!state.running)
+            ready.erase(state.task);
+        state.task.priority = priority;
+        if (!state.running)
+            ready.insert(state.task);
+    }
+    return true;
+}
+
+size_t WorkQueue::readyCount() const {
+    return ready.size();
+}
+
+} // namespace
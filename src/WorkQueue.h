@@ -0,0 +1,50 @@
+#pragma once
+#include <common.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+
+namespace chromafiler {
+
+// Scheduling state for a pool of worker threads. Each owner (eg. a window) has at most one
+// queued task; queuing again only updates its priority, so the task should read its latest
+// parameters when it runs. Higher priorities run first, otherwise tasks run in the order they
+// were queued. A task never runs on more than one worker at a time: if it's queued while
+// running, it waits until finish() is called.
+// Not thread-safe.
+class WorkQueue {
+public:
+    // returns true if owner was not already queued
+    bool push(const void *owner, int priority);
+    // take the next task to run and mark it running. returns false if none are ready
+    bool pop(const void **owner);
+    // call after a popped task has run. returns true if it was queued again in the meantime
+    bool finish(const void *owner);
+    // remove queued task, returns true if there was one. a running task is not interrupted
+    bool cancel(const void *owner);
+    // returns false if owner is not queued
+    bool setPriority(const void *owner, int priority);
+    size_t readyCount() const; // queued and not running
+
+private:
+    struct Task {
+        int priority;
+        uint64_t sequence;
+        const void *owner;
+    };
+    struct TaskOrder {
+        bool operator()(const Task &a, const Task &b) const;
+    };
+    struct OwnerState {
+        bool queued, running;
+        Task task;
+    };
+
+    std::set<Task, TaskOrder> ready;
+    std::unordered_map<const void *, OwnerState> owners;
+    uint64_t nextSequence = 0;
+};
+
+} // namespace
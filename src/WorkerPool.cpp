@@ -0,0 +1,86 @@
+#include "WorkerPool.h"
+#include <shlwapi.h>
+
+namespace chromafiler {
+
+WorkerPool::WorkerPool(int threadCount) : threadCount(threadCount) {}
+
+void WorkerPool::start() {
+    for (int i = 0; i < threadCount; i++) {
+        AddRef(); // released by thread
+        if (!checkLE(SHCreateThread(threadProc, this, CTF_COINIT_STA, nullptr)))
+            Release();
+    }
+}
+
+void WorkerPool::shutdown() {
+    AcquireSRWLockExclusive(&lock);
+    stopped = true;
+    releaseQueued();
+    ReleaseSRWLockExclusive(&lock);
+    WakeAllConditionVariable(&taskReady);
+}
+
+void WorkerPool::submit(PoolTask *task, int priority) {
+    AcquireSRWLockExclusive(&lock);
+    if (!stopped && queue.push(task, priority))
+        task->AddRef();
+    ReleaseSRWLockExclusive(&lock);
+    WakeConditionVariable(&taskReady);
+}
+
+void WorkerPool::cancel(PoolTask *task) {
+    AcquireSRWLockExclusive(&lock);
+    bool canceled = queue.cancel(task);
+    ReleaseSRWLockExclusive(&lock);
+    if (canceled)
+        task->Release();
+}
+
+void WorkerPool::setPriority(PoolTask *task, int priority) {
+    AcquireSRWLockExclusive(&lock);
+    queue.setPriority(task, priority);
+    ReleaseSRWLockExclusive(&lock);
+}
+
+void WorkerPool::releaseQueued() {
+    const void *owner;
+    while (queue.pop(&owner)) {
+        queue.finish(owner);
+        ((PoolTask *)owner)->Release();
+    }
+}
+
+DWORD WINAPI WorkerPool::threadProc(void *data) {
+    WorkerPool *self = (WorkerPool *)data;
+    self->work();
+    self->Release();
+    return 0;
+}
+
+void WorkerPool::work() {
+    AcquireSRWLockExclusive(&lock);
+    while (true) {
+        const void *owner;
+        while (!stopped && !queue.pop(&owner))
+            SleepConditionVariableSRW(&taskReady, &lock, INFINITE, 0);
+        if (stopped) {
+            releaseQueued(); // in case any were queued again while running
+            break;
+        }
+        ReleaseSRWLockExclusive(&lock);
+
+        PoolTask *task = (PoolTask *)owner;
+        task->run();
+
+        AcquireSRWLockExclusive(&lock);
+        if (queue.finish(owner)) {
+            // queued again while running, the reference now belongs to the queue
+            WakeConditionVariable(&taskReady);
+        }
+        task->Release(); // reference held while running
+    }
+    ReleaseSRWLockExclusive(&lock);
+}
+
+} // namespace
@@ -0,0 +1,40 @@
+#pragma once
+#include <common.h>
+
+#include "COMUtils.h"
+#include "WorkQueue.h"
+#include <windows.h>
+
+namespace chromafiler {
+
+// A unit of work that can be queued on a WorkerPool, usually on behalf of one window.
+class PoolTask : public UnknownImpl {
+public:
+    virtual void run() = 0; // called on a worker thread
+};
+
+// Fixed number of STA threads serving tasks from a shared priority queue (see WorkQueue).
+// The pool holds a reference to each task while it's queued or running.
+class WorkerPool : public UnknownImpl {
+public:
+    explicit WorkerPool(int threadCount);
+    void start();
+    void shutdown(); // threads exit after finishing their current task, without waiting
+
+    void submit(PoolTask *task, int priority);
+    void cancel(PoolTask *task); // if not started yet
+    void setPriority(PoolTask *task, int priority);
+
+private:
+    static DWORD WINAPI threadProc(void *);
+    void work();
+    void releaseQueued(); // lock must be held
+
+    int threadCount;
+    SRWLOCK lock = SRWLOCK_INIT;
+    CONDITION_VARIABLE taskReady = CONDITION_VARIABLE_INIT;
+    WorkQueue queue;
+    bool stopped = false;
+};
+
+} // namespace
@@ -15,6 +15,7 @@
 #define IDC_EXPLORER_SETTINGS       1010
 #define IDC_SELECTION_DELAY         1011
 #define IDC_SELECTION_DELAY_UD      1012
+#define IDC_IMAGE_STATS_ENABLED     1013
 
 #define IDD_SETTINGS_TRAY           105
 #define IDC_TRAY_ENABLED            1101
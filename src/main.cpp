@@ -1,6 +1,9 @@
 #include "main.h"
 #include "FolderWindow.h"
 #include "ThumbnailView.h"
+#include "ImageView.h"
+#include "ContactSheetView.h"
+#include "TextPreview.h"
 #include "PreviewWindow.h"
 #include "TextWindow.h"
 #include "TrayWindow.h"
@@ -21,6 +24,7 @@
 #pragma comment(lib, "Comctl32.lib")
 #pragma comment(lib, "Comdlg32.lib")
 #pragma comment(lib, "Wininet.lib")
+#pragma comment(lib, "Windowscodecs.lib")
 
 using namespace chromafiler;
 
@@ -111,6 +115,9 @@ int WINAPI wWinMain(HINSTANCE, HINSTANCE, PWSTR, int showCommand) {
     ItemWindow::init();
     FolderWindow::init();
     ThumbnailView::init();
+    ImageView::init();
+    ContactSheetView::init();
+    TextPreview::init();
     PreviewWindow::init();
     TextWindow::init();
     TrayWindow::init();
@@ -182,6 +189,9 @@ int WINAPI wWinMain(HINSTANCE, HINSTANCE, PWSTR, int showCommand) {
 
     ItemWindow::uninit();
     ThumbnailView::uninit();
+    ImageView::uninit();
+    ContactSheetView::uninit();
+    TextPreview::uninit();
     PreviewWindow::uninit();
     OleUninitialize();
 
@@ -27,6 +27,7 @@
 #define IDM_DEBUG_NAMES     1017
 #define IDM_CONTEXT_MENU    1018
 #define IDM_PROXY_BUTTON    1019
+#define IDM_CONTACT_SHEET   1020
 
 #define IDM_SHELL_FIRST     0x4000
 #define IDM_SHELL_LAST      0x7FFF
@@ -42,6 +43,8 @@
 #define IDM_ZOOM_OUT        1107
 #define IDM_ZOOM_RESET      1108
 #define IDM_LINE_SELECT     1109
+#define IDM_FILTER_LINES    1110
+#define IDM_COMPLETE_WORD   1111
 
 #define IDR_TEXT_MENU       108
 #define IDM_UNDO            1200
@@ -51,6 +54,12 @@
 #define IDM_PASTE           1204
 #define IDM_DELETE          1205
 #define IDM_SELECT_ALL      1206
+#define IDM_VALIDATE_JSON   1207
+#define IDM_FORMAT_JSON     1208
+#define IDM_SORT_LINES      1209
+#define IDM_SORT_LINES_NUMERIC  1210
+#define IDM_UNIQUE_LINES    1211
+#define IDM_REVERSE_LINES   1212
 
 #define IDR_ICON_FONT   103
 // https://docs.microsoft.com/en-us/windows/apps/design/style/segoe-ui-symbol-font
@@ -117,6 +126,19 @@
 #define IDS_INVALID_CHARS       250
 #define IDS_ADMIN_WARNING       251
 #define IDS_DONT_ASK            252
+#define IDS_JSON_ERROR          253
+#define IDS_TEXT_FILTER_CUE     254
+#define IDS_TEXT_FILTER_STATUS  255
+#define IDS_TEXT_FILTER_INVALID 256
+#define IDS_TEXT_STATUS_DUPLICATES  257
+#define IDS_IMAGE_STATUS        258
+#define IDS_IMAGE_STATUS_DEPTH  259
+#define IDS_CONTACT_SHEET_COMMAND   260
+#define IDS_IMAGE_STATS_RED         261
+#define IDS_IMAGE_STATS_GREEN       262
+#define IDS_IMAGE_STATS_BLUE        263
+#define IDS_IMAGE_STATS_CLIPPED     264
+#define IDS_TEXT_PREVIEW_TRUNCATED  265
 
 // corresponds to UNDONAMEID
 #define IDS_TEXT_UNDO_UNKNOWN   300
@@ -138,3 +160,12 @@
 #define IDS_ENCODING_UTF16BE    333
 #define IDS_ENCODING_ANSI       334
 #define IDS_ENCODING_COUNT      5
+
+// corresponds to JSONStatus
+#define IDS_JSON_STATUS_OK          340
+#define IDS_JSON_STATUS_CHAR        341
+#define IDS_JSON_STATUS_END         342
+#define IDS_JSON_STATUS_STRING      343
+#define IDS_JSON_STATUS_ESCAPE      344
+#define IDS_JSON_STATUS_NUMBER      345
+#define IDS_JSON_STATUS_TRAILING    346